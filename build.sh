@@ -35,6 +35,11 @@ then
   export ENABLE_LUA="ON"
 fi
 
+if [ -z "${ENABLE_LIBJPEG+x}" ]
+then
+  export ENABLE_LIBJPEG="ON"
+fi
+
 #save startpath
 STARTPATH=$(pwd)
 
@@ -353,7 +358,7 @@ buildrelease() {
   export INSTALL_PREFIX="${MYMPD_INSTALL_PREFIX:-/usr}"
   cmake -DCMAKE_INSTALL_PREFIX:PATH="$INSTALL_PREFIX" -DCMAKE_BUILD_TYPE=RELEASE \
   	-DENABLE_SSL="$ENABLE_SSL" -DENABLE_LIBID3TAG="$ENABLE_LIBID3TAG" \
-  	-DENABLE_FLAC="$ENABLE_FLAC" -DENABLE_LUA="$ENABLE_LUA" ..
+  	-DENABLE_FLAC="$ENABLE_FLAC" -DENABLE_LUA="$ENABLE_LUA" -DENABLE_LIBJPEG="$ENABLE_LIBJPEG" ..
   make
 }
 
@@ -417,7 +422,7 @@ builddebug() {
   cd debug || exit 1
   cmake -DCMAKE_INSTALL_PREFIX:PATH=/usr -DCMAKE_BUILD_TYPE=DEBUG -DMEMCHECK="$MEMCHECK" \
   	-DENABLE_SSL="$ENABLE_SSL" -DENABLE_LIBID3TAG="$ENABLE_LIBID3TAG" -DENABLE_FLAC="$ENABLE_FLAC" \
-  	-DENABLE_LUA="$ENABLE_LUA" -DCMAKE_EXPORT_COMPILE_COMMANDS=ON ..
+  	-DENABLE_LUA="$ENABLE_LUA" -DENABLE_LIBJPEG="$ENABLE_LIBJPEG" -DCMAKE_EXPORT_COMPILE_COMMANDS=ON ..
   make VERBOSE=1
   echo "Linking compilation database"
   sed -e 's/\\t/ /g' -e 's/-Wformat-overflow=2//g' -e 's/-fsanitize=bounds-strict//g' -e 's/-static-libasan//g' compile_commands.json > ../src/compile_commands.json
@@ -1158,6 +1163,7 @@ case "$ACTION" in
 	  echo "  - ENABLE_LIBID3TAG=\"ON\""
 	  echo "  - ENABLE_FLAC=\"ON\""
 	  echo "  - ENABLE_LUA=\"ON\""
+	  echo "  - ENABLE_LIBJPEG=\"ON\""
 	  echo "  - MANPAGES=\"ON\""
 	  echo ""
 	;;
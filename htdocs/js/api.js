@@ -143,8 +143,15 @@ function webSocketConnect() {
                     sendAPI("MPD_API_PLAYER_STATE", {}, parseState);
                     getSettings(true);
                     break;
+                case 'update_queue_diff':
+                    obj.result = obj.params;
+                    parseQueueDiff(obj);
+                    break;
                 case 'update_queue':
-                    if (app.current.app === 'Queue') {
+                    //the queue is already patched if update_queue_diff could be applied
+                    if (app.current.app === 'Queue' && (app.current.tab !== 'Current' || app.current.search.length >= 2 ||
+                        Number(getAttDec('QueueCurrentList', 'data-version')) !== obj.params.queueVersion))
+                    {
                         getQueue();
                     }
                     obj.result = obj.params;
@@ -545,7 +545,7 @@ function parseDatabase(obj) {
         let picture = '';
         if (obj.result.tag === 'Album') {
             id = genId('database' + obj.result.data[i].Album + obj.result.data[i].AlbumArtist);
-            picture = subdir + '/albumart/' + obj.result.data[i].FirstSongUri;
+            picture = subdir + '/albumart/' + obj.result.data[i].FirstSongUri + '?size=250';
             html = '<div class="card card-grid clickable" data-picture="' + encodeURI(picture)  + '" ' + 
                        'data-uri="' + encodeURI(obj.result.data[i].FirstSongUri.replace(/\/[^/]+$/, '')) + '" ' +
                        'data-type="dir" data-name="' + encodeURI(obj.result.data[i].Album) + '" ' +
@@ -255,6 +255,7 @@ function parseSmartPlaylist(obj) {
     setAttEnc(document.getElementById('saveSmartPlaylistType'), 'data-value', obj.result.type);
     document.getElementById('saveSmartPlaylistSearch').classList.add('hide');
     document.getElementById('saveSmartPlaylistSticker').classList.add('hide');
+    document.getElementById('saveSmartPlaylistScore').classList.add('hide');
     document.getElementById('saveSmartPlaylistNewest').classList.add('hide');
     let tagList;
     if (settings.featTags) {
@@ -285,6 +286,12 @@ function parseSmartPlaylist(obj) {
         document.getElementById('inputSaveSmartPlaylistStickerMaxentries').value = obj.result.maxentries;
         document.getElementById('inputSaveSmartPlaylistStickerMinvalue').value = obj.result.minvalue;
     }
+    else if (obj.result.type === 'score') {
+        document.getElementById('saveSmartPlaylistScore').classList.remove('hide');
+        document.getElementById('inputSaveSmartPlaylistScoreExpression').value = obj.result.expression;
+        document.getElementById('inputSaveSmartPlaylistScoreMaxentries').value = obj.result.maxentries;
+        document.getElementById('inputSaveSmartPlaylistScoreMinvalue').value = obj.result.minvalue;
+    }
     else if (obj.result.type === 'newest') {
         document.getElementById('saveSmartPlaylistNewest').classList.remove('hide');
         let timerange = obj.result.timerange / 24 / 60 / 60;
@@ -318,6 +325,23 @@ function saveSmartPlaylist() {
             sendAPI("MPD_API_SMARTPLS_SAVE", {"type": type, "playlist": name, "sticker": sticker, "maxentries": parseInt(maxentriesEl.value), 
                 "minvalue": parseInt(minvalueEl.value), "sort": sort});
         }
+        else if (type === 'score') {
+            let expressionEl = document.getElementById('inputSaveSmartPlaylistScoreExpression');
+            if (expressionEl.value === '') {
+                expressionEl.classList.add('is-invalid');
+                return;
+            }
+            let maxentriesEl = document.getElementById('inputSaveSmartPlaylistScoreMaxentries');
+            if (!validateInt(maxentriesEl)) {
+                return;
+            }
+            let minvalueEl = document.getElementById('inputSaveSmartPlaylistScoreMinvalue');
+            if (!validateInt(minvalueEl)) {
+                return;
+            }
+            sendAPI("MPD_API_SMARTPLS_SAVE", {"type": type, "playlist": name, "expression": expressionEl.value,
+                "maxentries": parseInt(maxentriesEl.value), "minvalue": parseInt(minvalueEl.value), "sort": sort});
+        }
         else if (type === 'newest') {
             let timerangeEl = document.getElementById('inputSaveSmartPlaylistNewestTimerange');
             if (!validateInt(timerangeEl)) {
@@ -360,6 +384,13 @@ function addSmartpls(type) {
         obj.result.maxentries = 200;
         obj.result.minvalue = 2;
     }
+    else if (type === 'topSongs') {
+        obj.result.playlist = settings.smartplsPrefix + (settings.smartplsPrefix !== '' ? '-' : '') + 'topSongs';
+        obj.result.type = 'score';
+        obj.result.expression = 'playCount + (like - 1) * 10 - skipCount * 2';
+        obj.result.maxentries = 200;
+        obj.result.minvalue = 1;
+    }
     parseSmartPlaylist(obj);
 }
 
@@ -157,26 +157,9 @@ function parseQueue(obj) {
     }
     
     let table = document.getElementById('QueueCurrentList');
-    let tfoot = table.getElementsByTagName('tfoot')[0];
-
     let colspan = settings['colsQueueCurrent'].length;
 
-    if (obj.result.totalTime && obj.result.totalTime > 0 && obj.result.totalEntities <= app.current.limit ) {
-        tfoot.innerHTML = '<tr><td colspan="' + (colspan + 1) + '"><small>' + t('Num songs', obj.result.totalEntities) + '&nbsp;&ndash;&nbsp;' + beautifyDuration(obj.result.totalTime) + '</small></td></tr>';
-    }
-    else if (obj.result.totalEntities > 0) {
-        tfoot.innerHTML = '<tr><td colspan="' + (colspan + 1) + '"><small>' + t('Num songs', obj.result.totalEntities) + '</small></td></tr>';
-    }
-    else {
-        tfoot.innerHTML = '';
-    }
-
-    if (obj.result.totalEntities > settings.maxElementsPerPage) {
-        document.getElementById('btnQueueGotoPlayingSong').parentNode.classList.remove('hide');
-    }
-    else {
-        document.getElementById('btnQueueGotoPlayingSong').parentNode.classList.add('hide');
-    }
+    setQueueFooter(obj.result.totalEntities, obj.result.totalTime);
 
     const rowTitle = advancedSettingsDefault.clickQueueSong.validValues[settings.advanced.clickQueueSong];
     let nrItems = obj.result.returnedEntities;
@@ -186,24 +169,7 @@ function parseQueue(obj) {
     let tbody = table.getElementsByTagName('tbody')[0];
     let tr = tbody.getElementsByTagName('tr');
     for (let i = 0; i < nrItems; i++) {
-        obj.result.data[i].Duration = beautifySongDuration(obj.result.data[i].Duration);
-        obj.result.data[i].Pos++;
-        let row = document.createElement('tr');
-        row.setAttribute('draggable', 'true');
-        row.setAttribute('id','queueTrackId' + obj.result.data[i].id);
-        row.setAttribute('tabindex', 0);
-        row.setAttribute('title', t(rowTitle));
-        setAttEnc(row, 'data-trackid', obj.result.data[i].id);
-        setAttEnc(row, 'data-songpos', obj.result.data[i].Pos);
-        setAttEnc(row, 'data-duration', obj.result.data[i].Duration);
-        setAttEnc(row, 'data-uri', obj.result.data[i].uri);
-        setAttEnc(row, 'data-type', 'song');
-        let tds = '';
-        for (let c = 0; c < settings.colsQueueCurrent.length; c++) {
-            tds += '<td data-col="' + encodeURI(settings.colsQueueCurrent[c]) + '">' + e(obj.result.data[i][settings.colsQueueCurrent[c]]) + '</td>';
-        }
-        tds += '<td data-col="Action"><a href="#" class="mi color-darkgrey">' + ligatureMore + '</a></td>';
-        row.innerHTML = tds;
+        const row = createQueueRow(obj.result.data[i], rowTitle);
         if (i < tr.length) {
             activeRow = replaceTblRow(tr[i], row) === true ? i : activeRow;
         }
@@ -232,6 +198,102 @@ function parseQueue(obj) {
     document.getElementById('QueueCurrentList').classList.remove('opacity05');
 }
 
+function setQueueFooter(totalEntities, totalTime) {
+    let tfoot = document.getElementById('QueueCurrentList').getElementsByTagName('tfoot')[0];
+    let colspan = settings['colsQueueCurrent'].length;
+
+    if (totalTime && totalTime > 0 && totalEntities <= app.current.limit ) {
+        tfoot.innerHTML = '<tr><td colspan="' + (colspan + 1) + '"><small>' + t('Num songs', totalEntities) + '&nbsp;&ndash;&nbsp;' + beautifyDuration(totalTime) + '</small></td></tr>';
+    }
+    else if (totalEntities > 0) {
+        tfoot.innerHTML = '<tr><td colspan="' + (colspan + 1) + '"><small>' + t('Num songs', totalEntities) + '</small></td></tr>';
+    }
+    else {
+        tfoot.innerHTML = '';
+    }
+
+    if (totalEntities > settings.maxElementsPerPage) {
+        document.getElementById('btnQueueGotoPlayingSong').parentNode.classList.remove('hide');
+    }
+    else {
+        document.getElementById('btnQueueGotoPlayingSong').parentNode.classList.add('hide');
+    }
+}
+
+function createQueueRow(data, rowTitle) {
+    data.Duration = beautifySongDuration(data.Duration);
+    data.Pos++;
+    let row = document.createElement('tr');
+    row.setAttribute('draggable', 'true');
+    row.setAttribute('id','queueTrackId' + data.id);
+    row.setAttribute('tabindex', 0);
+    row.setAttribute('title', t(rowTitle));
+    setAttEnc(row, 'data-trackid', data.id);
+    setAttEnc(row, 'data-songpos', data.Pos);
+    setAttEnc(row, 'data-duration', data.Duration);
+    setAttEnc(row, 'data-uri', data.uri);
+    setAttEnc(row, 'data-type', 'song');
+    let tds = '';
+    for (let c = 0; c < settings.colsQueueCurrent.length; c++) {
+        tds += '<td data-col="' + encodeURI(settings.colsQueueCurrent[c]) + '">' + e(data[settings.colsQueueCurrent[c]]) + '</td>';
+    }
+    tds += '<td data-col="Action"><a href="#" class="mi color-darkgrey">' + ligatureMore + '</a></td>';
+    row.innerHTML = tds;
+    return row;
+}
+
+function parseQueueDiff(obj) {
+    //patch the displayed page, the update_queue notification fetches the queue if this is not possible
+    if (app.current.app !== 'Queue' || app.current.tab !== 'Current' || app.current.search.length >= 2) {
+        return;
+    }
+    let table = document.getElementById('QueueCurrentList');
+    if (Number(getAttDec(table, 'data-version')) !== obj.result.fromVersion) {
+        return;
+    }
+    let tbody = table.getElementsByTagName('tbody')[0];
+    let tr = tbody.getElementsByTagName('tr');
+    if (tr.length > 0 && tr[0].classList.contains('not-clickable')) {
+        return;
+    }
+    const pageLen = Math.min(Math.max(obj.result.queueLength - app.current.offset, 0), app.current.limit);
+    if (pageLen === 0) {
+        return;
+    }
+    const rowTitle = advancedSettingsDefault.clickQueueSong.validValues[settings.advanced.clickQueueSong];
+    let navigate = document.activeElement.parentNode.parentNode === table ? true : false;
+    let activeRow = -1;
+    for (let i = 0; i < obj.result.data.length; i++) {
+        const idx = obj.result.data[i].Pos - app.current.offset;
+        if (idx < 0 || idx >= pageLen) {
+            continue;
+        }
+        const row = createQueueRow(obj.result.data[i], rowTitle);
+        if (idx < tr.length) {
+            activeRow = replaceTblRow(tr[idx], row) === true ? idx : activeRow;
+        }
+        else if (idx === tr.length) {
+            tbody.append(row);
+        }
+        else {
+            //gap in the page
+            return;
+        }
+    }
+    if (tr.length < pageLen) {
+        return;
+    }
+    for (let i = tr.length - 1; i >= pageLen; i--) {
+        tr[i].remove();
+    }
+    setQueueFooter(obj.result.queueLength, obj.result.totalTime);
+    setAttEnc(table, 'data-version', obj.result.queueVersion);
+    if (navigate === true && activeRow > -1) {
+        focusTable(activeRow);
+    }
+    setPagination(obj.result.queueLength, pageLen);
+}
+
 function parseLastPlayed(obj) {
     const rowTitle = advancedSettingsDefault.clickSong.validValues[settings.advanced.clickSong];
     let nrItems = obj.result.returnedEntities;
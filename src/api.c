@@ -27,6 +27,7 @@ bool is_public_api_method(enum mympd_cmd_ids cmd_id) {
         case MPD_API_SCRIPT_INIT:
         case MPD_API_TIMER_STARTPLAY:
         case MPDWORKER_API_CACHES_CREATE:
+        case MPD_API_THUMBNAIL_CREATE:
         case MYMPD_API_TIMER_SET:
         case MYMPD_API_SCRIPT_INIT:
         case MYMPD_API_SCRIPT_POST_EXECUTE:
@@ -37,3 +38,21 @@ bool is_public_api_method(enum mympd_cmd_ids cmd_id) {
             return true;
     }
 }
+
+bool is_mpd_reader_api_method(enum mympd_cmd_ids cmd_id) {
+    //read-only methods that can be served in parallel to the mpd_client connection
+    switch(cmd_id) {
+        case MPD_API_DATABASE_SEARCH:
+        case MPD_API_DATABASE_SEARCH_ADV:
+        case MPD_API_DATABASE_FILESYSTEM_LIST:
+        case MPD_API_DATABASE_SONGDETAILS:
+        case MPD_API_DATABASE_TAG_LIST:
+        case MPD_API_DATABASE_TAG_ALBUM_TITLE_LIST:
+        case MPD_API_LYRICS_GET:
+        case MPD_API_LYRICS_UNSYNCED_GET:
+        case MPD_API_LYRICS_SYNCED_GET:
+            return true;
+        default:
+            return false;
+    }
+}
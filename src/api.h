@@ -79,6 +79,7 @@
     X(MPD_API_MESSAGE_SEND) \
     X(MPD_API_URLHANDLERS) \
     X(MPD_API_ALBUMART) \
+    X(MPD_API_THUMBNAIL_CREATE) \
     X(MPD_API_TIMER_STARTPLAY) \
     X(MPD_API_MOUNT_LIST) \
     X(MPD_API_MOUNT_MOUNT) \
@@ -144,4 +145,5 @@ enum mympd_cmd_ids {
 //global functions
 enum mympd_cmd_ids get_cmd_id(const char *cmd);
 bool is_public_api_method(enum mympd_cmd_ids cmd_id);
+bool is_mpd_reader_api_method(enum mympd_cmd_ids cmd_id);
 #endif
@@ -58,6 +58,13 @@ static int mympd_inihandler(void *user, const char *section, const char *name, c
     else if (MATCH("mpd", "binarylimit")) {
         p_config->binarylimit = strtoumax(value, &crap, 10);
     }
+    else if (MATCH("mpd", "readers")) {
+        p_config->mpd_readers = strtoumax(value, &crap, 10);
+        if (p_config->mpd_readers > MPD_READERS_MAX) {
+            LOG_WARN("Too many mpd readers, using %u", MPD_READERS_MAX);
+            p_config->mpd_readers = MPD_READERS_MAX;
+        }
+    }
     else if (MATCH("webserver", "webport")) {
         p_config->webport = sdsreplace(p_config->webport, value);
     }
@@ -159,6 +166,22 @@ static int mympd_inihandler(void *user, const char *section, const char *name, c
     else if (MATCH("mympd", "covercache")) {
         p_config->covercache = strtobool(value);
     }
+    else if (MATCH("mympd", "thumbnails")) {
+        p_config->thumbnails = strtobool(value);
+    }
+    else if (MATCH("mympd", "coverextractors")) {
+        p_config->cover_extractors = strtoumax(value, &crap, 10);
+        if (p_config->cover_extractors == 0) {
+            p_config->cover_extractors = 1;
+        }
+        else if (p_config->cover_extractors > COVER_EXTRACTORS_MAX) {
+            LOG_WARN("Too many cover extractors, using %u", COVER_EXTRACTORS_MAX);
+            p_config->cover_extractors = COVER_EXTRACTORS_MAX;
+        }
+    }
+    else if (MATCH("mympd", "albumartcachesize")) {
+        p_config->albumart_cache_size = strtoumax(value, &crap, 10);
+    }
     else if (MATCH("mympd", "syscmds")) {
         p_config->syscmds = strtobool(value);
     }
@@ -362,7 +385,7 @@ static void mympd_parse_env(struct t_config *config, const char *envvar) {
 
 static void mympd_get_env(struct t_config *config) {
     const char *env_vars[]={"MPD_HOST", "MPD_PORT", "MPD_PASS", "MPD_MUSICDIRECTORY",
-        "MPD_PLAYLISTDIRECTORY", "MPD_REGEX", "MPD_BINARYLIMIT",
+        "MPD_PLAYLISTDIRECTORY", "MPD_REGEX", "MPD_BINARYLIMIT", "MPD_READERS",
         "WEBSERVER_WEBPORT", "WEBSERVER_PUBLISH", "WEBSERVER_WEBDAV", "WEBSERVER_ACL", 
       #ifdef ENABLE_LUA
         "WEBSERVER_SCRIPTACL",
@@ -384,7 +407,7 @@ static void mympd_get_env(struct t_config *config) {
         "MYMPD_COLSBROWSEDATABASE", "MYMPD_COLSBROWSEPLAYLISTDETAIL",
         "MYMPD_COLSBROWSEFILESYSTEM", "MYMPD_COLSPLAYBACK", "MYMPD_COLSQUEUELASTPLAYED",
         "MYMPD_LOCALPLAYER", "MYMPD_STREAMPORT", "MYMPD_HOME", "MYMPOD_COLSQUEUEJUKEBOX",
-        "MYMPD_STREAMURL", "MYMPD_VOLUMESTEP", "MYMPD_COVERCACHEKEEPDAYS", "MYMPD_COVERCACHE",
+        "MYMPD_STREAMURL", "MYMPD_VOLUMESTEP", "MYMPD_COVERCACHEKEEPDAYS", "MYMPD_COVERCACHE", "MYMPD_THUMBNAILS", "MYMPD_COVEREXTRACTORS", "MYMPD_ALBUMARTCACHESIZE",
         "MYMPD_COVERCACHEAVOID", "MYMPD_LYRICS", "MYMPD_PARTITIONS", "MYMPD_FOOTERSTOP",
         "MYMPD_VOLUMEMIN", "MYMPD_VOLUMEMAX", "MYMPD_VORBISUSLT", "MYMPD_VORBISSYLT",
         "MYMPD_USLTEXT", "MYMPD_SYLTEXT",
@@ -461,6 +484,7 @@ void mympd_config_defaults(t_config *config) {
     config->mpd_pass = sdsempty();
     config->regex = true;
     config->binarylimit = 16384;
+    config->mpd_readers = 2;
     config->music_directory = sdsnew("auto");
     config->playlist_directory = sdsnew("/var/lib/mpd/playlists");
     config->webport = sdsnew("80");
@@ -529,6 +553,9 @@ void mympd_config_defaults(t_config *config) {
     config->webdav = false;
     config->covercache_keep_days = 7;
     config->covercache = true;
+    config->thumbnails = false;
+    config->cover_extractors = 2;
+    config->albumart_cache_size = 16;
     config->theme = sdsnew("theme-dark");
     config->highlight_color = sdsnew("#28a745");
     config->custom_placeholder_images = false;
@@ -583,13 +610,15 @@ bool mympd_dump_config(void) {
         "playlistdirectory = %s\n"
         "regex = %s\n"
         "binarylimit = %u\n"
+        "readers = %u\n"
         "\n",
         p_config->mpd_host,
         p_config->mpd_port,
         p_config->music_directory,
         p_config->playlist_directory,
         (p_config->regex == true ? "true" : "false"),
-        p_config->binarylimit
+        p_config->binarylimit,
+        p_config->mpd_readers
     );
     
     fprintf(fp, "[webserver]\n"
@@ -646,6 +675,9 @@ bool mympd_dump_config(void) {
         "volumestep = %d\n"
         "covercachekeepdays = %d\n"
         "covercache = %s\n"
+        "thumbnails = %s\n"
+        "coverextractors = %u\n"
+        "albumartcachesize = %u\n"
         "syscmds = %s\n"
     #ifdef ENABLE_LUA
         "scripting = %s\n"
@@ -712,6 +744,9 @@ bool mympd_dump_config(void) {
         p_config->volume_step,
         p_config->covercache_keep_days,
         (p_config->covercache == true ? "true" : "false"),
+        (p_config->thumbnails == true ? "true" : "false"),
+        p_config->cover_extractors,
+        p_config->albumart_cache_size,
         (p_config->syscmds == true ? "true" : "false"),
     #ifdef ENABLE_LUA
         (p_config->scripting == true ? "true" : "false"),
@@ -865,4 +900,8 @@ void mympd_set_readonly(t_config *config) {
         LOG_INFO("Disabling covercache");
         config->covercache = false;
     }
+    if (config->thumbnails == true) {
+        LOG_INFO("Disabling thumbnails");
+        config->thumbnails = false;
+    }
 }
@@ -0,0 +1,264 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "../dist/src/sds/sds.h"
+#include "../dist/src/frozen/frozen.h"
+#include "sds_extras.h"
+#include "log.h"
+#include "list.h"
+#include "config_defs.h"
+#include "tiny_queue.h"
+#include "api.h"
+#include "global.h"
+#include "utility.h"
+#include "thumbnail.h"
+#include "covercache.h"
+#include "cover_extractor.h"
+
+//optional includes
+#ifdef ENABLE_LIBID3TAG
+    #include <id3tag.h>
+#endif
+
+#ifdef ENABLE_FLAC
+    #include <FLAC/metadata.h>
+#endif
+
+//private definitions
+static void cover_extract(t_config *config, t_work_request *request);
+static void cover_thumbnail_create(t_config *config, t_work_request *request);
+static void cover_thumbnail_send(const char *variant_key);
+static bool cover_extract_id3(t_config *config, const char *uri, const char *media_file, sds *binary);
+static bool cover_extract_flac(t_config *config, const char *uri, const char *media_file, sds *binary, bool is_ogg);
+static void cover_extract_send(long conn_id, const char *uri, const char *mime_type, sds binary);
+
+//public functions
+void *cover_extractor_loop(void *arg_extractor) {
+    t_cover_extractor_arg *extractor = (t_cover_extractor_arg *) arg_extractor;
+    thread_logname = sdscatfmt(sdsempty(), "coverextract%u", extractor->id);
+    LOG_INFO("Starting cover extractor %u", extractor->id);
+    while (s_signal_received == 0) {
+        t_work_request *request = tiny_queue_shift(cover_extractor_queue, 50, 0);
+        if (request != NULL) {
+            if (request->cmd_id == MPD_API_THUMBNAIL_CREATE) {
+                cover_thumbnail_create(extractor->config, request);
+            }
+            else {
+                cover_extract(extractor->config, request);
+            }
+            free_request(request);
+        }
+    }
+    sdsfree(thread_logname);
+    return NULL;
+}
+
+//returns true if the media file type has embedded pictures and its library is compiled in
+bool cover_extract_supported(const char *media_file) {
+    bool rc = false;
+    sds mime_type_media_file = get_mime_type_by_ext(media_file);
+    #ifdef ENABLE_LIBID3TAG
+    if (strcmp(mime_type_media_file, "audio/mpeg") == 0) {
+        rc = true;
+    }
+    #endif
+    #ifdef ENABLE_FLAC
+    if (strcmp(mime_type_media_file, "audio/ogg") == 0 || strcmp(mime_type_media_file, "audio/flac") == 0) {
+        rc = true;
+    }
+    #endif
+    sdsfree(mime_type_media_file);
+    return rc;
+}
+
+//private functions
+static void cover_extract(t_config *config, t_work_request *request) {
+    char *uri = NULL;
+    char *media_file = NULL;
+    unsigned size = 0;
+    int je = json_scanf(request->data, sdslen(request->data), "{params: {uri: %Q, mediafile: %Q, size: %u}}", &uri, &media_file, &size);
+    if (je < 2) {
+        FREE_PTR(uri);
+        FREE_PTR(media_file);
+        return;
+    }
+    bool rc = false;
+    sds mime_type_media_file = get_mime_type_by_ext(media_file);
+    LOG_DEBUG("Handle coverextract for uri \"%s\"", uri);
+    LOG_DEBUG("Mimetype of %s is %s", media_file, mime_type_media_file);
+    sds binary = sdsempty();
+    if (strcmp(mime_type_media_file, "audio/mpeg") == 0) {
+        rc = cover_extract_id3(config, uri, media_file, &binary);
+    }
+    else if (strcmp(mime_type_media_file, "audio/ogg") == 0) {
+        rc = cover_extract_flac(config, uri, media_file, &binary, true);
+    }
+    else if (strcmp(mime_type_media_file, "audio/flac") == 0) {
+        rc = cover_extract_flac(config, uri, media_file, &binary, false);
+    }
+    sdsfree(mime_type_media_file);
+    if (rc == true) {
+        sds mime_type = get_mime_type_by_magic_stream(binary);
+        cover_extract_send(request->conn_id, uri, mime_type, binary);
+        sdsfree(mime_type);
+        if (size > 0) {
+            //served from the covercache on the next request
+            thumbnail_store(config, uri, size, binary);
+        }
+    }
+    else {
+        LOG_VERBOSE("No coverimage found for %s", media_file);
+        cover_extract_send(request->conn_id, uri, NULL, NULL);
+    }
+    sdsfree(binary);
+    FREE_PTR(uri);
+    FREE_PTR(media_file);
+}
+
+static bool cover_extract_id3(t_config *config, const char *uri, const char *media_file, sds *binary) {
+    bool rc = false;
+    #ifdef ENABLE_LIBID3TAG
+    LOG_DEBUG("Exctracting coverimage from %s", media_file);
+    struct id3_file *file_struct = id3_file_open(media_file, ID3_FILE_MODE_READONLY);
+    if (file_struct == NULL) {
+        LOG_ERROR("Can't parse id3_file: %s", media_file);
+        return false;
+    }
+    struct id3_tag *tags = id3_file_tag(file_struct);
+    if (tags == NULL) {
+        LOG_ERROR("Can't read id3 tags from file: %s", media_file);
+        return false;
+    }
+    struct id3_frame *frame = id3_tag_findframe(tags, "APIC", 0);
+    if (frame != NULL) {
+        id3_length_t length;
+        const id3_byte_t *pic = id3_field_getbinarydata(id3_frame_field(frame, 4), &length);
+        *binary = sdscatlen(*binary, pic, length);
+        if (config->covercache == true) {
+            covercache_put(config, uri, (char *)id3_field_getlatin1(id3_frame_field(frame, 1)), *binary);
+        }
+        LOG_DEBUG("Coverimage successfully extracted");
+        rc = true;        
+    }
+    else {
+        LOG_DEBUG("No embedded picture detected");
+    }
+    id3_file_close(file_struct);
+    #else
+    (void) config;
+    (void) uri;
+    (void) media_file;
+    (void) binary;
+    #endif
+    return rc;
+}
+
+static bool cover_extract_flac(t_config *config, const char *uri, const char *media_file, sds *binary, bool is_ogg) {
+    bool rc = false;
+    #ifdef ENABLE_FLAC
+    LOG_DEBUG("Exctracting coverimage from %s", media_file);
+    FLAC__StreamMetadata *metadata = NULL;
+
+    FLAC__Metadata_Chain *chain = FLAC__metadata_chain_new();
+    
+    if(! (is_ogg? FLAC__metadata_chain_read_ogg(chain, media_file) : FLAC__metadata_chain_read(chain, media_file)) ) {
+        LOG_DEBUG("%s: ERROR: reading metadata", media_file);
+        FLAC__metadata_chain_delete(chain);
+        return false;
+    }
+
+    FLAC__Metadata_Iterator *iterator = FLAC__metadata_iterator_new();
+    FLAC__metadata_iterator_init(iterator, chain);
+    assert(iterator);
+    
+    do {
+        FLAC__StreamMetadata *block = FLAC__metadata_iterator_get_block(iterator);
+        if (block->type == FLAC__METADATA_TYPE_PICTURE) {
+            metadata = block;
+        }
+    } while (FLAC__metadata_iterator_next(iterator) && metadata == NULL);
+    
+    if (metadata == NULL) {
+        LOG_DEBUG("No embedded picture detected");
+    }
+    else {
+        *binary = sdscatlen(*binary, metadata->data.picture.data, metadata->data.picture.data_length);
+        if (config->covercache == true) {
+            covercache_put(config, uri, metadata->data.picture.mime_type, *binary);
+        }
+        LOG_DEBUG("Coverimage successfully extracted");
+        rc = true;
+    }
+    FLAC__metadata_iterator_delete(iterator);
+    FLAC__metadata_chain_delete(chain);
+    #else
+    (void) config;
+    (void) uri;
+    (void) media_file;
+    (void) binary;
+    (void) is_ogg;
+    #endif
+    return rc;
+}
+
+static void cover_thumbnail_create(t_config *config, t_work_request *request) {
+    char *key = NULL;
+    char *path = NULL;
+    unsigned size = 0;
+    sds image = (sds)request->extra;
+    request->extra = NULL;
+    int je = json_scanf(request->data, sdslen(request->data), "{params: {key: %Q, size: %u, path: %Q}}", &key, &size, &path);
+    if (je == 3) {
+        if (image == NULL) {
+            image = sdsempty();
+            thumbnail_read_file(path, &image);
+        }
+        if (thumbnail_store(config, key, size, image) == false) {
+            LOG_DEBUG("Using original image as thumbnail for \"%s\"", key);
+        }
+        sds variant_key = thumbnail_key(sdsempty(), key, size);
+        cover_thumbnail_send(variant_key);
+        sdsfree(variant_key);
+    }
+    if (image != NULL) {
+        sdsfree(image);
+    }
+    FREE_PTR(key);
+    FREE_PTR(path);
+}
+
+//internal message to the web server, the thumbnail can be queued again
+static void cover_thumbnail_send(const char *variant_key) {
+    t_work_result *response = create_result_new(-1, 0, 0, "");
+    response->data = sdscat(response->data, "{");
+    response->data = tojson_char(response->data, "thumbnailCreated", variant_key, false);
+    response->data = sdscat(response->data, "}");
+    tiny_queue_push(web_server_queue, response, 0);
+}
+
+//same result format as the mpd cover thread, a result without mime_type is cached as not found
+static void cover_extract_send(long conn_id, const char *uri, const char *mime_type, sds binary) {
+    t_work_result *response = create_result_new(conn_id, 0, MPD_API_ALBUMART, "MPD_API_ALBUMART");
+    response->data = jsonrpc_start_result(response->data, response->method, 0);
+    response->data = sdscat(response->data, ",");
+    if (mime_type != NULL) {
+        response->data = tojson_char(response->data, "mime_type", mime_type, true);
+        response->data = tojson_long(response->data, "offset", 0, true);
+        response->data = tojson_long(response->data, "size", sdslen(binary), true);
+        response->binary = sdscatlen(response->binary, binary, sdslen(binary));
+    }
+    response->data = tojson_char(response->data, "uri", uri, false);
+    response->data = jsonrpc_end_result(response->data);
+    tiny_queue_push(web_server_queue, response, 0);
+}
@@ -0,0 +1,16 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __COVER_EXTRACTOR_H__
+#define __COVER_EXTRACTOR_H__
+typedef struct t_cover_extractor_arg {
+    t_config *config;
+    unsigned id;
+} t_cover_extractor_arg;
+
+void *cover_extractor_loop(void *arg_extractor);
+bool cover_extract_supported(const char *media_file);
+#endif
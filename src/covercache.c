@@ -0,0 +1,397 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+#include "../dist/src/sds/sds.h"
+#include "../dist/src/rax/rax.h"
+#include "sds_extras.h"
+#include "log.h"
+#include "list.h"
+#include "config_defs.h"
+#include "utility.h"
+#include "covercache.h"
+
+//private definitions
+//the covercache stores each image once as <content hash>.<ext>,
+//the index file maps the uris (and thumbnail keys) to these files
+//index lines: <timestamp>\t<file>\t<key>
+typedef struct t_covercache_entry {
+    sds file;
+    time_t added;
+} t_covercache_entry;
+
+static rax *covercache_index = NULL;
+static unsigned covercache_index_lines = 0;
+static pthread_mutex_t covercache_mutex = PTHREAD_MUTEX_INITIALIZER;
+//serializes writing and deleting of cache files and the index file,
+//lookups only need covercache_mutex and are not blocked by file operations
+static pthread_mutex_t covercache_files_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool _covercache_load(t_config *config);
+static void _covercache_insert(const char *key, size_t key_len, const char *file, time_t added);
+static void _covercache_free_index(void);
+static bool _covercache_index_append(t_config *config, const char *key, const char *file, time_t added);
+static bool _covercache_index_write(t_config *config);
+static bool _covercache_write_file(const char *filepath, sds binary);
+static int _covercache_remove_unindexed(t_config *config);
+
+//public functions
+bool covercache_init(t_config *config) {
+    pthread_mutex_lock(&covercache_mutex);
+    bool rc = covercache_index != NULL ? true : _covercache_load(config);
+    pthread_mutex_unlock(&covercache_mutex);
+    return rc;
+}
+
+void covercache_free(void) {
+    pthread_mutex_lock(&covercache_files_mutex);
+    pthread_mutex_lock(&covercache_mutex);
+    _covercache_free_index();
+    pthread_mutex_unlock(&covercache_mutex);
+    pthread_mutex_unlock(&covercache_files_mutex);
+}
+
+//returns the absolute path of the cached image or an empty string
+sds covercache_get(sds buffer, t_config *config, const char *key) {
+    pthread_mutex_lock(&covercache_mutex);
+    if (covercache_index != NULL) {
+        void *data = raxFind(covercache_index, (unsigned char *)key, strlen(key));
+        if (data != raxNotFound) {
+            t_covercache_entry *entry = (t_covercache_entry *)data;
+            buffer = sdscatfmt(buffer, "%s/covercache/%s", config->varlibdir, entry->file);
+        }
+    }
+    pthread_mutex_unlock(&covercache_mutex);
+    return buffer;
+}
+
+//identical images are stored only once
+bool covercache_put(t_config *config, const char *key, const char *mime_type, sds binary) {
+    if (config->covercache == false) {
+        return false;
+    }
+    //a file that exists can not be deleted by covercache_crop before it is indexed
+    pthread_mutex_lock(&covercache_files_mutex);
+    pthread_mutex_lock(&covercache_mutex);
+    bool loaded = covercache_index != NULL ? true : false;
+    pthread_mutex_unlock(&covercache_mutex);
+    if (loaded == false) {
+        pthread_mutex_unlock(&covercache_files_mutex);
+        return false;
+    }
+    sds ext = get_ext_by_mime_type(mime_type);
+    sds file = sdscathash(sdsempty(), binary, sdslen(binary));
+    file = sdscatfmt(file, ".%s", ext);
+    sdsfree(ext);
+    sds filepath = sdscatfmt(sdsempty(), "%s/covercache/%s", config->varlibdir, file);
+    bool rc = true;
+    if (access(filepath, F_OK) != 0) { /* Flawfinder: ignore */
+        rc = _covercache_write_file(filepath, binary);
+    }
+    else {
+        LOG_DEBUG("Covercache file \"%s\" already exists", file);
+    }
+    if (rc == true) {
+        time_t now = time(NULL);
+        pthread_mutex_lock(&covercache_mutex);
+        bool indexed = false;
+        if (covercache_index != NULL) {
+            _covercache_insert(key, strlen(key), file, now);
+            indexed = true;
+        }
+        pthread_mutex_unlock(&covercache_mutex);
+        if (indexed == true) {
+            _covercache_index_append(config, key, file, now);
+        }
+        LOG_DEBUG("Write covercache file \"%s\" for \"%s\"", file, key);
+    }
+    pthread_mutex_unlock(&covercache_files_mutex);
+    sdsfree(filepath);
+    sdsfree(file);
+    return rc;
+}
+
+//removes the index entries older than keepdays and the files no longer referenced
+int covercache_crop(t_config *config, int keepdays) {
+    if (config->covercache == false) {
+        LOG_WARN("Covercache is disabled");
+        return 0;
+    }
+    if (keepdays == -1) {
+        keepdays = config->covercache_keep_days;
+    }
+    time_t expire = time(NULL) - keepdays * 24 * 60 * 60;
+    int num_deleted = 0;
+    pthread_mutex_lock(&covercache_files_mutex);
+    pthread_mutex_lock(&covercache_mutex);
+    if (covercache_index == NULL && _covercache_load(config) == false) {
+        pthread_mutex_unlock(&covercache_mutex);
+        pthread_mutex_unlock(&covercache_files_mutex);
+        return 0;
+    }
+    LOG_INFO("Cropping covercache");
+    //files still referenced by a valid entry
+    rax *keep = raxNew();
+    struct list expired;
+    list_init(&expired);
+    raxIterator iter;
+    raxStart(&iter, covercache_index);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        t_covercache_entry *entry = (t_covercache_entry *)iter.data;
+        if (keepdays == 0 || entry->added < expire) {
+            list_push_len(&expired, (char *)iter.key, (int)iter.key_len, 0, entry->file, (int)sdslen(entry->file), NULL);
+        }
+        else {
+            raxInsert(keep, (unsigned char *)entry->file, sdslen(entry->file), NULL, NULL);
+        }
+    }
+    raxStop(&iter);
+    //collect the files that are no longer referenced
+    struct list victims;
+    list_init(&victims);
+    struct list_node *current = expired.head;
+    while (current != NULL) {
+        t_covercache_entry *entry = NULL;
+        raxRemove(covercache_index, (unsigned char *)current->key, sdslen(current->key), (void **)&entry);
+        if (entry != NULL) {
+            sdsfree(entry->file);
+            free(entry);
+        }
+        //insert returns 1 for files not seen before
+        if (raxInsert(keep, (unsigned char *)current->value_p, sdslen(current->value_p), NULL, NULL) == 1) {
+            list_push(&victims, current->value_p, 0, NULL, NULL);
+        }
+        current = current->next;
+    }
+    pthread_mutex_unlock(&covercache_mutex);
+    list_free(&expired);
+    raxFree(keep);
+    //covercache_files_mutex is still held, no file can be indexed again
+    sds filepath = sdsempty();
+    current = victims.head;
+    while (current != NULL) {
+        filepath = sdscrop(filepath);
+        filepath = sdscatfmt(filepath, "%s/covercache/%s", config->varlibdir, current->key);
+        LOG_DEBUG("Deleting %s", filepath);
+        if (unlink(filepath) != 0) {
+            if (errno != ENOENT) {
+                LOG_ERROR("Error removing file \"%s\": %s", filepath, strerror(errno));
+            }
+        }
+        else {
+            num_deleted++;
+        }
+        current = current->next;
+    }
+    sdsfree(filepath);
+    list_free(&victims);
+    if (keepdays == 0) {
+        //also remove files written by older versions or left behind by crashes
+        num_deleted += _covercache_remove_unindexed(config);
+    }
+    //the index is only changed with covercache_files_mutex held
+    _covercache_index_write(config);
+    pthread_mutex_unlock(&covercache_files_mutex);
+    LOG_INFO("Deleted %d files from covercache", num_deleted);
+    return num_deleted;
+}
+
+//private functions
+static bool _covercache_load(t_config *config) {
+    covercache_index = raxNew();
+    covercache_index_lines = 0;
+    sds index_file = sdscatfmt(sdsempty(), "%s/covercache/index", config->varlibdir);
+    FILE *fp = fopen(index_file, "r");
+    if (fp == NULL) {
+        if (errno != ENOENT) {
+            LOG_ERROR("Can not open file \"%s\": %s", index_file, strerror(errno));
+            sdsfree(index_file);
+            return false;
+        }
+        //covercache from older versions, one file per uri
+        int num_deleted = _covercache_remove_unindexed(config);
+        if (num_deleted > 0) {
+            LOG_INFO("Removed %d files from the old covercache", num_deleted);
+        }
+        sdsfree(index_file);
+        return _covercache_index_write(config);
+    }
+    char *line = NULL;
+    size_t n = 0;
+    ssize_t read;
+    while ((read = getline(&line, &n, fp)) > 0) {
+        if (line[read - 1] == '\n') {
+            line[--read] = '\0';
+        }
+        char *file = strchr(line, '\t');
+        char *key = file != NULL ? strchr(file + 1, '\t') : NULL;
+        if (key == NULL) {
+            LOG_WARN("Invalid line in covercache index");
+            continue;
+        }
+        *file++ = '\0';
+        *key++ = '\0';
+        time_t added = (time_t)strtoimax(line, NULL, 10);
+        _covercache_insert(key, strlen(key), file, added);
+        covercache_index_lines++;
+    }
+    FREE_PTR(line);
+    fclose(fp);
+    sdsfree(index_file);
+    LOG_VERBOSE("Read %" PRIu64 " entries from covercache index", raxSize(covercache_index));
+    //compact the index if it contains overwritten entries
+    if (covercache_index_lines > raxSize(covercache_index)) {
+        return _covercache_index_write(config);
+    }
+    return true;
+}
+
+static void _covercache_insert(const char *key, size_t key_len, const char *file, time_t added) {
+    t_covercache_entry *entry = (t_covercache_entry *)malloc(sizeof(t_covercache_entry));
+    assert(entry);
+    entry->file = sdsnew(file);
+    entry->added = added;
+    t_covercache_entry *old = NULL;
+    if (raxInsert(covercache_index, (unsigned char *)key, key_len, entry, (void **)&old) == 0 && old != NULL) {
+        sdsfree(old->file);
+        free(old);
+    }
+}
+
+static void _covercache_free_index(void) {
+    if (covercache_index == NULL) {
+        return;
+    }
+    raxIterator iter;
+    raxStart(&iter, covercache_index);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        t_covercache_entry *entry = (t_covercache_entry *)iter.data;
+        sdsfree(entry->file);
+        free(entry);
+    }
+    raxStop(&iter);
+    raxFree(covercache_index);
+    covercache_index = NULL;
+}
+
+static bool _covercache_index_append(t_config *config, const char *key, const char *file, time_t added) {
+    sds index_file = sdscatfmt(sdsempty(), "%s/covercache/index", config->varlibdir);
+    FILE *fp = fopen(index_file, "a");
+    if (fp == NULL) {
+        LOG_ERROR("Can not open file \"%s\" for append: %s", index_file, strerror(errno));
+        sdsfree(index_file);
+        return false;
+    }
+    fprintf(fp, "%lld\t%s\t%s\n", (long long)added, file, key);
+    fclose(fp);
+    covercache_index_lines++;
+    sdsfree(index_file);
+    return true;
+}
+
+//writes the compacted index to a temporary file and replaces the old one
+static bool _covercache_index_write(t_config *config) {
+    sds tmp_file = sdscatfmt(sdsempty(), "%s/covercache/index.XXXXXX", config->varlibdir);
+    int fd = mkstemp(tmp_file);
+    if (fd < 0) {
+        LOG_ERROR("Can not open file \"%s\" for write: %s", tmp_file, strerror(errno));
+        sdsfree(tmp_file);
+        return false;
+    }
+    FILE *fp = fdopen(fd, "w");
+    raxIterator iter;
+    raxStart(&iter, covercache_index);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        t_covercache_entry *entry = (t_covercache_entry *)iter.data;
+        fprintf(fp, "%lld\t%s\t%.*s\n", (long long)entry->added, entry->file, (int)iter.key_len, (char *)iter.key);
+    }
+    raxStop(&iter);
+    fclose(fp);
+    sds index_file = sdscatfmt(sdsempty(), "%s/covercache/index", config->varlibdir);
+    bool rc = true;
+    if (rename(tmp_file, index_file) == -1) {
+        LOG_ERROR("Rename file from \"%s\" to \"%s\" failed: %s", tmp_file, index_file, strerror(errno));
+        if (unlink(tmp_file) != 0) {
+            LOG_ERROR("Error removing file \"%s\": %s", tmp_file, strerror(errno));
+        }
+        rc = false;
+    }
+    else {
+        covercache_index_lines = (unsigned)raxSize(covercache_index);
+    }
+    sdsfree(tmp_file);
+    sdsfree(index_file);
+    return rc;
+}
+
+static bool _covercache_write_file(const char *filepath, sds binary) {
+    sds tmp_file = sdscatfmt(sdsempty(), "%s.XXXXXX", filepath);
+    int fd = mkstemp(tmp_file);
+    if (fd < 0) {
+        LOG_ERROR("Can not open file \"%s\" for write: %s", tmp_file, strerror(errno));
+        sdsfree(tmp_file);
+        return false;
+    }
+    FILE *fp = fdopen(fd, "w");
+    fwrite(binary, 1, sdslen(binary), fp);
+    fclose(fp);
+    bool rc = true;
+    if (rename(tmp_file, filepath) == -1) {
+        LOG_ERROR("Rename file from \"%s\" to \"%s\" failed: %s", tmp_file, filepath, strerror(errno));
+        if (unlink(tmp_file) != 0) {
+            LOG_ERROR("Error removing file \"%s\": %s", tmp_file, strerror(errno));
+        }
+        rc = false;
+    }
+    sdsfree(tmp_file);
+    return rc;
+}
+
+static int _covercache_remove_unindexed(t_config *config) {
+    int num_deleted = 0;
+    sds covercache = sdscatfmt(sdsempty(), "%s/covercache", config->varlibdir);
+    DIR *covercache_dir = opendir(covercache);
+    if (covercache_dir != NULL) {
+        struct dirent *next_file;
+        sds filepath = sdsempty();
+        while ((next_file = readdir(covercache_dir)) != NULL ) {
+            if (next_file->d_type != DT_REG || strcmp(next_file->d_name, "index") == 0) {
+                continue;
+            }
+            filepath = sdscrop(filepath);
+            filepath = sdscatfmt(filepath, "%s/%s", covercache, next_file->d_name);
+            if (unlink(filepath) != 0) {
+                LOG_ERROR("Error removing file \"%s\": %s", filepath, strerror(errno));
+            }
+            else {
+                num_deleted++;
+            }
+        }
+        sdsfree(filepath);
+        closedir(covercache_dir);
+    }
+    else {
+        LOG_ERROR("Error opening directory %s: %s", covercache, strerror(errno));
+    }
+    sdsfree(covercache);
+    return num_deleted;
+}
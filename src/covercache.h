@@ -0,0 +1,14 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __COVERCACHE_H__
+#define __COVERCACHE_H__
+bool covercache_init(t_config *config);
+void covercache_free(void);
+sds covercache_get(sds buffer, t_config *config, const char *key);
+bool covercache_put(t_config *config, const char *key, const char *mime_type, sds binary);
+int covercache_crop(t_config *config, int keepdays);
+#endif
@@ -13,6 +13,7 @@
 #include "../dist/src/sds/sds.h"
 #include "../dist/src/mongoose/mongoose.h"
 #include "list.h"
+#include "config_defs.h"
 #include "tiny_queue.h"
 #include "lua_mympd_state.h"
 #include "api.h"
@@ -23,6 +24,11 @@ tiny_queue_t *web_server_queue;
 tiny_queue_t *mpd_client_queue;
 tiny_queue_t *mympd_api_queue;
 tiny_queue_t *mpd_worker_queue;
+tiny_queue_t *mpd_reader_queue;
+tiny_queue_t *mpd_reader_settings_queue[MPD_READERS_MAX];
+tiny_queue_t *mpd_cover_queue;
+tiny_queue_t *mpd_cover_settings_queue;
+tiny_queue_t *cover_extractor_queue;
 tiny_queue_t *mympd_script_queue;
 
 t_work_result *create_result(t_work_request *request) {
@@ -99,6 +105,9 @@ int expire_request_queue(tiny_queue_t *queue, time_t age) {
             if (strcmp(request->method, "MYMPD_API_SCRIPT_INIT") == 0) {
                 free_lua_mympd_state(request->extra);
             }
+            else if (request->cmd_id == MPD_API_THUMBNAIL_CREATE) {
+                sdsfree(request->extra);
+            }
             else {
                 free(request->extra);
             }
@@ -6,6 +6,7 @@
 
 #ifndef __GLOBAL_H__
 #define __GLOBAL_H__
+#include "config_defs.h"
 
 //signal handler
 extern sig_atomic_t s_signal_received;
@@ -15,6 +16,11 @@ extern tiny_queue_t *web_server_queue;
 extern tiny_queue_t *mpd_client_queue;
 extern tiny_queue_t *mympd_api_queue;
 extern tiny_queue_t *mpd_worker_queue;
+extern tiny_queue_t *mpd_reader_queue;
+extern tiny_queue_t *mpd_reader_settings_queue[MPD_READERS_MAX];
+extern tiny_queue_t *mpd_cover_queue;
+extern tiny_queue_t *mpd_cover_settings_queue;
+extern tiny_queue_t *cover_extractor_queue;
 extern tiny_queue_t *mympd_script_queue;
 
 typedef struct t_work_request {
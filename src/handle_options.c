@@ -16,15 +16,18 @@
 #include <stdbool.h>
 
 #include "../dist/src/sds/sds.h"
+#include "../dist/src/rax/rax.h"
 #include "sds_extras.h"
 #include "../dist/src/frozen/frozen.h"
 #include "log.h"
 #include "list.h"
 #include "config_defs.h"
 #include "config.h"
+#include "state_store.h"
 #include "mympd_api/mympd_api_utility.h"
 #include "mympd_api/mympd_api_timer.h"
 #include "mympd_api/mympd_api_settings.h"
+#include "mpd_client/mpd_client_last_played.h"
 #ifdef ENABLE_SSL
   #include "cert.h"
 #endif
@@ -39,26 +42,11 @@ static bool smartpls_init(t_config *config, const char *name, const char *value)
 bool smartpls_default(t_config *config) {
     bool rc = true;
 
-    //try to get prefix from state file, fallback to config value
-    sds prefix = sdsempty();
-    sds prefix_file = sdscatfmt(sdsempty(), "%s/state/smartpls_prefix", config->varlibdir);
-    FILE *fp = fopen(prefix_file, "r");
-    if (fp != NULL) {
-        size_t n = 0;
-        char *line = NULL;
-        ssize_t read = getline(&line, &n, fp);
-        if (read > 0) {
-            prefix = sdscat(prefix, line);
-            FREE_PTR(line);
-        }
-        fclose(fp);
-    }
-    else {
-        //ignore error
-        LOG_DEBUG("Can not open file \"%s\": %s", prefix_file, strerror(errno));
-        prefix = sdscat(prefix, config->smartpls_prefix);
-    }
-    sdsfree(prefix_file);
+    //try to get prefix from state store, fallback to config value
+    t_state_store *store = mympd_api_settings_store_open(config);
+    sds value = state_store_get(store, "smartpls_prefix");
+    sds prefix = sdsnew(value != NULL ? value : config->smartpls_prefix);
+    state_store_free(store);
     
     sds smartpls_file = sdscatfmt(sdsempty(), "%s%sbestRated", prefix, (sdslen(prefix) > 0 ? "-" : ""));
     rc = smartpls_init(config, smartpls_file, 
@@ -100,20 +88,7 @@ bool handle_option(t_config *config, char *cmd, sds option) {
         return smartpls_default(config);
     }
     if (MATCH_OPTION("reset_lastplayed")) {
-        sds lpfile = sdscatfmt(sdsempty(), "%s/state/last_played", config->varlibdir);
-        int rc = unlink(lpfile);
-        if (rc == 0) {
-            sdsfree(lpfile);
-            return true;
-        }
-        if (rc == ENOENT) {
-            LOG_ERROR("last_played file does not exist");
-        }
-        else {
-            LOG_ERROR("Can not delete file \"%s\": %s", lpfile, strerror(errno));
-        }
-        sdsfree(lpfile);
-        return false;
+        return last_played_store_remove(config);
     }
     #ifdef ENABLE_SSL
     if (MATCH_OPTION("cert_remove")) {
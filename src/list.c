@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "../dist/src/sds/sds.h"
 #include "sds_extras.h"
@@ -19,6 +20,14 @@
 //private definitions
 static struct list_node *list_node_extract(struct list *l, unsigned idx);
 static bool _list_free(struct list *l, bool free_user_data);
+static int _list_cmp_key(struct list_node *n1, struct list_node *n2);
+static int _list_cmp_value_i(struct list_node *n1, struct list_node *n2);
+static int _list_cmp_value_p(struct list_node *n1, struct list_node *n2);
+static bool _list_sort(struct list *l, int (*cmp)(struct list_node *, struct list_node *), bool order);
+static struct list_node **_list_to_array(struct list *l);
+static void _list_from_array(struct list *l, struct list_node **nodes);
+static void _list_fenwick_add(unsigned *tree, unsigned size, unsigned idx, int value);
+static unsigned _list_fenwick_count(unsigned *tree, unsigned idx);
 
 //public functions
 bool list_init(struct list *l) {
@@ -162,109 +171,134 @@ bool list_swap_item(struct list_node *n1, struct list_node *n2) {
     return true;
 }
 
+//fisher-yates shuffle over an array of the nodes
 bool list_shuffle(struct list *l) {
     if (l->length < 2) {
         return false;
     }
-    int n = 0;
-    struct list_node *current = l->head;
-    while (current != NULL) {
-        unsigned int pos = randrange(0, l->length);
-        list_swap_item(current, list_node_at(l, pos));
-        n++;
-        current = current->next;
+    struct list_node **nodes = _list_to_array(l);
+    for (unsigned i = l->length - 1; i > 0; i--) {
+        unsigned j = randrange(0, i);
+        struct list_node *tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
     }
+    _list_from_array(l, nodes);
+    free(nodes);
     return true;
 }
 
 bool list_sort_by_value_i(struct list *l, bool order) {
-    int swapped; 
-    struct list_node *ptr1; 
-    struct list_node *lptr = NULL; 
-  
-    if (l->head == NULL) {
-        return false;
-    }
-  
-    do { 
-        swapped = 0; 
-        ptr1 = l->head;
-  
-        while (ptr1->next != lptr)  { 
-            if (order == true && ptr1->value_i > ptr1->next->value_i) {  
-                list_swap_item(ptr1, ptr1->next); 
-                swapped = 1; 
-            } 
-            else if (order == false && ptr1->value_i < ptr1->next->value_i) {  
-                list_swap_item(ptr1, ptr1->next); 
-                swapped = 1; 
-            } 
-            ptr1 = ptr1->next; 
-        } 
-        lptr = ptr1; 
-    } 
-    while (swapped);
-    return true;
+    return _list_sort(l, _list_cmp_value_i, order);
 }
 
 bool list_sort_by_value_p(struct list *l, bool order) {
-    int swapped; 
-    struct list_node *ptr1; 
-    struct list_node *lptr = NULL; 
-  
-    if (l->head == NULL) {
-        return false;
-    }
-  
-    do { 
-        swapped = 0; 
-        ptr1 = l->head;
-  
-        while (ptr1->next != lptr)  { 
-            if (order == true && strcmp(ptr1->value_p, ptr1->next->value_p) > 0) {  
-                list_swap_item(ptr1, ptr1->next); 
-                swapped = 1; 
-            } 
-            else if (order == false && strcmp(ptr1->value_p, ptr1->next->value_p) < 0) {  
-                list_swap_item(ptr1, ptr1->next); 
-                swapped = 1; 
-            } 
-            ptr1 = ptr1->next; 
-        } 
-        lptr = ptr1; 
-    } 
-    while (swapped);
-    return true;
+    return _list_sort(l, _list_cmp_value_p, order);
 }
 
 bool list_sort_by_key(struct list *l, bool order) {
-    int swapped; 
-    struct list_node *ptr1; 
-    struct list_node *lptr = NULL; 
-  
-    if (l->head == NULL) {
-        return false;
+    return _list_sort(l, _list_cmp_key, order);
+}
+
+//calculates the minimal moves that reorder a list from its original order to the current order,
+//value_i of each node must be its original position
+//the songs of the longest increasing subsequence of original positions stay in place,
+//all others are moved once in the order of their target position
+//moves must have room for 2 * length entries, pairs of from and to
+//returns the number of moves
+unsigned list_reorder_moves(struct list *l, unsigned *moves) {
+    unsigned n = l->length;
+    if (n < 2) {
+        return 0;
+    }
+    unsigned *orig = malloc(n * sizeof(unsigned));
+    assert(orig);
+    unsigned t = 0;
+    struct list_node *current = l->head;
+    while (current != NULL) {
+        orig[t++] = (unsigned)current->value_i;
+        current = current->next;
     }
-  
-    do { 
-        swapped = 0; 
-        ptr1 = l->head;
-  
-        while (ptr1->next != lptr)  { 
-            if (order == true && strcmp(ptr1->key, ptr1->next->key) > 0) {  
-                list_swap_item(ptr1, ptr1->next); 
-                swapped = 1; 
-            } 
-            else if (order == false && strcmp(ptr1->key, ptr1->next->key) < 0) {  
-                list_swap_item(ptr1, ptr1->next); 
-                swapped = 1; 
+    //longest increasing subsequence, patience sorting with back pointers
+    unsigned *tails = malloc(n * sizeof(unsigned));
+    assert(tails);
+    unsigned *prev = malloc(n * sizeof(unsigned));
+    assert(prev);
+    unsigned lis_len = 0;
+    for (t = 0; t < n; t++) {
+        unsigned lo = 0;
+        unsigned hi = lis_len;
+        while (lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if (orig[tails[mid]] < orig[t]) {
+                lo = mid + 1;
             }
-            ptr1 = ptr1->next; 
-        } 
-        lptr = ptr1; 
-    } 
-    while (swapped);
-    return true;
+            else {
+                hi = mid;
+            }
+        }
+        prev[t] = lo > 0 ? tails[lo - 1] : UINT_MAX;
+        tails[lo] = t;
+        if (lo == lis_len) {
+            lis_len++;
+        }
+    }
+    bool *stays = calloc(n, sizeof(bool));
+    assert(stays);
+    for (t = tails[lis_len - 1]; t != UINT_MAX; t = prev[t]) {
+        stays[t] = true;
+    }
+    free(tails);
+    //a moved song is inserted behind the staying song that precedes it in the target order,
+    //slot 0 is the start of the list, slot s + 1 the song at original position s
+    //prev is reused as the slot of each moved song
+    unsigned *slot_size = calloc(n + 2, sizeof(unsigned));
+    assert(slot_size);
+    unsigned anchor = 0;
+    for (t = 0; t < n; t++) {
+        if (stays[t] == true) {
+            anchor = orig[t] + 1;
+        }
+        else {
+            prev[t] = anchor;
+            slot_size[anchor]++;
+        }
+    }
+    //all original and inserted positions in their final order, a fenwick tree counts the occupied ones
+    unsigned *slot_base = malloc((n + 2) * sizeof(unsigned));
+    assert(slot_base);
+    unsigned keys = 0;
+    for (unsigned s = 0; s <= n; s++) {
+        slot_base[s] = keys;
+        keys += slot_size[s] + (s > 0 ? 1 : 0);
+        slot_size[s] = 0;
+    }
+    unsigned *tree = calloc(keys + 1, sizeof(unsigned));
+    assert(tree);
+    for (unsigned s = 1; s <= n; s++) {
+        _list_fenwick_add(tree, keys, slot_base[s], 1);
+    }
+    unsigned count = 0;
+    for (t = 0; t < n; t++) {
+        if (stays[t] == true) {
+            continue;
+        }
+        unsigned from_key = slot_base[orig[t] + 1];
+        unsigned slot = prev[t];
+        unsigned to_key = slot_base[slot] + (slot > 0 ? 1 : 0) + slot_size[slot]++;
+        _list_fenwick_add(tree, keys, from_key, -1);
+        moves[count * 2] = _list_fenwick_count(tree, from_key);
+        moves[count * 2 + 1] = _list_fenwick_count(tree, to_key);
+        _list_fenwick_add(tree, keys, to_key, 1);
+        count++;
+    }
+    free(tree);
+    free(slot_base);
+    free(slot_size);
+    free(stays);
+    free(prev);
+    free(orig);
+    return count;
 }
 
 bool list_replace(struct list *l, unsigned pos, const char *key, long value_i, const char *value_p, void *user_data) {
@@ -486,6 +520,7 @@ struct list_node *list_shift_first(struct list *l) {
     if (l->tail == extracted) {
         l->tail = NULL;
     }
+    l->length--;
     
     extracted->next = NULL;
     return extracted;
@@ -581,3 +616,93 @@ static struct list_node *list_node_extract(struct list *l, unsigned idx) {
     }
     return current;
 }
+
+static int _list_cmp_key(struct list_node *n1, struct list_node *n2) {
+    return strcmp(n1->key, n2->key);
+}
+
+static int _list_cmp_value_i(struct list_node *n1, struct list_node *n2) {
+    return n1->value_i < n2->value_i ? -1 : (n1->value_i > n2->value_i ? 1 : 0);
+}
+
+static int _list_cmp_value_p(struct list_node *n1, struct list_node *n2) {
+    return strcmp(n1->value_p, n2->value_p);
+}
+
+//stable bottom-up merge sort over an array of the nodes
+static bool _list_sort(struct list *l, int (*cmp)(struct list_node *, struct list_node *), bool order) {
+    if (l->head == NULL) {
+        return false;
+    }
+    unsigned n = l->length;
+    struct list_node **nodes = _list_to_array(l);
+    struct list_node **tmp = malloc(n * sizeof(struct list_node *));
+    assert(tmp);
+    for (unsigned width = 1; width < n; width *= 2) {
+        for (unsigned left = 0; left < n; left += 2 * width) {
+            unsigned mid = left + width < n ? left + width : n;
+            unsigned right = left + 2 * width < n ? left + 2 * width : n;
+            unsigned i = left;
+            unsigned j = mid;
+            unsigned k = left;
+            while (i < mid && j < right) {
+                int rc = cmp(nodes[i], nodes[j]);
+                if ((order == true && rc <= 0) || (order == false && rc >= 0)) {
+                    tmp[k++] = nodes[i++];
+                }
+                else {
+                    tmp[k++] = nodes[j++];
+                }
+            }
+            while (i < mid) {
+                tmp[k++] = nodes[i++];
+            }
+            while (j < right) {
+                tmp[k++] = nodes[j++];
+            }
+        }
+        struct list_node **swap = nodes;
+        nodes = tmp;
+        tmp = swap;
+    }
+    _list_from_array(l, nodes);
+    free(nodes);
+    free(tmp);
+    return true;
+}
+
+static struct list_node **_list_to_array(struct list *l) {
+    struct list_node **nodes = malloc(l->length * sizeof(struct list_node *));
+    assert(nodes);
+    unsigned i = 0;
+    struct list_node *current = l->head;
+    while (current != NULL) {
+        nodes[i++] = current;
+        current = current->next;
+    }
+    return nodes;
+}
+
+static void _list_from_array(struct list *l, struct list_node **nodes) {
+    for (unsigned i = 0; i + 1 < l->length; i++) {
+        nodes[i]->next = nodes[i + 1];
+    }
+    nodes[l->length - 1]->next = NULL;
+    l->head = nodes[0];
+    l->tail = nodes[l->length - 1];
+}
+
+static void _list_fenwick_add(unsigned *tree, unsigned size, unsigned idx, int value) {
+    for (idx++; idx <= size; idx += idx & (~idx + 1)) {
+        tree[idx] += (unsigned)value;
+    }
+}
+
+//number of occupied positions before idx
+static unsigned _list_fenwick_count(unsigned *tree, unsigned idx) {
+    unsigned sum = 0;
+    for (; idx > 0; idx -= idx & (~idx + 1)) {
+        sum += tree[idx];
+    }
+    return sum;
+}
@@ -39,6 +39,7 @@ bool list_shuffle(struct list *l);
 bool list_sort_by_value_i(struct list *l, bool order);
 bool list_sort_by_value_p(struct list *l, bool order);
 bool list_sort_by_key(struct list *l, bool order);
+unsigned list_reorder_moves(struct list *l, unsigned *moves);
 bool list_swap_item(struct list_node *n1, struct list_node *n2);
 bool list_swap_item_pos(struct list *l, unsigned index1, unsigned index2);
 bool list_move_item_pos(struct list *l, unsigned from, unsigned to);
@@ -0,0 +1,329 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "../dist/src/sds/sds.h"
+#include "../dist/src/rax/rax.h"
+#include "sds_extras.h"
+#include "log.h"
+#include "lua_vm.h"
+
+//private definitions
+struct t_lua_vm_pool {
+    pthread_mutex_t mutex;
+    lua_State *idle[LUA_VM_POOL_SIZE];
+    int idle_count;
+    lua_vm_setup setup;
+    rax *bytecode; //script fullpath -> struct t_lua_vm_bytecode
+    bool initialized;
+};
+
+//compiled script, valid as long as the script file is unchanged
+struct t_lua_vm_bytecode {
+    struct timespec mtime;
+    off_t size;
+    sds code;
+};
+
+static struct t_lua_vm_pool lua_vm_pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .idle_count = 0,
+    .setup = NULL,
+    .bytecode = NULL,
+    .initialized = false
+};
+
+static lua_State *lua_vm_new(lua_vm_setup setup);
+static void lua_vm_save_globals(lua_State *lua_vm);
+static void lua_vm_reset_globals(lua_State *lua_vm);
+static void lua_vm_save_table(lua_State *lua_vm, int table, int pristine, int metatables);
+static void lua_vm_restore_table(lua_State *lua_vm, int table, int copy);
+static int lua_vm_bytecode_writer(lua_State *lua_vm, const void *p, size_t sz, void *ud);
+static void lua_vm_free_bytecode(void *data);
+
+//public functions
+//returns false if the pool is already initialized
+bool lua_vm_pool_init(lua_vm_setup setup) {
+    pthread_mutex_lock(&lua_vm_pool.mutex);
+    if (lua_vm_pool.initialized == true) {
+        pthread_mutex_unlock(&lua_vm_pool.mutex);
+        return false;
+    }
+    lua_vm_pool.setup = setup;
+    lua_vm_pool.bytecode = raxNew();
+    lua_vm_pool.idle_count = 0;
+    lua_vm_pool.initialized = true;
+    //one prepared state for the next script run
+    lua_State *lua_vm = lua_vm_new(setup);
+    if (lua_vm != NULL) {
+        lua_vm_pool.idle[lua_vm_pool.idle_count++] = lua_vm;
+    }
+    pthread_mutex_unlock(&lua_vm_pool.mutex);
+    return true;
+}
+
+void lua_vm_pool_free(void) {
+    pthread_mutex_lock(&lua_vm_pool.mutex);
+    if (lua_vm_pool.initialized == true) {
+        for (int i = 0; i < lua_vm_pool.idle_count; i++) {
+            lua_close(lua_vm_pool.idle[i]);
+        }
+        lua_vm_pool.idle_count = 0;
+        raxFreeWithCallback(lua_vm_pool.bytecode, lua_vm_free_bytecode);
+        lua_vm_pool.bytecode = NULL;
+        lua_vm_pool.initialized = false;
+    }
+    pthread_mutex_unlock(&lua_vm_pool.mutex);
+}
+
+lua_State *lua_vm_acquire(void) {
+    lua_State *lua_vm = NULL;
+    pthread_mutex_lock(&lua_vm_pool.mutex);
+    if (lua_vm_pool.initialized == false) {
+        pthread_mutex_unlock(&lua_vm_pool.mutex);
+        LOG_ERROR("Lua state pool is not initialized");
+        return NULL;
+    }
+    if (lua_vm_pool.idle_count > 0) {
+        lua_vm = lua_vm_pool.idle[--lua_vm_pool.idle_count];
+    }
+    lua_vm_setup setup = lua_vm_pool.setup;
+    pthread_mutex_unlock(&lua_vm_pool.mutex);
+    if (lua_vm == NULL) {
+        LOG_DEBUG("No idle lua state, creating a new one");
+        lua_vm = lua_vm_new(setup);
+    }
+    return lua_vm;
+}
+
+void lua_vm_release(lua_State *lua_vm, bool reuse) {
+    if (reuse == true) {
+        lua_vm_reset_globals(lua_vm);
+        lua_gc(lua_vm, LUA_GCCOLLECT, 0);
+        pthread_mutex_lock(&lua_vm_pool.mutex);
+        if (lua_vm_pool.initialized == true && lua_vm_pool.idle_count < LUA_VM_POOL_SIZE) {
+            lua_vm_pool.idle[lua_vm_pool.idle_count++] = lua_vm;
+            lua_vm = NULL;
+        }
+        pthread_mutex_unlock(&lua_vm_pool.mutex);
+    }
+    if (lua_vm != NULL) {
+        lua_close(lua_vm);
+    }
+}
+
+//loads the script from the bytecode cache, compiles and caches it if the file has changed
+int lua_vm_load_script(lua_State *lua_vm, const char *script_fullpath) {
+    struct stat status;
+    if (stat(script_fullpath, &status) != 0) {
+        //let lua report the error
+        return luaL_loadfilex(lua_vm, script_fullpath, "t");
+    }
+    sds code = NULL;
+    pthread_mutex_lock(&lua_vm_pool.mutex);
+    if (lua_vm_pool.bytecode != NULL) {
+        void *data = raxFind(lua_vm_pool.bytecode, (unsigned char *)script_fullpath, strlen(script_fullpath));
+        if (data != raxNotFound) {
+            struct t_lua_vm_bytecode *bytecode = (struct t_lua_vm_bytecode *)data;
+            if (bytecode->mtime.tv_sec == status.st_mtim.tv_sec &&
+                bytecode->mtime.tv_nsec == status.st_mtim.tv_nsec &&
+                bytecode->size == status.st_size)
+            {
+                code = sdsdup(bytecode->code);
+            }
+        }
+    }
+    pthread_mutex_unlock(&lua_vm_pool.mutex);
+    if (code != NULL) {
+        LOG_DEBUG("Loading cached bytecode for %s", script_fullpath);
+        sds chunkname = sdscatfmt(sdsempty(), "@%s", script_fullpath);
+        int rc = luaL_loadbufferx(lua_vm, code, sdslen(code), chunkname, "b");
+        sdsfree(chunkname);
+        sdsfree(code);
+        return rc;
+    }
+    int rc = luaL_loadfilex(lua_vm, script_fullpath, "t");
+    if (rc != 0) {
+        return rc;
+    }
+    code = sdsempty();
+    if (lua_dump(lua_vm, lua_vm_bytecode_writer, &code, 0) != 0) {
+        sdsfree(code);
+        return rc;
+    }
+    struct t_lua_vm_bytecode *bytecode = (struct t_lua_vm_bytecode *)malloc(sizeof(struct t_lua_vm_bytecode));
+    assert(bytecode);
+    bytecode->mtime = status.st_mtim;
+    bytecode->size = status.st_size;
+    bytecode->code = code;
+    void *old = NULL;
+    pthread_mutex_lock(&lua_vm_pool.mutex);
+    if (lua_vm_pool.bytecode != NULL) {
+        raxInsert(lua_vm_pool.bytecode, (unsigned char *)script_fullpath, strlen(script_fullpath), bytecode, &old);
+        bytecode = NULL;
+    }
+    pthread_mutex_unlock(&lua_vm_pool.mutex);
+    if (old != NULL) {
+        lua_vm_free_bytecode(old);
+    }
+    if (bytecode != NULL) {
+        lua_vm_free_bytecode(bytecode);
+    }
+    return rc;
+}
+
+void lua_vm_bytecode_remove(const char *script_fullpath) {
+    void *old = NULL;
+    pthread_mutex_lock(&lua_vm_pool.mutex);
+    if (lua_vm_pool.bytecode != NULL) {
+        raxRemove(lua_vm_pool.bytecode, (unsigned char *)script_fullpath, strlen(script_fullpath), &old);
+    }
+    pthread_mutex_unlock(&lua_vm_pool.mutex);
+    if (old != NULL) {
+        lua_vm_free_bytecode(old);
+    }
+}
+
+//private functions
+static lua_State *lua_vm_new(lua_vm_setup setup) {
+    lua_State *lua_vm = luaL_newstate();
+    if (lua_vm == NULL) {
+        LOG_ERROR("Memory allocation error in luaL_newstate");
+        return NULL;
+    }
+    setup(lua_vm);
+    lua_settop(lua_vm, 0);
+    lua_vm_save_globals(lua_vm);
+    return lua_vm;
+}
+
+//saves shallow copies of the global table, the library tables, package.loaded and the string metatable
+//to the registry, they are restored after each script run
+static void lua_vm_save_globals(lua_State *lua_vm) {
+    lua_newtable(lua_vm);
+    int pristine = lua_gettop(lua_vm);
+    lua_newtable(lua_vm);
+    int metatables = lua_gettop(lua_vm);
+    lua_pushglobaltable(lua_vm);
+    int globals = lua_gettop(lua_vm);
+    lua_vm_save_table(lua_vm, globals, pristine, metatables);
+    lua_pushnil(lua_vm);
+    while (lua_next(lua_vm, globals) != 0) {
+        //library tables, _G is already saved
+        if (lua_type(lua_vm, -1) == LUA_TTABLE) {
+            lua_vm_save_table(lua_vm, lua_gettop(lua_vm), pristine, metatables);
+        }
+        lua_pop(lua_vm, 1);
+    }
+    //modules loaded with require
+    if (lua_getglobal(lua_vm, "package") == LUA_TTABLE &&
+        lua_getfield(lua_vm, -1, "loaded") == LUA_TTABLE)
+    {
+        lua_vm_save_table(lua_vm, lua_gettop(lua_vm), pristine, metatables);
+    }
+    lua_settop(lua_vm, globals);
+    //the metatable shared by all strings
+    lua_pushliteral(lua_vm, "");
+    if (lua_getmetatable(lua_vm, -1) != 0) {
+        lua_vm_save_table(lua_vm, lua_gettop(lua_vm), pristine, metatables);
+        lua_setfield(lua_vm, LUA_REGISTRYINDEX, "mympd_string_mt");
+    }
+    lua_settop(lua_vm, metatables);
+    lua_setfield(lua_vm, LUA_REGISTRYINDEX, "mympd_metatables");
+    lua_setfield(lua_vm, LUA_REGISTRYINDEX, "mympd_pristine");
+}
+
+//pristine[table] = shallow copy of table, metatables[table] = metatable of table
+static void lua_vm_save_table(lua_State *lua_vm, int table, int pristine, int metatables) {
+    lua_pushvalue(lua_vm, table);
+    if (lua_rawget(lua_vm, pristine) != LUA_TNIL) {
+        //already saved
+        lua_pop(lua_vm, 1);
+        return;
+    }
+    lua_pop(lua_vm, 1);
+    lua_pushvalue(lua_vm, table);
+    lua_newtable(lua_vm);
+    lua_pushnil(lua_vm);
+    while (lua_next(lua_vm, table) != 0) {
+        lua_pushvalue(lua_vm, -2);
+        lua_insert(lua_vm, -2);
+        lua_rawset(lua_vm, -4);
+    }
+    lua_rawset(lua_vm, pristine);
+    if (lua_getmetatable(lua_vm, table) != 0) {
+        lua_pushvalue(lua_vm, table);
+        lua_insert(lua_vm, -2);
+        lua_rawset(lua_vm, metatables);
+    }
+}
+
+//restores the saved tables in place, references to them stay valid,
+//fields set by the last script are removed and overwritten fields are restored
+static void lua_vm_reset_globals(lua_State *lua_vm) {
+    lua_settop(lua_vm, 0);
+    lua_getfield(lua_vm, LUA_REGISTRYINDEX, "mympd_pristine");
+    lua_getfield(lua_vm, LUA_REGISTRYINDEX, "mympd_metatables");
+    lua_pushnil(lua_vm);
+    while (lua_next(lua_vm, 1) != 0) {
+        //stack: pristine, metatables, table, copy
+        lua_vm_restore_table(lua_vm, 3, 4);
+        lua_pushvalue(lua_vm, 3);
+        lua_rawget(lua_vm, 2);
+        lua_setmetatable(lua_vm, 3);
+        lua_pop(lua_vm, 1);
+    }
+    //the string metatable could be replaced with debug.setmetatable
+    lua_pushliteral(lua_vm, "");
+    lua_getfield(lua_vm, LUA_REGISTRYINDEX, "mympd_string_mt");
+    lua_setmetatable(lua_vm, -2);
+    lua_settop(lua_vm, 0);
+}
+
+static void lua_vm_restore_table(lua_State *lua_vm, int table, int copy) {
+    lua_pushnil(lua_vm);
+    while (lua_next(lua_vm, table) != 0) {
+        lua_pop(lua_vm, 1);
+        lua_pushvalue(lua_vm, -1);
+        if (lua_rawget(lua_vm, copy) == LUA_TNIL) {
+            //clearing existing fields is allowed while traversing
+            lua_pushvalue(lua_vm, -2);
+            lua_pushnil(lua_vm);
+            lua_rawset(lua_vm, table);
+        }
+        lua_pop(lua_vm, 1);
+    }
+    lua_pushnil(lua_vm);
+    while (lua_next(lua_vm, copy) != 0) {
+        lua_pushvalue(lua_vm, -2);
+        lua_insert(lua_vm, -2);
+        lua_rawset(lua_vm, table);
+    }
+}
+
+static int lua_vm_bytecode_writer(lua_State *lua_vm, const void *p, size_t sz, void *ud) {
+    (void) lua_vm;
+    sds *code = (sds *)ud;
+    *code = sdscatlen(*code, p, sz);
+    return 0;
+}
+
+static void lua_vm_free_bytecode(void *data) {
+    struct t_lua_vm_bytecode *bytecode = (struct t_lua_vm_bytecode *)data;
+    sdsfree(bytecode->code);
+    free(bytecode);
+}
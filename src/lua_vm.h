@@ -0,0 +1,23 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __LUA_VM_H__
+#define __LUA_VM_H__
+//idle lua states are kept to skip library loading on the next run, one per script worker
+#define LUA_VM_POOL_SIZE 2
+
+struct lua_State;
+
+//opens the libraries and registers the functions of a new lua state
+typedef void (*lua_vm_setup)(struct lua_State *lua_vm);
+
+bool lua_vm_pool_init(lua_vm_setup setup);
+void lua_vm_pool_free(void);
+struct lua_State *lua_vm_acquire(void);
+void lua_vm_release(struct lua_State *lua_vm, bool reuse);
+int lua_vm_load_script(struct lua_State *lua_vm, const char *script_fullpath);
+void lua_vm_bytecode_remove(const char *script_fullpath);
+#endif
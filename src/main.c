@@ -26,6 +26,7 @@
 
 #include "../dist/src/sds/sds.h"
 #include "../dist/src/mongoose/mongoose.h"
+#include "../dist/src/rax/rax.h"
 
 #include "sds_extras.h"
 #include "log.h"
@@ -38,7 +39,11 @@
 #include "global.h"
 #include "mpd_client.h"
 #include "mpd_worker.h"
+#include "mpd_reader.h"
+#include "cover_extractor.h"
+#include "covercache.h"
 #include "web_server/web_server_utility.h"
+#include "web_server/web_server_albumart_cache.h"
 #include "web_server.h"
 #include "mympd_api.h"
 #ifdef ENABLE_SSL
@@ -234,8 +239,17 @@ static bool check_dirs(t_config *config) {
     }
     #endif
 
+    //state directory, the default smart playlists read the prefix from the state store
+    sds testdirname = sdscatfmt(sdsempty(), "%s/state", config->varlibdir);
+    testdir_rc = testdir("State dir", testdirname, true);
+    if (testdir_rc > 1) {
+        sdsfree(testdirname);
+        return false;
+    }
+
     //smart playlists
-    sds testdirname = sdscatfmt(sdsempty(), "%s/smartpls", config->varlibdir);
+    testdirname = sdscrop(testdirname);
+    testdirname = sdscatfmt(testdirname, "%s/smartpls", config->varlibdir);
     testdir_rc = testdir("Smartpls dir", testdirname, true);
     if (testdir_rc == 1) {
         //directory created, create default smart playlists
@@ -245,15 +259,6 @@ static bool check_dirs(t_config *config) {
         sdsfree(testdirname);
         return false;
     }
-
-    //state directory
-    testdirname = sdscrop(testdirname);
-    testdirname = sdscatfmt(testdirname, "%s/state", config->varlibdir);
-    testdir_rc = testdir("State dir", testdirname, true);
-    if (testdir_rc > 1) {
-        sdsfree(testdirname);
-        return false;
-    }
     
     //for stream images
     testdirname = sdscrop(testdirname);
@@ -317,6 +322,9 @@ int main(int argc, char **argv) {
     bool init_thread_mpdclient = false;
     bool init_thread_mpdworker = false;
     bool init_thread_mympdapi = false;
+    unsigned init_threads_mpdreader = 0;
+    bool init_thread_mpdcover = false;
+    unsigned init_threads_coverextractor = 0;
     int rc = EXIT_FAILURE;
     #ifdef DEBUG
     set_loglevel(4);
@@ -336,6 +344,13 @@ int main(int argc, char **argv) {
     
     mpd_client_queue = tiny_queue_create();
     mpd_worker_queue = tiny_queue_create();
+    mpd_reader_queue = tiny_queue_create();
+    for (unsigned i = 0; i < MPD_READERS_MAX; i++) {
+        mpd_reader_settings_queue[i] = tiny_queue_create();
+    }
+    mpd_cover_queue = tiny_queue_create();
+    mpd_cover_settings_queue = tiny_queue_create();
+    cover_extractor_queue = tiny_queue_create();
     mympd_api_queue = tiny_queue_create();
     web_server_queue = tiny_queue_create();
     mympd_script_queue = tiny_queue_create();
@@ -463,6 +478,9 @@ int main(int argc, char **argv) {
         if (check_dirs(config) == false) {
             goto cleanup;
         }
+        if (config->covercache == true) {
+            covercache_init(config);
+        }
     }
 
     //Create working threads
@@ -470,6 +488,12 @@ int main(int argc, char **argv) {
     pthread_t mpd_worker_thread;
     pthread_t web_server_thread;
     pthread_t mympd_api_thread;
+    pthread_t mpd_reader_threads[MPD_READERS_MAX];
+    t_mpd_reader_arg mpd_reader_args[MPD_READERS_MAX];
+    pthread_t mpd_cover_thread;
+    t_mpd_reader_arg mpd_cover_arg = {config, 0, true};
+    pthread_t cover_extractor_threads[COVER_EXTRACTORS_MAX];
+    t_cover_extractor_arg cover_extractor_args[COVER_EXTRACTORS_MAX];
     //mympd api
     LOG_INFO("Starting mympd api thread");
     if (pthread_create(&mympd_api_thread, NULL, mympd_api_loop, config) == 0) {
@@ -490,6 +514,44 @@ int main(int argc, char **argv) {
         LOG_ERROR("Can't create mympd_worker thread");
         s_signal_received = SIGTERM;
     }
+    for (unsigned i = 0; i < config->mpd_readers; i++) {
+        LOG_INFO("Starting mpd reader thread %u", i);
+        mpd_reader_args[i].config = config;
+        mpd_reader_args[i].id = i;
+        mpd_reader_args[i].cover = false;
+        if (pthread_create(&mpd_reader_threads[i], NULL, mpd_reader_loop, &mpd_reader_args[i]) == 0) {
+            pthread_setname_np(mpd_reader_threads[i], "mympd_mpdreader");
+            init_threads_mpdreader++;
+        }
+        else {
+            LOG_ERROR("Can't create mympd_mpdreader thread");
+            s_signal_received = SIGTERM;
+            break;
+        }
+    }
+    LOG_INFO("Starting mpd cover thread");
+    if (pthread_create(&mpd_cover_thread, NULL, mpd_reader_loop, &mpd_cover_arg) == 0) {
+        pthread_setname_np(mpd_cover_thread, "mympd_mpdcover");
+        init_thread_mpdcover = true;
+    }
+    else {
+        LOG_ERROR("Can't create mympd_mpdcover thread");
+        s_signal_received = SIGTERM;
+    }
+    for (unsigned i = 0; i < config->cover_extractors; i++) {
+        LOG_INFO("Starting cover extractor thread %u", i);
+        cover_extractor_args[i].config = config;
+        cover_extractor_args[i].id = i;
+        if (pthread_create(&cover_extractor_threads[i], NULL, cover_extractor_loop, &cover_extractor_args[i]) == 0) {
+            pthread_setname_np(cover_extractor_threads[i], "mympd_coverextr");
+            init_threads_coverextractor++;
+        }
+        else {
+            LOG_ERROR("Can't create mympd_coverextr thread");
+            s_signal_received = SIGTERM;
+            break;
+        }
+    }
     LOG_INFO("Starting mpd client thread");
     if (pthread_create(&mpd_client_thread, NULL, mpd_client_loop, config) == 0) {
         pthread_setname_np(mpd_client_thread, "mympd_mpdclient");
@@ -524,6 +586,18 @@ int main(int argc, char **argv) {
         pthread_join(mpd_worker_thread, NULL);
         LOG_INFO("Stopping mpd worker thread");
     }
+    for (unsigned i = 0; i < init_threads_mpdreader; i++) {
+        pthread_join(mpd_reader_threads[i], NULL);
+        LOG_INFO("Stopping mpd reader thread %u", i);
+    }
+    if (init_thread_mpdcover == true) {
+        pthread_join(mpd_cover_thread, NULL);
+        LOG_INFO("Stopping mpd cover thread");
+    }
+    for (unsigned i = 0; i < init_threads_coverextractor; i++) {
+        pthread_join(cover_extractor_threads[i], NULL);
+        LOG_INFO("Stopping cover extractor thread %u", i);
+    }
     if (init_thread_webserver == true) {
         pthread_join(web_server_thread, NULL);
         LOG_INFO("Stopping web server thread");
@@ -556,11 +630,33 @@ int main(int argc, char **argv) {
     tiny_queue_free(mpd_worker_queue);
     LOG_DEBUG("Expired %d entries", expired);
 
+    LOG_DEBUG("Expiring mpd_reader_queue: %u", tiny_queue_length(mpd_reader_queue, 10));
+    expired = expire_request_queue(mpd_reader_queue, 0);
+    tiny_queue_free(mpd_reader_queue);
+    LOG_DEBUG("Expired %d entries", expired);
+    for (unsigned i = 0; i < MPD_READERS_MAX; i++) {
+        expire_request_queue(mpd_reader_settings_queue[i], 0);
+        tiny_queue_free(mpd_reader_settings_queue[i]);
+    }
+
+    LOG_DEBUG("Expiring mpd_cover_queue: %u", tiny_queue_length(mpd_cover_queue, 10));
+    expired = expire_request_queue(mpd_cover_queue, 0);
+    tiny_queue_free(mpd_cover_queue);
+    LOG_DEBUG("Expired %d entries", expired);
+    expire_request_queue(mpd_cover_settings_queue, 0);
+    tiny_queue_free(mpd_cover_settings_queue);
+
+    LOG_DEBUG("Expiring cover_extractor_queue: %u", tiny_queue_length(cover_extractor_queue, 10));
+    expired = expire_request_queue(cover_extractor_queue, 0);
+    tiny_queue_free(cover_extractor_queue);
+    LOG_DEBUG("Expired %d entries", expired);
+
     LOG_DEBUG("Expiring mympd_script_queue: %u", tiny_queue_length(mympd_script_queue, 10));
     expired = expire_result_queue(mympd_script_queue, 0);
     tiny_queue_free(mympd_script_queue);
     LOG_DEBUG("Expired %d entries", expired);
 
+    covercache_free();
     mympd_free_config(config);
     sdsfree(configfile);
     sdsfree(option);
@@ -570,6 +666,7 @@ int main(int argc, char **argv) {
         sdsfree(mg_user_data->playlist_directory);
         sdsfreesplitres(mg_user_data->coverimage_names, mg_user_data->coverimage_names_len);
         sdsfree(mg_user_data->rewrite_patterns);
+        albumart_cache_free(mg_user_data->albumart_cache);
     }
     FREE_PTR(mg_user_data);
     if (rc == EXIT_SUCCESS) {
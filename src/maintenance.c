@@ -6,66 +6,29 @@
 
 #define _GNU_SOURCE
 
-#include <errno.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdio.h>
-#include <unistd.h>
-#include <time.h>
-#include <sys/time.h>
-#include <dirent.h>
 #include <stdbool.h>
-#include <sys/stat.h>
-#include <sys/types.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "../dist/src/sds/sds.h"
 #include "sds_extras.h"
 #include "log.h"
 #include "list.h"
 #include "config_defs.h"
+#include "tiny_queue.h"
+#include "api.h"
+#include "global.h"
+#include "covercache.h"
 #include "maintenance.h"
 
+//the covercache index knows the age of all entries, no directory scan is needed
 int clear_covercache(t_config *config, int keepdays) {
-    int num_deleted = 0;
-    if (config->covercache == false) {
-        LOG_WARN("Covercache is disabled");
-        return 0;
+    int num_deleted = covercache_crop(config, keepdays);
+    if (num_deleted > 0) {
+        //the albumart cache of the web_server keeps the paths of large covers
+        t_work_result *web_server_response = create_result_new(-1, 0, 0, "");
+        web_server_response->data = sdscat(web_server_response->data, "{\"albumartCacheClear\":true}");
+        tiny_queue_push(web_server_queue, web_server_response, 0);
     }
-    if (keepdays == -1) {
-        keepdays = config->covercache_keep_days;
-    }
-    time_t now = time(NULL) - keepdays * 24 * 60 * 60;
-    
-    sds covercache = sdscatfmt(sdsempty(), "%s/covercache", config->varlibdir);
-    LOG_INFO("Cleaning covercache %s", covercache);
-    LOG_DEBUG("Remove files older than %ld sec", now);
-    DIR *covercache_dir = opendir(covercache);
-    if (covercache_dir != NULL) {
-        struct dirent *next_file;
-        while ( (next_file = readdir(covercache_dir)) != NULL ) {
-            if (strncmp(next_file->d_name, ".", 1) != 0) {
-                sds filepath = sdscatfmt(sdsempty(), "%s/%s", covercache, next_file->d_name);
-                struct stat status;
-                if (stat(filepath, &status) == 0) {
-                    if (status.st_mtime < now) {
-                        LOG_DEBUG("Deleting %s: %ld", filepath, status.st_mtime);
-                        if (unlink(filepath) != 0) {
-                            LOG_ERROR("Error removing file \"%s\": %s", filepath, strerror(errno));
-                        }
-                        else {
-                            num_deleted++;
-                        }
-                    }
-                }
-                sdsfree(filepath);
-            }
-        }
-        closedir(covercache_dir);
-    }
-    else {
-        LOG_ERROR("Error opening directory %s: %s", covercache, strerror(errno));
-    }
-    LOG_INFO("Deleted %d files from covercache", num_deleted);
-    sdsfree(covercache);
     return num_deleted;
 }
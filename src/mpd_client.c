@@ -34,7 +34,9 @@
 #include "mpd_client/mpd_client_browse.h"
 #include "mpd_client/mpd_client_jukebox.h"
 #include "mpd_client/mpd_client_playlists.h"
+#include "mpd_client/mpd_client_playlist_catalog.h"
 #include "mpd_client/mpd_client_stats.h"
+#include "mpd_client/mpd_client_last_played.h"
 #include "mpd_client/mpd_client_state.h"
 #include "mpd_client/mpd_client_features.h"
 #include "mpd_client/mpd_client_queue.h"
@@ -45,8 +47,14 @@
 #include "mpd_client.h"
 
 //private definitions
+typedef struct t_mpd_client_drain {
+    t_config *config;
+    t_mpd_client_state *mpd_client_state;
+} t_mpd_client_drain;
+
 static void mpd_client_idle(t_config *config, t_mpd_client_state *mpd_client_state);
 static void mpd_client_parse_idle(t_config *config, t_mpd_client_state *mpd_client_state, const int idle_bitmask);
+static bool mpd_client_handle_request(void *data, void *user_data);
 
 //public functions
 void *mpd_client_loop(void *arg_config) {
@@ -79,6 +87,9 @@ void *mpd_client_loop(void *arg_config) {
     }
 
     LOG_INFO("Starting mpd_client");
+    if (config->readonly == false) {
+        last_played_store_init(config);
+    }
     trigger_execute(mpd_client_state, TRIGGER_MYMPD_START);
     //On startup connect instantly
     mpd_client_state->mpd_state->conn_state = MPD_DISCONNECTED;
@@ -86,12 +97,22 @@ void *mpd_client_loop(void *arg_config) {
         mpd_client_idle(config, mpd_client_state);
     }
     trigger_execute(mpd_client_state, TRIGGER_MYMPD_STOP);
+    //write pending sticker changes
+    if (mpd_client_state->mpd_state->conn_state == MPD_CONNECTED && mpd_client_state->sticker_queue.length > 0) {
+        LOG_VERBOSE("Flushing %u queued sticker changes", mpd_client_state->sticker_queue.length);
+        if (mpd_send_noidle(mpd_client_state->mpd_state->conn)) {
+            mpd_response_finish(mpd_client_state->mpd_state->conn);
+            mpd_client_sticker_dequeue(mpd_client_state, true);
+        }
+    }
     //Cleanup
     mpd_shared_mpd_disconnect(mpd_client_state->mpd_state);
     mpd_client_last_played_list_save(config, mpd_client_state);
     triggerfile_save(config, mpd_client_state);
     sticker_cache_free(&mpd_client_state->sticker_cache);
     album_cache_free(&mpd_client_state->album_cache);
+    playlist_catalog_free(&mpd_client_state->playlist_catalog);
+    mpd_client_queue_mirror_clear(&mpd_client_state->queue_mirror);
     free_trigerlist_arguments(mpd_client_state);
     free_mpd_client_state(mpd_client_state);
     sdsfree(thread_logname);
@@ -99,6 +120,13 @@ void *mpd_client_loop(void *arg_config) {
 }
 
 //private functions
+static bool mpd_client_handle_request(void *data, void *user_data) {
+    t_mpd_client_drain *drain = (t_mpd_client_drain *)user_data;
+    mpd_client_api(drain->config, drain->mpd_client_state, (t_work_request *)data);
+    //stop draining on connection errors
+    return drain->mpd_client_state->mpd_state->conn_state == MPD_CONNECTED;
+}
+
 static void mpd_client_parse_idle(t_config *config, t_mpd_client_state *mpd_client_state, int idle_bitmask) {
     for (unsigned j = 0;; j++) {
         enum mpd_idle idle_event = 1 << j;
@@ -115,15 +143,30 @@ static void mpd_client_parse_idle(t_config *config, t_mpd_client_state *mpd_clie
                     buffer = jsonrpc_notify(buffer, "update_database");
                     //update database caches
                     caches_init(config, mpd_client_state);
+                    //invalidate albumart lookups of the web_server
+                    t_work_result *web_server_response = create_result_new(-1, 0, 0, "");
+                    web_server_response->data = sdscat(web_server_response->data, "{\"albumartCacheClear\":true}");
+                    tiny_queue_push(web_server_queue, web_server_response, 0);
                     //smart playlist updates are triggered in the mpd worker thread
                     break;
                 case MPD_IDLE_STORED_PLAYLIST:
+                    playlist_catalog_update(config, mpd_client_state);
                     buffer = jsonrpc_notify(buffer, "update_stored_playlist");
                     break;
-                case MPD_IDLE_QUEUE:
+                case MPD_IDLE_QUEUE: {
+                    //the diff is sent before update_queue, clients fetch the queue only if they could not apply it
+                    sds diff = mpd_client_put_queue_diff(mpd_client_state, sdsempty());
+                    if (sdslen(diff) > 0) {
+                        ws_notify(diff);
+                    }
+                    sdsfree(diff);
                     buffer = mpd_client_get_queue_state(mpd_client_state, buffer);
+                    //ignore queue changes caused by the jukebox itself
+                    if (mpd_client_state->jukebox_queue_version > 0 && mpd_client_state->queue_version == mpd_client_state->jukebox_queue_version) {
+                        LOG_DEBUG("Jukebox: ignoring own queue change");
+                    }
                     //jukebox enabled
-                    if (mpd_client_state->jukebox_mode != JUKEBOX_OFF && mpd_client_state->queue_length < mpd_client_state->jukebox_queue_length) {
+                    else if (mpd_client_state->jukebox_mode != JUKEBOX_OFF && mpd_client_state->queue_length < mpd_client_state->jukebox_queue_length) {
                         mpd_client_jukebox(config, mpd_client_state, 0);
                     }
                     //autoPlay enabled
@@ -136,6 +179,7 @@ static void mpd_client_parse_idle(t_config *config, t_mpd_client_state *mpd_clie
                         }
                     }
                     break;
+                }
                 case MPD_IDLE_PLAYER:
                     //get and put mpd state                
                     buffer = mpd_client_put_state(config, mpd_client_state, buffer, NULL, 0);
@@ -293,6 +337,10 @@ static void mpd_client_idle(t_config *config, t_mpd_client_state *mpd_client_sta
             mpd_client_set_binarylimit(config, mpd_client_state);
             //update sticker and album cache
             caches_init(config, mpd_client_state);
+            //playlists could be changed while disconnected
+            playlist_catalog_update(config, mpd_client_state);
+            //mpd could be restarted, the queue version is not longer valid
+            mpd_client_queue_mirror_clear(&mpd_client_state->queue_mirror);
             //set timer for smart playlist update
             mpd_client_set_timer(MYMPD_API_TIMER_SET, "MYMPD_API_TIMER_SET", 10, mpd_client_state->smartpls_interval, "timer_handler_smartpls_update");
             //jukebox
@@ -346,8 +394,9 @@ static void mpd_client_idle(t_config *config, t_mpd_client_state *mpd_client_sta
                     }
                 }
             }
+            bool sticker_flush = mpd_client_sticker_flush_due(mpd_client_state);
             if (pollrc > 0 || mpd_client_queue_length > 0 || jukebox_add_song == true || set_played == true
-                || mpd_client_state->sticker_queue.length > 0) 
+                || sticker_flush == true) 
             {
                 LOG_DEBUG("Leaving mpd idle mode");
                 if (!mpd_send_noidle(mpd_client_state->mpd_state->conn)) {
@@ -383,16 +432,14 @@ static void mpd_client_idle(t_config *config, t_mpd_client_state *mpd_client_sta
                 }
                 
                 if (mpd_client_queue_length > 0) {
-                    //Handle request
-                    LOG_DEBUG("Handle request");
-                    t_work_request *request = tiny_queue_shift(mpd_client_queue, 50, 0);
-                    if (request != NULL) {
-                        mpd_client_api(config, mpd_client_state, request);
-                    }
+                    //Handle requests, drain the queue within the time budget to save idle round trips
+                    t_mpd_client_drain drain = { config, mpd_client_state };
+                    unsigned handled = tiny_queue_drain(mpd_client_queue, MPD_CLIENT_REQUEST_BUDGET, mpd_client_handle_request, &drain);
+                    LOG_DEBUG("Handled %u requests", handled);
                 }
                 
-                if (mpd_client_state->sticker_queue.length > 0) {
-                    mpd_client_sticker_dequeue(mpd_client_state);
+                if (sticker_flush == true) {
+                    mpd_client_sticker_dequeue(mpd_client_state, false);
                 }
                 
                 LOG_DEBUG("Entering mpd idle mode");
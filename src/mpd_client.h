@@ -6,5 +6,7 @@
 
 #ifndef __MPD_CLIENT_H__
 #define __MPD_CLIENT_H__
+//milliseconds to handle queued requests before returning to idle mode
+#define MPD_CLIENT_REQUEST_BUDGET 100
 void *mpd_client_loop(void *arg_config);
 #endif
@@ -30,12 +30,15 @@
 #include "../mpd_shared/mpd_shared_sticker.h"
 #include "../mpd_shared/mpd_shared_tags.h"
 #include "../lua_mympd_state.h"
+#include "../mpd_worker/mpd_worker_utility.h"
+#include "../mpd_worker/mpd_worker_sticker_index.h"
 #include "mpd_client_utility.h"
 #include "mpd_client_browse.h"
 #include "mpd_client_cover.h" 
 #include "mpd_client_features.h"
 #include "mpd_client_jukebox.h"
 #include "mpd_client_playlists.h"
+#include "mpd_client_playlist_catalog.h"
 #include "mpd_client_queue.h"
 #include "mpd_client_state.h"
 #include "mpd_client_stats.h"
@@ -314,10 +317,12 @@ void mpd_client_api(t_config *config, t_mpd_client_state *mpd_client_state, void
             rc = true;
             bool mpd_host_changed = false;
             bool jukebox_changed = false;
+            bool features_changed = false;
             bool check_mpd_error = false;
+            size_t jukebox_queue_length = mpd_client_state->jukebox_queue_length;
             sds notify_buffer = sdsempty();
             while ((h = json_next_key(request->data, sdslen(request->data), h, ".params", &key, &val)) != NULL) {
-                rc = mpd_api_settings_set(config, mpd_client_state, &key, &val, &mpd_host_changed, &jukebox_changed, &check_mpd_error);
+                rc = mpd_api_settings_set(config, mpd_client_state, &key, &val, &mpd_host_changed, &jukebox_changed, &features_changed, &check_mpd_error);
                 if ((check_mpd_error == true && check_error_and_recover2(mpd_client_state->mpd_state, &notify_buffer, request->method, request->id, true) == false)
                     || rc == false)
                 {
@@ -334,15 +339,21 @@ void mpd_client_api(t_config *config, t_mpd_client_state *mpd_client_state, void
                     mpd_client_state->mpd_state->conn_state = MPD_DISCONNECT;
                 }
                 if (mpd_client_state->mpd_state->conn_state == MPD_CONNECTED) {
-                    //feature detection
-                    mpd_client_mpd_features(config, mpd_client_state);
+                    //feature detection, only settings that are evaluated by it trigger it
+                    if (features_changed == true) {
+                        mpd_client_mpd_features(config, mpd_client_state);
+                    }
                     
                     if (jukebox_changed == true) {
                         LOG_DEBUG("Jukebox options changed, clearing jukebox queue");
                         list_free(&mpd_client_state->jukebox_queue);
                         mpd_client_state->jukebox_enforce_unique = true;
+                        //unique tag could have changed
+                        mpd_client_last_played_recent_reset(mpd_client_state);
                     }
-                    if (mpd_client_state->jukebox_mode != JUKEBOX_OFF) {
+                    if (mpd_client_state->jukebox_mode != JUKEBOX_OFF &&
+                        (jukebox_changed == true || jukebox_queue_length != mpd_client_state->jukebox_queue_length))
+                    {
                         //enable jukebox
                         mpd_client_jukebox(config, mpd_client_state, 0);
                     }
@@ -387,24 +398,40 @@ void mpd_client_api(t_config *config, t_mpd_client_state *mpd_client_state, void
                 if (strcmp(p_charbuf1, "sticker") == 0) {
                     je = json_scanf(request->data, sdslen(request->data), "{params: {playlist: %Q, sticker: %Q, maxentries: %d, minvalue: %d, sort: %Q}}", &p_charbuf2, &p_charbuf3, &int_buf1, &int_buf2, &p_charbuf5);
                     if (je == 5) {
-                        rc = mpd_shared_smartpls_save(config, p_charbuf1, p_charbuf2, p_charbuf3, NULL, int_buf1, int_buf2, p_charbuf5);
+                        rc = mpd_shared_smartpls_save(config, p_charbuf1, p_charbuf2, p_charbuf3, NULL, int_buf1, int_buf2, p_charbuf5, false);
+                    }
+                }
+                else if (strcmp(p_charbuf1, "score") == 0) {
+                    je = json_scanf(request->data, sdslen(request->data), "{params: {playlist: %Q, expression: %Q, maxentries: %d, minvalue: %d, sort: %Q}}", &p_charbuf2, &p_charbuf3, &int_buf1, &int_buf2, &p_charbuf5);
+                    if (je == 5) {
+                        t_sticker_expr expr;
+                        if (sticker_expr_compile(&expr, p_charbuf3) == false) {
+                            response->data = jsonrpc_respond_message(response->data, request->method, request->id, "Invalid score expression", true);
+                            break;
+                        }
+                        rc = mpd_shared_smartpls_save(config, p_charbuf1, p_charbuf2, p_charbuf3, NULL, int_buf1, int_buf2, p_charbuf5, false);
                     }
                 }
                 else if (strcmp(p_charbuf1, "newest") == 0) {
                     je = json_scanf(request->data, sdslen(request->data), "{params: {playlist: %Q, timerange: %d, sort: %Q}}", &p_charbuf2, &int_buf1, &p_charbuf5);
                     if (je == 3) {
-                        rc = mpd_shared_smartpls_save(config, p_charbuf1, p_charbuf2, NULL, NULL, 0, int_buf1, p_charbuf5);
+                        rc = mpd_shared_smartpls_save(config, p_charbuf1, p_charbuf2, NULL, NULL, 0, int_buf1, p_charbuf5, false);
                     }
                 }            
                 else if (strcmp(p_charbuf1, "search") == 0) {
                     je = json_scanf(request->data, sdslen(request->data), "{params: {playlist: %Q, tag: %Q, searchstr: %Q, sort: %Q}}", &p_charbuf2, &p_charbuf3, &p_charbuf4, &p_charbuf5);
                     if (je == 4) {
-                        rc = mpd_shared_smartpls_save(config, p_charbuf1, p_charbuf2, p_charbuf3, p_charbuf4, 0, 0, p_charbuf5);
+                        rc = mpd_shared_smartpls_save(config, p_charbuf1, p_charbuf2, p_charbuf3, p_charbuf4, 0, 0, p_charbuf5, false);
                     }
                 }
             }
             if (rc == true) {
                 response->data = jsonrpc_respond_ok(response->data, request->method, request->id);
+                //an unchanged playlist content raises no idle event
+                t_playlist_catalog_entry *entry = playlist_catalog_get(mpd_client_state, p_charbuf2);
+                if (entry != NULL) {
+                    entry->smartpls = true;
+                }
                 mpd_client_smartpls_update(p_charbuf2);
             }
             else {
@@ -9,10 +9,14 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <signal.h>
 
 #include <mpd/client.h>
 
 #include "../../dist/src/sds/sds.h"
+#include "../../dist/src/frozen/frozen.h"
 #include "../sds_extras.h"
 #include "../api.h"
 #include "../log.h"
@@ -20,10 +24,28 @@
 #include "../mpd_shared.h"
 #include "../list.h"
 #include "config_defs.h"
+#include "../tiny_queue.h"
+#include "../global.h"
 #include "../utility.h"
+#include "../covercache.h"
 #include "mpd_client_utility.h"
 #include "mpd_client_cover.h"
 
+//private definitions
+static void _cover_add_request(struct list *pending, t_work_request *request);
+static void _cover_shift_requests(tiny_queue_t *queue, struct list *pending);
+static void _cover_take_waiters(struct list *pending, struct list *waiters, const char *uri, bool same_dir);
+static void _cover_stream(t_config *config, t_mpd_client_state *mpd_client_state, tiny_queue_t *queue,
+                          struct list *pending, const char *uri);
+static bool _cover_fetch(t_config *config, t_mpd_client_state *mpd_client_state, tiny_queue_t *queue, struct list *pending,
+                         struct list *waiters, const char *uri, bool readpicture, sds *binary, sds *mime_type, unsigned *size);
+static int _cover_recv_chunk(t_mpd_client_state *mpd_client_state, const char *uri, bool readpicture, unsigned offset,
+                             void *buffer, size_t buffer_size, unsigned *size);
+static void _cover_send_chunk(long conn_id, const char *uri, const char *mime_type, unsigned offset, unsigned size, const char *data, size_t len);
+static void _cover_send_message(long conn_id, const char *uri, const char *message, bool abort);
+
+//public functions
+
 sds mpd_client_getcover(t_config *config, t_mpd_client_state *mpd_client_state, sds buffer, sds method, long request_id,
                         const char *uri, sds *binary)
 {
@@ -58,7 +80,7 @@ sds mpd_client_getcover(t_config *config, t_mpd_client_state *mpd_client_state,
         buffer = tojson_char(buffer, "mime_type", mime_type, false);
         buffer = jsonrpc_end_result(buffer);
         if (config->covercache == true) {
-            write_covercache_file(config, uri, mime_type, *binary);
+            covercache_put(config, uri, mime_type, *binary);
         }
         sdsfree(mime_type);
     }
@@ -68,3 +90,256 @@ sds mpd_client_getcover(t_config *config, t_mpd_client_state *mpd_client_state,
     }
     return buffer;
 }
+
+//serves albumart requests from the cover queue, concurrent requests for the same uri share one transfer
+void mpd_client_getcover_stream(t_config *config, t_mpd_client_state *mpd_client_state, tiny_queue_t *queue, t_work_request *request) {
+    struct list pending;
+    list_init(&pending);
+    _cover_add_request(&pending, request);
+    _cover_shift_requests(queue, &pending);
+    while (pending.length > 0 && mpd_client_state->mpd_state->conn_state == MPD_CONNECTED) {
+        sds uri = sdsnew(pending.head->key);
+        _cover_stream(config, mpd_client_state, queue, &pending, uri);
+        sdsfree(uri);
+    }
+    //connection lost, let the mpd_client thread serve the remaining requests
+    struct list_node *current = pending.head;
+    while (current != NULL) {
+        t_work_request *forward = create_request(current->value_i, 0, MPD_API_ALBUMART, "MPD_API_ALBUMART", "");
+        forward->data = sdscat(forward->data, "{\"jsonrpc\":\"2.0\",\"id\":0,\"method\":\"MPD_API_ALBUMART\",\"params\":{");
+        forward->data = tojson_char(forward->data, "uri", current->key, false);
+        forward->data = sdscat(forward->data, "}}");
+        tiny_queue_push(mpd_client_queue, forward, 0);
+        current = current->next;
+    }
+    list_free(&pending);
+}
+
+//private functions
+static void _cover_add_request(struct list *pending, t_work_request *request) {
+    char *uri = NULL;
+    int je = json_scanf(request->data, sdslen(request->data), "{params: {uri: %Q}}", &uri);
+    if (je == 1) {
+        list_push(pending, uri, request->conn_id, NULL, NULL);
+    }
+    else {
+        _cover_send_message(request->conn_id, NULL, "Invalid uri", false);
+    }
+    FREE_PTR(uri);
+    free_request(request);
+}
+
+static void _cover_shift_requests(tiny_queue_t *queue, struct list *pending) {
+    while (tiny_queue_length(queue, 0) > 0) {
+        t_work_request *request = tiny_queue_shift(queue, 50, 0);
+        if (request == NULL) {
+            break;
+        }
+        _cover_add_request(pending, request);
+    }
+}
+
+static void _cover_take_waiters(struct list *pending, struct list *waiters, const char *uri, bool same_dir) {
+    const char *dir_end = strrchr(uri, '/');
+    size_t dir_len = dir_end != NULL ? (size_t)(dir_end - uri) : 0;
+    unsigned i = 0;
+    struct list_node *current = pending->head;
+    while (current != NULL) {
+        bool match = false;
+        if (same_dir == false) {
+            match = strcmp(current->key, uri) == 0 ? true : false;
+        }
+        else {
+            const char *current_dir_end = strrchr(current->key, '/');
+            size_t current_dir_len = current_dir_end != NULL ? (size_t)(current_dir_end - current->key) : 0;
+            match = current_dir_len == dir_len && strncmp(current->key, uri, dir_len) == 0 ? true : false;
+        }
+        current = current->next;
+        if (match == true) {
+            struct list_node *node = list_node_at(pending, i);
+            list_push(waiters, node->key, node->value_i, NULL, NULL);
+            list_shift(pending, i);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+static void _cover_stream(t_config *config, t_mpd_client_state *mpd_client_state, tiny_queue_t *queue,
+                          struct list *pending, const char *uri)
+{
+    struct list waiters;
+    list_init(&waiters);
+    _cover_take_waiters(pending, &waiters, uri, false);
+    if (waiters.length > 1) {
+        LOG_DEBUG("Fetching albumart for \"%s\" once for %u requests", uri, waiters.length);
+    }
+    sds binary = sdsempty();
+    sds mime_type = NULL;
+    unsigned size = 0;
+    bool readpicture = false;
+    bool rc = false;
+    if (mpd_client_state->feat_mpd_albumart == true) {
+        LOG_DEBUG("Try mpd command albumart for \"%s\"", uri);
+        rc = _cover_fetch(config, mpd_client_state, queue, pending, &waiters, uri, false, &binary, &mime_type, &size);
+    }
+    if (sdslen(binary) == 0 && mpd_client_state->feat_mpd_readpicture == true &&
+        mpd_client_state->mpd_state->conn_state == MPD_CONNECTED)
+    {
+        LOG_DEBUG("Try mpd command readpicture for \"%s\"", uri);
+        readpicture = true;
+        rc = _cover_fetch(config, mpd_client_state, queue, pending, &waiters, uri, true, &binary, &mime_type, &size);
+    }
+
+    if (rc == true) {
+        LOG_DEBUG("Albumart found by mpd for uri \"%s\"", uri);
+        if (readpicture == false) {
+            //albumart is looked up per directory, serve all waiting songs of this album
+            struct list album;
+            list_init(&album);
+            _cover_shift_requests(queue, pending);
+            _cover_take_waiters(pending, &album, uri, true);
+            struct list_node *current = album.head;
+            while (current != NULL) {
+                _cover_send_chunk(current->value_i, uri, mime_type, 0, size, binary, sdslen(binary));
+                current = current->next;
+            }
+            list_free(&album);
+        }
+        if (config->covercache == true) {
+            covercache_put(config, uri, mime_type, binary);
+        }
+    }
+    else {
+        struct list_node *current = waiters.head;
+        while (current != NULL) {
+            if (sdslen(binary) > 0) {
+                //headers are already sent, close the connection
+                _cover_send_message(current->value_i, uri, "Albumart transfer aborted", true);
+            }
+            else {
+                _cover_send_message(current->value_i, uri, "No albumart found by mpd", false);
+            }
+            current = current->next;
+        }
+        if (sdslen(binary) == 0) {
+            LOG_DEBUG("No albumart found by mpd for uri \"%s\"", uri);
+        }
+        else {
+            LOG_ERROR("Albumart transfer for uri \"%s\" aborted", uri);
+        }
+    }
+    list_free(&waiters);
+    sdsfree(binary);
+    if (mime_type != NULL) {
+        sdsfree(mime_type);
+    }
+}
+
+//streams the image chunk by chunk to the waiting connections, returns true if the image is complete
+static bool _cover_fetch(t_config *config, t_mpd_client_state *mpd_client_state, tiny_queue_t *queue, struct list *pending,
+                         struct list *waiters, const char *uri, bool readpicture, sds *binary, sds *mime_type, unsigned *size)
+{
+    unsigned offset = 0;
+    void *chunk = malloc(config->binarylimit);
+    assert(chunk);
+    while (s_signal_received == 0) {
+        int recv_len = _cover_recv_chunk(mpd_client_state, uri, readpicture, offset, chunk, config->binarylimit, size);
+        if (recv_len <= 0) {
+            break;
+        }
+        *binary = sdscatlen(*binary, chunk, recv_len);
+        if (*mime_type == NULL) {
+            *mime_type = get_mime_type_by_magic_stream(*binary);
+        }
+        struct list_node *current = waiters->head;
+        while (current != NULL) {
+            _cover_send_chunk(current->value_i, uri, *mime_type, offset, *size, chunk, recv_len);
+            current = current->next;
+        }
+        offset += recv_len;
+        if (offset >= *size) {
+            break;
+        }
+        //requests for the same uri join the running transfer
+        _cover_shift_requests(queue, pending);
+        unsigned joined = waiters->length;
+        _cover_take_waiters(pending, waiters, uri, false);
+        current = list_node_at(waiters, joined);
+        while (current != NULL) {
+            _cover_send_chunk(current->value_i, uri, *mime_type, 0, *size, *binary, sdslen(*binary));
+            current = current->next;
+        }
+    }
+    free(chunk);
+    return offset > 0 && offset >= *size ? true : false;
+}
+
+//returns the length of the received chunk, 0 if there is no picture and -1 on error
+static int _cover_recv_chunk(t_mpd_client_state *mpd_client_state, const char *uri, bool readpicture, unsigned offset,
+                             void *buffer, size_t buffer_size, unsigned *size)
+{
+    struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+    bool rc = readpicture == true ? mpd_send_readpicture(conn, uri, offset) : mpd_send_albumart(conn, uri, offset);
+    if (rc == true) {
+        struct mpd_pair *pair;
+        size_t chunk_size = 0;
+        bool found = false;
+        while (found == false && (pair = mpd_recv_pair(conn)) != NULL) {
+            if (strcmp(pair->name, "size") == 0) {
+                *size = strtoumax(pair->value, NULL, 10);
+            }
+            else if (strcmp(pair->name, "binary") == 0) {
+                chunk_size = strtoumax(pair->value, NULL, 10);
+                found = true;
+            }
+            mpd_return_pair(conn, pair);
+        }
+        size_t retrieve_bytes = chunk_size > buffer_size ? buffer_size : chunk_size;
+        if (found == false || mpd_recv_binary(conn, buffer, retrieve_bytes) == true) {
+            if (mpd_response_finish(conn) == true) {
+                return (int)retrieve_bytes;
+            }
+        }
+    }
+    if (mpd_connection_get_error(conn) == MPD_ERROR_SERVER) {
+        //silently clear the error if no albumart is found
+        mpd_connection_clear_error(conn);
+        mpd_response_finish(conn);
+    }
+    else {
+        check_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0);
+    }
+    return -1;
+}
+
+static void _cover_send_chunk(long conn_id, const char *uri, const char *mime_type, unsigned offset, unsigned size, const char *data, size_t len) {
+    t_work_result *response = create_result_new(conn_id, 0, MPD_API_ALBUMART, "MPD_API_ALBUMART");
+    response->data = jsonrpc_start_result(response->data, response->method, 0);
+    response->data = sdscat(response->data, ",");
+    response->data = tojson_char(response->data, "mime_type", mime_type, true);
+    response->data = tojson_long(response->data, "offset", offset, true);
+    response->data = tojson_long(response->data, "size", size, true);
+    response->data = tojson_char(response->data, "uri", uri, false);
+    response->data = jsonrpc_end_result(response->data);
+    response->binary = sdscatlen(response->binary, data, len);
+    tiny_queue_push(web_server_queue, response, 0);
+}
+
+//an abort closes the connection, a result without mime_type is cached as not found
+static void _cover_send_message(long conn_id, const char *uri, const char *message, bool abort) {
+    t_work_result *response = create_result_new(conn_id, 0, MPD_API_ALBUMART, "MPD_API_ALBUMART");
+    if (uri != NULL) {
+        LOG_DEBUG("%s", message);
+        response->data = jsonrpc_start_result(response->data, response->method, 0);
+        response->data = sdscat(response->data, ",");
+        response->data = tojson_bool(response->data, "abort", abort, true);
+        response->data = tojson_char(response->data, "uri", uri, false);
+        response->data = jsonrpc_end_result(response->data);
+    }
+    else {
+        response->data = jsonrpc_respond_message(response->data, response->method, 0, message, true);
+    }
+    tiny_queue_push(web_server_queue, response, 0);
+}
@@ -8,4 +8,5 @@
 #define __MPD_CLIENT_COVER_H__
 sds mpd_client_getcover(t_config *config, t_mpd_client_state *mpd_client_state, sds buffer, sds method, long request_id,
                         const char *uri, sds *binary);
+void mpd_client_getcover_stream(t_config *config, t_mpd_client_state *mpd_client_state, tiny_queue_t *queue, t_work_request *request);
 #endif
@@ -35,6 +35,29 @@ static void mpd_client_feature_music_directory(t_mpd_client_state *mpd_client_st
 
 //public functions
 void mpd_client_mpd_features(t_config *config, t_mpd_client_state *mpd_client_state) {
+    mpd_client_mpd_features_detect(config, mpd_client_state);
+
+    //set state
+    sds buffer = sdsempty();
+    buffer = mpd_client_put_state(config, mpd_client_state, buffer, NULL, 0);
+    sdsfree(buffer);
+
+    //push settings to web_server_queue
+    t_work_result *web_server_response = create_result_new(-1, 0, 0, "");
+    sds data = sdsnew("{");
+    data = tojson_char(data, "musicDirectory", mpd_client_state->music_directory_value, true);
+    data = tojson_char(data, "playlistDirectory", config->playlist_directory, true);
+    data = tojson_char(data, "coverimageName", mpd_client_state->coverimage_name, true);
+    data = tojson_bool(data, "featLibrary", mpd_client_state->feat_library, false);
+    data = tojson_bool(data, "featMpdAlbumart", mpd_client_state->feat_mpd_albumart, false);
+    data = sdscat(data, "}");
+    web_server_response->data = sdsreplace(web_server_response->data, data);
+    sdsfree(data);
+    tiny_queue_push(web_server_queue, web_server_response, 0);
+}
+
+//detects the features without publishing them, used by the reader connections
+void mpd_client_mpd_features_detect(t_config *config, t_mpd_client_state *mpd_client_state) {
     mpd_client_state->protocol = mpd_connection_get_server_version(mpd_client_state->mpd_state->conn);
     LOG_INFO("MPD protocoll version: %u.%u.%u", mpd_client_state->protocol[0], mpd_client_state->protocol[1], mpd_client_state->protocol[2]);
 
@@ -59,11 +82,6 @@ void mpd_client_mpd_features(t_config *config, t_mpd_client_state *mpd_client_st
     mpd_client_feature_music_directory(mpd_client_state);
     mpd_client_feature_love(mpd_client_state);
     mpd_client_feature_tags(mpd_client_state);
-    
-    //set state
-    sds buffer = sdsempty();
-    buffer = mpd_client_put_state(config, mpd_client_state, buffer, NULL, 0);
-    sdsfree(buffer);
 
     mpd_client_state->mpd_state->feat_mpd_searchwindow = mpd_shared_feat_mpd_searchwindow(mpd_client_state->mpd_state);
     mpd_client_state->mpd_state->feat_advsearch = mpd_shared_feat_advsearch(mpd_client_state->mpd_state);
@@ -92,19 +110,6 @@ void mpd_client_mpd_features(t_config *config, t_mpd_client_state *mpd_client_st
         LOG_WARN("Disabling mount and neighbor support");
         mpd_client_state->feat_mpd_neighbor = false;
     }
-    
-    //push settings to web_server_queue
-    t_work_result *web_server_response = create_result_new(-1, 0, 0, "");
-    sds data = sdsnew("{");
-    data = tojson_char(data, "musicDirectory", mpd_client_state->music_directory_value, true);
-    data = tojson_char(data, "playlistDirectory", config->playlist_directory, true);
-    data = tojson_char(data, "coverimageName", mpd_client_state->coverimage_name, true);
-    data = tojson_bool(data, "featLibrary", mpd_client_state->feat_library, false);
-    data = tojson_bool(data, "featMpdAlbumart", mpd_client_state->feat_mpd_albumart, false);
-    data = sdscat(data, "}");
-    web_server_response->data = sdsreplace(web_server_response->data, data);
-    sdsfree(data);
-    tiny_queue_push(web_server_queue, web_server_response, 0);
 }
 
 void mpd_client_feature_love(t_mpd_client_state *mpd_client_state) {
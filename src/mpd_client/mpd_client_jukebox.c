@@ -12,21 +12,25 @@
 #include <time.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <signal.h>
 #include <mpd/client.h>
 
 #include "../../dist/src/sds/sds.h"
 #include "../sds_extras.h"
+#include "../tiny_queue.h"
 #include "../api.h"
 #include "../log.h"
 #include "../list.h"
 #include "../random.h"
 #include "config_defs.h"
 #include "../utility.h"
+#include "../global.h"
 #include "../mpd_shared/mpd_shared_typedefs.h"
 #include "../mpd_shared/mpd_shared_tags.h"
 #include "../mpd_shared.h"
 #include "mpd_client_utility.h"
 #include "mpd_client_sticker.h"
+#include "mpd_client_stats.h"
 #include "mpd_client_jukebox.h"
 
 //private definitions
@@ -35,7 +39,8 @@ static bool mpd_client_jukebox_fill_jukebox_queue(t_config *config, t_mpd_client
 static bool _mpd_client_jukebox_fill_jukebox_queue(t_config *config, t_mpd_client_state *mpd_client_state, unsigned add_songs, enum jukebox_modes jukebox_mode, const char *playlist, bool manual);
 static bool mpd_client_jukebox_unique_tag(t_mpd_client_state *mpd_client_state, const char *uri, const char *value, bool manual, struct list *queue_list);
 static bool mpd_client_jukebox_unique_album(t_mpd_client_state *mpd_client_state, const char *album, bool manual, struct list *queue_list);
-static bool add_album_to_queue(t_mpd_client_state *mpd_client_state, const char *album);
+static bool mpd_client_jukebox_send_album(t_mpd_client_state *mpd_client_state, const char *album);
+static bool mpd_client_jukebox_add_batch(t_mpd_client_state *mpd_client_state, struct list *src_queue, unsigned count, enum jukebox_modes jukebox_mode, unsigned *added);
 
 //public functions
 bool mpd_client_rm_jukebox_entry(t_mpd_client_state *mpd_client_state, unsigned pos) {
@@ -91,6 +96,17 @@ sds mpd_client_put_jukebox_list(t_mpd_client_state *mpd_client_state, sds buffer
     return buffer;
 }
 
+//the mympd_api thread forwards only changed settings, it must know that the jukebox is disabled
+//to forward a later enabling
+void mpd_client_jukebox_disable(t_mpd_client_state *mpd_client_state) {
+    mpd_client_state->jukebox_mode = JUKEBOX_OFF;
+    t_work_request *request = create_request(-1, 0, MYMPD_API_SETTINGS_SET, "MYMPD_API_SETTINGS_SET", "");
+    request->data = sdscat(request->data, "{\"jsonrpc\":\"2.0\",\"id\":0,\"method\":\"MYMPD_API_SETTINGS_SET\",\"params\":{");
+    request->data = tojson_long(request->data, "jukeboxMode", JUKEBOX_OFF, false);
+    request->data = sdscat(request->data, "}}");
+    tiny_queue_push(mympd_api_queue, request, 0);
+}
+
 bool mpd_client_jukebox(t_config *config, t_mpd_client_state *mpd_client_state, unsigned attempt) {
     struct mpd_status *status = mpd_run_status(mpd_client_state->mpd_state->conn);
     if (status == NULL) {
@@ -136,11 +152,7 @@ bool mpd_client_jukebox(t_config *config, t_mpd_client_state *mpd_client_state,
 
     bool rc = mpd_client_jukebox_add_to_queue(config, mpd_client_state, add_songs, mpd_client_state->jukebox_mode, mpd_client_state->jukebox_playlist, false);
     
-    if (rc == true) {
-        bool rc2 = mpd_run_play(mpd_client_state->mpd_state->conn);
-        check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc2, "mpd_run_play");
-    }
-    else {
+    if (rc == false) {
         LOG_DEBUG("Jukebox mode: %d", mpd_client_state->jukebox_mode);
         LOG_ERROR("Jukebox: Error adding song(s)");
         if (mpd_client_state->jukebox_mode != JUKEBOX_OFF && attempt == 0) {
@@ -168,49 +180,15 @@ bool mpd_client_jukebox_add_to_queue(t_config *config, t_mpd_client_state *mpd_c
             return false;
         }
     }
+    struct list *src_queue = manual == false ? &mpd_client_state->jukebox_queue : &mpd_client_state->jukebox_queue_tmp;
     unsigned added = 0;
-    struct list_node *current;
-    if (manual == false) {
-        current = mpd_client_state->jukebox_queue.head;
-    }
-    else {
-        current = mpd_client_state->jukebox_queue_tmp.head;
-    }
-    while (current != NULL && added < add_songs) {
-        if (jukebox_mode == JUKEBOX_ADD_SONG) {
-	    bool rc = mpd_run_add(mpd_client_state->mpd_state->conn, current->key);
-            if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_run_add") == true) {
-	        LOG_INFO("Jukebox adding song: %s", current->key);
-                added++;
-            }
-            else {
-                LOG_ERROR("Jukebox adding song %s failed", current->key);
-            }
-        }
-        else {
-            bool rc = add_album_to_queue(mpd_client_state, current->key);
-            if (rc == true) {
-                LOG_INFO("Jukebox adding album: %s", current->key);
-                added++;
-            }
-            else {
-                LOG_ERROR("Jukebox adding album %s failed", current->key);
-            }
-        }
-        if (manual == false) {
-            list_shift(&mpd_client_state->jukebox_queue, 0);
-            current = mpd_client_state->jukebox_queue.head;
-        }
-        else {
-            list_shift(&mpd_client_state->jukebox_queue_tmp, 0);
-            current = mpd_client_state->jukebox_queue_tmp.head;
+    while (src_queue->head != NULL && added < add_songs) {
+        //each batch consumes at least one entry
+        if (mpd_client_jukebox_add_batch(mpd_client_state, src_queue, add_songs - added, jukebox_mode, &added) == false) {
+            break;
         }
     }
-    if (added > 0) {
-        bool rc = mpd_run_play(mpd_client_state->mpd_state->conn);
-        check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_run_play");
-    }
-    else {
+    if (added == 0) {
         LOG_ERROR("Error adding song(s)");
         return false;
     }
@@ -230,19 +208,88 @@ bool mpd_client_jukebox_add_to_queue(t_config *config, t_mpd_client_state *mpd_c
 
 
 //private functions
-static bool add_album_to_queue(t_mpd_client_state *mpd_client_state, const char *album) {
-    bool rc = mpd_search_add_db_songs(mpd_client_state->mpd_state->conn, true);
-    if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_search_add_db_songs") == false) {
+static bool mpd_client_jukebox_send_album(t_mpd_client_state *mpd_client_state, const char *album) {
+    if (mpd_search_add_db_songs(mpd_client_state->mpd_state->conn, true) == false) {
         mpd_search_cancel(mpd_client_state->mpd_state->conn);
         return false;
     }
-    rc = mpd_search_add_tag_constraint(mpd_client_state->mpd_state->conn, MPD_OPERATOR_DEFAULT, MPD_TAG_ALBUM, album);
-    if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_search_add_tag_constraint") == false) {
+    if (mpd_search_add_tag_constraint(mpd_client_state->mpd_state->conn, MPD_OPERATOR_DEFAULT, MPD_TAG_ALBUM, album) == false) {
         mpd_search_cancel(mpd_client_state->mpd_state->conn);
         return false;
     }
-    rc = mpd_search_commit(mpd_client_state->mpd_state->conn);
-    return check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_search_commit");
+    return mpd_search_commit(mpd_client_state->mpd_state->conn);
+}
+
+//sends up to count entries from the head of src_queue, followed by play and status, in one command list
+//MPD aborts a command list on the first failing command, the failed entry is dropped
+//and the unprocessed entries stay in src_queue for the next batch
+static bool mpd_client_jukebox_add_batch(t_mpd_client_state *mpd_client_state, struct list *src_queue, unsigned count, enum jukebox_modes jukebox_mode, unsigned *added) {
+    struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+    if (mpd_command_list_begin(conn, true) == false) {
+        check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+        return false;
+    }
+    unsigned sent = 0;
+    struct list_node *current = src_queue->head;
+    while (current != NULL && sent < count) {
+        bool rc = jukebox_mode == JUKEBOX_ADD_SONG ? mpd_send_add(conn, current->key) :
+            mpd_client_jukebox_send_album(mpd_client_state, current->key);
+        if (rc == false) {
+            LOG_ERROR("Error adding command to command list for %s", current->key);
+            break;
+        }
+        sent++;
+        current = current->next;
+    }
+    if (mpd_send_play(conn) == false) {
+        LOG_ERROR("Error adding command to command list mpd_send_play");
+    }
+    if (mpd_send_status(conn) == false) {
+        LOG_ERROR("Error adding command to command list mpd_send_status");
+    }
+    if (mpd_command_list_end(conn) == false) {
+        check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+        return false;
+    }
+
+    //one list_OK per command
+    unsigned processed = 0;
+    while (processed < sent && mpd_response_next(conn) == true) {
+        LOG_INFO("Jukebox adding %s: %s", (jukebox_mode == JUKEBOX_ADD_SONG ? "song" : "album"), src_queue->head->key);
+        list_shift(src_queue, 0);
+        processed++;
+        (*added)++;
+    }
+    if (processed < sent) {
+        //the failed command is reported by its position in the command list
+        int location = (int)mpd_connection_get_server_error_location(conn);
+        LOG_ERROR("Jukebox adding %s failed (command list position %d)", src_queue->head->key, location);
+        list_shift(src_queue, 0);
+        if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false &&
+            mpd_client_state->mpd_state->conn_state == MPD_FAILURE)
+        {
+            return false;
+        }
+        //play was not reached in the aborted command list
+        if (*added > 0) {
+            bool rc = mpd_run_play(conn);
+            check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_run_play");
+        }
+        return true;
+    }
+    if (mpd_response_next(conn) == true) {
+        //remember the queue version of our own changes to suppress the resulting idle event
+        struct mpd_status *status = mpd_recv_status(conn);
+        if (status != NULL) {
+            mpd_client_state->jukebox_queue_version = mpd_status_get_queue_version(status);
+            mpd_status_free(status);
+        }
+    }
+    mpd_response_finish(conn);
+    if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false) {
+        return false;
+    }
+    return sent > 0;
 }
 
 static struct list *mpd_client_jukebox_get_last_played(t_config *config, t_mpd_client_state *mpd_client_state) {
@@ -268,60 +315,15 @@ static struct list *mpd_client_jukebox_get_last_played(t_config *config, t_mpd_c
     mpd_response_finish(mpd_client_state->mpd_state->conn);
     check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
     
-    //put last_played to queue list
-    struct list_node *current = mpd_client_state->last_played.head;
+    //put last_played to queue list, the unique tag is resolved when the song is played
+    if (mpd_client_state->last_played_recent_loaded == false) {
+        mpd_client_last_played_recent_load(config, mpd_client_state);
+    }
+    struct list_node *current = mpd_client_state->last_played_recent.head;
     while (current != NULL) {
-        bool rc2 = mpd_send_list_meta(mpd_client_state->mpd_state->conn, current->key);
-        if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc2, "mpd_send_list_meta") == true) {
-            song = mpd_recv_song(mpd_client_state->mpd_state->conn);
-            if (song != NULL) {
-                list_push(queue_list, current->key, 0, mpd_song_get_tag(song, mpd_client_state->jukebox_unique_tag.tags[0], 0), NULL);
-                mpd_song_free(song);
-            }
-        }
-        mpd_response_finish(mpd_client_state->mpd_state->conn);
-        check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+        list_push(queue_list, current->key, 0, current->value_p, NULL);
         current = current->next;
     }
-    //get last_played from disc
-    if (queue_list->length < 20 && config->readonly == false) {
-        char *line = NULL;
-        char *data = NULL;
-        char *crap = NULL;
-        size_t n = 0;
-        sds lp_file = sdscatfmt(sdsempty(), "%s/state/last_played", config->varlibdir);
-        FILE *fp = fopen(lp_file, "r");
-        if (fp != NULL) {
-            while (getline(&line, &n, fp) > 0 && queue_list->length < 20) {
-                int value = strtoimax(line, &data, 10);
-                if (value > 0 && strlen(data) > 2) {
-                    data = data + 2;
-                    strtok_r(data, "\n", &crap);
-                    bool rc2 = mpd_send_list_meta(mpd_client_state->mpd_state->conn, data);
-                    if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc2, "mpd_send_list_meta") == true) {
-                        song = mpd_recv_song(mpd_client_state->mpd_state->conn);
-                        if (song != NULL) {
-                            list_push(queue_list, data, 0, mpd_song_get_tag(song, mpd_client_state->jukebox_unique_tag.tags[0], 0), NULL);
-                            mpd_song_free(song);
-                        }
-                    }
-                    mpd_response_finish(mpd_client_state->mpd_state->conn);
-                    check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
-                }
-                else {
-                    LOG_ERROR("Reading last_played line failed");
-                    LOG_DEBUG("Erroneous line: %s", line);
-                }
-            }
-            fclose(fp);
-            FREE_PTR(line);
-        }
-        else {
-            //ignore missing last_played file
-            LOG_DEBUG("Can not open \"%s\": %s", lp_file, strerror(errno));
-        }
-        sdsfree(lp_file);
-    }
     LOG_DEBUG("Jukebox last_played list length: %d", queue_list->length);
     return queue_list;
 }
@@ -344,7 +346,7 @@ static bool mpd_client_jukebox_fill_jukebox_queue(t_config *config, t_mpd_client
     if (rc == false) {
         LOG_ERROR("Filling jukebox queue failed, disabling jukebox");
         send_jsonrpc_notify_error("Filling jukebox queue failed, disabling jukebox");
-        mpd_client_state->jukebox_mode = JUKEBOX_OFF;
+        mpd_client_jukebox_disable(mpd_client_state);
         return false;
     }
     return true;
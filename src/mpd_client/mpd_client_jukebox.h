@@ -10,5 +10,6 @@ bool mpd_client_rm_jukebox_entry(t_mpd_client_state *mpd_client_state, unsigned
 sds mpd_client_put_jukebox_list(t_mpd_client_state *mpd_client_state, sds buffer, sds method, long request_id, 
                                 const unsigned int offset, const unsigned int limit, const t_tags *tagcols);
 bool mpd_client_jukebox(t_config *config, t_mpd_client_state *mpd_client_state, unsigned attempt);
+void mpd_client_jukebox_disable(t_mpd_client_state *mpd_client_state);
 bool mpd_client_jukebox_add_to_queue(t_config *config, t_mpd_client_state *mpd_client_state, unsigned add_songs, enum jukebox_modes jukebox_mode, const char *playlist, bool manual);
 #endif
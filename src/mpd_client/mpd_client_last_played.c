@@ -0,0 +1,433 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "../../dist/src/sds/sds.h"
+#include "../sds_extras.h"
+#include "../log.h"
+#include "../list.h"
+#include "config_defs.h"
+#include "../utility.h"
+#include "mpd_client_last_played.h"
+
+/*
+ The last played history is an append-only log of two files in the state directory:
+ - last_played.dat: records in played order, a t_last_played_record header followed by the uri
+ - last_played.idx: one fixed-width uint64_t offset into last_played.dat per record
+ The index is the authoritative list of records, a missing index is rebuilt from the data file.
+*/
+
+#define LAST_PLAYED_URI_MAX 4096
+
+typedef struct t_last_played_record {
+    int64_t played;
+    uint32_t uri_len;
+} t_last_played_record;
+
+//private definitions
+static sds last_played_store_file(t_config *config, const char *ext);
+static bool write_all(int fd, const void *buf, size_t len);
+static bool read_at(int fd, void *buf, size_t len, off_t offset);
+static bool last_played_store_write_record(int fd_data, int fd_index, off_t *data_size, time_t played, const char *uri);
+static sds last_played_store_read_record(int fd_data, uint64_t offset, time_t *played);
+static bool last_played_store_write_files(t_config *config, struct list *entries, bool newest_first);
+static bool last_played_store_rebuild_index(t_config *config);
+static bool last_played_store_migrate(t_config *config);
+
+//public functions
+unsigned last_played_store_append(t_config *config, time_t played, const char *uri) {
+    sds data_file = last_played_store_file(config, "dat");
+    sds index_file = last_played_store_file(config, "idx");
+    unsigned count = 0;
+    int fd_data = open(data_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    int fd_index = open(index_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    struct stat st_data;
+    struct stat st_index;
+    if (fd_data < 0 || fd_index < 0 || fstat(fd_data, &st_data) != 0 || fstat(fd_index, &st_index) != 0) {
+        LOG_ERROR("Can not open last played history for write: %s", strerror(errno));
+    }
+    else {
+        //drop a partially written index entry
+        off_t index_size = st_index.st_size - (st_index.st_size % (off_t)sizeof(uint64_t));
+        if (index_size != st_index.st_size && ftruncate(fd_index, index_size) != 0) {
+            LOG_ERROR("Can not truncate file \"%s\": %s", index_file, strerror(errno));
+        }
+        else {
+            off_t data_size = st_data.st_size;
+            if (last_played_store_write_record(fd_data, fd_index, &data_size, played, uri) == true) {
+                count = (unsigned)(index_size / (off_t)sizeof(uint64_t)) + 1;
+            }
+            else {
+                LOG_ERROR("Writing last played history failed: %s", strerror(errno));
+            }
+        }
+    }
+    if (fd_data > -1) {
+        close(fd_data);
+    }
+    if (fd_index > -1) {
+        close(fd_index);
+    }
+    sdsfree(data_file);
+    sdsfree(index_file);
+    return count;
+}
+
+unsigned last_played_store_count(t_config *config) {
+    sds index_file = last_played_store_file(config, "idx");
+    struct stat st;
+    unsigned count = 0;
+    if (stat(index_file, &st) == 0) {
+        count = (unsigned)(st.st_size / (off_t)sizeof(uint64_t));
+    }
+    sdsfree(index_file);
+    return count;
+}
+
+//fills entries newest first, key is the uri and value_i the play time
+//only the newest max records are visible, max = 0 means no limit
+bool last_played_store_get(t_config *config, unsigned max, unsigned offset, unsigned limit, struct list *entries, unsigned *total) {
+    *total = 0;
+    sds data_file = last_played_store_file(config, "dat");
+    sds index_file = last_played_store_file(config, "idx");
+    int fd_index = open(index_file, O_RDONLY | O_CLOEXEC);
+    int open_errno = fd_index < 0 ? errno : 0;
+    int fd_data = open(data_file, O_RDONLY | O_CLOEXEC);
+    if (fd_data < 0 && open_errno == 0) {
+        open_errno = errno;
+    }
+    sdsfree(data_file);
+    sdsfree(index_file);
+    if (fd_index < 0 || fd_data < 0) {
+        if (fd_index > -1) {
+            close(fd_index);
+        }
+        if (fd_data > -1) {
+            close(fd_data);
+        }
+        if (open_errno == ENOENT) {
+            //no history yet
+            return true;
+        }
+        LOG_ERROR("Can not open last played history: %s", strerror(open_errno));
+        return false;
+    }
+    bool rc = true;
+    struct stat st;
+    if (fstat(fd_index, &st) == 0) {
+        unsigned count = (unsigned)(st.st_size / (off_t)sizeof(uint64_t));
+        unsigned visible = max > 0 && count > max ? max : count;
+        *total = visible;
+        if (offset < visible) {
+            unsigned end = limit == 0 || offset + limit > visible ? visible : offset + limit;
+            unsigned len = end - offset;
+            //newest first position p is index entry count - 1 - p
+            uint64_t *offsets = malloc(len * sizeof(uint64_t));
+            assert(offsets);
+            if (read_at(fd_index, offsets, len * sizeof(uint64_t), (off_t)(count - end) * (off_t)sizeof(uint64_t)) == true) {
+                for (unsigned i = len; i > 0; i--) {
+                    time_t played = 0;
+                    sds uri = last_played_store_read_record(fd_data, offsets[i - 1], &played);
+                    if (uri != NULL) {
+                        list_push_len(entries, uri, sdslen(uri), played, NULL, 0, NULL);
+                        sdsfree(uri);
+                    }
+                    else {
+                        LOG_ERROR("Invalid last played record at offset %" PRIu64, offsets[i - 1]);
+                    }
+                }
+            }
+            else {
+                LOG_ERROR("Reading last played index failed");
+                rc = false;
+            }
+            free(offsets);
+        }
+    }
+    else {
+        rc = false;
+    }
+    close(fd_index);
+    close(fd_data);
+    return rc;
+}
+
+//rewrites the history with the newest keep records
+bool last_played_store_compact(t_config *config, unsigned keep) {
+    if (last_played_store_count(config) <= keep) {
+        return true;
+    }
+    LOG_VERBOSE("Compacting last played history to %u entries", keep);
+    struct list entries;
+    list_init(&entries);
+    unsigned total;
+    if (last_played_store_get(config, keep, 0, 0, &entries, &total) == false) {
+        list_free(&entries);
+        return false;
+    }
+    bool rc = last_played_store_write_files(config, &entries, true);
+    list_free(&entries);
+    return rc;
+}
+
+bool last_played_store_init(t_config *config) {
+    if (last_played_store_migrate(config) == false) {
+        return false;
+    }
+    sds data_file = last_played_store_file(config, "dat");
+    sds index_file = last_played_store_file(config, "idx");
+    bool rc = true;
+    if (access(data_file, F_OK) == 0 && access(index_file, F_OK) != 0) { /* Flawfinder: ignore */
+        //interrupted compaction
+        rc = last_played_store_rebuild_index(config);
+    }
+    sdsfree(data_file);
+    sdsfree(index_file);
+    return rc;
+}
+
+bool last_played_store_remove(t_config *config) {
+    const char *exts[] = {"dat", "idx", NULL};
+    const char **p = NULL;
+    bool rc = true;
+    for (p = exts; *p != NULL; p++) {
+        sds filename = last_played_store_file(config, *p);
+        if (unlink(filename) != 0 && errno != ENOENT) {
+            LOG_ERROR("Can not delete file \"%s\": %s", filename, strerror(errno));
+            rc = false;
+        }
+        sdsfree(filename);
+    }
+    //legacy text file
+    sds lp_file = sdscatfmt(sdsempty(), "%s/state/last_played", config->varlibdir);
+    if (unlink(lp_file) != 0 && errno != ENOENT) {
+        LOG_ERROR("Can not delete file \"%s\": %s", lp_file, strerror(errno));
+        rc = false;
+    }
+    sdsfree(lp_file);
+    return rc;
+}
+
+//private functions
+static sds last_played_store_file(t_config *config, const char *ext) {
+    return sdscatfmt(sdsempty(), "%s/state/last_played.%s", config->varlibdir, ext);
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+static bool read_at(int fd, void *buf, size_t len, off_t offset) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t nread = pread(fd, p, len, offset);
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nread <= 0) {
+            return false;
+        }
+        p += nread;
+        offset += nread;
+        len -= (size_t)nread;
+    }
+    return true;
+}
+
+static bool last_played_store_write_record(int fd_data, int fd_index, off_t *data_size, time_t played, const char *uri) {
+    size_t uri_len = strlen(uri);
+    if (uri_len == 0 || uri_len > LAST_PLAYED_URI_MAX) {
+        return false;
+    }
+    t_last_played_record record;
+    memset(&record, 0, sizeof(record));
+    record.played = (int64_t)played;
+    record.uri_len = (uint32_t)uri_len;
+    uint64_t offset = (uint64_t)*data_size;
+    //data first, a record is visible after its index entry is written
+    if (write_all(fd_data, &record, sizeof(record)) == false ||
+        write_all(fd_data, uri, uri_len) == false ||
+        write_all(fd_index, &offset, sizeof(offset)) == false)
+    {
+        return false;
+    }
+    *data_size += (off_t)(sizeof(record) + uri_len);
+    return true;
+}
+
+static sds last_played_store_read_record(int fd_data, uint64_t offset, time_t *played) {
+    t_last_played_record record;
+    if (read_at(fd_data, &record, sizeof(record), (off_t)offset) == false ||
+        record.uri_len == 0 || record.uri_len > LAST_PLAYED_URI_MAX)
+    {
+        return NULL;
+    }
+    sds uri = sdsnewlen(NULL, record.uri_len);
+    if (read_at(fd_data, uri, record.uri_len, (off_t)(offset + sizeof(record))) == false) {
+        sdsfree(uri);
+        return NULL;
+    }
+    *played = (time_t)record.played;
+    return uri;
+}
+
+//replaces the history with the given entries
+static bool last_played_store_write_files(t_config *config, struct list *entries, bool newest_first) {
+    sds tmp_data_file = sdscatfmt(sdsempty(), "%s/state/last_played.dat.XXXXXX", config->varlibdir);
+    sds tmp_index_file = sdscatfmt(sdsempty(), "%s/state/last_played.idx.XXXXXX", config->varlibdir);
+    int fd_data = mkstemp(tmp_data_file);
+    int fd_index = fd_data > -1 ? mkstemp(tmp_index_file) : -1;
+    if (fd_data < 0 || fd_index < 0) {
+        LOG_ERROR("Can not open file \"%s\" for write: %s", (fd_data < 0 ? tmp_data_file : tmp_index_file), strerror(errno));
+        if (fd_data > -1) {
+            close(fd_data);
+            unlink(tmp_data_file);
+        }
+        sdsfree(tmp_data_file);
+        sdsfree(tmp_index_file);
+        return false;
+    }
+    //records are written oldest first
+    struct list_node **nodes = malloc((entries->length + 1) * sizeof(struct list_node *));
+    assert(nodes);
+    unsigned i = 0;
+    struct list_node *current = entries->head;
+    while (current != NULL) {
+        nodes[newest_first == true ? entries->length - 1 - i : i] = current;
+        i++;
+        current = current->next;
+    }
+    bool rc = true;
+    off_t data_size = 0;
+    for (i = 0; i < entries->length; i++) {
+        if (last_played_store_write_record(fd_data, fd_index, &data_size, nodes[i]->value_i, nodes[i]->key) == false) {
+            LOG_ERROR("Writing last played history failed: %s", strerror(errno));
+            rc = false;
+            break;
+        }
+    }
+    free(nodes);
+    close(fd_data);
+    close(fd_index);
+    sds data_file = last_played_store_file(config, "dat");
+    sds index_file = last_played_store_file(config, "idx");
+    if (rc == true) {
+        //the index is removed first, an interrupted replace is repaired by last_played_store_init
+        if ((unlink(index_file) != 0 && errno != ENOENT) ||
+            rename(tmp_data_file, data_file) == -1 ||
+            rename(tmp_index_file, index_file) == -1)
+        {
+            LOG_ERROR("Replacing last played history failed: %s", strerror(errno));
+            rc = false;
+        }
+    }
+    if (rc == false) {
+        unlink(tmp_data_file);
+        unlink(tmp_index_file);
+    }
+    sdsfree(tmp_data_file);
+    sdsfree(tmp_index_file);
+    sdsfree(data_file);
+    sdsfree(index_file);
+    return rc;
+}
+
+static bool last_played_store_rebuild_index(t_config *config) {
+    LOG_WARN("Rebuilding last played index");
+    sds data_file = last_played_store_file(config, "dat");
+    int fd_data = open(data_file, O_RDONLY | O_CLOEXEC);
+    sdsfree(data_file);
+    if (fd_data < 0) {
+        LOG_ERROR("Can not open last played history: %s", strerror(errno));
+        return false;
+    }
+    struct list entries;
+    list_init(&entries);
+    struct stat st;
+    if (fstat(fd_data, &st) == 0) {
+        uint64_t offset = 0;
+        time_t played;
+        sds uri;
+        //a truncated record ends the history
+        while ((off_t)offset < st.st_size && (uri = last_played_store_read_record(fd_data, offset, &played)) != NULL) {
+            list_push_len(&entries, uri, sdslen(uri), played, NULL, 0, NULL);
+            offset += sizeof(t_last_played_record) + sdslen(uri);
+            sdsfree(uri);
+        }
+    }
+    close(fd_data);
+    bool rc = last_played_store_write_files(config, &entries, false);
+    list_free(&entries);
+    return rc;
+}
+
+//converts the old text file (newest first, "timestamp::uri" per line)
+static bool last_played_store_migrate(t_config *config) {
+    sds lp_file = sdscatfmt(sdsempty(), "%s/state/last_played", config->varlibdir);
+    sds data_file = last_played_store_file(config, "dat");
+    bool exists = access(data_file, F_OK) == 0 ? true : false; /* Flawfinder: ignore */
+    sdsfree(data_file);
+    FILE *fp = exists == false ? fopen(lp_file, "r") : NULL;
+    if (fp == NULL) {
+        sdsfree(lp_file);
+        return true;
+    }
+    struct list entries;
+    list_init(&entries);
+    char *line = NULL;
+    char *data = NULL;
+    char *crap = NULL;
+    size_t n = 0;
+    while (getline(&line, &n, fp) > 0) {
+        long value = strtoimax(line, &data, 10);
+        if (value > 0 && strlen(data) > 2) {
+            data = data + 2;
+            strtok_r(data, "\n", &crap);
+            //reverse to oldest first
+            list_insert(&entries, data, value, NULL, NULL);
+        }
+        else {
+            LOG_ERROR("Reading last_played line failed");
+            LOG_DEBUG("Erroneous line: %s", line);
+        }
+    }
+    FREE_PTR(line);
+    fclose(fp);
+    bool rc = last_played_store_write_files(config, &entries, false);
+    if (rc == true) {
+        LOG_INFO("Migrated %u last played entries from \"%s\"", entries.length, lp_file);
+        if (unlink(lp_file) != 0) {
+            LOG_ERROR("Can not delete file \"%s\": %s", lp_file, strerror(errno));
+        }
+    }
+    list_free(&entries);
+    sdsfree(lp_file);
+    return rc;
+}
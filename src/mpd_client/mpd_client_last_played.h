@@ -0,0 +1,15 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __MPD_CLIENT_LAST_PLAYED_H__
+#define __MPD_CLIENT_LAST_PLAYED_H__
+unsigned last_played_store_append(t_config *config, time_t played, const char *uri);
+unsigned last_played_store_count(t_config *config);
+bool last_played_store_get(t_config *config, unsigned max, unsigned offset, unsigned limit, struct list *entries, unsigned *total);
+bool last_played_store_compact(t_config *config, unsigned keep);
+bool last_played_store_init(t_config *config);
+bool last_played_store_remove(t_config *config);
+#endif
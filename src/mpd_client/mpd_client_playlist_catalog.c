@@ -0,0 +1,175 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <mpd/client.h>
+
+#include "../../dist/src/sds/sds.h"
+#include "../../dist/src/rax/rax.h"
+#include "../sds_extras.h"
+#include "../list.h"
+#include "config_defs.h"
+#include "../utility.h"
+#include "../log.h"
+#include "../mpd_shared/mpd_shared_typedefs.h"
+#include "../mpd_shared.h"
+#include "mpd_client_utility.h"
+#include "mpd_client_playlist_catalog.h"
+
+//private definitions
+static bool playlist_catalog_enumerate(t_mpd_client_state *mpd_client_state, rax *catalog, struct list *changed);
+static void playlist_catalog_smartpls(t_config *config, t_mpd_client_state *mpd_client_state, rax *catalog);
+
+//public functions
+//refreshes the catalog of the stored playlists, only new and modified playlists are enumerated
+bool playlist_catalog_update(t_config *config, t_mpd_client_state *mpd_client_state) {
+    bool rc = mpd_send_list_playlists(mpd_client_state->mpd_state->conn);
+    if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_send_list_playlists") == false) {
+        return false;
+    }
+    rax *catalog = raxNew();
+    struct list changed;
+    list_init(&changed);
+    struct mpd_playlist *pl;
+    while ((pl = mpd_recv_playlist(mpd_client_state->mpd_state->conn)) != NULL) {
+        const char *plpath = mpd_playlist_get_path(pl);
+        size_t len = strlen(plpath);
+        time_t last_modified = mpd_playlist_get_last_modified(pl);
+        t_playlist_catalog_entry *entry = NULL;
+        if (mpd_client_state->playlist_catalog != NULL) {
+            //reuse the unchanged entries of the old catalog
+            void *data;
+            if (raxRemove(mpd_client_state->playlist_catalog, (unsigned char *)plpath, len, &data) == 1) {
+                entry = data;
+                if (entry->last_modified != last_modified) {
+                    list_push(&changed, plpath, 0, NULL, NULL);
+                }
+            }
+        }
+        if (entry == NULL) {
+            entry = malloc(sizeof(t_playlist_catalog_entry));
+            assert(entry);
+            entry->entries = 0;
+            entry->duration = 0;
+            list_push(&changed, plpath, 0, NULL, NULL);
+        }
+        entry->last_modified = last_modified;
+        raxInsert(catalog, (unsigned char *)plpath, len, entry, NULL);
+        mpd_playlist_free(pl);
+    }
+    mpd_response_finish(mpd_client_state->mpd_state->conn);
+    rc = check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+    if (rc == true && changed.length > 0) {
+        rc = playlist_catalog_enumerate(mpd_client_state, catalog, &changed);
+    }
+    list_free(&changed);
+    if (rc == false) {
+        //the reused entries are already moved, the catalog is rebuild on next use
+        playlist_catalog_free(&catalog);
+        playlist_catalog_free(&mpd_client_state->playlist_catalog);
+        return false;
+    }
+    playlist_catalog_smartpls(config, mpd_client_state, catalog);
+    //remaining entries are deleted playlists
+    playlist_catalog_free(&mpd_client_state->playlist_catalog);
+    mpd_client_state->playlist_catalog = catalog;
+    LOG_VERBOSE("Playlist catalog updated: %" PRIu64 " playlists", raxSize(catalog));
+    return true;
+}
+
+t_playlist_catalog_entry *playlist_catalog_get(t_mpd_client_state *mpd_client_state, const char *playlist) {
+    if (mpd_client_state->playlist_catalog == NULL) {
+        return NULL;
+    }
+    void *data = raxFind(mpd_client_state->playlist_catalog, (unsigned char *)playlist, strlen(playlist));
+    return data == raxNotFound ? NULL : data;
+}
+
+void playlist_catalog_free(rax **playlist_catalog) {
+    if (*playlist_catalog == NULL) {
+        return;
+    }
+    raxFreeWithCallback(*playlist_catalog, free);
+    *playlist_catalog = NULL;
+}
+
+//private functions
+//counts the entries and the duration of the changed playlists in one command list
+static bool playlist_catalog_enumerate(t_mpd_client_state *mpd_client_state, rax *catalog, struct list *changed) {
+    struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+    if (mpd_command_list_begin(conn, true) == false) {
+        return check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+    }
+    struct list_node *current = changed->head;
+    while (current != NULL) {
+        if (mpd_send_list_playlist_meta(conn, current->key) == false) {
+            LOG_ERROR("Error adding command to command list mpd_send_list_playlist_meta");
+            break;
+        }
+        current = current->next;
+    }
+    if (mpd_command_list_end(conn)) {
+        current = changed->head;
+        while (current != NULL) {
+            t_playlist_catalog_entry *entry = raxFind(catalog, (unsigned char *)current->key, sdslen(current->key));
+            entry->entries = 0;
+            entry->duration = 0;
+            struct mpd_song *song;
+            while ((song = mpd_recv_song(conn)) != NULL) {
+                entry->entries++;
+                entry->duration += mpd_song_get_duration(song);
+                mpd_song_free(song);
+            }
+            if (mpd_response_next(conn) == false) {
+                break;
+            }
+            current = current->next;
+        }
+        mpd_response_finish(conn);
+    }
+    LOG_DEBUG("Enumerated %u playlists", changed->length);
+    return check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+}
+
+//the smart playlist flags are set from one read of the smartpls directory
+static void playlist_catalog_smartpls(t_config *config, t_mpd_client_state *mpd_client_state, rax *catalog) {
+    raxIterator iter;
+    raxStart(&iter, catalog);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        ((t_playlist_catalog_entry *)iter.data)->smartpls = false;
+    }
+    raxStop(&iter);
+    if (mpd_client_state->feat_smartpls == false) {
+        return;
+    }
+    sds dirname = sdscatfmt(sdsempty(), "%s/smartpls", config->varlibdir);
+    DIR *dir = opendir(dirname);
+    if (dir == NULL) {
+        LOG_ERROR("Can not open smartpls dir \"%s\": %s", dirname, strerror(errno));
+        sdsfree(dirname);
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, ".", 1) == 0) {
+            continue;
+        }
+        void *data = raxFind(catalog, (unsigned char *)ent->d_name, strlen(ent->d_name));
+        if (data != raxNotFound) {
+            ((t_playlist_catalog_entry *)data)->smartpls = true;
+        }
+    }
+    closedir(dir);
+    sdsfree(dirname);
+}
@@ -0,0 +1,20 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __MPD_CLIENT_PLAYLIST_CATALOG_H__
+#define __MPD_CLIENT_PLAYLIST_CATALOG_H__
+
+typedef struct t_playlist_catalog_entry {
+    time_t last_modified;
+    unsigned entries;
+    unsigned duration;
+    bool smartpls;
+} t_playlist_catalog_entry;
+
+bool playlist_catalog_update(t_config *config, t_mpd_client_state *mpd_client_state);
+t_playlist_catalog_entry *playlist_catalog_get(t_mpd_client_state *mpd_client_state, const char *playlist);
+void playlist_catalog_free(rax **playlist_catalog);
+#endif
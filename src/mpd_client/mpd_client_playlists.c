@@ -33,6 +33,7 @@
 #include "../mpd_shared/mpd_shared_search.h"
 #include "mpd_client_utility.h"
 #include "mpd_client_playlists.h"
+#include "mpd_client_playlist_catalog.h"
 
 //private definitions
 static int mpd_client_enum_playlist(t_mpd_client_state *mpd_client_state, const char *playlist, bool empty_check);
@@ -52,55 +53,51 @@ void mpd_client_smartpls_update_all(void) {
     tiny_queue_push(mpd_worker_queue, request, 0);
 }
 
+//the playlist list is served from the playlist catalog
 sds mpd_client_put_playlists(t_config *config, t_mpd_client_state *mpd_client_state, sds buffer, sds method, long request_id,
                              const unsigned int offset, const unsigned int limit, const char *searchstr) 
 {
-    bool rc = mpd_send_list_playlists(mpd_client_state->mpd_state->conn);
-    if (check_rc_error_and_recover(mpd_client_state->mpd_state, &buffer, method, request_id, false, rc, "mpd_send_list_playlists") == false) {
-        return buffer;
-    }
-
-    struct mpd_playlist *pl;
-    struct list entity_list;
-    list_init(&entity_list);
-    size_t search_len = strlen(searchstr);
-    while ((pl = mpd_recv_playlist(mpd_client_state->mpd_state->conn)) != NULL) {
-        const char *plpath = mpd_playlist_get_path(pl);
-        if (search_len == 0  || strcasestr(plpath, searchstr) != NULL) {
-            list_push(&entity_list, plpath, mpd_playlist_get_last_modified(pl), NULL, NULL);
-        }
-        mpd_playlist_free(pl);
-    }
-    mpd_response_finish(mpd_client_state->mpd_state->conn);
-    if (check_error_and_recover2(mpd_client_state->mpd_state, &buffer, method, request_id, false) == false) {
+    if (mpd_client_state->playlist_catalog == NULL &&
+        playlist_catalog_update(config, mpd_client_state) == false)
+    {
+        buffer = jsonrpc_respond_message(buffer, method, request_id, "Error reading playlists", true);
         return buffer;
     }
 
-    list_sort_by_key(&entity_list, true);
-    
     buffer = jsonrpc_start_result(buffer, method, request_id);
     buffer = sdscat(buffer,",\"data\":[");
 
     unsigned entity_count = 0;
     unsigned entities_returned = 0;
-    struct list_node *current = entity_list.head;
-    while (current != NULL) {
+    size_t search_len = strlen(searchstr);
+    sds plpath = sdsempty();
+    raxIterator iter;
+    raxStart(&iter, mpd_client_state->playlist_catalog);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        sdsclear(plpath);
+        plpath = sdscatlen(plpath, iter.key, iter.key_len);
+        if (search_len > 0 && strcasestr(plpath, searchstr) == NULL) {
+            continue;
+        }
         entity_count++;
         if (entity_count > offset && (entity_count <= offset + limit || limit == 0)) {
             if (entities_returned++) {
                 buffer = sdscat(buffer,",");
             }
-            bool smartpls = is_smartpls(config, mpd_client_state, current->key);
+            t_playlist_catalog_entry *entry = (t_playlist_catalog_entry *)iter.data;
             buffer = sdscat(buffer, "{");
-            buffer = tojson_char(buffer, "Type", (smartpls == true ? "smartpls" : "plist"), true);
-            buffer = tojson_char(buffer, "uri", current->key, true);
-            buffer = tojson_char(buffer, "name", current->key, true);
-            buffer = tojson_long(buffer, "last_modified", current->value_i, false);
+            buffer = tojson_char(buffer, "Type", (entry->smartpls == true ? "smartpls" : "plist"), true);
+            buffer = tojson_char(buffer, "uri", plpath, true);
+            buffer = tojson_char(buffer, "name", plpath, true);
+            buffer = tojson_long(buffer, "last_modified", entry->last_modified, true);
+            buffer = tojson_long(buffer, "entries", entry->entries, true);
+            buffer = tojson_long(buffer, "duration", entry->duration, false);
             buffer = sdscat(buffer, "}");
         }
-        current = current->next;
     }
-    list_free(&entity_list);
+    raxStop(&iter);
+    sdsfree(plpath);
     
     buffer = sdscat(buffer, "],");
     buffer = tojson_char(buffer, "searchstr", searchstr, true);
@@ -279,6 +276,18 @@ sds mpd_client_smartpls_put(t_config *config, sds buffer, sds method, long reque
             }
             FREE_PTR(p_charbuf1);
         }
+        else if (strcmp(smartpltype, "score") == 0) {
+            je = json_scanf(content, (int)strlen(content), "{expression: %Q, maxentries: %d, minvalue: %d}", &p_charbuf1, &int_buf1, &int_buf2);
+            if (je == 3) {
+                buffer = tojson_char(buffer, "expression", p_charbuf1, true);
+                buffer = tojson_long(buffer, "maxentries", int_buf1, true);
+                buffer = tojson_long(buffer, "minvalue", int_buf2, true);
+            }
+            else {
+                rc = false;
+            }
+            FREE_PTR(p_charbuf1);
+        }
         else if (strcmp(smartpltype, "newest") == 0) {
             je = json_scanf(content, (int)strlen(content), "{timerange: %d}", &int_buf1);
             if (je == 1) {
@@ -342,7 +351,7 @@ sds mpd_client_playlist_delete_all(t_config *config, t_mpd_client_state *mpd_cli
     struct mpd_playlist *pl;
     while ((pl = mpd_recv_playlist(mpd_client_state->mpd_state->conn)) != NULL) {
         const char *plpath = mpd_playlist_get_path(pl);
-        list_push(&playlists, plpath, 1, NULL, NULL);
+        list_push(&playlists, plpath, mpd_playlist_get_last_modified(pl), NULL, NULL);
         mpd_playlist_free(pl);
     }
     mpd_response_finish(mpd_client_state->mpd_state->conn);
@@ -381,7 +390,9 @@ sds mpd_client_playlist_delete_all(t_config *config, t_mpd_client_state *mpd_cli
     if (strcmp(type, "deleteEmptyPlaylists") == 0) {
         struct list_node *current = playlists.head;
         while (current != NULL) {
-            current->value_i = mpd_client_enum_playlist(mpd_client_state, current->key, true);
+            t_playlist_catalog_entry *entry = playlist_catalog_get(mpd_client_state, current->key);
+            current->value_i = entry != NULL && entry->last_modified == (time_t)current->value_i ?
+                (long)entry->entries : mpd_client_enum_playlist(mpd_client_state, current->key, true);
             current = current->next;
         }
     }
@@ -4,10 +4,13 @@
  https://github.com/jcorporation/mympd
 */
 
+#define _GNU_SOURCE 
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <assert.h>
 #include <mpd/client.h>
 
 #include "../../dist/src/sds/sds.h"
@@ -23,6 +26,14 @@
 #include "mpd_client_utility.h"
 #include "mpd_client_queue.h"
 
+//private definitions
+static bool _mpd_client_queue_mirror_load(t_mpd_client_state *mpd_client_state, unsigned length);
+static bool _mpd_client_queue_mirror_apply_changes(t_mpd_client_state *mpd_client_state, unsigned length, struct list *changes);
+static int _mpd_client_queue_mirror_cmp_id(const void *a, const void *b);
+static int _mpd_client_queue_mirror_cmp_key(const void *key, const void *b);
+static bool _mpd_client_queue_song_matches(const struct mpd_song *song, enum mpd_tag_type tag, const char *searchstr);
+
+//public functions
 bool mpd_client_queue_prio_set_highest(t_mpd_client_state *mpd_client_state, const unsigned trackid) {
     //default prio is 10
     unsigned priority = 10;
@@ -131,61 +142,172 @@ sds mpd_client_put_queue_state(struct mpd_status *status, sds buffer) {
 sds mpd_client_put_queue(t_mpd_client_state *mpd_client_state, sds buffer, sds method, long request_id,
                          unsigned int offset, unsigned int limit, const t_tags *tagcols)
 {
-    struct mpd_status *status = mpd_run_status(mpd_client_state->mpd_state->conn);
-    if (status == NULL) {
-        buffer = check_error_and_recover(mpd_client_state->mpd_state, buffer, method, request_id);
+    if (mpd_client_queue_mirror_sync(mpd_client_state, NULL) == false) {
+        buffer = jsonrpc_respond_message(buffer, method, request_id, "Error getting queue", true);
         return buffer;
     }
+    t_queue_mirror *mirror = &mpd_client_state->queue_mirror;
 
-    if (offset >= mpd_status_get_queue_length(status)) {
+    if (offset >= mirror->length) {
         offset = 0;
     }
     
-    if (limit == 0) {
-        limit = INT_MAX - offset;
-    }
-    bool rc = mpd_send_list_queue_range_meta(mpd_client_state->mpd_state->conn, offset, offset + limit);
-    if (check_rc_error_and_recover(mpd_client_state->mpd_state, &buffer, method, request_id, false, rc, "mpd_send_list_queue_range_meta") == false) {
-        return buffer;
+    if (limit == 0 || limit > mirror->length - offset) {
+        limit = mirror->length - offset;
     }
         
     buffer = jsonrpc_start_result(buffer, method, request_id);
     buffer = sdscat(buffer, ",\"data\":[");
     unsigned total_time = 0;
-    unsigned entity_count = 0;
     unsigned entities_returned = 0;
-    struct mpd_song *song;
-    while ((song = mpd_recv_song(mpd_client_state->mpd_state->conn)) != NULL) {
+    for (unsigned pos = offset; pos < offset + limit; pos++) {
+        const struct mpd_song *song = mirror->songs[pos];
         total_time += mpd_song_get_duration(song);
-        entity_count++;
         if (entities_returned++) {
             buffer = sdscat(buffer, ",");
         }
         buffer = sdscat(buffer, "{");
         buffer = tojson_long(buffer, "id", mpd_song_get_id(song), true);
-        buffer = tojson_long(buffer, "Pos", mpd_song_get_pos(song), true);
+        buffer = tojson_long(buffer, "Pos", pos, true);
         buffer = put_song_tags(buffer, mpd_client_state->mpd_state, tagcols, song);
         buffer = sdscat(buffer, "}");
-        mpd_song_free(song);
     }
 
     buffer = sdscat(buffer, "],");
     buffer = tojson_long(buffer, "totalTime", total_time, true);
-    buffer = tojson_long(buffer, "totalEntities", mpd_status_get_queue_length(status), true);
+    buffer = tojson_long(buffer, "totalEntities", mirror->length, true);
     buffer = tojson_long(buffer, "offset", offset, true);
     buffer = tojson_long(buffer, "returnedEntities", entities_returned, true);
-    buffer = tojson_long(buffer, "queueVersion", mpd_status_get_queue_version(status), false);
+    buffer = tojson_long(buffer, "queueVersion", mirror->version, false);
     buffer = jsonrpc_end_result(buffer);
     
-    mpd_client_state->queue_version = mpd_status_get_queue_version(status);
-    mpd_client_state->queue_length = mpd_status_get_queue_length(status);
+    return buffer;
+}
+
+//updates the local queue mirror with the changes since the last sync
+//the changed positions are appended to changes if the sync was incremental
+bool mpd_client_queue_mirror_sync(t_mpd_client_state *mpd_client_state, struct list *changes) {
+    t_queue_mirror *mirror = &mpd_client_state->queue_mirror;
+    struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+    //status and queue changes in one command list, mpd executes it atomically
+    if (mpd_command_list_begin(conn, true) == false) {
+        check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+        return false;
+    }
+    bool rc = mpd_send_status(conn);
+    if (rc == false) {
+        LOG_ERROR("Error adding command to command list mpd_send_status");
+    }
+    if (mirror->valid == true) {
+        rc = mpd_send_queue_changes_brief(conn, mirror->version);
+        if (rc == false) {
+            LOG_ERROR("Error adding command to command list mpd_send_queue_changes_brief");
+        }
+    }
+    else {
+        rc = mpd_send_list_queue_meta(conn);
+        if (rc == false) {
+            LOG_ERROR("Error adding command to command list mpd_send_list_queue_meta");
+        }
+    }
+    if (mpd_command_list_end(conn) == false) {
+        check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+        return false;
+    }
+    struct mpd_status *status = mpd_recv_status(conn);
+    if (status == NULL) {
+        check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+        return false;
+    }
+    unsigned version = mpd_status_get_queue_version(status);
+    unsigned length = mpd_status_get_queue_length(status);
+    mpd_client_state->queue_version = version;
+    mpd_client_state->queue_length = length;
     mpd_status_free(status);
+    if (mpd_response_next(conn) == false) {
+        check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+        return false;
+    }
 
-    mpd_response_finish(mpd_client_state->mpd_state->conn);
-    if (check_error_and_recover2(mpd_client_state->mpd_state, &buffer, method, request_id, false) == false) {
+    bool incremental = mirror->valid;
+    if (incremental == true) {
+        rc = _mpd_client_queue_mirror_apply_changes(mpd_client_state, length, changes);
+    }
+    else {
+        rc = _mpd_client_queue_mirror_load(mpd_client_state, length);
+    }
+    if (rc == false) {
+        mpd_client_queue_mirror_clear(mirror);
+        if (incremental == false || mpd_client_state->mpd_state->conn_state != MPD_CONNECTED) {
+            return false;
+        }
+        //too many changes or the queue changed while fetching songs
+        LOG_VERBOSE("Reloading the queue mirror");
+        if (changes != NULL) {
+            list_free(changes);
+        }
+        return mpd_client_queue_mirror_sync(mpd_client_state, NULL);
+    }
+    mirror->version = version;
+    mirror->valid = true;
+    mirror->incremental = incremental;
+    LOG_DEBUG("Queue mirror synced to version %u", version);
+    return true;
+}
+
+void mpd_client_queue_mirror_clear(t_queue_mirror *mirror) {
+    for (unsigned i = 0; i < mirror->length; i++) {
+        if (mirror->songs[i] != NULL) {
+            mpd_song_free(mirror->songs[i]);
+        }
+    }
+    free(mirror->songs);
+    mirror->songs = NULL;
+    mirror->length = 0;
+    mirror->version = 0;
+    mirror->valid = false;
+    mirror->incremental = false;
+}
+
+//syncs the queue mirror and prints the changed songs since the last sync
+//the buffer is unchanged if clients must fetch the queue
+sds mpd_client_put_queue_diff(t_mpd_client_state *mpd_client_state, sds buffer) {
+    t_queue_mirror *mirror = &mpd_client_state->queue_mirror;
+    unsigned from_version = mirror->version;
+    struct list changes;
+    list_init(&changes);
+    if (mpd_client_queue_mirror_sync(mpd_client_state, &changes) == false ||
+        mirror->incremental == false || changes.length > QUEUE_DIFF_MAX)
+    {
+        list_free(&changes);
         return buffer;
     }
-    
+    unsigned total_time = 0;
+    for (unsigned pos = 0; pos < mirror->length; pos++) {
+        total_time += mpd_song_get_duration(mirror->songs[pos]);
+    }
+    buffer = jsonrpc_start_notify(buffer, "update_queue_diff");
+    buffer = tojson_long(buffer, "fromVersion", from_version, true);
+    buffer = tojson_long(buffer, "queueVersion", mirror->version, true);
+    buffer = tojson_long(buffer, "queueLength", mirror->length, true);
+    buffer = tojson_long(buffer, "totalTime", total_time, true);
+    buffer = sdscat(buffer, "\"data\":[");
+    struct list_node *current = changes.head;
+    while (current != NULL) {
+        const struct mpd_song *song = mirror->songs[current->value_i];
+        if (current != changes.head) {
+            buffer = sdscat(buffer, ",");
+        }
+        buffer = sdscat(buffer, "{");
+        buffer = tojson_long(buffer, "id", mpd_song_get_id(song), true);
+        buffer = tojson_long(buffer, "Pos", current->value_i, true);
+        buffer = put_song_tags(buffer, mpd_client_state->mpd_state, &mpd_client_state->mpd_state->mympd_tag_types, song);
+        buffer = sdscat(buffer, "}");
+        current = current->next;
+    }
+    buffer = sdscat(buffer, "]");
+    buffer = jsonrpc_end_notify(buffer);
+    list_free(&changes);
     return buffer;
 }
 
@@ -235,37 +357,22 @@ sds mpd_client_crop_queue(t_mpd_client_state *mpd_client_state, sds buffer, sds
 sds mpd_client_search_queue(t_mpd_client_state *mpd_client_state, sds buffer, sds method, long request_id,
                             const char *mpdtagtype, const unsigned int offset, const unsigned int limit, const char *searchstr, const t_tags *tagcols)
 {
-    bool rc = mpd_search_queue_songs(mpd_client_state->mpd_state->conn, false);
-    if (check_rc_error_and_recover(mpd_client_state->mpd_state, &buffer, method, request_id, false, rc, "mpd_search_queue_songs") == false) {
-        mpd_search_cancel(mpd_client_state->mpd_state->conn);
-        return buffer;
-    }
-    if (mpd_tag_name_parse(mpdtagtype) != MPD_TAG_UNKNOWN) {
-        rc = mpd_search_add_tag_constraint(mpd_client_state->mpd_state->conn, MPD_OPERATOR_DEFAULT, mpd_tag_name_parse(mpdtagtype), searchstr);
-        if (check_rc_error_and_recover(mpd_client_state->mpd_state, &buffer, method, request_id, false, rc, "mpd_search_add_tag_constraint") == false) {
-            mpd_search_cancel(mpd_client_state->mpd_state->conn);
-            return buffer;
-        }        
-    }
-    else {
-        rc = mpd_search_add_any_tag_constraint(mpd_client_state->mpd_state->conn, MPD_OPERATOR_DEFAULT, searchstr);
-        if (check_rc_error_and_recover(mpd_client_state->mpd_state, &buffer, method, request_id, false, rc, "mpd_search_add_any_tag_constraint") == false) {
-            mpd_search_cancel(mpd_client_state->mpd_state->conn);
-            return buffer;
-        }
-    }
-
-    rc = mpd_search_commit(mpd_client_state->mpd_state->conn);
-    if (check_rc_error_and_recover(mpd_client_state->mpd_state, &buffer, method, request_id, false, rc, "mpd_search_commit") == false) {
+    if (mpd_client_queue_mirror_sync(mpd_client_state, NULL) == false) {
+        buffer = jsonrpc_respond_message(buffer, method, request_id, "Error getting queue", true);
         return buffer;
     }
+    t_queue_mirror *mirror = &mpd_client_state->queue_mirror;
+    enum mpd_tag_type tag = mpd_tag_name_parse(mpdtagtype);
     
     buffer = jsonrpc_start_result(buffer, method, request_id);
     buffer = sdscat(buffer, ",\"data\":[");
-    struct mpd_song *song;
     unsigned entity_count = 0;
     unsigned entities_returned = 0;
-    while ((song = mpd_recv_song(mpd_client_state->mpd_state->conn)) != NULL) {
+    for (unsigned pos = 0; pos < mirror->length; pos++) {
+        const struct mpd_song *song = mirror->songs[pos];
+        if (_mpd_client_queue_song_matches(song, tag, searchstr) == false) {
+            continue;
+        }
         entity_count++;
         if (entity_count > offset && (entity_count <= offset + limit || limit == 0)) {
             if (entities_returned++) {
@@ -273,11 +380,10 @@ sds mpd_client_search_queue(t_mpd_client_state *mpd_client_state, sds buffer, sd
             }
             buffer = sdscat(buffer, "{");
             buffer = tojson_long(buffer, "id", mpd_song_get_id(song), true);
-            buffer = tojson_long(buffer, "Pos", mpd_song_get_pos(song), true);
+            buffer = tojson_long(buffer, "Pos", pos, true);
             buffer = put_song_tags(buffer, mpd_client_state->mpd_state, tagcols, song);
             buffer = sdscat(buffer, "}");
         }
-        mpd_song_free(song);
     }
 
     buffer = sdscat(buffer, "],");
@@ -287,10 +393,200 @@ sds mpd_client_search_queue(t_mpd_client_state *mpd_client_state, sds buffer, sd
     buffer = tojson_char(buffer, "mpdtagtype", mpdtagtype, false);
     buffer = jsonrpc_end_result(buffer);
     
-    mpd_response_finish(mpd_client_state->mpd_state->conn);
-    if (check_error_and_recover2(mpd_client_state->mpd_state, &buffer, method, request_id, false) == false) {
-        return buffer;
-    }
-    
     return buffer;
 }
+
+//private functions
+static bool _mpd_client_queue_mirror_load(t_mpd_client_state *mpd_client_state, unsigned length) {
+    t_queue_mirror *mirror = &mpd_client_state->queue_mirror;
+    struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+    mpd_client_queue_mirror_clear(mirror);
+    mirror->songs = (struct mpd_song **)malloc((length + 1) * sizeof(struct mpd_song *));
+    assert(mirror->songs);
+    bool consistent = true;
+    struct mpd_song *song;
+    while ((song = mpd_recv_song(conn)) != NULL) {
+        if (mirror->length < length) {
+            mirror->songs[mirror->length++] = song;
+        }
+        else {
+            consistent = false;
+            mpd_song_free(song);
+        }
+    }
+    mpd_response_finish(conn);
+    if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false) {
+        return false;
+    }
+    return consistent == true && mirror->length == length ? true : false;
+}
+
+static bool _mpd_client_queue_mirror_apply_changes(t_mpd_client_state *mpd_client_state, unsigned length, struct list *changes) {
+    t_queue_mirror *mirror = &mpd_client_state->queue_mirror;
+    struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+    //old songs sorted by id to find moved songs
+    struct mpd_song **by_id = (struct mpd_song **)malloc((mirror->length + 1) * sizeof(struct mpd_song *));
+    assert(by_id);
+    memcpy(by_id, mirror->songs, mirror->length * sizeof(struct mpd_song *));
+    qsort(by_id, mirror->length, sizeof(struct mpd_song *), _mpd_client_queue_mirror_cmp_id);
+    //unchanged positions keep their song
+    struct mpd_song **songs = (struct mpd_song **)malloc((length + 1) * sizeof(struct mpd_song *));
+    assert(songs);
+    for (unsigned pos = 0; pos < length; pos++) {
+        songs[pos] = pos < mirror->length ? mirror->songs[pos] : NULL;
+    }
+    //songs that must be fetched from mpd
+    unsigned *fetch_pos = (unsigned *)malloc((length + 1) * sizeof(unsigned));
+    assert(fetch_pos);
+    unsigned *fetch_id = (unsigned *)malloc((length + 1) * sizeof(unsigned));
+    assert(fetch_id);
+    unsigned fetch_count = 0;
+    bool consistent = true;
+    unsigned pos;
+    unsigned id;
+    while (mpd_recv_queue_change_brief(conn, &pos, &id) == true) {
+        if (pos >= length) {
+            consistent = false;
+            continue;
+        }
+        struct mpd_song **found = NULL;
+        //same id on same position means the song itself has changed
+        if (pos >= mirror->length || mpd_song_get_id(mirror->songs[pos]) != id) {
+            found = (struct mpd_song **)bsearch(&id, by_id, mirror->length, sizeof(struct mpd_song *), _mpd_client_queue_mirror_cmp_key);
+        }
+        if (changes != NULL) {
+            list_push(changes, "", pos, NULL, NULL);
+        }
+        if (found != NULL) {
+            songs[pos] = *found;
+        }
+        else {
+            songs[pos] = NULL;
+            fetch_pos[fetch_count] = pos;
+            fetch_id[fetch_count] = id;
+            fetch_count++;
+        }
+    }
+    mpd_response_finish(conn);
+    if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false) {
+        consistent = false;
+    }
+    //songs of the old mirror that are still in the queue
+    bool *reused = (bool *)calloc(mirror->length + 1, sizeof(bool));
+    assert(reused);
+    for (pos = 0; pos < length; pos++) {
+        if (songs[pos] == NULL) {
+            continue;
+        }
+        id = mpd_song_get_id(songs[pos]);
+        struct mpd_song **found = (struct mpd_song **)bsearch(&id, by_id, mirror->length, sizeof(struct mpd_song *), _mpd_client_queue_mirror_cmp_key);
+        if (found != NULL && *found == songs[pos]) {
+            if (reused[found - by_id] == true) {
+                //song on two positions
+                consistent = false;
+                songs[pos] = NULL;
+                continue;
+            }
+            reused[found - by_id] = true;
+        }
+    }
+    //fetch new and changed songs in one command list, a complete reload is cheaper for big changes
+    unsigned fetched = 0;
+    if (consistent == true && fetch_count > 0 && fetch_count <= length / 2) {
+        if (mpd_command_list_begin(conn, true) == true) {
+            for (unsigned i = 0; i < fetch_count; i++) {
+                if (mpd_send_get_queue_song_id(conn, fetch_id[i]) == false) {
+                    LOG_ERROR("Error adding command to command list mpd_send_get_queue_song_id");
+                    break;
+                }
+            }
+            if (mpd_command_list_end(conn) == true) {
+                while (fetched < fetch_count) {
+                    struct mpd_song *song;
+                    while ((song = mpd_recv_song(conn)) != NULL) {
+                        if (songs[fetch_pos[fetched]] == NULL) {
+                            songs[fetch_pos[fetched]] = song;
+                        }
+                        else {
+                            mpd_song_free(song);
+                        }
+                    }
+                    if (songs[fetch_pos[fetched]] == NULL) {
+                        break;
+                    }
+                    fetched++;
+                    if (mpd_response_next(conn) == false) {
+                        break;
+                    }
+                }
+                if (fetched == fetch_count) {
+                    mpd_response_finish(conn);
+                }
+            }
+        }
+        if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false) {
+            consistent = false;
+        }
+    }
+    if (fetched < fetch_count) {
+        consistent = false;
+    }
+    //free the removed and changed songs
+    for (unsigned i = 0; i < mirror->length; i++) {
+        if (reused[i] == false || consistent == false) {
+            mpd_song_free(by_id[i]);
+        }
+    }
+    if (consistent == false) {
+        for (unsigned i = 0; i < fetched; i++) {
+            mpd_song_free(songs[fetch_pos[i]]);
+        }
+        for (pos = 0; pos < length; pos++) {
+            songs[pos] = NULL;
+        }
+    }
+    free(mirror->songs);
+    mirror->songs = songs;
+    mirror->length = length;
+    free(by_id);
+    free(reused);
+    free(fetch_pos);
+    free(fetch_id);
+    return consistent;
+}
+
+static int _mpd_client_queue_mirror_cmp_id(const void *a, const void *b) {
+    unsigned id_a = mpd_song_get_id(*(struct mpd_song * const *)a);
+    unsigned id_b = mpd_song_get_id(*(struct mpd_song * const *)b);
+    return id_a < id_b ? -1 : id_a > id_b ? 1 : 0;
+}
+
+static int _mpd_client_queue_mirror_cmp_key(const void *key, const void *b) {
+    unsigned id_a = *(const unsigned *)key;
+    unsigned id_b = mpd_song_get_id(*(struct mpd_song * const *)b);
+    return id_a < id_b ? -1 : id_a > id_b ? 1 : 0;
+}
+
+//case insensitive substring match like the default operator of playlistsearch
+static bool _mpd_client_queue_song_matches(const struct mpd_song *song, enum mpd_tag_type tag, const char *searchstr) {
+    if (tag != MPD_TAG_UNKNOWN) {
+        const char *value;
+        unsigned idx = 0;
+        while ((value = mpd_song_get_tag(song, tag, idx++)) != NULL) {
+            if (strcasestr(value, searchstr) != NULL) {
+                return true;
+            }
+        }
+        return false;
+    }
+    //any tag
+    if (strcasestr(mpd_song_get_uri(song), searchstr) != NULL) {
+        return true;
+    }
+    for (unsigned i = 0; i < MPD_TAG_COUNT; i++) {
+        if (_mpd_client_queue_song_matches(song, i, searchstr) == true) {
+            return true;
+        }
+    }
+    return false;
+}
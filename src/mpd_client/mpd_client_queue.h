@@ -6,6 +6,8 @@
 
 #ifndef __MPD_CLIENT_QUEUE_H__
 #define __MPD_CLIENT_QUEUE_H__
+//maximum number of changed songs sent in a queue diff notification
+#define QUEUE_DIFF_MAX 250
 sds mpd_client_get_queue_state(t_mpd_client_state *mpd_client_state, sds buffer);
 sds mpd_client_put_queue_state(struct mpd_status *status, sds buffer);
 sds mpd_client_put_queue(t_mpd_client_state *mpd_client_state, sds buffer, sds method, long request_id,
@@ -16,5 +18,8 @@ sds mpd_client_search_queue(t_mpd_client_state *mpd_client_state, sds buffer, sd
                             const char *searchstr, const t_tags *tagcols);
 bool mpd_client_queue_replace_with_song(t_mpd_client_state *mpd_client_state, const char *uri);
 bool mpd_client_queue_replace_with_playlist(t_mpd_client_state *mpd_client_state, const char *plist);
+bool mpd_client_queue_mirror_sync(t_mpd_client_state *mpd_client_state, struct list *changes);
+sds mpd_client_put_queue_diff(t_mpd_client_state *mpd_client_state, sds buffer);
+void mpd_client_queue_mirror_clear(t_queue_mirror *mirror);
 bool mpd_client_queue_prio_set_highest(t_mpd_client_state *mpd_client_state, const unsigned trackid);
 #endif
@@ -32,7 +32,7 @@ static sds print_tags_array(sds buffer, const char *tagsname, t_tags tags);
 //public functions
 bool mpd_api_settings_set(t_config *config, t_mpd_client_state *mpd_client_state, struct json_token *key, 
                           struct json_token *val, bool *mpd_host_changed, bool *jukebox_changed,
-                          bool *check_mpd_error)
+                          bool *features_changed, bool *check_mpd_error)
 {
     bool rc = true;
     char *crap;
@@ -64,6 +64,7 @@ bool mpd_api_settings_set(t_config *config, t_mpd_client_state *mpd_client_state
         }
     }
     else if (strncmp(key->ptr, "musicDirectory", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->music_directory = sdsreplacelen(mpd_client_state->music_directory, settingvalue, sdslen(settingvalue));
     }
     else if (strncmp(key->ptr, "jukeboxMode", key->len) == 0) {
@@ -112,9 +113,11 @@ bool mpd_api_settings_set(t_config *config, t_mpd_client_state *mpd_client_state
         mpd_client_state->auto_play = val->type == JSON_TYPE_TRUE ? true : false;
     }
     else if (strncmp(key->ptr, "coverimage", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->coverimage = val->type == JSON_TYPE_TRUE ? true : false;
     }
     else if (strncmp(key->ptr, "coverimageName", key->len) == 0) {
+        *features_changed = true;
         if (validate_string(settingvalue) && sdslen(settingvalue) > 0) {
             mpd_client_state->coverimage_name = sdsreplacelen(mpd_client_state->coverimage_name, settingvalue, sdslen(settingvalue));
         }
@@ -127,27 +130,34 @@ bool mpd_api_settings_set(t_config *config, t_mpd_client_state *mpd_client_state
         mpd_client_state->booklet_name = sdsreplacelen(mpd_client_state->booklet_name, settingvalue, sdslen(settingvalue));
     }
     else if (strncmp(key->ptr, "love", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->love = val->type == JSON_TYPE_TRUE ? true : false;
     }
     else if (strncmp(key->ptr, "loveChannel", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->love_channel = sdsreplacelen(mpd_client_state->love_channel, settingvalue, sdslen(settingvalue));
     }
     else if (strncmp(key->ptr, "loveMessage", key->len) == 0) {
         mpd_client_state->love_message = sdsreplacelen(mpd_client_state->love_message, settingvalue, sdslen(settingvalue));
     }
     else if (strncmp(key->ptr, "taglist", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->mpd_state->taglist = sdsreplacelen(mpd_client_state->mpd_state->taglist, settingvalue, sdslen(settingvalue));
     }
     else if (strncmp(key->ptr, "searchtaglist", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->searchtaglist = sdsreplacelen(mpd_client_state->searchtaglist, settingvalue, sdslen(settingvalue));
     }
     else if (strncmp(key->ptr, "browsetaglist", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->browsetaglist = sdsreplacelen(mpd_client_state->browsetaglist, settingvalue, sdslen(settingvalue));
     }
     else if (strncmp(key->ptr, "stickers", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->stickers = val->type == JSON_TYPE_TRUE ? true : false;
     }
     else if (strncmp(key->ptr, "smartpls", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->smartpls = val->type == JSON_TYPE_TRUE ? true : false;
     }
     else if (strncmp(key->ptr, "smartplsSort", key->len) == 0) {
@@ -160,6 +170,7 @@ bool mpd_api_settings_set(t_config *config, t_mpd_client_state *mpd_client_state
         mpd_client_state->smartpls_interval = strtoumax(settingvalue, &crap, 10);
     }
     else if (strncmp(key->ptr, "generatePlsTags", key->len) == 0) {
+        *features_changed = true;
         mpd_client_state->generate_pls_tags = sdsreplacelen(mpd_client_state->generate_pls_tags, settingvalue, sdslen(settingvalue));
     }
     else if (strncmp(key->ptr, "lastPlayedCount", key->len) == 0) {
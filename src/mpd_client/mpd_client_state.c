@@ -26,7 +26,6 @@
 #include "../mpd_shared/mpd_shared_tags.h"
 #include "../mpd_shared.h"
 #include "mpd_client_utility.h"
-#include "mpd_client_cover.h"
 #include "mpd_client_api.h"
 #include "mpd_client_sticker.h"
 #include "mpd_client_state.h"
@@ -24,68 +24,66 @@
 #include "../mpd_shared/mpd_shared_tags.h"
 #include "../mpd_shared.h"
 #include "mpd_client_utility.h"
+#include "mpd_client_last_played.h"
 #include "mpd_client_stats.h"
 
 //private definitions
-static sds mpd_client_put_last_played_obj(t_mpd_client_state *mpd_client_state, sds buffer, 
-                                          unsigned entity_count, long last_played, const char *uri, const t_tags *tagcols);
+static sds mpd_client_put_last_played_obj(t_mpd_client_state *mpd_client_state, sds buffer, unsigned entity_count,
+                                          long last_played, const char *uri, const struct mpd_song *song, const t_tags *tagcols);
+static void mpd_client_last_played_recent_push(t_mpd_client_state *mpd_client_state, const char *uri, const struct mpd_song *song);
 
 //public functions
-bool mpd_client_last_played_list_save(t_config *config, t_mpd_client_state *mpd_client_state) {
+bool mpd_client_last_played_recent_load(t_config *config, t_mpd_client_state *mpd_client_state) {
+    list_free(&mpd_client_state->last_played_recent);
+    struct list uris;
+    list_init(&uris);
     if (config->readonly == true) {
-        LOG_VERBOSE("Skip saving last_played list to disc");
-        return true;
-    }
-    LOG_VERBOSE("Saving last_played list to disc");
-    sds tmp_file = sdscatfmt(sdsempty(), "%s/state/last_played.XXXXXX", config->varlibdir);
-    int fd = mkstemp(tmp_file);
-    if (fd < 0 ) {
-        LOG_ERROR("Can not open file \"%s\" for write: %s", tmp_file, strerror(errno));
-        sdsfree(tmp_file);
-        return false;
-    }    
-    
-    FILE *fp = fdopen(fd, "w");
-    //first write last_played list to tmp file
-    unsigned i = 0;
-    struct list_node *current = mpd_client_state->last_played.head;
-    while (current != NULL && i < mpd_client_state->last_played_count) {
-        fprintf(fp, "%ld::%s\n", current->value_i, current->key);
-        current = current->next;
-        i++;
-    }
-    //append current last_played file to tmp file
-    char *line = NULL;
-    size_t n = 0;
-    sds lp_file = sdscatfmt(sdsempty(), "%s/state/last_played", config->varlibdir);
-    FILE *fi = fopen(lp_file, "r");
-    if (fi != NULL) {
-        while (getline(&line, &n, fi) > 0 && i < mpd_client_state->last_played_count) {
-            fputs(line, fp);
-            i++;
+        struct list_node *node = mpd_client_state->last_played.head;
+        while (node != NULL && uris.length < LAST_PLAYED_RECENT_MAX) {
+            list_push(&uris, node->key, 0, NULL, NULL);
+            node = node->next;
         }
-        FREE_PTR(line);
-        fclose(fi);
     }
     else {
-        //ignore error
-        LOG_DEBUG("Can not open file \"%s\": %s", lp_file, strerror(errno));
+        unsigned total;
+        last_played_store_get(config, mpd_client_state->last_played_count, 0, LAST_PLAYED_RECENT_MAX, &uris, &total);
     }
-    fclose(fp);
-    
-    if (rename(tmp_file, lp_file) == -1) {
-        LOG_ERROR("Renaming file from %s to %s failed: %s", tmp_file, lp_file, strerror(errno));
-        sdsfree(tmp_file);
-        sdsfree(lp_file);
+    //resolve the jukebox unique tag once, afterwards it is captured on playback
+    if (mpd_client_get_songs_by_uri(mpd_client_state, &uris) == false) {
+        mpd_client_free_songs_by_uri(&uris);
         return false;
     }
-    sdsfree(tmp_file);
-    sdsfree(lp_file);
-    //empt list after write to disc
-    list_free(&mpd_client_state->last_played);    
+    struct list_node *current = uris.head;
+    while (current != NULL) {
+        if (current->user_data != NULL) {
+            const char *tag_value = NULL;
+            if (mpd_client_state->jukebox_unique_tag.tags[0] != MPD_TAG_TITLE) {
+                tag_value = mpd_song_get_tag((struct mpd_song *)current->user_data, mpd_client_state->jukebox_unique_tag.tags[0], 0);
+            }
+            list_push(&mpd_client_state->last_played_recent, current->key, 0, tag_value, NULL);
+        }
+        current = current->next;
+    }
+    mpd_client_free_songs_by_uri(&uris);
+    mpd_client_state->last_played_recent_loaded = true;
+    LOG_DEBUG("Loaded %u recently played songs", mpd_client_state->last_played_recent.length);
     return true;
 }
 
+void mpd_client_last_played_recent_reset(t_mpd_client_state *mpd_client_state) {
+    list_free(&mpd_client_state->last_played_recent);
+    mpd_client_state->last_played_recent_loaded = false;
+}
+
+bool mpd_client_last_played_list_save(t_config *config, t_mpd_client_state *mpd_client_state) {
+    if (config->readonly == true) {
+        LOG_VERBOSE("Skip saving last_played list to disc");
+        return true;
+    }
+    //entries are appended on playback, only compact the history
+    return last_played_store_compact(config, mpd_client_state->last_played_count);
+}
+
 bool mpd_client_add_song_to_last_played_list(t_config *config, t_mpd_client_state *mpd_client_state, const int song_id) {
     if (song_id > -1) {
         struct mpd_song *song = mpd_run_get_queue_song_id(mpd_client_state->mpd_state->conn, song_id);
@@ -96,18 +94,22 @@ bool mpd_client_add_song_to_last_played_list(t_config *config, t_mpd_client_stat
                 mpd_song_free(song);
                 return true;
             }
-            list_insert(&mpd_client_state->last_played, uri, time(NULL), NULL, NULL);
-            mpd_song_free(song);
-            //write last_played list to disc
+            mpd_client_last_played_recent_push(mpd_client_state, uri, song);
             if (config->readonly == false) {
-                if (mpd_client_state->last_played.length > 9 || mpd_client_state->last_played.length > mpd_client_state->last_played_count) {
-                    mpd_client_last_played_list_save(config, mpd_client_state);
+                unsigned count = last_played_store_append(config, time(NULL), uri);
+                //compact if the history has grown to twice its size
+                if (count > 2 * mpd_client_state->last_played_count) {
+                    last_played_store_compact(config, mpd_client_state->last_played_count);
                 }
             }
-            else if (mpd_client_state->last_played.length > mpd_client_state->last_played_count) {
-                //remove last entry
-                list_shift(&mpd_client_state->last_played, mpd_client_state->last_played.length - 1);
+            else {
+                list_insert(&mpd_client_state->last_played, uri, time(NULL), NULL, NULL);
+                if (mpd_client_state->last_played.length > mpd_client_state->last_played_count) {
+                    //remove last entry
+                    list_shift(&mpd_client_state->last_played, mpd_client_state->last_played.length - 1);
+                }
             }
+            mpd_song_free(song);
             //notify clients
             sds buffer = jsonrpc_notify(sdsempty(), "update_lastplayed");
             ws_notify(buffer);
@@ -133,55 +135,34 @@ sds mpd_client_put_last_played_songs(t_config *config, t_mpd_client_state *mpd_c
     buffer = jsonrpc_start_result(buffer, method, request_id);
     buffer = sdscat(buffer, ",\"data\":[");
     
-    if (mpd_client_state->last_played.length > 0) {
+    //collect the requested page
+    struct list entries;
+    list_init(&entries);
+    if (config->readonly == true) {
         struct list_node *current = mpd_client_state->last_played.head;
         while (current != NULL) {
             entity_count++;
             if (entity_count > offset && (entity_count <= offset + limit || limit == 0)) {
-                if (entities_returned++) {
-                    buffer = sdscat(buffer, ",");
-                }
-                buffer = mpd_client_put_last_played_obj(mpd_client_state, buffer, entity_count, current->value_i, current->key, tagcols);
+                list_push(&entries, current->key, current->value_i, NULL, NULL);
             }
             current = current->next;
         }
     }
-
-    if (config->readonly == false) {
-        char *line = NULL;
-        char *data = NULL;
-        char *crap = NULL;
-        size_t n = 0;
-        sds lp_file = sdscatfmt(sdsempty(), "%s/state/last_played", config->varlibdir);
-        FILE *fp = fopen(lp_file, "r");
-        if (fp != NULL) {
-            while (getline(&line, &n, fp) > 0) {
-                entity_count++;
-                if (entity_count > offset && (entity_count <= offset + limit || limit == 0)) {
-                    int value = strtoimax(line, &data, 10);
-                    if (strlen(data) > 2) {
-                        data = data + 2;
-                        strtok_r(data, "\n", &crap);
-                        if (entities_returned++) {
-                            buffer = sdscat(buffer, ",");
-                        }
-                        buffer = mpd_client_put_last_played_obj(mpd_client_state, buffer, entity_count, value, data, tagcols);
-                    }
-                    else {
-                        LOG_ERROR("Reading last_played line failed");
-                        LOG_DEBUG("Errorneous line: %s", line);
-                    }
-                }
-            }
-            fclose(fp);
-            FREE_PTR(line);
-        }
-        else {
-            //ignore error
-            LOG_DEBUG("Can not open file \"%s\": %s", lp_file, strerror(errno));
+    else {
+        last_played_store_get(config, mpd_client_state->last_played_count, offset, limit, &entries, &entity_count);
+    }
+    //get the song details for the whole page in one command list
+    mpd_client_get_songs_by_uri(mpd_client_state, &entries);
+    struct list_node *current = entries.head;
+    while (current != NULL) {
+        if (entities_returned++) {
+            buffer = sdscat(buffer, ",");
         }
-        sdsfree(lp_file);
+        buffer = mpd_client_put_last_played_obj(mpd_client_state, buffer, offset + entities_returned, current->value_i, current->key,
+            (struct mpd_song *)current->user_data, tagcols);
+        current = current->next;
     }
+    mpd_client_free_songs_by_uri(&entries);
     buffer = sdscat(buffer, "],");
     buffer = tojson_long(buffer, "totalEntities", entity_count, true);
     buffer = tojson_long(buffer, "offset", offset, true);
@@ -229,28 +210,33 @@ sds mpd_client_put_stats(t_config *config, t_mpd_client_state *mpd_client_state,
 
 
 //private functions
-static sds mpd_client_put_last_played_obj(t_mpd_client_state *mpd_client_state, sds buffer, 
-                                          unsigned entity_count, long last_played, const char *uri, const t_tags *tagcols)
+static sds mpd_client_put_last_played_obj(t_mpd_client_state *mpd_client_state, sds buffer, unsigned entity_count,
+                                          long last_played, const char *uri, const struct mpd_song *song, const t_tags *tagcols)
 {
     buffer = sdscat(buffer, "{");
     buffer = tojson_long(buffer, "Pos", entity_count, true);
     buffer = tojson_long(buffer, "LastPlayed", last_played, true);
-    bool rc = mpd_send_list_meta(mpd_client_state->mpd_state->conn, uri);
-    if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_send_list_meta") == false) {
-        buffer = put_empty_song_tags(buffer, mpd_client_state->mpd_state, tagcols, uri);
+    if (song != NULL) {
+        buffer = put_song_tags(buffer, mpd_client_state->mpd_state, tagcols, song);
     }
     else {
-        struct mpd_entity *entity;
-        if ((entity = mpd_recv_entity(mpd_client_state->mpd_state->conn)) != NULL) {
-            const struct mpd_song *song = mpd_entity_get_song(entity);
-            buffer = put_song_tags(buffer, mpd_client_state->mpd_state, tagcols, song);
-            mpd_entity_free(entity);
-            mpd_response_finish(mpd_client_state->mpd_state->conn);
-        }
-        else {
-            buffer = put_empty_song_tags(buffer, mpd_client_state->mpd_state, tagcols, uri);
-        }
+        buffer = put_empty_song_tags(buffer, mpd_client_state->mpd_state, tagcols, uri);
     }
     buffer = sdscat(buffer, "}");
     return buffer;
 }
+
+static void mpd_client_last_played_recent_push(t_mpd_client_state *mpd_client_state, const char *uri, const struct mpd_song *song) {
+    if (mpd_client_state->last_played_recent_loaded == false) {
+        //list is populated on first use
+        return;
+    }
+    const char *tag_value = NULL;
+    if (mpd_client_state->jukebox_unique_tag.tags[0] != MPD_TAG_TITLE) {
+        tag_value = mpd_song_get_tag(song, mpd_client_state->jukebox_unique_tag.tags[0], 0);
+    }
+    list_insert(&mpd_client_state->last_played_recent, uri, 0, tag_value, NULL);
+    if (mpd_client_state->last_played_recent.length > LAST_PLAYED_RECENT_MAX) {
+        list_shift(&mpd_client_state->last_played_recent, mpd_client_state->last_played_recent.length - 1);
+    }
+}
@@ -6,7 +6,12 @@
 
 #ifndef __MPD_CLIENT_STATS_H__
 #define __MPD_CLIENT_STATS_H__
+
+#define LAST_PLAYED_RECENT_MAX 20
+
 bool mpd_client_add_song_to_last_played_list(t_config *config, t_mpd_client_state *mpd_client_state, const int song_id);
+bool mpd_client_last_played_recent_load(t_config *config, t_mpd_client_state *mpd_client_state);
+void mpd_client_last_played_recent_reset(t_mpd_client_state *mpd_client_state);
 bool mpd_client_last_played_list_save(t_config *config, t_mpd_client_state *mpd_client_state);
 sds mpd_client_put_last_played_songs(t_config *config, t_mpd_client_state *mpd_client_state, sds buffer, sds method, long request_id, 
                                      const unsigned int offset, const unsigned int limit, const t_tags *tagcols);
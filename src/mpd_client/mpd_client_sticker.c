@@ -30,54 +30,126 @@
 #include "mpd_client_sticker.h"
 
 //privat definitions
-static bool _mpd_client_count_song_uri(t_mpd_client_state *mpd_client_state, const char *uri, const char *name, const long value);
-static bool _mpd_client_set_sticker(t_mpd_client_state *mpd_client_state, const char *uri, const char *name, const long value);
+//pending sticker changes for one song, the counters are increments until resolved
+typedef struct t_sticker_change {
+    unsigned play_count_inc;
+    unsigned skip_count_inc;
+    unsigned play_count;
+    unsigned skip_count;
+    time_t last_played;
+    time_t last_skipped;
+    int like;
+} t_sticker_change;
+
+static t_sticker_change *_mpd_client_sticker_queue_get(t_mpd_client_state *mpd_client_state, const char *uri);
+static bool _mpd_client_sticker_resolve_counters(t_mpd_client_state *mpd_client_state, bool use_cache);
+static bool _mpd_client_sticker_set_batch(t_mpd_client_state *mpd_client_state, struct list *sets, bool use_cache);
+static void _mpd_client_sticker_cache_update(t_mpd_client_state *mpd_client_state, const char *uri, const char *name, long value);
 
 //public functions
 bool mpd_client_sticker_inc_play_count(t_mpd_client_state *mpd_client_state, const char *uri) {
-    return list_push(&mpd_client_state->sticker_queue, uri, 1, "playCount", NULL);
+    t_sticker_change *change = _mpd_client_sticker_queue_get(mpd_client_state, uri);
+    if (change == NULL) {
+        return false;
+    }
+    change->play_count_inc++;
+    return true;
 }
 
 bool mpd_client_sticker_inc_skip_count(t_mpd_client_state *mpd_client_state, const char *uri) {
-    return list_push(&mpd_client_state->sticker_queue, uri, 1, "skipCount", NULL);
+    t_sticker_change *change = _mpd_client_sticker_queue_get(mpd_client_state, uri);
+    if (change == NULL) {
+        return false;
+    }
+    change->skip_count_inc++;
+    return true;
 }
 
 bool mpd_client_sticker_like(t_mpd_client_state *mpd_client_state, const char *uri, int value) {
-    return list_push(&mpd_client_state->sticker_queue, uri, value, "like", NULL);
+    t_sticker_change *change = _mpd_client_sticker_queue_get(mpd_client_state, uri);
+    if (change == NULL) {
+        return false;
+    }
+    change->like = value;
+    //user initiated, flush on next loop
+    mpd_client_state->sticker_queue_time = 0;
+    return true;
 }
 
 bool mpd_client_sticker_last_played(t_mpd_client_state *mpd_client_state, const char *uri) {
-    return list_push(&mpd_client_state->sticker_queue, uri, mpd_client_state->song_start_time, "lastPlayed", NULL);
+    t_sticker_change *change = _mpd_client_sticker_queue_get(mpd_client_state, uri);
+    if (change == NULL) {
+        return false;
+    }
+    change->last_played = mpd_client_state->song_start_time;
+    return true;
 }
 
 bool mpd_client_sticker_last_skipped(t_mpd_client_state *mpd_client_state, const char *uri) {
-    time_t now = time(NULL);
-    return list_push(&mpd_client_state->sticker_queue, uri, now, "lastSkipped", NULL);
+    t_sticker_change *change = _mpd_client_sticker_queue_get(mpd_client_state, uri);
+    if (change == NULL) {
+        return false;
+    }
+    change->last_skipped = time(NULL);
+    return true;
 }
 
-bool mpd_client_sticker_dequeue(t_mpd_client_state *mpd_client_state) {
+bool mpd_client_sticker_flush_due(t_mpd_client_state *mpd_client_state) {
+    if (mpd_client_state->sticker_queue.length == 0) {
+        return false;
+    }
     if (mpd_client_state->sticker_cache != NULL && mpd_client_state->sticker_cache_building == true) {
-        //sticker cache is currently (re-)building in the mpd_worker thread
-        //cache sticker write calls
-        LOG_VERBOSE("Delay setting stickers, sticker_cache is building");
         return false;
     }
-    
+    if (mpd_client_state->sticker_queue.length >= STICKER_QUEUE_MAX) {
+        return true;
+    }
+    return time(NULL) >= mpd_client_state->sticker_queue_time + STICKER_QUEUE_DELAY;
+}
+
+bool mpd_client_sticker_dequeue(t_mpd_client_state *mpd_client_state, bool force) {
+    bool use_cache = mpd_client_state->sticker_cache != NULL ? true : false;
+    if (use_cache == true && mpd_client_state->sticker_cache_building == true) {
+        if (force == false) {
+            //sticker cache is currently (re-)building in the mpd_worker thread
+            //cache sticker write calls
+            LOG_VERBOSE("Delay setting stickers, sticker_cache is building");
+            return false;
+        }
+        //the cache is outdated, read the counters from mpd
+        use_cache = false;
+    }
+    if (_mpd_client_sticker_resolve_counters(mpd_client_state, use_cache) == false) {
+        return false;
+    }
+
+    struct list sets;
+    list_init(&sets);
     struct list_node *current = mpd_client_state->sticker_queue.head;
     while (current != NULL) {
-        LOG_DEBUG("Setting %s = %ld for %s", current->value_p, current->value_i, current->key);
-        if (strcmp(current->value_p, "playCount") == 0 || strcmp(current->value_p, "skipCount") == 0) {
-            _mpd_client_count_song_uri(mpd_client_state, current->key, current->value_p, current->value_i);
+        t_sticker_change *change = (t_sticker_change *)current->user_data;
+        if (change->play_count_inc > 0) {
+            list_push(&sets, current->key, change->play_count, "playCount", NULL);
         }
-        else if (strcmp(current->value_p, "like") == 0 || strcmp(current->value_p, "lastPlayed") == 0 || 
-                 strcmp(current->value_p, "lastSkipped") == 0) 
-        {
-            _mpd_client_set_sticker(mpd_client_state, current->key, current->value_p, current->value_i);
+        if (change->skip_count_inc > 0) {
+            list_push(&sets, current->key, change->skip_count, "skipCount", NULL);
         }
-        list_shift(&mpd_client_state->sticker_queue, 0);
-        current = mpd_client_state->sticker_queue.head;
+        if (change->like > -1) {
+            list_push(&sets, current->key, change->like, "like", NULL);
+        }
+        if (change->last_played > 0) {
+            list_push(&sets, current->key, change->last_played, "lastPlayed", NULL);
+        }
+        if (change->last_skipped > 0) {
+            list_push(&sets, current->key, change->last_skipped, "lastSkipped", NULL);
+        }
+        current = current->next;
     }
-    return true;
+    list_free(&mpd_client_state->sticker_queue);
+
+    bool rc = _mpd_client_sticker_set_batch(mpd_client_state, &sets, use_cache);
+    list_free(&sets);
+    return rc;
 }
 
 struct t_sticker *get_sticker_from_cache(t_mpd_client_state *mpd_client_state, const char *uri) {
@@ -134,92 +206,196 @@ bool mpd_client_get_sticker(t_mpd_client_state *mpd_client_state, const char *ur
 }
 
 //private functions
-static bool _mpd_client_count_song_uri(t_mpd_client_state *mpd_client_state, const char *uri, const char *name, const long value) {
-    if (uri == NULL || strstr(uri, "://") != NULL) {
-        return false;
+static t_sticker_change *_mpd_client_sticker_queue_get(t_mpd_client_state *mpd_client_state, const char *uri) {
+    if (uri == NULL || is_streamuri(uri) == true) {
+        LOG_ERROR("Failed to queue sticker change, invalid song uri: %s", uri);
+        return NULL;
+    }
+    struct list_node *node = list_get_node(&mpd_client_state->sticker_queue, uri);
+    if (node != NULL) {
+        return (t_sticker_change *)node->user_data;
+    }
+    t_sticker_change *change = (t_sticker_change *)malloc(sizeof(t_sticker_change));
+    assert(change);
+    change->play_count_inc = 0;
+    change->skip_count_inc = 0;
+    change->play_count = 0;
+    change->skip_count = 0;
+    change->last_played = 0;
+    change->last_skipped = 0;
+    change->like = -1;
+    if (mpd_client_state->sticker_queue.length == 0) {
+        mpd_client_state->sticker_queue_time = time(NULL);
     }
-    unsigned old_value = 0;
-    t_sticker *sticker = NULL;
-    if (mpd_client_state->sticker_cache != NULL) {
-        sticker = get_sticker_from_cache(mpd_client_state, uri);
-        if (sticker != NULL) {
-            if (strcmp(name, "playCount") == 0) {
-                old_value = sticker->playCount;
+    list_push(&mpd_client_state->sticker_queue, uri, 0, NULL, change);
+    return change;
+}
+
+//adds the current counter values to the queued increments
+static bool _mpd_client_sticker_resolve_counters(t_mpd_client_state *mpd_client_state, bool use_cache) {
+    struct list_node *current;
+    if (use_cache == true) {
+        current = mpd_client_state->sticker_queue.head;
+        while (current != NULL) {
+            t_sticker_change *change = (t_sticker_change *)current->user_data;
+            t_sticker *sticker = get_sticker_from_cache(mpd_client_state, current->key);
+            change->play_count = change->play_count_inc + (sticker != NULL ? sticker->playCount : 0);
+            change->skip_count = change->skip_count_inc + (sticker != NULL ? sticker->skipCount : 0);
+            current = current->next;
+        }
+    }
+    else {
+        //read the stickers of all songs in one command list
+        struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+        struct list_node *start = mpd_client_state->sticker_queue.head;
+        while (start != NULL) {
+            if (mpd_command_list_begin(conn, true) == false) {
+                check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+                return false;
+            }
+            current = start;
+            while (current != NULL) {
+                if (mpd_send_sticker_list(conn, "song", current->key) == false) {
+                    LOG_ERROR("Error adding command to command list mpd_send_sticker_list");
+                    break;
+                }
+                current = current->next;
             }
-            else if (strcmp(name, "skipCount") == 0) {
-                old_value = sticker->skipCount;
+            if (mpd_command_list_end(conn) == false) {
+                check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+                return false;
+            }
+            while (start != NULL) {
+                t_sticker_change *change = (t_sticker_change *)start->user_data;
+                change->play_count = change->play_count_inc;
+                change->skip_count = change->skip_count_inc;
+                struct mpd_pair *pair;
+                char *crap = NULL;
+                while ((pair = mpd_recv_sticker(conn)) != NULL) {
+                    if (strcmp(pair->name, "playCount") == 0) {
+                        change->play_count += strtoimax(pair->value, &crap, 10);
+                    }
+                    else if (strcmp(pair->name, "skipCount") == 0) {
+                        change->skip_count += strtoimax(pair->value, &crap, 10);
+                    }
+                    mpd_return_sticker(conn, pair);
+                }
+                if (mpd_response_next(conn) == false) {
+                    break;
+                }
+                start = start->next;
+            }
+            if (start != NULL) {
+                //a failing uri aborts the command list, the remaining uris are sent in a new one
+                LOG_WARN("Can not get stickers for %s, discarding changes", start->key);
+                t_sticker_change *change = (t_sticker_change *)start->user_data;
+                change->play_count_inc = 0;
+                change->skip_count_inc = 0;
+                change->last_played = 0;
+                change->last_skipped = 0;
+                change->like = -1;
+                start = start->next;
+                if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false &&
+                    mpd_client_state->mpd_state->conn_state == MPD_FAILURE)
+                {
+                    return false;
+                }
+            }
+            else {
+                mpd_response_finish(conn);
+                if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false) {
+                    return false;
+                }
             }
         }
     }
-    else {
-        struct mpd_pair *pair;
-        char *crap = NULL;
-        bool rc = mpd_send_sticker_list(mpd_client_state->mpd_state->conn, "song", uri);
-        if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_send_sticker_list") == false) {
+    //limit the counters
+    current = mpd_client_state->sticker_queue.head;
+    while (current != NULL) {
+        t_sticker_change *change = (t_sticker_change *)current->user_data;
+        if (change->play_count > INT_MAX / 2) {
+            change->play_count = INT_MAX / 2;
+        }
+        if (change->skip_count > INT_MAX / 2) {
+            change->skip_count = INT_MAX / 2;
+        }
+        current = current->next;
+    }
+    return true;
+}
+
+//sends all sticker set commands in one command list
+static bool _mpd_client_sticker_set_batch(t_mpd_client_state *mpd_client_state, struct list *sets, bool use_cache) {
+    struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+    struct list_node *start = sets->head;
+    while (start != NULL) {
+        if (mpd_command_list_begin(conn, true) == false) {
+            check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
             return false;
         }
-        while ((pair = mpd_recv_sticker(mpd_client_state->mpd_state->conn)) != NULL) {
-            if (strcmp(pair->name, name) == 0) {
-                old_value = strtoimax(pair->value, &crap, 10);
+        struct list_node *current = start;
+        while (current != NULL) {
+            sds value_str = sdsfromlonglong(current->value_i);
+            LOG_VERBOSE("Setting sticker: \"%s\" -> %s: %s", current->key, current->value_p, value_str);
+            bool rc = mpd_send_sticker_set(conn, "song", current->key, current->value_p, value_str);
+            sdsfree(value_str);
+            if (rc == false) {
+                LOG_ERROR("Error adding command to command list mpd_send_sticker_set");
+                break;
             }
-            mpd_return_sticker(mpd_client_state->mpd_state->conn, pair);
+            current = current->next;
         }
-        mpd_response_finish(mpd_client_state->mpd_state->conn);
-        if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, true) == false) {
+        if (mpd_command_list_end(conn) == false) {
+            check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
             return false;
         }
-    }
-
-    old_value += value;
-    if (old_value > INT_MAX / 2) {
-        old_value = INT_MAX / 2;
-    }
-
-    sds value_str = sdsfromlonglong(old_value);
-    LOG_VERBOSE("Setting sticker: \"%s\" -> %s: %s", uri, name, value_str);
-    bool rc = mpd_run_sticker_set(mpd_client_state->mpd_state->conn, "song", uri, name, value_str);
-    sdsfree(value_str);
-    if (rc == false) {
-        check_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0);
-    }
-    else {
-        if (sticker != NULL) {
-            if (strcmp(name, "playCount") == 0) {
-                sticker->playCount = old_value;
+        while (start != NULL) {
+            if (mpd_response_next(conn) == false) {
+                break;
+            }
+            if (use_cache == true) {
+                _mpd_client_sticker_cache_update(mpd_client_state, start->key, start->value_p, start->value_i);
+            }
+            start = start->next;
+        }
+        if (start != NULL) {
+            //a failing command aborts the command list, the remaining commands are sent in a new one
+            LOG_ERROR("Failed to set sticker %s to %ld for %s", start->value_p, start->value_i, start->key);
+            start = start->next;
+            if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false &&
+                mpd_client_state->mpd_state->conn_state == MPD_FAILURE)
+            {
+                return false;
             }
-            else if (strcmp(name, "skipCount") == 0) {
-                sticker->skipCount = old_value;
+        }
+        else {
+            mpd_response_finish(conn);
+            if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false) {
+                return false;
             }
-        }    
+        }
     }
-    return rc;
+    return true;
 }
 
-static bool _mpd_client_set_sticker(t_mpd_client_state *mpd_client_state, const char *uri, const char *name, const long value) {
-    if (uri == NULL || strstr(uri, "://") != NULL) {
-        LOG_ERROR("Failed to set sticker %s to %d, invalid song uri: %s", name, value, uri);
-        return false;
+static void _mpd_client_sticker_cache_update(t_mpd_client_state *mpd_client_state, const char *uri, const char *name, long value) {
+    t_sticker *sticker = get_sticker_from_cache(mpd_client_state, uri);
+    if (sticker == NULL) {
+        return;
     }
-    sds value_str = sdsfromlonglong(value);
-    LOG_VERBOSE("Setting sticker: \"%s\" -> %s: %s", uri, name, value_str);
-    bool rc = mpd_run_sticker_set(mpd_client_state->mpd_state->conn, "song", uri, name, value_str);
-    sdsfree(value_str);
-    if (check_rc_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_run_sticker_set") == false) {
-        return false;
+    if (strcmp(name, "playCount") == 0) {
+        sticker->playCount = value;
     }
-    if (mpd_client_state->sticker_cache != NULL) {
-        t_sticker *sticker = get_sticker_from_cache(mpd_client_state, uri);
-        if (sticker != NULL) {
-            if (strcmp(name, "like") == 0) {
-                sticker->like = value;
-            }
-            else if (strcmp(name, "lastPlayed") == 0) {
-                sticker->lastPlayed = value;
-            }
-            else if (strcmp(name, "lastSkipped") == 0) {
-                sticker->lastSkipped = value;
-            }
-        }
+    else if (strcmp(name, "skipCount") == 0) {
+        sticker->skipCount = value;
+    }
+    else if (strcmp(name, "like") == 0) {
+        sticker->like = value;
+    }
+    else if (strcmp(name, "lastPlayed") == 0) {
+        sticker->lastPlayed = value;
+    }
+    else if (strcmp(name, "lastSkipped") == 0) {
+        sticker->lastSkipped = value;
     }
-    return true;
 }
@@ -6,12 +6,17 @@
 
 #ifndef __MPD_CLIENT_STICKER_H__
 #define __MPD_CLIENT_STICKER_H__
+//seconds a sticker change is kept in the queue to coalesce it with following changes
+#define STICKER_QUEUE_DELAY 10
+//number of queued songs that forces a flush
+#define STICKER_QUEUE_MAX 50
 bool mpd_client_sticker_inc_play_count(t_mpd_client_state *mpd_client_state, const char *uri);
 bool mpd_client_sticker_inc_skip_count(t_mpd_client_state *mpd_client_state, const char *uri);
 bool mpd_client_sticker_like(t_mpd_client_state *mpd_client_state, const char *uri, int value);
 bool mpd_client_sticker_last_played(t_mpd_client_state *mpd_client_state, const char *uri);
 bool mpd_client_sticker_last_skipped(t_mpd_client_state *mpd_client_state, const char *uri);
-bool mpd_client_sticker_dequeue(t_mpd_client_state *mpd_client_state);
+bool mpd_client_sticker_flush_due(t_mpd_client_state *mpd_client_state);
+bool mpd_client_sticker_dequeue(t_mpd_client_state *mpd_client_state, bool force);
 struct t_sticker *get_sticker_from_cache(t_mpd_client_state *mpd_client_state, const char *uri);
 bool mpd_client_get_sticker(t_mpd_client_state *mpd_client_state, const char *uri, t_sticker *sticker);
 #endif
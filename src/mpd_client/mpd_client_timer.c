@@ -26,6 +26,7 @@
 #include "../mpd_shared/mpd_shared_typedefs.h"
 #include "../mpd_shared.h"
 #include "mpd_client_utility.h"
+#include "mpd_client_jukebox.h"
 
 void mpd_client_set_timer(enum mympd_cmd_ids cmd_id, const char *cmd, int timeout, int interval, const char *handler) {
     t_work_request *request = create_request(-1, 0, cmd_id, cmd, "");
@@ -41,7 +42,7 @@ sds mpd_client_timer_startplay(t_mpd_client_state *mpd_client_state, sds buffer,
                                unsigned volume, const char *playlist, enum jukebox_modes jukebox_mode) 
 {
     //disable jukebox to prevent adding songs to queue from old jukebox queue list
-    mpd_client_state->jukebox_mode = JUKEBOX_OFF;
+    mpd_client_jukebox_disable(mpd_client_state);
     
     bool rc = false;
     if (mpd_command_list_begin(mpd_client_state->mpd_state->conn, false)) {
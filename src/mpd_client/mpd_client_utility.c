@@ -30,6 +30,7 @@
 #include "../mpd_shared/mpd_shared_tags.h"
 #include "../mpd_shared.h"
 #include "mpd_client_utility.h"
+#include "mpd_client_playlist_catalog.h"
 
 //private definitons
 static void detect_extra_files(t_mpd_client_state *mpd_client_state, const char *uri, sds *booklet_path, struct list *images, bool is_dirname);
@@ -63,6 +64,78 @@ bool caches_init(t_config *config, t_mpd_client_state *mpd_client_state) {
     return true;
 }
 
+//sets the user_data of each entry to the song with the uri of the entry key, NULL if not found
+//all uris are requested in one command list, free the entries with mpd_client_free_songs_by_uri
+//MPD aborts the command list on an unknown uri, the remaining uris are resent from the failed position
+bool mpd_client_get_songs_by_uri(t_mpd_client_state *mpd_client_state, struct list *entries) {
+    struct mpd_connection *conn = mpd_client_state->mpd_state->conn;
+    struct list_node *start = entries->head;
+    while (start != NULL) {
+        if (mpd_command_list_begin(conn, true) == false) {
+            check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+            return false;
+        }
+        struct list_node *current = start;
+        while (current != NULL) {
+            if (mpd_send_list_meta(conn, current->key) == false) {
+                LOG_ERROR("Error adding command to command list mpd_send_list_meta");
+                break;
+            }
+            current = current->next;
+        }
+        if (mpd_command_list_end(conn) == false) {
+            check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+            return false;
+        }
+        current = start;
+        start = NULL;
+        while (current != NULL) {
+            struct mpd_song *song;
+            while ((song = mpd_recv_song(conn)) != NULL) {
+                if (current->user_data == NULL) {
+                    current->user_data = song;
+                }
+                else {
+                    mpd_song_free(song);
+                }
+            }
+            if (mpd_response_next(conn) == false) {
+                break;
+            }
+            current = current->next;
+        }
+        if (mpd_connection_get_error(conn) == MPD_ERROR_SERVER) {
+            //the failed command is reported by its position in the command list
+            unsigned location = mpd_connection_get_server_error_location(conn);
+            LOG_WARN("Can not get song details for %s (command list position %u)", (current != NULL ? current->key : ""), location);
+            if (mpd_connection_clear_error(conn) == false) {
+                check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false);
+                return false;
+            }
+            if (current != NULL) {
+                start = current->next;
+            }
+            continue;
+        }
+        mpd_response_finish(conn);
+        if (check_error_and_recover2(mpd_client_state->mpd_state, NULL, NULL, 0, false) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void mpd_client_free_songs_by_uri(struct list *entries) {
+    struct list_node *current = entries->head;
+    while (current != NULL) {
+        if (current->user_data != NULL) {
+            mpd_song_free((struct mpd_song *)current->user_data);
+        }
+        current = current->next;
+    }
+    list_free_keep_user_data(entries);
+}
+
 sds put_extra_files(t_mpd_client_state *mpd_client_state, sds buffer, const char *uri, bool is_dirname) {
     struct list images;
     list_init(&images);
@@ -103,6 +176,10 @@ void json_to_tags(const char *str, int len, void *user_data) {
 
 bool is_smartpls(t_config *config, t_mpd_client_state *mpd_client_state, const char *plpath) {
     bool smartpls = false;
+    t_playlist_catalog_entry *entry = playlist_catalog_get(mpd_client_state, plpath);
+    if (entry != NULL) {
+        return entry->smartpls;
+    }
     if (mpd_client_state->feat_smartpls == true) {
         sds smartpls_file = sdscatfmt(sdsempty(), "%s/smartpls/%s", config->varlibdir, plpath);
         if (validate_string(plpath) == true) {
@@ -123,6 +200,11 @@ void default_mpd_client_state(t_mpd_client_state *mpd_client_state) {
     mpd_client_state->last_song_uri = sdsempty();
     mpd_client_state->queue_version = 0;
     mpd_client_state->queue_length = 0;
+    mpd_client_state->queue_mirror.songs = NULL;
+    mpd_client_state->queue_mirror.length = 0;
+    mpd_client_state->queue_mirror.version = 0;
+    mpd_client_state->queue_mirror.valid = false;
+    mpd_client_state->queue_mirror.incremental = false;
     mpd_client_state->last_last_played_id = -1;
     mpd_client_state->song_end_time = 0;
     mpd_client_state->song_start_time = 0;
@@ -138,6 +220,7 @@ void default_mpd_client_state(t_mpd_client_state *mpd_client_state) {
     mpd_client_state->jukebox_playlist = sdsempty();
     mpd_client_state->jukebox_unique_tag.len = 1;
     mpd_client_state->jukebox_unique_tag.tags[0] = MPD_TAG_ARTIST;
+    mpd_client_state->jukebox_queue_version = 0;
     mpd_client_state->jukebox_last_played = 24;
     mpd_client_state->jukebox_queue_length = 1;
     mpd_client_state->jukebox_enforce_unique = true;
@@ -161,14 +244,19 @@ void default_mpd_client_state(t_mpd_client_state *mpd_client_state) {
     reset_t_tags(&mpd_client_state->generate_pls_tag_types);
     //init last played songs list
     list_init(&mpd_client_state->last_played);
+    list_init(&mpd_client_state->last_played_recent);
+    mpd_client_state->last_played_recent_loaded = false;
     //init sticker queue
     list_init(&mpd_client_state->sticker_queue);
+    mpd_client_state->sticker_queue_time = 0;
     //sticker cache
     mpd_client_state->sticker_cache_building = false;
     mpd_client_state->sticker_cache = NULL;
     //album cache
     mpd_client_state->album_cache_building = false;
     mpd_client_state->album_cache = NULL;
+    //playlist catalog
+    mpd_client_state->playlist_catalog = NULL;
     //jukebox queue
     list_init(&mpd_client_state->jukebox_queue);
     list_init(&mpd_client_state->jukebox_queue_tmp);
@@ -197,6 +285,7 @@ void free_mpd_client_state(t_mpd_client_state *mpd_client_state) {
     sdsfree(mpd_client_state->booklet_name);
     list_free(&mpd_client_state->jukebox_queue);
     list_free(&mpd_client_state->jukebox_queue_tmp);
+    list_free(&mpd_client_state->last_played_recent);
     list_free(&mpd_client_state->sticker_queue);
     list_free(&mpd_client_state->triggers);
     //mpd state
@@ -31,6 +31,15 @@ enum trigger_events {
     TRIGGER_MPD_MOUNT = 0x2000
 };
 
+//local copy of the mpd queue, songs are ordered by position
+typedef struct t_queue_mirror {
+    struct mpd_song **songs;
+    unsigned length;
+    unsigned version;
+    bool valid;
+    bool incremental;
+} t_queue_mirror;
+
 typedef struct t_mpd_client_state {
     // States
     int song_id;
@@ -40,6 +49,7 @@ typedef struct t_mpd_client_state {
     sds last_song_uri;
     unsigned queue_version;
     unsigned queue_length;
+    t_queue_mirror queue_mirror;
     int last_last_played_id;
     int last_skipped_id;
     time_t song_end_time;
@@ -72,6 +82,7 @@ typedef struct t_mpd_client_state {
     t_tags jukebox_unique_tag;
     int jukebox_last_played;
     bool jukebox_enforce_unique;
+    unsigned jukebox_queue_version;
     bool auto_play;
     bool coverimage;
     sds coverimage_name;
@@ -96,12 +107,18 @@ typedef struct t_mpd_client_state {
     t_tags generate_pls_tag_types;
     //last played list
     struct list last_played;
+    //most recently played songs with resolved jukebox unique tag
+    struct list last_played_recent;
+    bool last_played_recent_loaded;
     //sticker cache
     rax *sticker_cache;
     struct list sticker_queue;
+    time_t sticker_queue_time;
     bool sticker_cache_building;
     rax *album_cache;
     bool album_cache_building;
+    //stored playlists
+    rax *playlist_catalog;
     //mpd state
     struct t_mpd_state *mpd_state;
     //triggers
@@ -115,4 +132,6 @@ bool is_smartpls(t_config *config, t_mpd_client_state *mpd_client_state, const c
 sds put_extra_files(t_mpd_client_state *mpd_client_state, sds buffer, const char *uri, bool is_dirname);
 bool mpd_client_set_binarylimit(t_config *config, t_mpd_client_state *mpd_client_state);
 bool caches_init(t_config *config, t_mpd_client_state *mpd_client_state);
+bool mpd_client_get_songs_by_uri(t_mpd_client_state *mpd_client_state, struct list *entries);
+void mpd_client_free_songs_by_uri(struct list *entries);
 #endif
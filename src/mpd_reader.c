@@ -0,0 +1,283 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <signal.h>
+#include <assert.h>
+#include <unistd.h>
+#include <mpd/client.h>
+
+#include "../dist/src/sds/sds.h"
+#include "../dist/src/frozen/frozen.h"
+#include "sds_extras.h"
+#include "log.h"
+#include "list.h"
+#include "config_defs.h"
+#include "tiny_queue.h"
+#include "api.h"
+#include "global.h"
+#include "utility.h"
+#include "mpd_shared/mpd_shared_typedefs.h"
+#include "mpd_shared.h"
+#include "mpd_shared/mpd_shared_tags.h"
+#include "mpd_client/mpd_client_utility.h"
+#include "mpd_client/mpd_client_api.h"
+#include "mpd_client/mpd_client_features.h"
+#include "mpd_client/mpd_client_settings.h"
+#include "mpd_client/mpd_client_cover.h"
+#include "mpd_reader.h"
+
+//private definitions
+static void mpd_reader_idle(t_config *config, t_mpd_client_state *mpd_client_state, tiny_queue_t *request_queue,
+                            tiny_queue_t *settings_queue, bool cover);
+static void mpd_reader_settings(t_config *config, t_mpd_client_state *mpd_client_state, t_work_request *request);
+static void mpd_reader_api(t_config *config, t_mpd_client_state *mpd_client_state, t_work_request *request);
+
+//public functions
+void *mpd_reader_loop(void *arg_reader) {
+    t_mpd_reader_arg *reader = (t_mpd_reader_arg *) arg_reader;
+    t_config *config = reader->config;
+    tiny_queue_t *request_queue = mpd_reader_queue;
+    tiny_queue_t *settings_queue = mpd_reader_settings_queue[reader->id];
+    if (reader->cover == true) {
+        request_queue = mpd_cover_queue;
+        settings_queue = mpd_cover_settings_queue;
+        thread_logname = sdsreplace(thread_logname, "mpdcover");
+    }
+    else {
+        thread_logname = sdscatfmt(sdsempty(), "mpdreader%u", reader->id);
+    }
+    //State of mpd connection
+    t_mpd_client_state *mpd_client_state = (t_mpd_client_state *)malloc(sizeof(t_mpd_client_state));
+    assert(mpd_client_state);
+    default_mpd_client_state(mpd_client_state);
+
+    //wait for initial settings
+    while (s_signal_received == 0) {
+        t_work_request *request = tiny_queue_shift(settings_queue, 50, 0);
+        if (request != NULL) {
+            LOG_DEBUG("Got initial settings from mympd_api");
+            mpd_reader_settings(config, mpd_client_state, request);
+            break;
+        }
+    }
+
+    if (reader->cover == true) {
+        LOG_INFO("Starting mpd_reader for albumart");
+    }
+    else {
+        LOG_INFO("Starting mpd_reader %u", reader->id);
+    }
+    //On startup connect instantly
+    mpd_client_state->mpd_state->conn_state = MPD_DISCONNECTED;
+    while (s_signal_received == 0) {
+        mpd_reader_idle(config, mpd_client_state, request_queue, settings_queue, reader->cover);
+    }
+    //Cleanup
+    mpd_shared_mpd_disconnect(mpd_client_state->mpd_state);
+    free_mpd_client_state(mpd_client_state);
+    sdsfree(thread_logname);
+    return NULL;
+}
+
+void mpd_reader_push_settings(t_config *config, const char *data) {
+    for (unsigned i = 0; i < config->mpd_readers; i++) {
+        t_work_request *request = create_request(-1, 0, MYMPD_API_SETTINGS_SET, "MYMPD_API_SETTINGS_SET", data);
+        tiny_queue_push(mpd_reader_settings_queue[i], request, 0);
+    }
+    t_work_request *request = create_request(-1, 0, MYMPD_API_SETTINGS_SET, "MYMPD_API_SETTINGS_SET", data);
+    tiny_queue_push(mpd_cover_settings_queue, request, 0);
+}
+
+//private functions
+static void mpd_reader_idle(t_config *config, t_mpd_client_state *mpd_client_state, tiny_queue_t *request_queue,
+                            tiny_queue_t *settings_queue, bool cover)
+{
+    struct pollfd fds[1];
+    int pollrc;
+    unsigned settings_queue_length = 0;
+    unsigned request_queue_length = 0;
+
+    switch (mpd_client_state->mpd_state->conn_state) {
+        case MPD_WAIT: {
+            settings_queue_length = tiny_queue_length(settings_queue, 50);
+            if (settings_queue_length > 0) {
+                //allow to change mpd host
+                t_work_request *request = tiny_queue_shift(settings_queue, 50, 0);
+                if (request != NULL) {
+                    mpd_reader_settings(config, mpd_client_state, request);
+                    mpd_client_state->mpd_state->conn_state = MPD_DISCONNECTED;
+                }
+            }
+            //let the mpd_client thread serve or reject requests while disconnected
+            t_work_request *request = tiny_queue_shift(request_queue, 50, 0);
+            if (request != NULL) {
+                tiny_queue_push(mpd_client_queue, request, 0);
+            }
+
+            time_t now = time(NULL);
+            if (now > mpd_client_state->mpd_state->reconnect_time) {
+                mpd_client_state->mpd_state->conn_state = MPD_DISCONNECTED;
+            }
+            if (now < mpd_client_state->mpd_state->reconnect_time) {
+                //pause 100ms to prevent high cpu usage
+                my_usleep(100000);
+            }
+            break;
+        }
+        case MPD_DISCONNECTED:
+            /* Try to connect */
+            LOG_DEBUG("MPD reader connecting");
+            mpd_client_state->mpd_state->conn = mpd_connection_new(mpd_client_state->mpd_state->mpd_host, mpd_client_state->mpd_state->mpd_port, mpd_client_state->mpd_state->timeout);
+            if (mpd_client_state->mpd_state->conn == NULL) {
+                LOG_ERROR("MPD reader connection to failed: out-of-memory");
+                mpd_client_state->mpd_state->conn_state = MPD_FAILURE;
+                mpd_connection_free(mpd_client_state->mpd_state->conn);
+                return;
+            }
+
+            if (mpd_connection_get_error(mpd_client_state->mpd_state->conn) != MPD_ERROR_SUCCESS) {
+                LOG_ERROR("MPD reader connection: %s", mpd_connection_get_error_message(mpd_client_state->mpd_state->conn));
+                mpd_client_state->mpd_state->conn_state = MPD_FAILURE;
+                return;
+            }
+
+            if (sdslen(mpd_client_state->mpd_state->mpd_pass) > 0 && !mpd_run_password(mpd_client_state->mpd_state->conn, mpd_client_state->mpd_state->mpd_pass)) {
+                LOG_ERROR("MPD reader connection: %s", mpd_connection_get_error_message(mpd_client_state->mpd_state->conn));
+                mpd_client_state->mpd_state->conn_state = MPD_FAILURE;
+                return;
+            }
+
+            LOG_VERBOSE("MPD reader connected");
+            mpd_connection_set_timeout(mpd_client_state->mpd_state->conn, mpd_client_state->mpd_state->timeout);
+            mpd_client_state->mpd_state->conn_state = MPD_CONNECTED;
+            mpd_client_state->mpd_state->reconnect_interval = 0;
+            mpd_client_state->mpd_state->reconnect_time = 0;
+            //reset list of supported tags
+            reset_t_tags(&mpd_client_state->mpd_state->mpd_tag_types);
+            //get mpd features
+            mpd_client_mpd_features_detect(config, mpd_client_state);
+            //set binarylimit
+            mpd_client_set_binarylimit(config, mpd_client_state);
+            //idle keeps the connection open
+            if (!mpd_send_idle_mask(mpd_client_state->mpd_state->conn, MPD_IDLE_DATABASE)) {
+                LOG_ERROR("MPD reader entering idle mode failed");
+                mpd_client_state->mpd_state->conn_state = MPD_FAILURE;
+            }
+            break;
+
+        case MPD_FAILURE:
+            LOG_ERROR("MPD reader connection failed");
+            // fall through
+        case MPD_DISCONNECT:
+        case MPD_RECONNECT:
+            if (mpd_client_state->mpd_state->conn != NULL) {
+                mpd_connection_free(mpd_client_state->mpd_state->conn);
+            }
+            mpd_client_state->mpd_state->conn = NULL;
+            mpd_client_state->mpd_state->conn_state = MPD_WAIT;
+            if (mpd_client_state->mpd_state->reconnect_interval <= 20) {
+                mpd_client_state->mpd_state->reconnect_interval += 2;
+            }
+            mpd_client_state->mpd_state->reconnect_time = time(NULL) + mpd_client_state->mpd_state->reconnect_interval;
+            LOG_VERBOSE("MPD reader waiting %u seconds before reconnection", mpd_client_state->mpd_state->reconnect_interval);
+            break;
+
+        case MPD_CONNECTED:
+            fds[0].fd = mpd_connection_get_fd(mpd_client_state->mpd_state->conn);
+            fds[0].events = POLLIN;
+            pollrc = poll(fds, 1, 50);
+            settings_queue_length = tiny_queue_length(settings_queue, 0);
+            request_queue_length = tiny_queue_length(request_queue, 50);
+            if (pollrc > 0 || settings_queue_length > 0 || request_queue_length > 0) {
+                if (!mpd_send_noidle(mpd_client_state->mpd_state->conn)) {
+                    check_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0);
+                    mpd_client_state->mpd_state->conn_state = MPD_FAILURE;
+                    break;
+                }
+                //idle events are not used
+                mpd_response_finish(mpd_client_state->mpd_state->conn);
+                if (settings_queue_length > 0) {
+                    t_work_request *request = tiny_queue_shift(settings_queue, 50, 0);
+                    if (request != NULL) {
+                        mpd_reader_settings(config, mpd_client_state, request);
+                    }
+                }
+                if (request_queue_length > 0 && mpd_client_state->mpd_state->conn_state == MPD_CONNECTED) {
+                    //the request could be shifted by another reader
+                    t_work_request *request = tiny_queue_shift(request_queue, 50, 0);
+                    if (request != NULL) {
+                        if (cover == true) {
+                            mpd_client_getcover_stream(config, mpd_client_state, request_queue, request);
+                        }
+                        else {
+                            mpd_reader_api(config, mpd_client_state, request);
+                        }
+                    }
+                }
+                if (mpd_client_state->mpd_state->conn_state == MPD_CONNECTED &&
+                    !mpd_send_idle_mask(mpd_client_state->mpd_state->conn, MPD_IDLE_DATABASE))
+                {
+                    check_error_and_recover(mpd_client_state->mpd_state, NULL, NULL, 0);
+                    mpd_client_state->mpd_state->conn_state = MPD_FAILURE;
+                }
+            }
+            break;
+        default:
+            LOG_ERROR("Invalid mpd reader connection state");
+    }
+}
+
+static void mpd_reader_settings(t_config *config, t_mpd_client_state *mpd_client_state, t_work_request *request) {
+    void *h = NULL;
+    struct json_token key;
+    struct json_token val;
+    bool mpd_host_changed = false;
+    bool jukebox_changed = false;
+    bool features_changed = false;
+    bool check_mpd_error = false;
+    //player options are set by the mpd_client thread
+    enum mpd_conn_states conn_state = mpd_client_state->mpd_state->conn_state;
+    mpd_client_state->mpd_state->conn_state = MPD_DISCONNECTED;
+    while ((h = json_next_key(request->data, sdslen(request->data), h, ".params", &key, &val)) != NULL) {
+        if (mpd_api_settings_set(config, mpd_client_state, &key, &val, &mpd_host_changed, &jukebox_changed, &features_changed, &check_mpd_error) == false) {
+            LOG_ERROR("MPD reader can not apply setting %.*s", key.len, key.ptr);
+        }
+    }
+    mpd_client_state->mpd_state->conn_state = conn_state;
+    if (conn_state == MPD_CONNECTED) {
+        if (mpd_host_changed == true) {
+            //reconnect with new settings
+            mpd_client_state->mpd_state->conn_state = MPD_DISCONNECT;
+        }
+        else if (features_changed == true) {
+            //feature detection
+            mpd_client_mpd_features_detect(config, mpd_client_state);
+        }
+    }
+    free_request(request);
+}
+
+static void mpd_reader_api(t_config *config, t_mpd_client_state *mpd_client_state, t_work_request *request) {
+    //searches that add to the queue or a playlist are mutations
+    if (request->cmd_id == MPD_API_DATABASE_SEARCH || request->cmd_id == MPD_API_DATABASE_SEARCH_ADV) {
+        char *plist = NULL;
+        bool replace = false;
+        json_scanf(request->data, sdslen(request->data), "{params: {plist: %Q, replace: %B}}", &plist, &replace);
+        bool forward = (plist != NULL && strlen(plist) > 0) || replace == true ? true : false;
+        FREE_PTR(plist);
+        if (forward == true) {
+            LOG_DEBUG("Forwarding %s to mpd_client", request->method);
+            tiny_queue_push(mpd_client_queue, request, 0);
+            return;
+        }
+    }
+    mpd_client_api(config, mpd_client_state, request);
+}
@@ -0,0 +1,17 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __MPD_READER_H__
+#define __MPD_READER_H__
+typedef struct t_mpd_reader_arg {
+    t_config *config;
+    unsigned id;
+    bool cover; //serves the albumart queue
+} t_mpd_reader_arg;
+
+void *mpd_reader_loop(void *arg_reader);
+void mpd_reader_push_settings(t_config *config, const char *data);
+#endif
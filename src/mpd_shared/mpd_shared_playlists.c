@@ -10,10 +10,13 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h> 
+#include <stdint.h>
+#include <assert.h>
 #include <string.h>
 #include <mpd/client.h>
 
 #include "../../dist/src/sds/sds.h"
+#include "../../dist/src/rax/rax.h"
 #include "../sds_extras.h"
 #include "../api.h"
 #include "../list.h"
@@ -26,6 +29,17 @@
 #include "../random.h"
 #include "mpd_shared_playlists.h"
 
+//private definitions
+//every delete or move rewrites the playlist file in mpd, a rebuild writes it only once
+#define PLAYLIST_DIFF_MAX_REWRITES 10
+
+static bool _mpd_shared_playlist_content(t_mpd_state *mpd_state, const char *playlist, struct list *content, bool *exists);
+static bool _mpd_shared_playlist_rebuild(t_mpd_state *mpd_state, const char *playlist, struct list *content, bool exists);
+static unsigned *_mpd_shared_playlist_ids(rax *ids, struct list *l);
+static sds _mpd_shared_playlist_shuffle_sort_result(sds buffer, sds method, long request_id, const char *tagstr);
+
+//public functions
+
 unsigned long mpd_shared_get_db_mtime(t_mpd_state *mpd_state) {
     struct mpd_stats *stats = mpd_run_stats(mpd_state->conn);
     if (stats == NULL) {
@@ -107,12 +121,14 @@ sds mpd_shared_playlist_shuffle_sort(t_mpd_state *mpd_state, sds buffer, sds met
     struct list plist;
     list_init(&plist);
     struct mpd_song *song;
+    long pos = 0;
     while ((song = mpd_recv_song(mpd_state->conn)) != NULL) {
         const char *tag_value = NULL;
         if (sort_tags.tags[0] != MPD_TAG_UNKNOWN) {
             tag_value = mpd_song_get_tag(song, sort_tags.tags[0], 0);
         }
-        list_push(&plist, mpd_song_get_uri(song), 0, tag_value, NULL);
+        //the original position is needed to calculate the moves
+        list_push(&plist, mpd_song_get_uri(song), pos++, tag_value, NULL);
         mpd_song_free(song);
     }
     mpd_response_finish(mpd_state->conn);
@@ -153,6 +169,36 @@ sds mpd_shared_playlist_shuffle_sort(t_mpd_state *mpd_state, sds buffer, sds met
         }
     }
     
+    //few changes are applied in place, else the playlist is rebuild
+    unsigned *moves = malloc(2 * plist.length * sizeof(unsigned));
+    assert(moves);
+    unsigned moves_len = list_reorder_moves(&plist, moves);
+    if (moves_len <= PLAYLIST_DIFF_MAX_REWRITES) {
+        LOG_DEBUG("Reordering playlist %s with %u moves", uri, moves_len);
+        list_free(&plist);
+        if (moves_len > 0 && mpd_command_list_begin(mpd_state->conn, false) == true) {
+            for (unsigned i = 0; i < moves_len; i++) {
+                rc = mpd_send_playlist_move(mpd_state->conn, uri, moves[i * 2], moves[i * 2 + 1]);
+                if (rc == false) {
+                    LOG_ERROR("Error adding command to command list mpd_send_playlist_move");
+                    break;
+                }
+            }
+            if (mpd_command_list_end(mpd_state->conn)) {
+                mpd_response_finish(mpd_state->conn);
+            }
+        }
+        free(moves);
+        if (sort_tags.tags[0] != MPD_TAG_UNKNOWN) {
+            enable_mpd_tags(mpd_state, mpd_state->mympd_tag_types);
+        }
+        if (check_error_and_recover2(mpd_state, &buffer, method, request_id, false) == false) {
+            return buffer;
+        }
+        return _mpd_shared_playlist_shuffle_sort_result(buffer, method, request_id, tagstr);
+    }
+    free(moves);
+
     unsigned int randnr = randrange(100000,999999);
     sds uri_tmp = sdscatprintf(sdsempty(), "%u-tmp-%s", randnr, uri);
     sds uri_old = sdscatprintf(sdsempty(), "%u-old-%s", randnr, uri);
@@ -212,19 +258,12 @@ sds mpd_shared_playlist_shuffle_sort(t_mpd_state *mpd_state, sds buffer, sds met
     if (sort_tags.tags[0] != MPD_TAG_UNKNOWN) {
         enable_mpd_tags(mpd_state, mpd_state->mympd_tag_types);
     }
-    if (buffer != NULL) {
-        if (strcmp(tagstr, "shuffle") == 0) {
-            buffer = jsonrpc_respond_message(buffer, method, request_id, "Shuffled playlist succesfully", false);
-        }
-        else {
-            buffer = jsonrpc_respond_message(buffer, method, request_id, "Sorted playlist succesfully", false);
-        }
-    }
-    return buffer;
+    return _mpd_shared_playlist_shuffle_sort_result(buffer, method, request_id, tagstr);
 }
 
 bool mpd_shared_smartpls_save(t_config *config, const char *smartpltype, const char *playlist, 
-                              const char *tag, const char *searchstr, const int maxentries, const int timerange, const char *sort)
+                              const char *tag, const char *searchstr, const int maxentries, const int timerange, const char *sort,
+                              const bool generated)
 {
     if (validate_string_not_dir(playlist) == false) {
         return false;
@@ -246,12 +285,21 @@ bool mpd_shared_smartpls_save(t_config *config, const char *smartpltype, const c
         line = tojson_long(line, "maxentries", maxentries, true);
         line = tojson_long(line, "minvalue", timerange, true);
     }
+    else if (strcmp(smartpltype, "score") == 0) {
+        line = tojson_char(line, "expression", tag, true);
+        line = tojson_long(line, "maxentries", maxentries, true);
+        line = tojson_long(line, "minvalue", timerange, true);
+    }
     else if (strcmp(smartpltype, "newest") == 0) {
         line = tojson_long(line, "timerange", timerange, true);
     }
     else if (strcmp(smartpltype, "search") == 0) {
         line = tojson_char(line, "tag", tag, true);
         line = tojson_char(line, "searchstr", searchstr, true);
+        //maintained by the per tag generation, saving it from the ui removes the marker
+        if (generated == true) {
+            line = tojson_bool(line, "generated", true, true);
+        }
     }
     line = tojson_char(line, "sort", sort, false);
     line = sdscat(line, "}");
@@ -273,3 +321,198 @@ bool mpd_shared_smartpls_save(t_config *config, const char *smartpltype, const c
     sdsfree(pl_file);
     return true;
 }
+
+//replaces the content of a stored playlist with the minimal set of
+//playlistdelete, playlistadd and playlistmove commands in one command list
+bool mpd_shared_playlist_update(t_mpd_state *mpd_state, const char *playlist, struct list *content) {
+    struct list current;
+    list_init(&current);
+    bool exists = false;
+    if (_mpd_shared_playlist_content(mpd_state, playlist, &current, &exists) == false) {
+        list_free(&current);
+        return false;
+    }
+    if (content->length == 0) {
+        list_free(&current);
+        return _mpd_shared_playlist_rebuild(mpd_state, playlist, content, exists);
+    }
+    //map the uris to ids, duplicate entries share the same id
+    rax *ids = raxNew();
+    unsigned *old = _mpd_shared_playlist_ids(ids, &current);
+    unsigned *new = _mpd_shared_playlist_ids(ids, content);
+    unsigned *needed = calloc(raxSize(ids), sizeof(unsigned));
+    assert(needed);
+    raxFree(ids);
+    for (unsigned i = 0; i < content->length; i++) {
+        needed[new[i]]++;
+    }
+    //positions to delete in descending order, so that the remaining positions stay valid
+    unsigned *deletes = malloc((current.length + 1) * sizeof(unsigned));
+    assert(deletes);
+    unsigned deletes_len = 0;
+    unsigned *cur = malloc((current.length + content->length) * sizeof(unsigned));
+    assert(cur);
+    unsigned cur_len = 0;
+    for (unsigned i = current.length; i > 0; i--) {
+        if (needed[old[i - 1]] > 0) {
+            needed[old[i - 1]]--;
+            cur[cur_len++] = old[i - 1];
+        }
+        else {
+            deletes[deletes_len++] = i - 1;
+        }
+    }
+    //kept entries were collected in reverse order
+    for (unsigned i = 0; i < cur_len / 2; i++) {
+        unsigned tmp = cur[i];
+        cur[i] = cur[cur_len - 1 - i];
+        cur[cur_len - 1 - i] = tmp;
+    }
+    //songs to append
+    const char **adds = malloc(content->length * sizeof(char *));
+    assert(adds);
+    unsigned adds_len = 0;
+    struct list_node *current_node = content->head;
+    for (unsigned i = 0; i < content->length; i++) {
+        if (needed[new[i]] > 0) {
+            needed[new[i]]--;
+            cur[cur_len++] = new[i];
+            adds[adds_len++] = current_node->key;
+        }
+        current_node = current_node->next;
+    }
+    //moves to bring the entries in their final order
+    unsigned *moves = malloc(2 * (cur_len + 1) * sizeof(unsigned));
+    assert(moves);
+    unsigned moves_len = 0;
+    for (unsigned i = 0; i < cur_len && deletes_len + moves_len <= PLAYLIST_DIFF_MAX_REWRITES; i++) {
+        if (cur[i] == new[i]) {
+            continue;
+        }
+        unsigned j = i + 1;
+        while (cur[j] != new[i]) {
+            j++;
+        }
+        memmove(cur + i + 1, cur + i, (j - i) * sizeof(unsigned));
+        cur[i] = new[i];
+        moves[2 * moves_len] = j;
+        moves[2 * moves_len + 1] = i;
+        moves_len++;
+    }
+    bool rc = true;
+    if (deletes_len + moves_len > PLAYLIST_DIFF_MAX_REWRITES) {
+        rc = _mpd_shared_playlist_rebuild(mpd_state, playlist, content, exists);
+    }
+    else if (deletes_len + adds_len + moves_len == 0) {
+        LOG_DEBUG("Playlist %s is unchanged", playlist);
+    }
+    else if (mpd_command_list_begin(mpd_state->conn, false) == true) {
+        LOG_DEBUG("Updating playlist %s: %u deletes, %u adds, %u moves", playlist, deletes_len, adds_len, moves_len);
+        for (unsigned i = 0; i < deletes_len && rc == true; i++) {
+            rc = mpd_send_playlist_delete(mpd_state->conn, playlist, deletes[i]);
+        }
+        for (unsigned i = 0; i < adds_len && rc == true; i++) {
+            rc = mpd_send_playlist_add(mpd_state->conn, playlist, adds[i]);
+        }
+        for (unsigned i = 0; i < moves_len && rc == true; i++) {
+            rc = mpd_send_playlist_move(mpd_state->conn, playlist, moves[2 * i], moves[2 * i + 1]);
+        }
+        if (rc == false) {
+            LOG_ERROR("Error adding command to command list");
+        }
+        if (mpd_command_list_end(mpd_state->conn)) {
+            mpd_response_finish(mpd_state->conn);
+        }
+        rc = check_error_and_recover2(mpd_state, NULL, NULL, 0, false);
+    }
+    else {
+        rc = check_error_and_recover2(mpd_state, NULL, NULL, 0, false);
+    }
+    free(old);
+    free(new);
+    free(needed);
+    free(deletes);
+    free(cur);
+    free(adds);
+    free(moves);
+    list_free(&current);
+    return rc;
+}
+
+//private functions
+static bool _mpd_shared_playlist_content(t_mpd_state *mpd_state, const char *playlist, struct list *content, bool *exists) {
+    bool rc = mpd_send_list_playlist(mpd_state->conn, playlist);
+    if (check_rc_error_and_recover(mpd_state, NULL, NULL, 0, false, rc, "mpd_send_list_playlist") == false) {
+        return false;
+    }
+    struct mpd_song *song;
+    while ((song = mpd_recv_song(mpd_state->conn)) != NULL) {
+        list_push(content, mpd_song_get_uri(song), 0, NULL, NULL);
+        mpd_song_free(song);
+    }
+    mpd_response_finish(mpd_state->conn);
+    if (mpd_connection_get_error(mpd_state->conn) == MPD_ERROR_SERVER &&
+        mpd_connection_get_server_error(mpd_state->conn) == MPD_SERVER_ERROR_NO_EXIST)
+    {
+        //playlist does not exist yet
+        mpd_connection_clear_error(mpd_state->conn);
+        *exists = false;
+        return true;
+    }
+    *exists = true;
+    return check_error_and_recover2(mpd_state, NULL, NULL, 0, false);
+}
+
+static bool _mpd_shared_playlist_rebuild(t_mpd_state *mpd_state, const char *playlist, struct list *content, bool exists) {
+    LOG_DEBUG("Rebuilding playlist %s with %u songs", playlist, content->length);
+    if (exists == false && content->length == 0) {
+        return true;
+    }
+    if (mpd_command_list_begin(mpd_state->conn, false) == true) {
+        bool rc = true;
+        if (exists == true) {
+            rc = mpd_send_rm(mpd_state->conn, playlist);
+        }
+        struct list_node *current = content->head;
+        while (current != NULL && rc == true) {
+            rc = mpd_send_playlist_add(mpd_state->conn, playlist, current->key);
+            current = current->next;
+        }
+        if (rc == false) {
+            LOG_ERROR("Error adding command to command list");
+        }
+        if (mpd_command_list_end(mpd_state->conn)) {
+            mpd_response_finish(mpd_state->conn);
+        }
+    }
+    return check_error_and_recover2(mpd_state, NULL, NULL, 0, false);
+}
+
+static unsigned *_mpd_shared_playlist_ids(rax *ids, struct list *l) {
+    unsigned *list_ids = malloc((l->length + 1) * sizeof(unsigned));
+    assert(list_ids);
+    unsigned i = 0;
+    struct list_node *current = l->head;
+    while (current != NULL) {
+        void *data = raxFind(ids, (unsigned char *)current->key, sdslen(current->key));
+        if (data == raxNotFound) {
+            data = (void *)(uintptr_t)raxSize(ids);
+            raxInsert(ids, (unsigned char *)current->key, sdslen(current->key), data, NULL);
+        }
+        list_ids[i++] = (unsigned)(uintptr_t)data;
+        current = current->next;
+    }
+    return list_ids;
+}
+
+static sds _mpd_shared_playlist_shuffle_sort_result(sds buffer, sds method, long request_id, const char *tagstr) {
+    if (buffer != NULL) {
+        if (strcmp(tagstr, "shuffle") == 0) {
+            buffer = jsonrpc_respond_message(buffer, method, request_id, "Shuffled playlist succesfully", false);
+        }
+        else {
+            buffer = jsonrpc_respond_message(buffer, method, request_id, "Sorted playlist succesfully", false);
+        }
+    }
+    return buffer;
+}
@@ -76,7 +76,7 @@ static void mpd_worker_idle(t_config *config, t_mpd_worker_state *mpd_worker_sta
     unsigned mpd_worker_queue_length = 0;
     struct pollfd fds[1];
     int pollrc;
-    enum mpd_idle set_idle_mask = MPD_IDLE_DATABASE;
+    enum mpd_idle set_idle_mask = MPD_IDLE_DATABASE | MPD_IDLE_STICKER;
     
     switch (mpd_worker_state->mpd_state->conn_state) {
         case MPD_WAIT: {
@@ -173,7 +173,8 @@ static void mpd_worker_idle(t_config *config, t_mpd_worker_state *mpd_worker_sta
             pollrc = poll(fds, 1, 50);
 
             mpd_worker_queue_length = tiny_queue_length(mpd_worker_queue, 50);
-            if (pollrc > 0 || mpd_worker_queue_length > 0) {
+            bool smartpls_due = mpd_worker_smartpls_dirty_due(mpd_worker_state);
+            if (pollrc > 0 || mpd_worker_queue_length > 0 || smartpls_due == true) {
                 LOG_DEBUG("Leaving mpd worker idle mode");
                 if (!mpd_send_noidle(mpd_worker_state->mpd_state->conn)) {
                     check_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0);
@@ -198,6 +199,10 @@ static void mpd_worker_idle(t_config *config, t_mpd_worker_state *mpd_worker_sta
                         mpd_worker_api(config, mpd_worker_state, request);
                     }
                 }
+                if (mpd_worker_smartpls_dirty_due(mpd_worker_state) == true) {
+                    //update the smart playlists whose inputs have changed
+                    mpd_worker_smartpls_process_dirty(config, mpd_worker_state);
+                }
                 LOG_DEBUG("Entering mpd worker idle mode");
                 if (!mpd_send_idle_mask(mpd_worker_state->mpd_state->conn, set_idle_mask)) {
                     check_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0);
@@ -221,7 +226,8 @@ static void mpd_worker_parse_idle(t_config *config, t_mpd_worker_state *mpd_work
             LOG_VERBOSE("MPD idle event: %s", idle_name);
             switch(idle_event) {
                 case MPD_IDLE_DATABASE:
-                    mpd_worker_smartpls_update_all(config, mpd_worker_state, false);
+                case MPD_IDLE_STICKER:
+                    mpd_worker_smartpls_mark_dirty(config, mpd_worker_state, idle_event);
                     //sticker cache and album cache updates are triggered from mpd_client
                     break;
                 default: {
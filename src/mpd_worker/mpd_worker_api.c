@@ -27,6 +27,7 @@
 #include "mpd_worker_utility.h"
 #include "mpd_worker_smartpls.h"
 #include "mpd_worker_cache.h"
+#include "mpd_worker_thumbnails.h"
 #include "mpd_worker_api.h"
 
 //private definitions
@@ -130,7 +131,19 @@ void mpd_worker_api(t_config *config, t_mpd_worker_state *mpd_worker_state, void
         case MPDWORKER_API_CACHES_CREATE:
             je = json_scanf(request->data, sdslen(request->data), "{params: {featTags: %B, featSticker: %B}}", &bool_buf1, &bool_buf2);
             if (je == 2) {
-                mpd_worker_cache_init(mpd_worker_state, bool_buf1, bool_buf2);
+                if (config->thumbnails == true && config->covercache == true && bool_buf1 == true) {
+                    //pre-generate the thumbnails for all albums after the caches are pushed
+                    struct list album_uris;
+                    list_init(&album_uris);
+                    rc = mpd_worker_cache_init(mpd_worker_state, bool_buf1, bool_buf2, &album_uris);
+                    if (rc == true) {
+                        mpd_worker_thumbnails_create(config, mpd_worker_state, &album_uris);
+                    }
+                    list_free(&album_uris);
+                }
+                else {
+                    mpd_worker_cache_init(mpd_worker_state, bool_buf1, bool_buf2, NULL);
+                }
             }
             async = true;
             free_request(request);
@@ -208,12 +221,15 @@ static bool mpd_worker_api_settings_set(t_mpd_worker_state *mpd_worker_state, st
     }
     else if (strncmp(key->ptr, "smartplsSort", key->len) == 0) {
         mpd_worker_state->smartpls_sort = sdsreplacelen(mpd_worker_state->smartpls_sort, settingvalue, sdslen(settingvalue));
+        mpd_worker_state->generate_pls_db_mtime = 0;
     }
     else if (strncmp(key->ptr, "smartplsPrefix", key->len) == 0) {
         mpd_worker_state->smartpls_prefix = sdsreplacelen(mpd_worker_state->smartpls_prefix, settingvalue, sdslen(settingvalue));
+        mpd_worker_state->generate_pls_db_mtime = 0;
     }
     else if (strncmp(key->ptr, "generatePlsTags", key->len) == 0) {
         mpd_worker_state->generate_pls_tags = sdsreplacelen(mpd_worker_state->generate_pls_tags, settingvalue, sdslen(settingvalue));
+        mpd_worker_state->generate_pls_db_mtime = 0;
     }
     else if (strncmp(key->ptr, "taglist", key->len) == 0) {
         mpd_worker_state->mpd_state->taglist = sdsreplacelen(mpd_worker_state->mpd_state->taglist, settingvalue, sdslen(settingvalue));
@@ -31,10 +31,12 @@
 #include "mpd_worker_cache.h"
 
 //privat definitions
-static bool _cache_init(t_mpd_worker_state *mpd_worker_state, rax *album_cache, rax *sticker_cache, bool feat_tags, bool feat_sticker);
+static bool _cache_init(t_mpd_worker_state *mpd_worker_state, rax *album_cache, rax *sticker_cache, bool feat_tags, bool feat_sticker,
+                        struct list *album_uris);
 
 //public functions
-bool mpd_worker_cache_init(t_mpd_worker_state *mpd_worker_state, bool feat_tags, bool feat_sticker) {
+//album_uris is filled with the first song uri of each album, it can be NULL
+bool mpd_worker_cache_init(t_mpd_worker_state *mpd_worker_state, bool feat_tags, bool feat_sticker, struct list *album_uris) {
     rax *album_cache = NULL;
     if (feat_tags == true) {
         album_cache = raxNew();
@@ -46,7 +48,7 @@ bool mpd_worker_cache_init(t_mpd_worker_state *mpd_worker_state, bool feat_tags,
     
     bool rc = true;
     if (feat_tags == true || feat_sticker == true) {
-        rc =_cache_init(mpd_worker_state, album_cache, sticker_cache, feat_tags, feat_sticker);
+        rc =_cache_init(mpd_worker_state, album_cache, sticker_cache, feat_tags, feat_sticker, album_uris);
     }
 
     //push album cache building response to mpd_client thread
@@ -84,7 +86,9 @@ bool mpd_worker_cache_init(t_mpd_worker_state *mpd_worker_state, bool feat_tags,
 }
 
 //private functions
-static bool _cache_init(t_mpd_worker_state *mpd_worker_state, rax *album_cache, rax *sticker_cache, bool feat_tags, bool feat_sticker) {
+static bool _cache_init(t_mpd_worker_state *mpd_worker_state, rax *album_cache, rax *sticker_cache, bool feat_tags, bool feat_sticker,
+                        struct list *album_uris)
+{
     LOG_VERBOSE("Creating caches");
     unsigned start = 0;
     unsigned end = start + 1000;
@@ -143,6 +147,9 @@ static bool _cache_init(t_mpd_worker_state *mpd_worker_state, rax *album_cache,
                     }
                     else {
                         album_count++;
+                        if (album_uris != NULL) {
+                            list_push(album_uris, mpd_song_get_uri(song), 0, NULL, NULL);
+                        }
                     }
                 }
                 else {
@@ -0,0 +1,142 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <assert.h>
+#include <mpd/client.h>
+
+#include "../../dist/src/sds/sds.h"
+#include "../sds_extras.h"
+#include "../log.h"
+#include "../list.h"
+#include "config_defs.h"
+#include "../utility.h"
+#include "../mpd_shared/mpd_shared_typedefs.h"
+#include "../mpd_shared.h"
+#include "../mpd_shared/mpd_shared_playlists.h"
+#include "mpd_worker_utility.h"
+#include "mpd_worker_playlists.h"
+
+//private definitions
+//the job list is shared by all writers
+typedef struct t_playlists_queue {
+    struct list_node *next;
+    pthread_mutex_t lock;
+} t_playlists_queue;
+
+typedef struct t_playlists_writer {
+    t_mpd_state *mpd_state;
+    unsigned id;
+    unsigned written;
+    t_playlists_queue *queue;
+} t_playlists_writer;
+
+static void *mpd_worker_playlists_writer(void *arg);
+static bool mpd_worker_playlists_connect(t_mpd_state *mpd_state);
+
+//public functions
+//writes the playlists over several mpd connections in parallel,
+//the key of a job is the playlist name and the user_data the new content,
+//value_i of successful jobs is set to 1
+//returns the number of written playlists
+unsigned mpd_worker_playlists_write(t_mpd_worker_state *mpd_worker_state, struct list *jobs, unsigned writers) {
+    if (jobs->length == 0) {
+        return 0;
+    }
+    if (writers > PLAYLIST_WRITERS_MAX) {
+        writers = PLAYLIST_WRITERS_MAX;
+    }
+    if (writers > jobs->length) {
+        writers = jobs->length;
+    }
+    t_playlists_queue queue;
+    queue.next = jobs->head;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_t threads[PLAYLIST_WRITERS_MAX];
+    t_playlists_writer args[PLAYLIST_WRITERS_MAX];
+    unsigned started = 0;
+    for (unsigned i = 0; i < writers; i++) {
+        t_mpd_state *mpd_state = (t_mpd_state *)malloc(sizeof(t_mpd_state));
+        assert(mpd_state);
+        mpd_shared_default_mpd_state(mpd_state);
+        mpd_state->conn = NULL;
+        mpd_state->mpd_host = sdsreplace(mpd_state->mpd_host, mpd_worker_state->mpd_state->mpd_host);
+        mpd_state->mpd_port = mpd_worker_state->mpd_state->mpd_port;
+        mpd_state->mpd_pass = sdsreplace(mpd_state->mpd_pass, mpd_worker_state->mpd_state->mpd_pass);
+        mpd_state->timeout = mpd_worker_state->mpd_state->timeout;
+        mpd_state->mympd_tag_types = mpd_worker_state->mpd_state->mympd_tag_types;
+        mpd_state->feat_tags = mpd_worker_state->mpd_state->feat_tags;
+        args[started].mpd_state = mpd_state;
+        args[started].id = i;
+        args[started].written = 0;
+        args[started].queue = &queue;
+        if (pthread_create(&threads[started], NULL, mpd_worker_playlists_writer, &args[started]) != 0) {
+            LOG_ERROR("Can't create playlist writer thread");
+            mpd_shared_free_mpd_state(mpd_state);
+            break;
+        }
+        started++;
+    }
+    unsigned written = 0;
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        written += args[i].written;
+        mpd_shared_free_mpd_state(args[i].mpd_state);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    LOG_VERBOSE("Written %u of %u playlists with %u connections", written, jobs->length, started);
+    return written;
+}
+
+//private functions
+static void *mpd_worker_playlists_writer(void *arg) {
+    t_playlists_writer *writer = (t_playlists_writer *)arg;
+    thread_logname = sdscatfmt(sdsempty(), "plswriter%u", writer->id);
+    if (mpd_worker_playlists_connect(writer->mpd_state) == true) {
+        while (writer->mpd_state->conn_state == MPD_CONNECTED) {
+            pthread_mutex_lock(&writer->queue->lock);
+            struct list_node *job = writer->queue->next;
+            if (job != NULL) {
+                writer->queue->next = job->next;
+            }
+            pthread_mutex_unlock(&writer->queue->lock);
+            if (job == NULL) {
+                break;
+            }
+            if (mpd_shared_playlist_update(writer->mpd_state, job->key, (struct list *)job->user_data) == true) {
+                job->value_i = 1;
+                writer->written++;
+            }
+        }
+    }
+    if (writer->mpd_state->conn != NULL) {
+        mpd_connection_free(writer->mpd_state->conn);
+    }
+    sdsfree(thread_logname);
+    return NULL;
+}
+
+static bool mpd_worker_playlists_connect(t_mpd_state *mpd_state) {
+    mpd_state->conn = mpd_connection_new(mpd_state->mpd_host, mpd_state->mpd_port, mpd_state->timeout);
+    if (mpd_state->conn == NULL) {
+        LOG_ERROR("Playlist writer connection failed: out-of-memory");
+        return false;
+    }
+    if (mpd_connection_get_error(mpd_state->conn) != MPD_ERROR_SUCCESS) {
+        LOG_ERROR("Playlist writer connection: %s", mpd_connection_get_error_message(mpd_state->conn));
+        return false;
+    }
+    if (sdslen(mpd_state->mpd_pass) > 0 && !mpd_run_password(mpd_state->conn, mpd_state->mpd_pass)) {
+        LOG_ERROR("Playlist writer connection: %s", mpd_connection_get_error_message(mpd_state->conn));
+        return false;
+    }
+    mpd_state->conn_state = MPD_CONNECTED;
+    return true;
+}
@@ -0,0 +1,13 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __MPD_WORKER_PLAYLISTS_H__
+#define __MPD_WORKER_PLAYLISTS_H__
+
+#define PLAYLIST_WRITERS_MAX 4
+
+unsigned mpd_worker_playlists_write(t_mpd_worker_state *mpd_worker_state, struct list *jobs, unsigned writers);
+#endif
@@ -4,6 +4,7 @@
  https://github.com/jcorporation/mympd
 */
 
+#include <assert.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -15,6 +16,7 @@
 #include <mpd/client.h>
 
 #include "../../dist/src/sds/sds.h"
+#include "../../dist/src/rax/rax.h"
 #include "../sds_extras.h"
 #include "../../dist/src/frozen/frozen.h"
 #include "../api.h"
@@ -28,62 +30,236 @@
 #include "../mpd_shared/mpd_shared_search.h"
 #include "../mpd_shared/mpd_shared_playlists.h"
 #include "mpd_worker_utility.h"
+#include "mpd_worker_sticker_index.h"
+#include "mpd_worker_playlists.h"
 #include "mpd_worker_smartpls.h"
 
 //private definitions
-static bool mpd_worker_smartpls_per_tag(t_config *mpd_config, t_mpd_worker_state *mpd_worker_state);
-static bool mpd_worker_smartpls_clear(t_mpd_worker_state *mpd_worker_state, const char *playlist);
-static bool mpd_worker_smartpls_update_search(t_mpd_worker_state *mpd_worker_state, const char *playlist, const char *tag, const char *searchstr);
-static bool mpd_worker_smartpls_update_sticker(t_mpd_worker_state *mpd_worker_state, const char *playlist, const char *sticker, const int maxentries, const int minvalue);
-static bool mpd_worker_smartpls_update_newest(t_mpd_worker_state *mpd_worker_state, const char *playlist, const int timerange);
+#define SMARTPLS_INPUT_DATABASE MPD_IDLE_DATABASE
+#define SMARTPLS_INPUT_STICKER MPD_IDLE_STICKER
+#define SMARTPLS_INPUT_TIME 0x10000
+//maintained by the per tag generation
+#define SMARTPLS_INPUT_GENERATED 0x20000
+//sticker changes come in bursts while songs are played
+#define SMARTPLS_DIRTY_DELAY 30
+
+//inputs of a smart playlist, recorded on each evaluation
+typedef struct t_smartpls_inputs {
+    unsigned inputs;
+    time_t evaluated;
+    unsigned long long hash;
+} t_smartpls_inputs;
+
+//songs of one tag value for the per tag generation
+typedef struct t_smartpls_group {
+    struct list members;
+    enum mpd_tag_type tag;
+    sds value;
+    unsigned long long hash;
+} t_smartpls_group;
+
+static bool mpd_worker_smartpls_per_tag(t_config *config, t_mpd_worker_state *mpd_worker_state, bool force);
+static unsigned long long mpd_worker_smartpls_hash(const char *uri);
+static void mpd_worker_smartpls_enqueue(t_mpd_worker_state *mpd_worker_state, const char *playlist);
+static bool mpd_worker_smartpls_playlist_mtimes(t_mpd_worker_state *mpd_worker_state, rax *mtimes);
+static t_smartpls_inputs *mpd_worker_smartpls_set_inputs(t_mpd_worker_state *mpd_worker_state, const char *playlist, unsigned inputs);
+static bool mpd_worker_smartpls_search(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *expression,
+                                       const char *tag, bool exact, time_t modified_since, enum mpd_tag_type sort_tag);
+static bool mpd_worker_smartpls_update_search(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *tag,
+                                              const char *searchstr, enum mpd_tag_type sort_tag);
+static bool mpd_worker_smartpls_update_playlist(t_config *config, t_mpd_worker_state *mpd_worker_state, const char *playlist,
+                                                t_sticker_index *sticker_index);
+static bool mpd_worker_smartpls_update_sticker(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *sticker,
+                                               const int maxentries, const int minvalue, t_sticker_index *sticker_index);
+static bool mpd_worker_smartpls_update_score(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *expression,
+                                             const int maxentries, const int minvalue, t_sticker_index *sticker_index, unsigned *inputs);
+static bool mpd_worker_smartpls_update_newest(t_mpd_worker_state *mpd_worker_state, struct list *content, const int timerange,
+                                              enum mpd_tag_type sort_tag);
+static void mpd_worker_smartpls_get_sort_values(t_mpd_worker_state *mpd_worker_state, struct list *content, enum mpd_tag_type sort_tag);
+static void mpd_worker_smartpls_sort(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *sort, enum mpd_tag_type sort_tag);
 
 //public functions
+//checks all smart playlists against the database, the definition and the playlist mtime
+//and updates the changed ones, all playlist mtimes are fetched with one listplaylists
 bool mpd_worker_smartpls_update_all(t_config *config, t_mpd_worker_state *mpd_worker_state, bool force) {
     if (mpd_worker_state->feat_smartpls == false) {
         LOG_DEBUG("Smart playlists are disabled");
         return true;
     }
     
-    mpd_worker_smartpls_per_tag(config, mpd_worker_state);
+    mpd_worker_smartpls_per_tag(config, mpd_worker_state, force);
 
     unsigned long db_mtime = mpd_shared_get_db_mtime(mpd_worker_state->mpd_state);
     LOG_DEBUG("Database mtime: %d", db_mtime);
+    rax *mtimes = raxNew();
+    if (force == false && mpd_worker_smartpls_playlist_mtimes(mpd_worker_state, mtimes) == false) {
+        raxFree(mtimes);
+        return false;
+    }
     
     sds dirname = sdscatfmt(sdsempty(), "%s/smartpls", config->varlibdir);
     DIR *dir = opendir (dirname);
-    if (dir != NULL) {
-        struct dirent *ent;
-        while ((ent = readdir(dir)) != NULL) {
-            if (strncmp(ent->d_name, ".", 1) == 0) {
-                continue;
-            }
-            unsigned long playlist_mtime = mpd_shared_get_playlist_mtime(mpd_worker_state->mpd_state, ent->d_name);
-            unsigned long smartpls_mtime = mpd_shared_get_smartpls_mtime(config, ent->d_name);
-            LOG_DEBUG("Playlist %s: playlist mtime %d, smartpls mtime %d", ent->d_name, playlist_mtime, smartpls_mtime);
-            if (force == true || db_mtime > playlist_mtime || smartpls_mtime > playlist_mtime) {
-                mpd_worker_smartpls_update(config, mpd_worker_state, ent->d_name);
-            }
-            else {
-                LOG_VERBOSE("Update of smart playlist %s skipped, already up to date", ent->d_name);
+    if (dir == NULL) {
+        LOG_ERROR("Can't open smart playlist directory %s: %s", dirname, strerror(errno));
+        sdsfree(dirname);
+        raxFree(mtimes);
+        return false;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, ".", 1) == 0) {
+            continue;
+        }
+        size_t len = strlen(ent->d_name);
+        //the playlist is not touched if the content has not changed, the evaluation time is the reference
+        t_smartpls_inputs *inputs = raxFind(mpd_worker_state->smartpls_inputs, (unsigned char *)ent->d_name, len);
+        if (inputs == raxNotFound) {
+            inputs = NULL;
+        }
+        if (force == true) {
+            if (inputs == NULL || (inputs->inputs & SMARTPLS_INPUT_GENERATED) == 0) {
+                mpd_worker_smartpls_enqueue(mpd_worker_state, ent->d_name);
             }
+            continue;
+        }
+        void *data = raxFind(mtimes, (unsigned char *)ent->d_name, len);
+        unsigned long playlist_mtime = data != raxNotFound ? (unsigned long)(uintptr_t)data : 0;
+        unsigned long smartpls_mtime = mpd_shared_get_smartpls_mtime(config, ent->d_name);
+        unsigned long last_update = playlist_mtime;
+        if (inputs != NULL && (unsigned long)inputs->evaluated > last_update) {
+            last_update = (unsigned long)inputs->evaluated;
+        }
+        LOG_DEBUG("Playlist %s: last update %d, smartpls mtime %d", ent->d_name, last_update, smartpls_mtime);
+        if (smartpls_mtime > last_update ||
+            (db_mtime > last_update && (inputs == NULL || (inputs->inputs & SMARTPLS_INPUT_DATABASE) != 0)) ||
+            (inputs != NULL && (inputs->inputs & SMARTPLS_INPUT_TIME) != 0))
+        {
+            mpd_worker_smartpls_enqueue(mpd_worker_state, ent->d_name);
+        }
+        else {
+            LOG_VERBOSE("Update of smart playlist %s skipped, already up to date", ent->d_name);
         }
-        closedir (dir);
     }
-    else {
+    closedir (dir);
+    sdsfree(dirname);
+    raxFree(mtimes);
+    return mpd_worker_smartpls_process_dirty(config, mpd_worker_state);
+}
+
+//marks all smart playlists that depend on the changed inputs as dirty,
+//playlists that were not evaluated yet are always marked
+void mpd_worker_smartpls_mark_dirty(t_config *config, t_mpd_worker_state *mpd_worker_state, unsigned idle_events) {
+    if (mpd_worker_state->feat_smartpls == false) {
+        return;
+    }
+    if ((idle_events & SMARTPLS_INPUT_DATABASE) != 0) {
+        mpd_worker_smartpls_per_tag(config, mpd_worker_state, false);
+    }
+    sds dirname = sdscatfmt(sdsempty(), "%s/smartpls", config->varlibdir);
+    DIR *dir = opendir (dirname);
+    if (dir == NULL) {
         LOG_ERROR("Can't open smart playlist directory %s: %s", dirname, strerror(errno));
         sdsfree(dirname);
-        return false;
+        return;
     }
+    unsigned marked = mpd_worker_state->smartpls_dirty.length;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, ".", 1) == 0) {
+            continue;
+        }
+        t_smartpls_inputs *inputs = raxFind(mpd_worker_state->smartpls_inputs, (unsigned char *)ent->d_name, strlen(ent->d_name));
+        if (inputs == raxNotFound || (inputs->inputs & idle_events) != 0) {
+            mpd_worker_smartpls_enqueue(mpd_worker_state, ent->d_name);
+        }
+    }
+    closedir (dir);
     sdsfree(dirname);
-    return true;
+    if ((idle_events & SMARTPLS_INPUT_DATABASE) != 0) {
+        mpd_worker_state->smartpls_dirty_time = time(NULL);
+    }
+    else if (marked == 0) {
+        mpd_worker_state->smartpls_dirty_time = time(NULL) + SMARTPLS_DIRTY_DELAY;
+    }
+    LOG_DEBUG("%u smart playlists marked dirty", mpd_worker_state->smartpls_dirty.length);
+}
+
+bool mpd_worker_smartpls_dirty_due(t_mpd_worker_state *mpd_worker_state) {
+    return mpd_worker_state->smartpls_dirty.length > 0 &&
+        time(NULL) >= mpd_worker_state->smartpls_dirty_time;
+}
+
+//updates all queued playlists, the sticker values are fetched only once for all of them
+bool mpd_worker_smartpls_process_dirty(t_config *config, t_mpd_worker_state *mpd_worker_state) {
+    bool rc = true;
+    t_sticker_index sticker_index;
+    sticker_index_init(&sticker_index);
+    struct list_node *current;
+    while ((current = list_shift_first(&mpd_worker_state->smartpls_dirty)) != NULL) {
+        if (mpd_worker_smartpls_update_playlist(config, mpd_worker_state, current->key, &sticker_index) == false) {
+            rc = false;
+        }
+        list_node_free(current);
+    }
+    sticker_index_free(&sticker_index);
+    return rc;
 }
 
 bool mpd_worker_smartpls_update(t_config *config, t_mpd_worker_state *mpd_worker_state, const char *playlist) {
+    t_sticker_index sticker_index;
+    sticker_index_init(&sticker_index);
+    bool rc = mpd_worker_smartpls_update_playlist(config, mpd_worker_state, playlist, &sticker_index);
+    sticker_index_free(&sticker_index);
+    return rc;
+}
+
+//private functions
+static void mpd_worker_smartpls_enqueue(t_mpd_worker_state *mpd_worker_state, const char *playlist) {
+    if (list_get_node(&mpd_worker_state->smartpls_dirty, playlist) == NULL) {
+        list_push(&mpd_worker_state->smartpls_dirty, playlist, 0, NULL, NULL);
+    }
+}
+
+//playlist name -> last modified, saved as pointer value
+static bool mpd_worker_smartpls_playlist_mtimes(t_mpd_worker_state *mpd_worker_state, rax *mtimes) {
+    bool rc = mpd_send_list_playlists(mpd_worker_state->mpd_state->conn);
+    if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_send_list_playlists") == false) {
+        return false;
+    }
+    struct mpd_playlist *pl;
+    while ((pl = mpd_recv_playlist(mpd_worker_state->mpd_state->conn)) != NULL) {
+        const char *plpath = mpd_playlist_get_path(pl);
+        raxInsert(mtimes, (unsigned char *)plpath, strlen(plpath), (void *)(uintptr_t)mpd_playlist_get_last_modified(pl), NULL);
+        mpd_playlist_free(pl);
+    }
+    mpd_response_finish(mpd_worker_state->mpd_state->conn);
+    return check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false);
+}
+
+static t_smartpls_inputs *mpd_worker_smartpls_set_inputs(t_mpd_worker_state *mpd_worker_state, const char *playlist, unsigned inputs) {
+    size_t len = strlen(playlist);
+    t_smartpls_inputs *entry = raxFind(mpd_worker_state->smartpls_inputs, (unsigned char *)playlist, len);
+    if (entry == raxNotFound) {
+        entry = malloc(sizeof(t_smartpls_inputs));
+        assert(entry);
+        entry->hash = 0;
+        raxInsert(mpd_worker_state->smartpls_inputs, (unsigned char *)playlist, len, entry, NULL);
+    }
+    entry->inputs = inputs;
+    entry->evaluated = time(NULL);
+    return entry;
+}
+
+//the new content is build in memory and only the differences are written to the playlist
+static bool mpd_worker_smartpls_update_playlist(t_config *config, t_mpd_worker_state *mpd_worker_state, const char *playlist,
+                                                t_sticker_index *sticker_index)
+{
     char *smartpltype = NULL;
     int je;
     bool rc = true;
     char *p_charbuf1 = NULL;
     char *p_charbuf2 = NULL;
+    char *sort = NULL;
     int int_buf1;
     int int_buf2;
     
@@ -98,30 +274,55 @@ bool mpd_worker_smartpls_update(t_config *config, t_mpd_worker_state *mpd_worker
     
     sds filename = sdscatfmt(sdsempty(), "%s/smartpls/%s", config->varlibdir, playlist);
     char *content = json_fread(filename);
-    sdsfree(filename);
     if (content == NULL) {
         LOG_ERROR("Cant read smart playlist %s", playlist);
+        sdsfree(filename);
         return false;
     }
     je = json_scanf(content, (int)strlen(content), "{type: %Q }", &smartpltype);
     if (je != 1) {
         LOG_ERROR("Cant read smart playlist type from %s", filename);
+        sdsfree(filename);
+        FREE_PTR(content);
         return false;
     }
+    //only the uris and the sort tag are needed
+    t_tags sort_tags;
+    sort_tags.len = 0;
+    enum mpd_tag_type sort_tag = MPD_TAG_UNKNOWN;
+    je = json_scanf(content, (int)strlen(content), "{sort: %Q}", &sort);
+    if (je == 1 && mpd_worker_state->mpd_state->feat_tags == true) {
+        sort_tag = mpd_tag_name_parse(sort);
+        if (sort_tag != MPD_TAG_UNKNOWN) {
+            sort_tags.tags[sort_tags.len++] = sort_tag;
+        }
+    }
+    enable_mpd_tags(mpd_worker_state->mpd_state, sort_tags);
+
+    struct list new_content;
+    list_init(&new_content);
+    unsigned inputs = 0;
     if (strcmp(smartpltype, "sticker") == 0) {
+        inputs = SMARTPLS_INPUT_STICKER;
         je = json_scanf(content, (int)strlen(content), "{sticker: %Q, maxentries: %d, minvalue: %d}", &p_charbuf1, &int_buf1, &int_buf2);
         if (je == 3) {
-            if (mpd_worker_smartpls_update_sticker(mpd_worker_state, playlist, p_charbuf1, int_buf1, int_buf2) == false) {
-                LOG_ERROR("Update of smart playlist %s failed.", playlist);
-                rc = false;
-            }
+            rc = mpd_worker_smartpls_update_sticker(mpd_worker_state, &new_content, p_charbuf1, int_buf1, int_buf2, sticker_index);
         }
         else if (je == 2) {
             //for backward compatibility
-            if (mpd_worker_smartpls_update_sticker(mpd_worker_state, playlist, p_charbuf1, int_buf1, 2) == false) {
-                LOG_ERROR("Update of smart playlist %s failed.", playlist);
-                rc = false;
-            }
+            rc = mpd_worker_smartpls_update_sticker(mpd_worker_state, &new_content, p_charbuf1, int_buf1, 2, sticker_index);
+        }
+        else {
+            LOG_ERROR("Can't parse smart playlist file %s", filename);
+            rc = false;
+        }
+        FREE_PTR(p_charbuf1);
+    }
+    else if (strcmp(smartpltype, "score") == 0) {
+        inputs = SMARTPLS_INPUT_STICKER;
+        je = json_scanf(content, (int)strlen(content), "{expression: %Q, maxentries: %d, minvalue: %d}", &p_charbuf1, &int_buf1, &int_buf2);
+        if (je == 3) {
+            rc = mpd_worker_smartpls_update_score(mpd_worker_state, &new_content, p_charbuf1, int_buf1, int_buf2, sticker_index, &inputs);
         }
         else {
             LOG_ERROR("Can't parse smart playlist file %s", filename);
@@ -130,12 +331,10 @@ bool mpd_worker_smartpls_update(t_config *config, t_mpd_worker_state *mpd_worker
         FREE_PTR(p_charbuf1);
     }
     else if (strcmp(smartpltype, "newest") == 0) {
+        inputs = SMARTPLS_INPUT_DATABASE;
         je = json_scanf(content, (int)strlen(content), "{timerange: %d}", &int_buf1);
         if (je == 1) {
-            if (mpd_worker_smartpls_update_newest(mpd_worker_state, playlist, int_buf1) == false) {
-                LOG_ERROR("Update of smart playlist %s failed", playlist);
-                rc = false;
-            }
+            rc = mpd_worker_smartpls_update_newest(mpd_worker_state, &new_content, int_buf1, sort_tag);
         }
         else {
             LOG_ERROR("Can't parse smart playlist file %s", filename);
@@ -143,13 +342,19 @@ bool mpd_worker_smartpls_update(t_config *config, t_mpd_worker_state *mpd_worker
         }
     }
     else if (strcmp(smartpltype, "search") == 0) {
+        inputs = SMARTPLS_INPUT_DATABASE;
         je = json_scanf(content, (int)strlen(content), "{tag: %Q, searchstr: %Q}", &p_charbuf1, &p_charbuf2);
         if (je == 2) {
-            if (mpd_worker_smartpls_update_search(mpd_worker_state, playlist, p_charbuf1, p_charbuf2) == false) {
-                LOG_ERROR("Update of smart playlist %s failed", playlist);
-                rc = false;
+            bool generated = false;
+            json_scanf(content, (int)strlen(content), "{generated: %B}", &generated);
+            if (generated == true) {
+                //keep the playlist under control of the per tag generation
+                inputs = SMARTPLS_INPUT_GENERATED;
+                rc = mpd_worker_smartpls_search(mpd_worker_state, &new_content, p_charbuf2, p_charbuf1, true, 0, sort_tag);
+            }
+            else {
+                rc = mpd_worker_smartpls_update_search(mpd_worker_state, &new_content, p_charbuf1, p_charbuf2, sort_tag);
             }
-
         }
         else {
             LOG_ERROR("Can't parse smart playlist file %s", filename);
@@ -158,198 +363,296 @@ bool mpd_worker_smartpls_update(t_config *config, t_mpd_worker_state *mpd_worker
         FREE_PTR(p_charbuf1);
         FREE_PTR(p_charbuf2);
     }
+    //sticker results have no tags
+    if (rc == true && sort_tag != MPD_TAG_UNKNOWN &&
+        (strcmp(smartpltype, "sticker") == 0 || strcmp(smartpltype, "score") == 0))
+    {
+        mpd_worker_smartpls_get_sort_values(mpd_worker_state, &new_content, sort_tag);
+    }
+    enable_mpd_tags(mpd_worker_state->mpd_state, mpd_worker_state->mpd_state->mympd_tag_types);
     if (rc == true) {
-        je = json_scanf(content, (int)strlen(content), "{sort: %Q}", &p_charbuf1);
-        if (je == 1 && strlen(p_charbuf1) > 0) {
-            mpd_shared_playlist_shuffle_sort(mpd_worker_state->mpd_state, NULL, NULL, 0, playlist, p_charbuf1);
+        if (sort != NULL && strlen(sort) > 0) {
+            mpd_worker_smartpls_sort(mpd_worker_state, &new_content, sort, sort_tag);
         }
-        FREE_PTR(p_charbuf1);
+        rc = mpd_shared_playlist_update(mpd_worker_state->mpd_state, playlist, &new_content);
+    }
+    if (rc == true) {
+        LOG_VERBOSE("Updated smart playlist %s with %u songs", playlist, new_content.length);
+        t_smartpls_inputs *entry = mpd_worker_smartpls_set_inputs(mpd_worker_state, playlist, inputs);
+        if (inputs == SMARTPLS_INPUT_GENERATED) {
+            entry->hash = 0;
+            struct list_node *current = new_content.head;
+            while (current != NULL) {
+                entry->hash += mpd_worker_smartpls_hash(current->key);
+                current = current->next;
+            }
+        }
+    }
+    else {
+        LOG_ERROR("Update of smart playlist %s failed", playlist);
     }
+    list_free(&new_content);
+    sdsfree(filename);
+    FREE_PTR(sort);
     FREE_PTR(smartpltype);
     FREE_PTR(content);
     return rc;
 }
 
-//private functions
-static bool mpd_worker_smartpls_per_tag(t_config *config, t_mpd_worker_state *mpd_worker_state) {
-    for (size_t i = 0; i < mpd_worker_state->generate_pls_tag_types.len; i++) {
-        enum mpd_tag_type tag = mpd_worker_state->generate_pls_tag_types.tags[i];
-        bool rc = mpd_search_db_tags(mpd_worker_state->mpd_state->conn, tag);
-
-        if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_search_db_tags") == false) {
-            mpd_search_cancel(mpd_worker_state->mpd_state->conn);
-            return false;
+//one windowed pass over the database grouped locally by the tag values,
+//only playlists whose member set has changed since the last generation are written
+static bool mpd_worker_smartpls_per_tag(t_config *config, t_mpd_worker_state *mpd_worker_state, bool force) {
+    if (mpd_worker_state->generate_pls_tag_types.len == 0) {
+        return true;
+    }
+    unsigned long db_mtime = mpd_shared_get_db_mtime(mpd_worker_state->mpd_state);
+    if (force == false && db_mtime > 0 && db_mtime == mpd_worker_state->generate_pls_db_mtime) {
+        LOG_DEBUG("Database unchanged, skipping generation of tag playlists");
+        return true;
+    }
+    t_tags pass_tags = mpd_worker_state->generate_pls_tag_types;
+    enum mpd_tag_type sort_tag = MPD_TAG_UNKNOWN;
+    if (mpd_worker_state->mpd_state->feat_tags == true) {
+        sort_tag = mpd_tag_name_parse(mpd_worker_state->smartpls_sort);
+        if (sort_tag != MPD_TAG_UNKNOWN && pass_tags.len < 64) {
+            pass_tags.tags[pass_tags.len++] = sort_tag;
+        }
+    }
+    enable_mpd_tags(mpd_worker_state->mpd_state, pass_tags);
+    rax *groups = raxNew();
+    sds playlist = sdsempty();
+    struct mpd_connection *conn = mpd_worker_state->mpd_state->conn;
+    //fetch the database in windows of 1000 songs
+    unsigned start = 0;
+    unsigned end = start + 1000;
+    unsigned i = 0;
+    bool rc = true;
+    do {
+        if (mpd_search_db_songs(conn, false) == false ||
+            mpd_search_add_uri_constraint(conn, MPD_OPERATOR_DEFAULT, "") == false ||
+            mpd_search_add_window(conn, start, end) == false)
+        {
+            check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, false, "mpd_search_db_songs");
+            mpd_search_cancel(conn);
+            rc = false;
+            break;
         }
-        rc = mpd_search_commit(mpd_worker_state->mpd_state->conn);
+        rc = mpd_search_commit(conn);
         if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_search_commit") == false) {
-            return false;
-        }
-        struct mpd_pair *pair;
-        struct list tag_list;
-        list_init(&tag_list);
-        while ((pair = mpd_recv_pair_tag(mpd_worker_state->mpd_state->conn, tag)) != NULL) {
-            if (strlen(pair->value) > 0) {
-                list_push(&tag_list, pair->value, 0, NULL, NULL);
+            rc = false;
+            break;
+        }
+        struct mpd_song *song;
+        while ((song = mpd_recv_song(conn)) != NULL) {
+            const char *uri = mpd_song_get_uri(song);
+            const char *sort_value = sort_tag != MPD_TAG_UNKNOWN ? mpd_song_get_tag(song, sort_tag, 0) : NULL;
+            for (size_t t = 0; t < mpd_worker_state->generate_pls_tag_types.len; t++) {
+                enum mpd_tag_type tag = mpd_worker_state->generate_pls_tag_types.tags[t];
+                const char *value;
+                unsigned idx = 0;
+                while ((value = mpd_song_get_tag(song, tag, idx++)) != NULL) {
+                    if (value[0] == '\0') {
+                        continue;
+                    }
+                    sdsclear(playlist);
+                    playlist = sdscatfmt(playlist, "%s%s%s-%s", mpd_worker_state->smartpls_prefix, (sdslen(mpd_worker_state->smartpls_prefix) > 0 ? "-" : ""), mpd_tag_name(tag), value);
+                    t_smartpls_group *group = raxFind(groups, (unsigned char *)playlist, sdslen(playlist));
+                    if (group == raxNotFound) {
+                        group = malloc(sizeof(t_smartpls_group));
+                        assert(group);
+                        list_init(&group->members);
+                        group->tag = tag;
+                        group->value = sdsnew(value);
+                        group->hash = 0;
+                        raxInsert(groups, (unsigned char *)playlist, sdslen(playlist), group, NULL);
+                    }
+                    list_push(&group->members, uri, 0, sort_value, NULL);
+                    group->hash += mpd_worker_smartpls_hash(uri);
+                }
             }
-            mpd_return_pair(mpd_worker_state->mpd_state->conn, pair);
+            mpd_song_free(song);
+            i++;
         }
-        mpd_response_finish(mpd_worker_state->mpd_state->conn);
-        if (check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false) == false) {
-            list_free(&tag_list);
-            return false;
+        mpd_response_finish(conn);
+        rc = check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false);
+        start = end;
+        end = end + 1000;
+    } while (rc == true && i >= start);
+    enable_mpd_tags(mpd_worker_state->mpd_state, mpd_worker_state->mpd_state->mympd_tag_types);
+
+    struct list jobs;
+    list_init(&jobs);
+    raxIterator iter;
+    raxStart(&iter, groups);
+    raxSeek(&iter, "^", NULL, 0);
+    while (rc == true && raxNext(&iter)) {
+        t_smartpls_group *group = iter.data;
+        sdsclear(playlist);
+        playlist = sdscatlen(playlist, iter.key, iter.key_len);
+        sds plpath = sdscatfmt(sdsempty(), "%s/smartpls/%s", config->varlibdir, playlist);
+        if (access(plpath, F_OK) == -1) { /* Flawfinder: ignore */
+            LOG_VERBOSE("Created smart playlist %s", playlist);
+            mpd_shared_smartpls_save(config, "search", playlist, mpd_tag_name(group->tag), group->value, 0, 0, mpd_worker_state->smartpls_sort, true);
+        }
+        sdsfree(plpath);
+        t_smartpls_inputs *inputs = raxFind(mpd_worker_state->smartpls_inputs, iter.key, iter.key_len);
+        if (inputs != raxNotFound && (inputs->inputs & SMARTPLS_INPUT_GENERATED) == 0) {
+            LOG_DEBUG("Smart playlist %s was edited, skipping generation", playlist);
+        }
+        else if (force == false && inputs != raxNotFound && inputs->hash == group->hash) {
+            LOG_DEBUG("Smart playlist %s is unchanged", playlist);
+        }
+        else {
+            if (sdslen(mpd_worker_state->smartpls_sort) > 0) {
+                mpd_worker_smartpls_sort(mpd_worker_state, &group->members, mpd_worker_state->smartpls_sort, sort_tag);
+            }
+            list_push(&jobs, playlist, 0, NULL, group);
+        }
+    }
+    raxStop(&iter);
+    sdsfree(playlist);
+
+    if (jobs.length > 0) {
+        //the writers get the member lists, the groups are freed below
+        struct list_node *current = jobs.head;
+        while (current != NULL) {
+            current->user_data = &((t_smartpls_group *)current->user_data)->members;
+            current = current->next;
         }
-        struct list_node *current = tag_list.head;
+        mpd_worker_playlists_write(mpd_worker_state, &jobs, PLAYLIST_WRITERS_MAX);
+        current = jobs.head;
         while (current != NULL) {
-            const char *tagstr = mpd_tag_name(tag);
-            sds playlist = sdscatfmt(sdsempty(), "%s%s%s-%s", mpd_worker_state->smartpls_prefix, (sdslen(mpd_worker_state->smartpls_prefix) > 0 ? "-" : ""), tagstr, current->key);
-            sds plpath = sdscatfmt(sdsempty(), "%s/smartpls/%s", config->varlibdir, playlist);
-            if (access(plpath, F_OK) == -1) { /* Flawfinder: ignore */
-                LOG_VERBOSE("Created smart playlist %s", playlist);
-                mpd_shared_smartpls_save(config, "search", playlist, tagstr, current->key, 0, 0, mpd_worker_state->smartpls_sort);
+            if (current->value_i == 1) {
+                t_smartpls_group *group = raxFind(groups, (unsigned char *)current->key, sdslen(current->key));
+                t_smartpls_inputs *inputs = mpd_worker_smartpls_set_inputs(mpd_worker_state, current->key, SMARTPLS_INPUT_GENERATED);
+                inputs->hash = group->hash;
+            }
+            else {
+                rc = false;
             }
-            sdsfree(playlist);
-            sdsfree(plpath);
             current = current->next;
         }
-        list_free(&tag_list);
     }
-    return true;
+    if (rc == true) {
+        mpd_worker_state->generate_pls_db_mtime = db_mtime;
+    }
+    LOG_VERBOSE("Generated %u of %" PRIu64 " tag playlists", jobs.length, raxSize(groups));
+    list_free_keep_user_data(&jobs);
+
+    raxStart(&iter, groups);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        t_smartpls_group *group = iter.data;
+        list_free(&group->members);
+        sdsfree(group->value);
+        free(group);
+    }
+    raxStop(&iter);
+    raxFree(groups);
+    return rc;
 }
 
-static bool mpd_worker_smartpls_clear(t_mpd_worker_state *mpd_worker_state, const char *playlist) {
-    struct mpd_playlist *pl;
-    bool exists = false;
-    
-    //first check if playlist exists
-    bool rc = mpd_send_list_playlists(mpd_worker_state->mpd_state->conn);
-    if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_send_list_playlists") == false) {
+//64 bit fnv-1a, the member set hash is the sum of the uri hashes
+static unsigned long long mpd_worker_smartpls_hash(const char *uri) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)uri; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+//appends the uris of the matching songs to the list, the sort tag value is saved in value_p
+//exact matches the tag value case sensitive like the per tag generation
+static bool mpd_worker_smartpls_search(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *expression,
+                                       const char *tag, bool exact, time_t modified_since, enum mpd_tag_type sort_tag)
+{
+    struct mpd_connection *conn = mpd_worker_state->mpd_state->conn;
+    bool rc = mpd_search_db_songs(conn, exact);
+    if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_search_db_songs") == false) {
+        mpd_search_cancel(conn);
         return false;
     }
-    while ((pl = mpd_recv_playlist(mpd_worker_state->mpd_state->conn)) != NULL) {
-        const char *plpath = mpd_playlist_get_path(pl);
-        if (strcmp(playlist, plpath) == 0) {
-            exists = true;
-        }
-        mpd_playlist_free(pl);
-        if (exists == true) {
-            break;
-        }
+    if (modified_since > 0) {
+        rc = mpd_search_add_modified_since_constraint(conn, MPD_OPERATOR_DEFAULT, modified_since);
     }
-    mpd_response_finish(mpd_worker_state->mpd_state->conn);
-    if (check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false) == false) {
+    else if (tag == NULL) {
+        rc = mpd_search_add_expression(conn, expression);
+    }
+    else if (strcmp(tag, "any") == 0) {
+        rc = mpd_search_add_any_tag_constraint(conn, MPD_OPERATOR_DEFAULT, expression);
+    }
+    else {
+        rc = mpd_search_add_tag_constraint(conn, MPD_OPERATOR_DEFAULT, mpd_tag_name_parse(tag), expression);
+    }
+    if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_search_add_constraint") == false) {
+        mpd_search_cancel(conn);
         return false;
     }
-
-    //delete playlist if exists
-    if (exists) {
-        rc = mpd_run_rm(mpd_worker_state->mpd_state->conn, playlist);
-        if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_run_rm") == false) {
-            return false;
-        }
+    rc = mpd_search_commit(conn);
+    if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_search_commit") == false) {
+        return false;
     }
-    return true;
+    struct mpd_song *song;
+    while ((song = mpd_recv_song(conn)) != NULL) {
+        const char *tag_value = sort_tag != MPD_TAG_UNKNOWN ? mpd_song_get_tag(song, sort_tag, 0) : NULL;
+        list_push(content, mpd_song_get_uri(song), 0, tag_value, NULL);
+        mpd_song_free(song);
+    }
+    mpd_response_finish(conn);
+    return check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false);
 }
 
-static bool mpd_worker_smartpls_update_search(t_mpd_worker_state *mpd_worker_state, const char *playlist, const char *tag, const char *searchstr) {
-    sds buffer = sdsempty();
-    sds method = sdsempty();
-    mpd_worker_smartpls_clear(mpd_worker_state, playlist);
-    if (mpd_worker_state->mpd_state->feat_advsearch == true && strcmp(tag, "expression") == 0) {
-        buffer = mpd_shared_search_adv(mpd_worker_state->mpd_state, buffer, method, 0, searchstr, NULL, true, NULL, playlist, 0, 0, NULL);
+static bool mpd_worker_smartpls_update_search(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *tag,
+                                              const char *searchstr, enum mpd_tag_type sort_tag)
+{
+    if (strcmp(searchstr, "") == 0) {
+        LOG_ERROR("No search expression defined");
+        return false;
     }
-    else {
-        buffer = mpd_shared_search(mpd_worker_state->mpd_state, buffer, method, 0, searchstr, tag, playlist, 0, 0, NULL);
+    if (mpd_worker_state->mpd_state->feat_advsearch == true && strcmp(tag, "expression") == 0) {
+        return mpd_worker_smartpls_search(mpd_worker_state, content, searchstr, NULL, false, 0, sort_tag);
     }
-    sdsfree(buffer);
-    sdsfree(method);
-    LOG_VERBOSE("Updated smart playlist %s", playlist);
-    return true;
+    return mpd_worker_smartpls_search(mpd_worker_state, content, searchstr, tag, false, 0, sort_tag);
 }
 
-static bool mpd_worker_smartpls_update_sticker(t_mpd_worker_state *mpd_worker_state, const char *playlist, const char *sticker, const int maxentries, const int minvalue)
+static bool mpd_worker_smartpls_update_sticker(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *sticker,
+                                               const int maxentries, const int minvalue, t_sticker_index *sticker_index)
 {
-    bool rc = mpd_send_sticker_find(mpd_worker_state->mpd_state->conn, "song", "", sticker);
-    if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_send_sticker_find") == false) {
-        return false;    
+    if (maxentries <= 0) {
+        return true;
     }
-
-    struct list add_list;
-    list_init(&add_list);
-
-    struct mpd_pair *pair;
-    char *uri = NULL;
-    int value_max = 0;
-
-    while ((pair = mpd_recv_pair(mpd_worker_state->mpd_state->conn)) != NULL) {
-        if (strcmp(pair->name, "file") == 0) {
-            FREE_PTR(uri);
-            uri = strdup(pair->value);
-        } 
-        else if (strcmp(pair->name, "sticker") == 0) {
-            size_t j;
-            const char *p_value = mpd_parse_sticker(pair->value, &j);
-            if (p_value != NULL) {
-                char *crap;
-                int value = strtoimax(p_value, &crap, 10);
-                if (value >= 1) {
-                    list_push(&add_list, uri, value, NULL, NULL);
-                }
-                if (value > value_max) {
-                    value_max = value;
-                }
-            }
-        }
-        mpd_return_pair(mpd_worker_state->mpd_state->conn, pair);
+    int field = sticker_index_field(sticker);
+    if (field == -1) {
+        return sticker_find_top(mpd_worker_state, sticker, (unsigned)maxentries, minvalue, content);
     }
-    mpd_response_finish(mpd_worker_state->mpd_state->conn);
-    FREE_PTR(uri);
-    if (check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false) == false) {
+    if (sticker_index_load(mpd_worker_state, sticker_index, 1u << field) == false) {
         return false;
     }
+    sticker_index_top_field(sticker_index, field, (unsigned)maxentries, minvalue, content);
+    return true;
+}
 
-    mpd_worker_smartpls_clear(mpd_worker_state, playlist);
-     
-    if (minvalue > 0) {
-        value_max = minvalue;
+static bool mpd_worker_smartpls_update_score(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *expression,
+                                             const int maxentries, const int minvalue, t_sticker_index *sticker_index, unsigned *inputs)
+{
+    t_sticker_expr expr;
+    if (maxentries <= 0 || sticker_expr_compile(&expr, expression) == false) {
+        return false;
     }
-    else if (value_max > 2) {
-        value_max = value_max / 2;
+    if (expr.now == true) {
+        *inputs |= SMARTPLS_INPUT_TIME;
     }
-
-    list_sort_by_value_i(&add_list, false);
-
-    int i = 0;
-    if (mpd_command_list_begin(mpd_worker_state->mpd_state->conn, false)) {
-        struct list_node *current = add_list.head;
-
-        while (current != NULL) {
-            if (current->value_i >= value_max) {
-                rc = mpd_send_playlist_add(mpd_worker_state->mpd_state->conn, playlist, current->key);
-                if (rc == false) {
-                    LOG_ERROR("Error adding command to command list mpd_send_playlist_add");
-                    break;
-                }
-                i++;
-                if (i >= maxentries) {
-                    break;
-                }
-            }
-            current = current->next;
-        }
-        if (mpd_command_list_end(mpd_worker_state->mpd_state->conn)) {
-            mpd_response_finish(mpd_worker_state->mpd_state->conn);
-        }
-        if (check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false) == false) {
-            list_free(&add_list);
-            return false;
-        }
+    if (sticker_index_load(mpd_worker_state, sticker_index, expr.stickers) == false) {
+        return false;
     }
-    list_free(&add_list);
-    LOG_VERBOSE("Updated smart playlist %s with %d songs, minValue: %d", playlist, i, value_max);
+    sticker_index_top_expr(sticker_index, &expr, (unsigned)maxentries, minvalue, content);
     return true;
 }
 
-static bool mpd_worker_smartpls_update_newest(t_mpd_worker_state *mpd_worker_state, const char *playlist, const int timerange) {
+static bool mpd_worker_smartpls_update_newest(t_mpd_worker_state *mpd_worker_state, struct list *content, const int timerange,
+                                              enum mpd_tag_type sort_tag)
+{
     unsigned long value_max = 0;
     
     struct mpd_stats *stats = mpd_run_stats(mpd_worker_state->mpd_state->conn);
@@ -362,24 +665,85 @@ static bool mpd_worker_smartpls_update_newest(t_mpd_worker_state *mpd_worker_sta
         return false;
     }
 
-    mpd_worker_smartpls_clear(mpd_worker_state, playlist);
     value_max -= timerange;
-    sds buffer = sdsempty();
-    sds method = sdsempty();
-    if (value_max > 0) {
-        if (mpd_worker_state->mpd_state->feat_advsearch == true) {
-            sds searchstr = sdscatprintf(sdsempty(), "(modified-since '%lu')", value_max);
-            buffer = mpd_shared_search_adv(mpd_worker_state->mpd_state, buffer, method, 0, searchstr, NULL, true, NULL, playlist, 0, 0, NULL);
-            sdsfree(searchstr);
+    if (value_max == 0) {
+        return true;
+    }
+    if (mpd_worker_state->mpd_state->feat_advsearch == true) {
+        sds searchstr = sdscatprintf(sdsempty(), "(modified-since '%lu')", value_max);
+        bool rc = mpd_worker_smartpls_search(mpd_worker_state, content, searchstr, NULL, false, 0, sort_tag);
+        sdsfree(searchstr);
+        return rc;
+    }
+    return mpd_worker_smartpls_search(mpd_worker_state, content, NULL, NULL, false, (time_t)value_max, sort_tag);
+}
+
+//gets the sort tag values for a list of uris with lsinfo in one command list
+//MPD aborts the command list on a stale uri, the remaining uris are resent from the failed position
+static void mpd_worker_smartpls_get_sort_values(t_mpd_worker_state *mpd_worker_state, struct list *content, enum mpd_tag_type sort_tag) {
+    struct mpd_connection *conn = mpd_worker_state->mpd_state->conn;
+    struct list_node *start = content->head;
+    while (start != NULL) {
+        if (mpd_command_list_begin(conn, true) == false) {
+            check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false);
+            return;
         }
-        else {
-            sds searchstr = sdscatprintf(sdsempty(), "%lu", value_max);
-            buffer = mpd_shared_search(mpd_worker_state->mpd_state, buffer, method, 0, searchstr, "modified-since", playlist, 0, 0, NULL);
-            sdsfree(searchstr);
+        struct list_node *current = start;
+        while (current != NULL) {
+            if (mpd_send_list_meta(conn, current->key) == false) {
+                LOG_ERROR("Error adding command to command list mpd_send_list_meta");
+                break;
+            }
+            current = current->next;
+        }
+        if (mpd_command_list_end(conn) == false) {
+            check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false);
+            return;
+        }
+        current = start;
+        start = NULL;
+        while (current != NULL) {
+            struct mpd_song *song;
+            while ((song = mpd_recv_song(conn)) != NULL) {
+                const char *tag_value = mpd_song_get_tag(song, sort_tag, 0);
+                if (tag_value != NULL) {
+                    current->value_p = sdsreplace(current->value_p, tag_value);
+                }
+                mpd_song_free(song);
+            }
+            if (mpd_response_next(conn) == false) {
+                break;
+            }
+            current = current->next;
+        }
+        if (mpd_connection_get_error(conn) == MPD_ERROR_SERVER) {
+            LOG_WARN("Can not get song details for %s", (current != NULL ? current->key : ""));
+            if (mpd_connection_clear_error(conn) == false) {
+                check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false);
+                return;
+            }
+            if (current != NULL) {
+                start = current->next;
+            }
+            continue;
+        }
+        mpd_response_finish(conn);
+        if (check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false) == false) {
+            return;
         }
-        LOG_VERBOSE("Updated smart playlist %s", playlist);
     }
-    sdsfree(buffer);
-    sdsfree(method);
-    return true;
+}
+
+static void mpd_worker_smartpls_sort(t_mpd_worker_state *mpd_worker_state, struct list *content, const char *sort, enum mpd_tag_type sort_tag) {
+    if (strcmp(sort, "shuffle") == 0) {
+        list_shuffle(content);
+    }
+    else if (strcmp(sort, "filename") == 0 ||
+             (mpd_worker_state->mpd_state->feat_tags == false && mpd_tag_name_parse(sort) != MPD_TAG_UNKNOWN))
+    {
+        list_sort_by_key(content, true);
+    }
+    else if (sort_tag != MPD_TAG_UNKNOWN) {
+        list_sort_by_value_p(content, true);
+    }
 }
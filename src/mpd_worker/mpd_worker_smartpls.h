@@ -8,4 +8,7 @@
 #define __MPD_WORKER_SMARTPLS_H__
 bool mpd_worker_smartpls_update_all(t_config *config, t_mpd_worker_state *mpd_worker_state, bool force);
 bool mpd_worker_smartpls_update(t_config *config, t_mpd_worker_state *mpd_worker_state, const char *playlist);
+void mpd_worker_smartpls_mark_dirty(t_config *config, t_mpd_worker_state *mpd_worker_state, unsigned idle_events);
+bool mpd_worker_smartpls_dirty_due(t_mpd_worker_state *mpd_worker_state);
+bool mpd_worker_smartpls_process_dirty(t_config *config, t_mpd_worker_state *mpd_worker_state);
 #endif
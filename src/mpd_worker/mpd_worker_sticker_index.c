@@ -0,0 +1,503 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <time.h>
+#include <assert.h>
+#include <mpd/client.h>
+
+#include "../../dist/src/sds/sds.h"
+#include "../../dist/src/rax/rax.h"
+#include "../sds_extras.h"
+#include "../log.h"
+#include "../list.h"
+#include "config_defs.h"
+#include "../utility.h"
+#include "../mpd_shared/mpd_shared_typedefs.h"
+#include "../mpd_shared.h"
+#include "mpd_worker_utility.h"
+#include "mpd_worker_sticker_index.h"
+
+//private definitions
+enum sticker_index_fields {
+    STICKER_PLAYCOUNT = 0,
+    STICKER_SKIPCOUNT,
+    STICKER_LASTPLAYED,
+    STICKER_LASTSKIPPED,
+    STICKER_LIKE,
+    STICKER_FIELDS_LEN
+};
+
+static const char *sticker_index_names[] = {"playCount", "skipCount", "lastPlayed", "lastSkipped", "like"};
+
+//operations of the compiled expression, values below STICKER_FIELDS_LEN push a sticker value
+enum sticker_expr_ops {
+    STICKER_OP_NUM = 16,
+    STICKER_OP_NOW,
+    STICKER_OP_ADD,
+    STICKER_OP_SUB,
+    STICKER_OP_MUL,
+    STICKER_OP_DIV,
+    STICKER_OP_NEG
+};
+
+typedef struct t_sticker_index_entry {
+    t_sticker sticker;
+    unsigned set;
+} t_sticker_index_entry;
+
+//maximum nesting of parentheses and unary minus, limits the parser recursion
+#define STICKER_EXPR_MAX_DEPTH 32
+
+typedef struct t_expr_parser {
+    const char *p;
+    t_sticker_expr *expr;
+    bool error;
+    unsigned depth;
+} t_expr_parser;
+
+typedef struct t_top_entry {
+    double score;
+    sds uri;
+} t_top_entry;
+
+//min-heap of the best k entries, the root is the worst entry
+typedef struct t_top_heap {
+    t_top_entry *entries;
+    unsigned len;
+    unsigned size;
+} t_top_heap;
+
+static unsigned sticker_value(t_sticker *sticker, int field);
+static void _expr_emit(t_expr_parser *parser, int op, double value);
+static void _expr_skip_space(t_expr_parser *parser);
+static void _expr_parse_sum(t_expr_parser *parser);
+static void _expr_parse_product(t_expr_parser *parser);
+static void _expr_parse_factor(t_expr_parser *parser);
+static double _expr_eval(t_sticker_expr *expr, t_sticker *sticker, double now);
+static void top_heap_init(t_top_heap *heap, unsigned size);
+static void top_heap_push(t_top_heap *heap, const char *uri, size_t uri_len, double score);
+static void top_heap_to_list(t_top_heap *heap, double minvalue, struct list *content);
+static bool top_entry_worse(double score1, const char *uri1, size_t len1, double score2, const char *uri2, size_t len2);
+static void top_heap_sift_down(t_top_heap *heap, unsigned i);
+static int top_entry_cmp(const void *a, const void *b);
+
+//public functions
+int sticker_index_field(const char *name) {
+    for (int i = 0; i < STICKER_FIELDS_LEN; i++) {
+        if (strcmp(name, sticker_index_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void sticker_index_init(t_sticker_index *index) {
+    index->songs = raxNew();
+    index->loaded = 0;
+}
+
+void sticker_index_free(t_sticker_index *index) {
+    if (index->songs == NULL) {
+        return;
+    }
+    raxIterator iter;
+    raxStart(&iter, index->songs);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        FREE_PTR(iter.data);
+    }
+    raxStop(&iter);
+    raxFree(index->songs);
+    index->songs = NULL;
+    index->loaded = 0;
+}
+
+//loads the requested stickers that are not already in the index, one sticker find per sticker name
+bool sticker_index_load(t_mpd_worker_state *mpd_worker_state, t_sticker_index *index, unsigned stickers) {
+    struct mpd_connection *conn = mpd_worker_state->mpd_state->conn;
+    for (int field = 0; field < STICKER_FIELDS_LEN; field++) {
+        unsigned mask = 1u << field;
+        if ((stickers & mask) == 0 || (index->loaded & mask) != 0) {
+            continue;
+        }
+        bool rc = mpd_send_sticker_find(conn, "song", "", sticker_index_names[field]);
+        if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_send_sticker_find") == false) {
+            return false;
+        }
+        struct mpd_pair *pair;
+        sds uri = sdsempty();
+        unsigned count = 0;
+        while ((pair = mpd_recv_pair(conn)) != NULL) {
+            if (strcmp(pair->name, "file") == 0) {
+                uri = sdsreplace(uri, pair->value);
+            }
+            else if (strcmp(pair->name, "sticker") == 0 && sdslen(uri) > 0) {
+                size_t j;
+                const char *p_value = mpd_parse_sticker(pair->value, &j);
+                if (p_value != NULL) {
+                    t_sticker_index_entry *entry = raxFind(index->songs, (unsigned char *)uri, sdslen(uri));
+                    if (entry == raxNotFound) {
+                        entry = calloc(1, sizeof(t_sticker_index_entry));
+                        assert(entry);
+                        //same default as mpd_shared_get_sticker
+                        entry->sticker.like = 1;
+                        raxInsert(index->songs, (unsigned char *)uri, sdslen(uri), entry, NULL);
+                    }
+                    unsigned value = (unsigned)strtoumax(p_value, NULL, 10);
+                    switch(field) {
+                        case STICKER_PLAYCOUNT:   entry->sticker.playCount = value; break;
+                        case STICKER_SKIPCOUNT:   entry->sticker.skipCount = value; break;
+                        case STICKER_LASTPLAYED:  entry->sticker.lastPlayed = value; break;
+                        case STICKER_LASTSKIPPED: entry->sticker.lastSkipped = value; break;
+                        case STICKER_LIKE:        entry->sticker.like = value; break;
+                    }
+                    entry->set |= mask;
+                    count++;
+                }
+            }
+            mpd_return_pair(conn, pair);
+        }
+        mpd_response_finish(conn);
+        sdsfree(uri);
+        if (check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false) == false) {
+            return false;
+        }
+        index->loaded |= mask;
+        LOG_DEBUG("Loaded %u values of sticker %s", count, sticker_index_names[field]);
+    }
+    return true;
+}
+
+//compiles an arithmetic expression over the sticker names, e.g. "playCount * 2 + like * 10 - skipCount"
+//supported are numbers, the sticker names, now, + - * / and parenthesis
+bool sticker_expr_compile(t_sticker_expr *expr, const char *str) {
+    expr->len = 0;
+    expr->stickers = 0;
+    expr->now = false;
+    t_expr_parser parser = {str, expr, false, 0};
+    _expr_parse_sum(&parser);
+    _expr_skip_space(&parser);
+    if (parser.error == true || *parser.p != '\0' || expr->len == 0) {
+        LOG_ERROR("Invalid sticker expression: %s", str);
+        return false;
+    }
+    return true;
+}
+
+//top entries with value >= minvalue, if minvalue is 0 the half of the maximum value is used
+void sticker_index_top_field(t_sticker_index *index, int field, unsigned maxentries, int minvalue, struct list *content) {
+    unsigned mask = 1u << field;
+    unsigned value_max = 0;
+    unsigned value_min = minvalue > 1 ? (unsigned)minvalue : 1;
+    t_top_heap heap;
+    top_heap_init(&heap, maxentries);
+    raxIterator iter;
+    raxStart(&iter, index->songs);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        t_sticker_index_entry *entry = (t_sticker_index_entry *)iter.data;
+        if ((entry->set & mask) == 0) {
+            continue;
+        }
+        unsigned value = sticker_value(&entry->sticker, field);
+        if (value > value_max) {
+            value_max = value;
+        }
+        if (value >= value_min) {
+            top_heap_push(&heap, (char *)iter.key, iter.key_len, value);
+        }
+    }
+    raxStop(&iter);
+    if (minvalue <= 0) {
+        minvalue = value_max > 2 ? value_max / 2 : value_max;
+    }
+    top_heap_to_list(&heap, minvalue, content);
+}
+
+void sticker_index_top_expr(t_sticker_index *index, t_sticker_expr *expr, unsigned maxentries, double minvalue, struct list *content) {
+    double now = (double)time(NULL);
+    t_top_heap heap;
+    top_heap_init(&heap, maxentries);
+    raxIterator iter;
+    raxStart(&iter, index->songs);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        t_sticker_index_entry *entry = (t_sticker_index_entry *)iter.data;
+        double score = _expr_eval(expr, &entry->sticker, now);
+        if (score >= minvalue) {
+            top_heap_push(&heap, (char *)iter.key, iter.key_len, score);
+        }
+    }
+    raxStop(&iter);
+    top_heap_to_list(&heap, minvalue, content);
+}
+
+//for stickers that are not managed by mympd
+bool sticker_find_top(t_mpd_worker_state *mpd_worker_state, const char *sticker, unsigned maxentries, int minvalue, struct list *content) {
+    struct mpd_connection *conn = mpd_worker_state->mpd_state->conn;
+    bool rc = mpd_send_sticker_find(conn, "song", "", sticker);
+    if (check_rc_error_and_recover(mpd_worker_state->mpd_state, NULL, NULL, 0, false, rc, "mpd_send_sticker_find") == false) {
+        return false;
+    }
+    t_top_heap heap;
+    top_heap_init(&heap, maxentries);
+    struct mpd_pair *pair;
+    sds uri = sdsempty();
+    int value_max = 0;
+    while ((pair = mpd_recv_pair(conn)) != NULL) {
+        if (strcmp(pair->name, "file") == 0) {
+            uri = sdsreplace(uri, pair->value);
+        }
+        else if (strcmp(pair->name, "sticker") == 0) {
+            size_t j;
+            const char *p_value = mpd_parse_sticker(pair->value, &j);
+            if (p_value != NULL) {
+                int value = (int)strtoimax(p_value, NULL, 10);
+                if (value >= 1 && value >= minvalue) {
+                    top_heap_push(&heap, uri, sdslen(uri), value);
+                }
+                if (value > value_max) {
+                    value_max = value;
+                }
+            }
+        }
+        mpd_return_pair(conn, pair);
+    }
+    mpd_response_finish(conn);
+    sdsfree(uri);
+    if (minvalue <= 0) {
+        minvalue = value_max > 2 ? value_max / 2 : value_max;
+    }
+    top_heap_to_list(&heap, minvalue, content);
+    return check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false);
+}
+
+//private functions
+static unsigned sticker_value(t_sticker *sticker, int field) {
+    switch(field) {
+        case STICKER_PLAYCOUNT:   return sticker->playCount;
+        case STICKER_SKIPCOUNT:   return sticker->skipCount;
+        case STICKER_LASTPLAYED:  return sticker->lastPlayed;
+        case STICKER_LASTSKIPPED: return sticker->lastSkipped;
+        case STICKER_LIKE:        return sticker->like;
+    }
+    return 0;
+}
+
+static void _expr_emit(t_expr_parser *parser, int op, double value) {
+    if (parser->expr->len == STICKER_EXPR_MAX) {
+        parser->error = true;
+        return;
+    }
+    parser->expr->ops[parser->expr->len] = op;
+    parser->expr->values[parser->expr->len] = value;
+    parser->expr->len++;
+}
+
+static void _expr_skip_space(t_expr_parser *parser) {
+    while (isspace((unsigned char)*parser->p)) {
+        parser->p++;
+    }
+}
+
+static void _expr_parse_sum(t_expr_parser *parser) {
+    _expr_parse_product(parser);
+    while (parser->error == false) {
+        _expr_skip_space(parser);
+        char op = *parser->p;
+        if (op != '+' && op != '-') {
+            break;
+        }
+        parser->p++;
+        _expr_parse_product(parser);
+        _expr_emit(parser, op == '+' ? STICKER_OP_ADD : STICKER_OP_SUB, 0);
+    }
+}
+
+static void _expr_parse_product(t_expr_parser *parser) {
+    _expr_parse_factor(parser);
+    while (parser->error == false) {
+        _expr_skip_space(parser);
+        char op = *parser->p;
+        if (op != '*' && op != '/') {
+            break;
+        }
+        parser->p++;
+        _expr_parse_factor(parser);
+        _expr_emit(parser, op == '*' ? STICKER_OP_MUL : STICKER_OP_DIV, 0);
+    }
+}
+
+static void _expr_parse_factor(t_expr_parser *parser) {
+    _expr_skip_space(parser);
+    if ((*parser->p == '(' || *parser->p == '-') && parser->depth == STICKER_EXPR_MAX_DEPTH) {
+        parser->error = true;
+        return;
+    }
+    if (*parser->p == '(') {
+        parser->p++;
+        parser->depth++;
+        _expr_parse_sum(parser);
+        parser->depth--;
+        _expr_skip_space(parser);
+        if (*parser->p != ')') {
+            parser->error = true;
+            return;
+        }
+        parser->p++;
+    }
+    else if (*parser->p == '-') {
+        parser->p++;
+        parser->depth++;
+        _expr_parse_factor(parser);
+        parser->depth--;
+        _expr_emit(parser, STICKER_OP_NEG, 0);
+    }
+    else if (isdigit((unsigned char)*parser->p) || *parser->p == '.') {
+        char *end;
+        double value = strtod(parser->p, &end);
+        parser->p = end;
+        _expr_emit(parser, STICKER_OP_NUM, value);
+    }
+    else if (isalpha((unsigned char)*parser->p)) {
+        const char *start = parser->p;
+        while (isalpha((unsigned char)*parser->p)) {
+            parser->p++;
+        }
+        sds name = sdsnewlen(start, (size_t)(parser->p - start));
+        int field = sticker_index_field(name);
+        if (field >= 0) {
+            _expr_emit(parser, field, 0);
+            parser->expr->stickers |= 1u << field;
+        }
+        else if (strcmp(name, "now") == 0) {
+            _expr_emit(parser, STICKER_OP_NOW, 0);
+            parser->expr->now = true;
+        }
+        else {
+            parser->error = true;
+        }
+        sdsfree(name);
+    }
+    else {
+        parser->error = true;
+    }
+}
+
+static double _expr_eval(t_sticker_expr *expr, t_sticker *sticker, double now) {
+    double stack[STICKER_EXPR_MAX];
+    unsigned sp = 0;
+    for (unsigned i = 0; i < expr->len; i++) {
+        int op = expr->ops[i];
+        switch(op) {
+            case STICKER_OP_NUM: stack[sp++] = expr->values[i]; break;
+            case STICKER_OP_NOW: stack[sp++] = now; break;
+            case STICKER_OP_ADD: sp--; stack[sp - 1] += stack[sp]; break;
+            case STICKER_OP_SUB: sp--; stack[sp - 1] -= stack[sp]; break;
+            case STICKER_OP_MUL: sp--; stack[sp - 1] *= stack[sp]; break;
+            case STICKER_OP_DIV: sp--; stack[sp - 1] = stack[sp] != 0 ? stack[sp - 1] / stack[sp] : 0; break;
+            case STICKER_OP_NEG: stack[sp - 1] = -stack[sp - 1]; break;
+            default:             stack[sp++] = sticker_value(sticker, op);
+        }
+    }
+    return stack[0];
+}
+
+static void top_heap_init(t_top_heap *heap, unsigned size) {
+    heap->size = size;
+    heap->len = 0;
+    heap->entries = size > 0 ? malloc(size * sizeof(t_top_entry)) : NULL;
+    assert(heap->entries || size == 0);
+}
+
+//equal scores are ordered by uri to get a stable result
+static bool top_entry_worse(double score1, const char *uri1, size_t len1, double score2, const char *uri2, size_t len2) {
+    if (score1 != score2) {
+        return score1 < score2;
+    }
+    int cmp = memcmp(uri1, uri2, len1 < len2 ? len1 : len2);
+    return cmp != 0 ? cmp > 0 : len1 > len2;
+}
+
+static void top_heap_push(t_top_heap *heap, const char *uri, size_t uri_len, double score) {
+    if (heap->len < heap->size) {
+        //sift up
+        unsigned i = heap->len++;
+        while (i > 0) {
+            unsigned parent = (i - 1) / 2;
+            t_top_entry *p = &heap->entries[parent];
+            if (top_entry_worse(score, uri, uri_len, p->score, p->uri, sdslen(p->uri)) == false) {
+                break;
+            }
+            heap->entries[i] = *p;
+            i = parent;
+        }
+        heap->entries[i].score = score;
+        heap->entries[i].uri = sdsnewlen(uri, uri_len);
+        return;
+    }
+    if (heap->size == 0) {
+        return;
+    }
+    t_top_entry *root = &heap->entries[0];
+    if (top_entry_worse(root->score, root->uri, sdslen(root->uri), score, uri, uri_len) == true) {
+        root->score = score;
+        root->uri = sdsreplacelen(root->uri, uri, uri_len);
+        top_heap_sift_down(heap, 0);
+    }
+}
+
+static void top_heap_sift_down(t_top_heap *heap, unsigned i) {
+    t_top_entry entry = heap->entries[i];
+    for (;;) {
+        unsigned child = 2 * i + 1;
+        if (child >= heap->len) {
+            break;
+        }
+        t_top_entry *c = &heap->entries[child];
+        if (child + 1 < heap->len) {
+            t_top_entry *c2 = &heap->entries[child + 1];
+            if (top_entry_worse(c2->score, c2->uri, sdslen(c2->uri), c->score, c->uri, sdslen(c->uri)) == true) {
+                child++;
+                c = c2;
+            }
+        }
+        if (top_entry_worse(c->score, c->uri, sdslen(c->uri), entry.score, entry.uri, sdslen(entry.uri)) == false) {
+            break;
+        }
+        heap->entries[i] = *c;
+        i = child;
+    }
+    heap->entries[i] = entry;
+}
+
+static int top_entry_cmp(const void *a, const void *b) {
+    const t_top_entry *e1 = (const t_top_entry *)a;
+    const t_top_entry *e2 = (const t_top_entry *)b;
+    if (top_entry_worse(e1->score, e1->uri, sdslen(e1->uri), e2->score, e2->uri, sdslen(e2->uri)) == true) {
+        return 1;
+    }
+    return -1;
+}
+
+//appends the entries with score >= minvalue, best first, and frees the heap
+static void top_heap_to_list(t_top_heap *heap, double minvalue, struct list *content) {
+    qsort(heap->entries, heap->len, sizeof(t_top_entry), top_entry_cmp);
+    for (unsigned i = 0; i < heap->len; i++) {
+        if (heap->entries[i].score >= minvalue) {
+            list_push(content, heap->entries[i].uri, (long)heap->entries[i].score, NULL, NULL);
+        }
+        sdsfree(heap->entries[i].uri);
+    }
+    FREE_PTR(heap->entries);
+    heap->len = 0;
+}
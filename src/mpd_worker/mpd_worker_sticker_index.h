@@ -0,0 +1,35 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __MPD_WORKER_STICKER_INDEX_H__
+#define __MPD_WORKER_STICKER_INDEX_H__
+
+#define STICKER_EXPR_MAX 64
+
+//sticker values of all songs with at least one of the loaded stickers
+typedef struct t_sticker_index {
+    rax *songs;
+    unsigned loaded;
+} t_sticker_index;
+
+//expression compiled to reverse polish notation
+typedef struct t_sticker_expr {
+    int ops[STICKER_EXPR_MAX];
+    double values[STICKER_EXPR_MAX];
+    unsigned len;
+    unsigned stickers;
+    bool now;
+} t_sticker_expr;
+
+int sticker_index_field(const char *name);
+void sticker_index_init(t_sticker_index *index);
+void sticker_index_free(t_sticker_index *index);
+bool sticker_index_load(t_mpd_worker_state *mpd_worker_state, t_sticker_index *index, unsigned stickers);
+bool sticker_expr_compile(t_sticker_expr *expr, const char *str);
+void sticker_index_top_field(t_sticker_index *index, int field, unsigned maxentries, int minvalue, struct list *content);
+void sticker_index_top_expr(t_sticker_index *index, t_sticker_expr *expr, unsigned maxentries, double minvalue, struct list *content);
+bool sticker_find_top(t_mpd_worker_state *mpd_worker_state, const char *sticker, unsigned maxentries, int minvalue, struct list *content);
+#endif
@@ -0,0 +1,156 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <mpd/client.h>
+
+#include "../../dist/src/sds/sds.h"
+#include "../sds_extras.h"
+#include "../api.h"
+#include "../log.h"
+#include "../list.h"
+#include "config_defs.h"
+#include "../utility.h"
+#include "../tiny_queue.h"
+#include "../global.h"
+#include "../thumbnail.h"
+#include "../covercache.h"
+#include "../mpd_shared/mpd_shared_typedefs.h"
+#include "../mpd_shared.h"
+#include "mpd_worker_utility.h"
+#include "mpd_worker_thumbnails.h"
+
+//private definitions
+static bool _thumbnails_missing(t_config *config, const char *uri);
+static bool _thumbnails_fetch_cover(t_mpd_worker_state *mpd_worker_state, const char *uri, bool readpicture, sds *binary);
+
+//public functions
+//creates the missing thumbnails for the first song of each album
+bool mpd_worker_thumbnails_create(t_config *config, t_mpd_worker_state *mpd_worker_state, struct list *album_uris) {
+    LOG_VERBOSE("Creating thumbnails for %u albums", album_uris->length);
+    unsigned created = 0;
+    struct list_node *current = album_uris->head;
+    sds covercachefile = sdsempty();
+    sds binary = sdsempty();
+    while (current != NULL && s_signal_received == 0) {
+        if (_thumbnails_missing(config, current->key) == false) {
+            current = current->next;
+            continue;
+        }
+        //get the original image from the covercache or from mpd
+        sdsclear(binary);
+        sdsclear(covercachefile);
+        covercachefile = covercache_get(covercachefile, config, current->key);
+        if (sdslen(covercachefile) > 0) {
+            thumbnail_read_file(covercachefile, &binary);
+        }
+        else {
+            if (_thumbnails_fetch_cover(mpd_worker_state, current->key, false, &binary) == false) {
+                _thumbnails_fetch_cover(mpd_worker_state, current->key, true, &binary);
+            }
+            if (sdslen(binary) == 0) {
+                if (mpd_worker_state->mpd_state->conn_state != MPD_CONNECTED) {
+                    break;
+                }
+                current = current->next;
+                continue;
+            }
+            sds mime_type = get_mime_type_by_magic_stream(binary);
+            covercache_put(config, current->key, mime_type, binary);
+            sdsfree(mime_type);
+        }
+        for (const unsigned *size = thumbnail_sizes; *size != 0; size++) {
+            sds variant_key = thumbnail_key(sdsempty(), current->key, *size);
+            sds thumb_file = covercache_get(sdsempty(), config, variant_key);
+            //images that can not be scaled are stored as their own thumbnail and not tried again
+            if (sdslen(thumb_file) == 0 && thumbnail_store(config, current->key, *size, binary) == true) {
+                created++;
+            }
+            sdsfree(thumb_file);
+            sdsfree(variant_key);
+        }
+        current = current->next;
+    }
+    sdsfree(covercachefile);
+    sdsfree(binary);
+    LOG_VERBOSE("Created %u thumbnails", created);
+    return current == NULL ? true : false;
+}
+
+//private functions
+static bool _thumbnails_missing(t_config *config, const char *uri) {
+    for (const unsigned *size = thumbnail_sizes; *size != 0; size++) {
+        sds variant_key = thumbnail_key(sdsempty(), uri, *size);
+        sds thumb_file = covercache_get(sdsempty(), config, variant_key);
+        size_t len = sdslen(thumb_file);
+        sdsfree(thumb_file);
+        sdsfree(variant_key);
+        if (len == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool _thumbnails_fetch_cover(t_mpd_worker_state *mpd_worker_state, const char *uri, bool readpicture, sds *binary) {
+    struct mpd_connection *conn = mpd_worker_state->mpd_state->conn;
+    unsigned offset = 0;
+    unsigned size = 0;
+    sdsclear(*binary);
+    do {
+        bool rc = readpicture == true ? mpd_send_readpicture(conn, uri, offset) : mpd_send_albumart(conn, uri, offset);
+        if (rc == false) {
+            break;
+        }
+        struct mpd_pair *pair;
+        size_t chunk_size = 0;
+        bool found = false;
+        while (found == false && (pair = mpd_recv_pair(conn)) != NULL) {
+            if (strcmp(pair->name, "size") == 0) {
+                size = strtoumax(pair->value, NULL, 10);
+            }
+            else if (strcmp(pair->name, "binary") == 0) {
+                chunk_size = strtoumax(pair->value, NULL, 10);
+                found = true;
+            }
+            mpd_return_pair(conn, pair);
+        }
+        if (found == false || chunk_size == 0) {
+            mpd_response_finish(conn);
+            break;
+        }
+        *binary = sdsMakeRoomFor(*binary, chunk_size);
+        if (mpd_recv_binary(conn, *binary + sdslen(*binary), chunk_size) == false) {
+            break;
+        }
+        sdsIncrLen(*binary, (ssize_t)chunk_size);
+        if (mpd_response_finish(conn) == false) {
+            break;
+        }
+        offset += chunk_size;
+    } while (offset < size && s_signal_received == 0);
+
+    if (mpd_connection_get_error(conn) == MPD_ERROR_SERVER) {
+        //no albumart found or command not supported
+        mpd_connection_clear_error(conn);
+        mpd_response_finish(conn);
+    }
+    else if (check_error_and_recover2(mpd_worker_state->mpd_state, NULL, NULL, 0, false) == false) {
+        sdsclear(*binary);
+        return false;
+    }
+    if (offset == 0 || offset < size) {
+        sdsclear(*binary);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,10 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __MPD_WORKER_THUMBNAILS_H__
+#define __MPD_WORKER_THUMBNAILS_H__
+bool mpd_worker_thumbnails_create(t_config *config, t_mpd_worker_state *mpd_worker_state, struct list *album_uris);
+#endif
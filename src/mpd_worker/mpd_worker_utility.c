@@ -40,6 +40,10 @@ void default_mpd_worker_state(t_mpd_worker_state *mpd_worker_state) {
     mpd_worker_state->smartpls_prefix = sdsempty();
     mpd_worker_state->generate_pls_tags = sdsempty();
     reset_t_tags(&mpd_worker_state->generate_pls_tag_types);
+    mpd_worker_state->generate_pls_db_mtime = 0;
+    mpd_worker_state->smartpls_inputs = raxNew();
+    list_init(&mpd_worker_state->smartpls_dirty);
+    mpd_worker_state->smartpls_dirty_time = 0;
     //mpd state
     mpd_worker_state->mpd_state = (t_mpd_state *)malloc(sizeof(t_mpd_state));
     assert(mpd_worker_state->mpd_state);
@@ -50,6 +54,8 @@ void free_mpd_worker_state(t_mpd_worker_state *mpd_worker_state) {
     sdsfree(mpd_worker_state->smartpls_sort);
     sdsfree(mpd_worker_state->smartpls_prefix);
     sdsfree(mpd_worker_state->generate_pls_tags);
+    raxFreeWithCallback(mpd_worker_state->smartpls_inputs, free);
+    list_free(&mpd_worker_state->smartpls_dirty);
     //mpd state
     mpd_shared_free_mpd_state(mpd_worker_state->mpd_state);
     free(mpd_worker_state);
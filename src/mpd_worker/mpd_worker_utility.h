@@ -7,6 +7,8 @@
 #ifndef __MPD_WORKER_UTILITY_H__
 #define __MPD_WORKER_UTILITY_H__
 
+#include "../../dist/src/rax/rax.h"
+
 typedef struct t_mpd_worker_state {
     bool feat_playlists;
     bool smartpls;
@@ -15,6 +17,11 @@ typedef struct t_mpd_worker_state {
     sds smartpls_prefix;
     sds generate_pls_tags;
     t_tags generate_pls_tag_types;
+    unsigned long generate_pls_db_mtime;
+    //smart playlist scheduler
+    rax *smartpls_inputs;
+    struct list smartpls_dirty;
+    time_t smartpls_dirty_time;
     //mpd state
     struct t_mpd_state *mpd_state;
 } t_mpd_worker_state;
@@ -21,6 +21,7 @@
 #include <mpd/client.h>
 
 #include "../dist/src/sds/sds.h"
+#include "../dist/src/rax/rax.h"
 #include "sds_extras.h"
 #include "../dist/src/frozen/frozen.h"
 #include "api.h"
@@ -30,6 +31,7 @@
 #include "config_defs.h"
 #include "utility.h"
 #include "global.h"
+#include "state_store.h"
 #include "lua_mympd_state.h"
 #include "mpd_client.h"
 #include "maintenance.h"
@@ -42,10 +44,12 @@
 #include "mympd_api/mympd_api_timer_handlers.h"
 #include "mympd_api/mympd_api_scripts.h"
 #include "mympd_api/mympd_api_home.h"
+#include "mpd_reader.h"
 #include "mympd_api.h"
 
 //private definitions
 static void mympd_api(t_config *config, t_mympd_state *mympd_state, t_work_request *request);
+static sds settings_add_token(sds buffer, struct json_token *key, struct json_token *val);
 
 //public functions
 void *mympd_api_loop(void *arg_config) {
@@ -76,7 +80,14 @@ void *mympd_api_loop(void *arg_config) {
     }
 
     //push settings to mpd_client queue
-    mympd_api_push_to_mpd_client(mympd_state);
+    mympd_api_push_to_mpd_client(config, mympd_state);
+
+    #ifdef ENABLE_LUA
+    //prepare lua states for scripts
+    if (config->scripting == true || config->remotescripting == true) {
+        mympd_api_script_init(config);
+    }
+    #endif
 
     while (s_signal_received == 0) {
         //poll message queue
@@ -94,6 +105,9 @@ void *mympd_api_loop(void *arg_config) {
     if (mympd_state->timer == true) {
         timerfile_save(config, mympd_state);
     }
+    #ifdef ENABLE_LUA
+    mympd_api_script_cleanup();
+    #endif
     free_mympd_state(mympd_state);
     sdsfree(thread_logname);
     return NULL;
@@ -293,7 +307,7 @@ static void mympd_api(t_config *config, t_mympd_state *mympd_state, t_work_reque
                         response->data = jsonrpc_respond_ok(response->data, request->method, request->id);
                     }
                     else {
-                        response->data = jsonrpc_respond_message(response->data, request->method, request->id, "Can't create mympd_script thread", true);
+                        response->data = jsonrpc_respond_message(response->data, request->method, request->id, "Can't queue script", true);
                     }
                 }
                 else {
@@ -322,7 +336,7 @@ static void mympd_api(t_config *config, t_mympd_state *mympd_state, t_work_reque
                         response->data = jsonrpc_respond_ok(response->data, request->method, request->id);
                     }
                     else {
-                        response->data = jsonrpc_respond_message(response->data, request->method, request->id, "Can't create mympd_script thread", true);
+                        response->data = jsonrpc_respond_message(response->data, request->method, request->id, "Can't queue script", true);
                     }
                 }
             } 
@@ -350,7 +364,7 @@ static void mympd_api(t_config *config, t_mympd_state *mympd_state, t_work_reque
                 cols = json_to_cols(cols, request->data, sdslen(request->data), &error);
                 if (error == false) {
                     cols = sdscatlen(cols, "]", 1);
-                    if (mympd_api_cols_save(config, mympd_state, p_charbuf1, cols)) {
+                    if (mympd_api_cols_save(mympd_state, p_charbuf1, cols)) {
                         response->data = jsonrpc_respond_ok(response->data, request->method, request->id);
                     }
                     else {
@@ -377,19 +391,39 @@ static void mympd_api(t_config *config, t_mympd_state *mympd_state, t_work_reque
             struct json_token key;
             struct json_token val;
             rc = true;
+            //only changed settings are forwarded to the other threads
+            sds changed_settings = sdscat(sdsempty(), "{\"jsonrpc\":\"2.0\",\"id\":0,\"method\":\"MYMPD_API_SETTINGS_SET\",\"params\":{");
+            unsigned changed_count = 0;
             while ((h = json_next_key(request->data, sdslen(request->data), h, ".params", &key, &val)) != NULL) {
-                rc = mympd_api_settings_set(config, mympd_state, &key, &val);
+                bool changed = true;
+                rc = mympd_api_settings_set(config, mympd_state, &key, &val, &changed);
                 if (rc == false) {
                     break;
                 }
+                if (changed == true) {
+                    changed_settings = settings_add_token(changed_settings, &key, &val);
+                    changed_count++;
+                }
+            }
+            //one transaction for all settings of the request
+            if (state_store_commit(mympd_state->state_store) == false) {
+                rc = false;
             }
             if (rc == true) {
-                //forward request to mpd_client queue            
-                t_work_request *mpd_client_request = create_request(-1, request->id, request->cmd_id, request->method, request->data);
-                tiny_queue_push(mpd_client_queue, mpd_client_request, 0);
-                //forward request to mpd_worker queue            
-                t_work_request *mpd_client_request2 = create_request(-1, request->id, request->cmd_id, request->method, request->data);
-                tiny_queue_push(mpd_worker_queue, mpd_client_request2, 0);
+                if (changed_count > 0) {
+                    changed_settings = sdscat(changed_settings, "}}");
+                    //forward request to mpd_client queue
+                    t_work_request *mpd_client_request = create_request(-1, request->id, request->cmd_id, request->method, changed_settings);
+                    tiny_queue_push(mpd_client_queue, mpd_client_request, 0);
+                    //forward request to mpd_reader queues
+                    mpd_reader_push_settings(config, changed_settings);
+                    //forward request to mpd_worker queue
+                    t_work_request *mpd_client_request2 = create_request(-1, request->id, request->cmd_id, request->method, changed_settings);
+                    tiny_queue_push(mpd_worker_queue, mpd_client_request2, 0);
+                }
+                else {
+                    LOG_DEBUG("Settings unchanged");
+                }
                 //respond with ok
                 response->data = jsonrpc_respond_ok(response->data, request->method, request->id);
             }
@@ -398,6 +432,7 @@ static void mympd_api(t_config *config, t_mympd_state *mympd_state, t_work_reque
                 response->data = tojson_char_len(response->data, "setting", key.ptr, key.len, false);
                 response->data = jsonrpc_end_phrase(response->data);
             }
+            sdsfree(changed_settings);
             break;
         }
         case MYMPD_API_SETTINGS_GET:
@@ -409,14 +444,17 @@ static void mympd_api(t_config *config, t_mympd_state *mympd_state, t_work_reque
             struct json_token val;
             rc = true;
             while ((h = json_next_key(request->data, sdslen(request->data), h, ".params", &key, &val)) != NULL) {
-                rc = mympd_api_connection_save(config, mympd_state, &key, &val);
+                rc = mympd_api_connection_save(mympd_state, &key, &val);
                 if (rc == false) {
                     break;
                 }
             }
+            if (state_store_commit(mympd_state->state_store) == false) {
+                rc = false;
+            }
             if (rc == true) {
                 //push settings to mpd_client queue
-                mympd_api_push_to_mpd_client(mympd_state);
+                mympd_api_push_to_mpd_client(config, mympd_state);
                 response->data = jsonrpc_respond_ok(response->data, request->method, request->id);
             }
             else {
@@ -562,3 +600,19 @@ static void mympd_api(t_config *config, t_mympd_state *mympd_state, t_work_reque
     }
     free_request(request);
 }
+
+//copies a parsed setting, string tokens are still escaped
+static sds settings_add_token(sds buffer, struct json_token *key, struct json_token *val) {
+    if (buffer[sdslen(buffer) - 1] != '{') {
+        buffer = sdscatlen(buffer, ",", 1);
+    }
+    buffer = sdscatlen(buffer, "\"", 1);
+    buffer = sdscatlen(buffer, key->ptr, (size_t)key->len);
+    buffer = sdscatlen(buffer, "\":", 2);
+    if (val->type == JSON_TYPE_STRING) {
+        buffer = sdscatlen(buffer, "\"", 1);
+        buffer = sdscatlen(buffer, val->ptr, (size_t)val->len);
+        return sdscatlen(buffer, "\"", 1);
+    }
+    return sdscatlen(buffer, val->ptr, (size_t)val->len);
+}
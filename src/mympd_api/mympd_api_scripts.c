@@ -19,11 +19,12 @@
 #include <inttypes.h>
 #include <dirent.h>
 #include <sys/types.h>
-#include <sys/syscall.h>
+#include <sys/stat.h>
 
 #include <mpd/client.h>
 
 #include "../../dist/src/sds/sds.h"
+#include "../../dist/src/rax/rax.h"
 #include "../sds_extras.h"
 #include "../../dist/src/frozen/frozen.h"
 #include "../log.h"
@@ -42,6 +43,7 @@
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"  
+#include "../lua_vm.h"
 
 #ifndef DEBUG
 //embedded files for release build
@@ -50,7 +52,6 @@
 
 //private definitions
 struct t_script_thread_arg {
-    t_config *config;
     bool localscript;
     sds script_fullpath;
     sds script_name;
@@ -58,7 +59,74 @@ struct t_script_thread_arg {
     struct list *arguments;
 };
 
-static void *mympd_api_script_execute(void *script_thread_arg);
+//scripts are run by a fixed number of workers from a bounded queue,
+//a local script runs only once at a time and is queued only once
+#define SCRIPT_WORKERS LUA_VM_POOL_SIZE
+#define SCRIPT_QUEUE_SIZE 16
+//running scripts check for shutdown every SCRIPT_STOP_CHECK instructions
+#define SCRIPT_STOP_CHECK 10000
+
+struct t_script_executor {
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+    pthread_t workers[SCRIPT_WORKERS];
+    int worker_count;
+    struct list queue; //key: script name, value_i: localscript, user_data: struct t_script_thread_arg
+    struct list running; //names of running local scripts
+    unsigned long queued;
+    unsigned long replaced; //queued runs superseded by a newer run of the same script
+    unsigned long rejected; //runs refused because the queue was full
+    bool stop;
+};
+
+#define LUA_LIBS_ALL (1u << 31)
+
+static const struct t_lua_lib {
+    const char *name;
+    lua_CFunction open; //NULL for embedded mympd lua libraries
+} lua_libs[] = {
+    {"base", luaopen_base},
+    {"package", luaopen_package},
+    {"coroutine", luaopen_coroutine},
+    {"string", luaopen_string},
+    {"utf8", luaopen_utf8},
+    {"table", luaopen_table},
+    {"math", luaopen_math},
+    {"io", luaopen_io},
+    {"os", luaopen_os},
+    {"debug", luaopen_debug},
+    {"json", NULL},
+    {"mympd", NULL},
+    {NULL, NULL}
+};
+
+static struct t_script_executor script_executor = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER,
+    .worker_count = 0,
+    .queue = {0, NULL, NULL},
+    .running = {0, NULL, NULL},
+    .queued = 0,
+    .replaced = 0,
+    .rejected = 0,
+    .stop = false
+};
+
+//bitmask of lua_libs, parsed once from config->lualibs
+static unsigned script_lualibs = 0;
+
+//jsonrpc id of the last api call from a script, each call gets its own id,
+//a late response for a timed out call is not taken by the next script on the same worker
+static long script_api_request_id = 0;
+
+static void *script_worker_loop(void *arg);
+static struct t_script_thread_arg *script_queue_next(void);
+static void script_running_remove(const char *script);
+static sds script_executor_stats(sds buffer);
+static unsigned parse_lualibs(sds lualibs);
+static void lua_vm_setup_libs(lua_State *lua_vm);
+static void mympd_api_script_execute(struct t_script_thread_arg *script_arg);
+static void lua_stop_hook(lua_State *lua_vm, lua_Debug *ar);
 static sds lua_err_to_str(sds buffer, int rc, bool phrase, const char *script);
 static void populate_lua_table(lua_State *lua_vm, struct list *lua_mympd_state);
 static void populate_lua_table_field_p(lua_State *lua_vm, const char *key, const char *value);
@@ -73,6 +141,46 @@ static void free_t_script_thread_arg(struct t_script_thread_arg *script_thread_a
 static bool mympd_luaopen(lua_State *lua_vm, const char *lualib);
 
 //public functions
+void mympd_api_script_init(t_config *config) {
+    script_lualibs = parse_lualibs(config->lualibs);
+    if (lua_vm_pool_init(lua_vm_setup_libs) == false) {
+        return;
+    }
+
+    pthread_mutex_lock(&script_executor.mutex);
+    script_executor.stop = false;
+    for (int i = 0; i < SCRIPT_WORKERS; i++) {
+        if (pthread_create(&script_executor.workers[script_executor.worker_count], NULL, script_worker_loop, NULL) != 0) {
+            LOG_ERROR("Can not create mympd_script thread");
+            continue;
+        }
+        pthread_setname_np(script_executor.workers[script_executor.worker_count], "mympd_script");
+        script_executor.worker_count++;
+    }
+    pthread_mutex_unlock(&script_executor.mutex);
+}
+
+void mympd_api_script_cleanup(void) {
+    //running scripts are aborted by lua_stop_hook and stop waiting for api responses
+    //after the shutdown signal, the workers are joined
+    pthread_mutex_lock(&script_executor.mutex);
+    __atomic_store_n(&script_executor.stop, true, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&script_executor.wakeup);
+    pthread_mutex_unlock(&script_executor.mutex);
+    for (int i = 0; i < script_executor.worker_count; i++) {
+        pthread_join(script_executor.workers[i], NULL);
+    }
+    script_executor.worker_count = 0;
+    struct list_node *current;
+    while ((current = list_shift_first(&script_executor.queue)) != NULL) {
+        free_t_script_thread_arg((struct t_script_thread_arg *)current->user_data);
+        list_node_free_keep_user_data(current);
+    }
+    list_free(&script_executor.running);
+
+    lua_vm_pool_free();
+}
+
 sds mympd_api_script_list(t_config *config, sds buffer, sds method, long request_id, bool all) {
     buffer = jsonrpc_start_result(buffer, method, request_id);
     buffer = sdscat(buffer, ",\"data\":[");
@@ -143,7 +251,8 @@ sds mympd_api_script_list(t_config *config, sds buffer, sds method, long request
         LOG_ERROR("Can not open directory \"%s\": %s", scriptdirname, strerror(errno));
     }
     sdsfree(scriptdirname);
-    buffer = sdscat(buffer, "]");        
+    buffer = sdscat(buffer, "],");
+    buffer = script_executor_stats(buffer);
     buffer = jsonrpc_end_result(buffer);
     return buffer;
 }
@@ -155,6 +264,7 @@ bool mympd_api_script_delete(t_config *config, const char *script) {
         sdsfree(scriptfilename);
         return false;
     }
+    lua_vm_bytecode_remove(scriptfilename);
     sdsfree(scriptfilename);
     return true;
 }
@@ -185,6 +295,7 @@ bool mympd_api_script_save(t_config *config, const char *script, int order, cons
         if (unlink(oldscript_filename) == -1) {
             LOG_ERROR("Error removing file \"%s\": %s", oldscript_filename, strerror(errno));
         }
+        lua_vm_bytecode_remove(oldscript_filename);
         sdsfree(oldscript_filename);
     }
     sdsfree(tmp_file);
@@ -246,19 +357,9 @@ sds mympd_api_script_get(t_config *config, sds buffer, sds method, long request_
 }
 
 bool mympd_api_script_start(t_config *config, const char *script, struct list *arguments, bool localscript) {
-    pthread_t mympd_script_thread;
-    pthread_attr_t attr;
-    if (pthread_attr_init(&attr) != 0) {
-        LOG_ERROR("Can not init mympd_script thread attribute");
-        return false;
-    }
-    if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0) {
-        LOG_ERROR("Can not set mympd_script thread to detached");
-        return false;
-    }
+    mympd_api_script_init(config);
     struct t_script_thread_arg *script_thread_arg = (struct t_script_thread_arg *)malloc(sizeof(struct t_script_thread_arg));
     assert(script_thread_arg);
-    script_thread_arg->config = config;
     script_thread_arg->localscript = localscript;
     script_thread_arg->arguments = arguments;
     if (localscript == true) {
@@ -271,12 +372,41 @@ bool mympd_api_script_start(t_config *config, const char *script, struct list *a
         script_thread_arg->script_fullpath = sdsempty();
         script_thread_arg->script_content = sdsnew(script);
     }
-    if (pthread_create(&mympd_script_thread, &attr, mympd_api_script_execute, script_thread_arg) != 0) {
-        LOG_ERROR("Can not create mympd_script thread");
+    pthread_mutex_lock(&script_executor.mutex);
+    if (script_executor.worker_count == 0) {
+        pthread_mutex_unlock(&script_executor.mutex);
+        LOG_ERROR("No mympd_script thread is running");
         free_t_script_thread_arg(script_thread_arg);
         return false;
     }
-    pthread_setname_np(mympd_script_thread, "mympd_script");
+    if (localscript == true) {
+        //the newest run of a script replaces an already queued one
+        struct list_node *current = script_executor.queue.head;
+        while (current != NULL) {
+            if (current->value_i == 1 && strcmp(current->key, script) == 0) {
+                free_t_script_thread_arg((struct t_script_thread_arg *)current->user_data);
+                current->user_data = script_thread_arg;
+                script_executor.replaced++;
+                LOG_DEBUG("Replaced queued run of script %s", script);
+                pthread_mutex_unlock(&script_executor.mutex);
+                return true;
+            }
+            current = current->next;
+        }
+    }
+    if (script_executor.queue.length >= SCRIPT_QUEUE_SIZE) {
+        script_executor.rejected++;
+        pthread_mutex_unlock(&script_executor.mutex);
+        LOG_WARN("Script queue is full, rejecting script %s", script_thread_arg->script_name);
+        free_t_script_thread_arg(script_thread_arg);
+        return false;
+    }
+    list_push(&script_executor.queue, script_thread_arg->script_name, localscript, NULL, script_thread_arg);
+    script_executor.queued++;
+    LOG_DEBUG("Queued script %s, queue length: %u, running: %u", script_thread_arg->script_name,
+        script_executor.queue.length, script_executor.running.length);
+    pthread_cond_signal(&script_executor.wakeup);
+    pthread_mutex_unlock(&script_executor.mutex);
     expire_result_queue(mympd_script_queue, 120);
     return true;
 }
@@ -287,59 +417,98 @@ bool mympd_api_get_lua_mympd_state(t_mympd_state *mympd_state, struct list *lua_
 }
 
 //private functions
-static void *mympd_api_script_execute(void *script_thread_arg) {
+static void *script_worker_loop(void *arg) {
+    (void) arg;
     thread_logname = sdsreplace(thread_logname, "script");
-    struct t_script_thread_arg *script_arg = (struct t_script_thread_arg *) script_thread_arg;
-    
+    pthread_mutex_lock(&script_executor.mutex);
+    while (script_executor.stop == false) {
+        struct t_script_thread_arg *script_arg = script_queue_next();
+        if (script_arg == NULL) {
+            pthread_cond_wait(&script_executor.wakeup, &script_executor.mutex);
+            continue;
+        }
+        if (script_arg->localscript == true) {
+            list_push(&script_executor.running, script_arg->script_name, 0, NULL, NULL);
+        }
+        pthread_mutex_unlock(&script_executor.mutex);
+        mympd_api_script_execute(script_arg);
+        pthread_mutex_lock(&script_executor.mutex);
+        if (script_arg->localscript == true) {
+            script_running_remove(script_arg->script_name);
+            //queued runs of this script are runnable now
+            pthread_cond_broadcast(&script_executor.wakeup);
+        }
+        free_t_script_thread_arg(script_arg);
+    }
+    pthread_mutex_unlock(&script_executor.mutex);
+    sdsfree(thread_logname);
+    return NULL;
+}
+
+//returns the first queued run whose script is not running, must be called with the mutex locked
+static struct t_script_thread_arg *script_queue_next(void) {
+    unsigned i = 0;
+    struct list_node *current = script_executor.queue.head;
+    while (current != NULL) {
+        if (current->value_i == 0 || list_get_node(&script_executor.running, current->key) == NULL) {
+            break;
+        }
+        current = current->next;
+        i++;
+    }
+    if (current == NULL) {
+        return NULL;
+    }
+    if (i > 0) {
+        list_move_item_pos(&script_executor.queue, i, 0);
+    }
+    current = list_shift_first(&script_executor.queue);
+    struct t_script_thread_arg *script_arg = (struct t_script_thread_arg *)current->user_data;
+    list_node_free_keep_user_data(current);
+    return script_arg;
+}
+
+static void script_running_remove(const char *script) {
+    unsigned i = 0;
+    struct list_node *current = script_executor.running.head;
+    while (current != NULL) {
+        if (strcmp(current->key, script) == 0) {
+            list_shift(&script_executor.running, i);
+            return;
+        }
+        current = current->next;
+        i++;
+    }
+}
+
+static sds script_executor_stats(sds buffer) {
+    pthread_mutex_lock(&script_executor.mutex);
+    buffer = sdscat(buffer, "\"queue\":{");
+    buffer = tojson_long(buffer, "workers", script_executor.worker_count, true);
+    buffer = tojson_long(buffer, "length", script_executor.queue.length, true);
+    buffer = tojson_long(buffer, "running", script_executor.running.length, true);
+    buffer = tojson_long(buffer, "queued", script_executor.queued, true);
+    buffer = tojson_long(buffer, "replaced", script_executor.replaced, true);
+    buffer = tojson_long(buffer, "rejected", script_executor.rejected, false);
+    buffer = sdscat(buffer, "}");
+    pthread_mutex_unlock(&script_executor.mutex);
+    return buffer;
+}
+
+static void mympd_api_script_execute(struct t_script_thread_arg *script_arg) {
     const char *script_return_text = NULL;
-    lua_State *lua_vm = luaL_newstate();
+    lua_State *lua_vm = lua_vm_acquire();
     if (lua_vm == NULL) {
-        LOG_ERROR("Memory allocation error in luaL_newstate");
         sds buffer = jsonrpc_start_phrase_notify(sdsempty(), "Error executing script %{script}: Memory allocation error", false);
         buffer = tojson_char(buffer, "script", script_arg->script_name, false);
         buffer = jsonrpc_end_phrase(buffer);
         ws_notify(buffer);
         sdsfree(buffer);
-        sdsfree(thread_logname);
-        free_t_script_thread_arg(script_arg);
-        return NULL;
+        return;
     }
-    if (strcmp(script_arg->config->lualibs, "all") == 0) {
-        LOG_DEBUG("Open all standard lua libs");
-        luaL_openlibs(lua_vm);
-        mympd_luaopen(lua_vm, "json");
-        mympd_luaopen(lua_vm, "mympd");
-    }
-    else {
-        int count;
-        sds *tokens = sdssplitlen(script_arg->config->lualibs, sdslen(script_arg->config->lualibs), ",", 1, &count);
-        for (int i = 0; i < count; i++) {
-            sdstrim(tokens[i], " ");
-            LOG_DEBUG("Open lua library %s", tokens[i]);
-            if (strcmp(tokens[i], "base") == 0)           { luaL_requiref(lua_vm, "base", luaopen_base, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "package") == 0)   { luaL_requiref(lua_vm, "package", luaopen_package, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "coroutine") == 0) { luaL_requiref(lua_vm, "coroutine", luaopen_coroutine, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "string") == 0)    { luaL_requiref(lua_vm, "string", luaopen_string, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "utf8") == 0)      { luaL_requiref(lua_vm, "utf8", luaopen_utf8, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "table") == 0)     { luaL_requiref(lua_vm, "table", luaopen_table, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "math") == 0)      { luaL_requiref(lua_vm, "math", luaopen_math, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "io") == 0)        { luaL_requiref(lua_vm, "io", luaopen_io, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "os") == 0)        { luaL_requiref(lua_vm, "os", luaopen_os, 1); lua_pop(lua_vm, 1); }
-            else if (strcmp(tokens[i], "debug") == 0)     { luaL_requiref(lua_vm, "debug", luaopen_debug, 1); lua_pop(lua_vm, 1); }
-            //custom libs
-            else if (strcmp(tokens[i], "json") == 0)	  { mympd_luaopen(lua_vm, tokens[i]); }
-            else if (strcmp(tokens[i], "mympd") == 0) 	  { mympd_luaopen(lua_vm, tokens[i]); }
-            else {
-                LOG_ERROR("Can not open lua library %s", tokens[i]);
-                continue;
-            }
-        }
-        sdsfreesplitres(tokens,count);
-    }
-    register_lua_functions(lua_vm);
     int rc;
     if (script_arg->localscript == true) {
-        rc = luaL_loadfilex(lua_vm, script_arg->script_fullpath, "t");
+        rc = lua_vm_load_script(lua_vm, script_arg->script_fullpath);
     }
     else {
         rc = luaL_loadstring(lua_vm, script_arg->script_content);
@@ -355,7 +524,9 @@ static void *mympd_api_script_execute(void *script_thread_arg) {
             lua_setglobal(lua_vm, "arguments");
         }
         LOG_DEBUG("Start script");
+        lua_sethook(lua_vm, lua_stop_hook, LUA_MASKCOUNT, SCRIPT_STOP_CHECK);
         rc = lua_pcall(lua_vm, 0, 1, 0);
+        lua_sethook(lua_vm, NULL, 0, 0);
         LOG_DEBUG("End script");
     }
     //it should be only one value on the stack
@@ -398,10 +569,66 @@ static void *mympd_api_script_execute(void *script_thread_arg) {
         LOG_ERROR(err_str);
         sdsfree(err_str);
     }
-    lua_close(lua_vm);
-    sdsfree(thread_logname);
-    free_t_script_thread_arg(script_arg);
-    return NULL;
+    //states of failed scripts are not reused
+    lua_vm_release(lua_vm, rc == 0);
+}
+
+//aborts the running script on shutdown, scripts in endless loops would block the join of the workers
+static void lua_stop_hook(lua_State *lua_vm, lua_Debug *ar) {
+    (void) ar;
+    if (__atomic_load_n(&script_executor.stop, __ATOMIC_RELAXED) == true) {
+        luaL_error(lua_vm, "Script stopped");
+    }
+}
+
+static unsigned parse_lualibs(sds lualibs) {
+    if (strcmp(lualibs, "all") == 0) {
+        return LUA_LIBS_ALL;
+    }
+    unsigned mask = 0;
+    int count;
+    sds *tokens = sdssplitlen(lualibs, sdslen(lualibs), ",", 1, &count);
+    for (int i = 0; i < count; i++) {
+        sdstrim(tokens[i], " ");
+        int j = 0;
+        while (lua_libs[j].name != NULL && strcmp(tokens[i], lua_libs[j].name) != 0) {
+            j++;
+        }
+        if (lua_libs[j].name == NULL) {
+            LOG_ERROR("Can not open lua library %s", tokens[i]);
+            continue;
+        }
+        mask |= 1u << j;
+    }
+    sdsfreesplitres(tokens, count);
+    return mask;
+}
+
+//opens the configured libraries of a new pooled lua state
+static void lua_vm_setup_libs(lua_State *lua_vm) {
+    unsigned lualibs = script_lualibs;
+    if (lualibs == LUA_LIBS_ALL) {
+        LOG_DEBUG("Open all standard lua libs");
+        luaL_openlibs(lua_vm);
+        mympd_luaopen(lua_vm, "json");
+        mympd_luaopen(lua_vm, "mympd");
+    }
+    else {
+        for (int i = 0; lua_libs[i].name != NULL; i++) {
+            if ((lualibs & (1u << i)) == 0) {
+                continue;
+            }
+            LOG_DEBUG("Open lua library %s", lua_libs[i].name);
+            if (lua_libs[i].open != NULL) {
+                luaL_requiref(lua_vm, lua_libs[i].name, lua_libs[i].open, 1);
+                lua_pop(lua_vm, 1);
+            }
+            else {
+                mympd_luaopen(lua_vm, lua_libs[i].name);
+            }
+        }
+    }
+    register_lua_functions(lua_vm);
 }
 
 static sds lua_err_to_str(sds buffer, int rc, bool phrase, const char *script) {
@@ -539,10 +766,10 @@ static int _mympd_api(lua_State *lua_vm, bool raw) {
         return luaL_error(lua_vm, "Invalid method");
     }
 
-    pid_t tid = syscall(__NR_gettid);
+    long id = __atomic_add_fetch(&script_api_request_id, 1, __ATOMIC_RELAXED);
     
-    t_work_request *request = create_request(-2, tid, method_id, method, "");
-    request->data = sdscatprintf(request->data, "{\"jsonrpc\":\"2.0\",\"id\":%d,\"method\":\"%s\",\"params\":{", tid, method);
+    t_work_request *request = create_request(-2, id, method_id, method, "");
+    request->data = sdscatprintf(request->data, "{\"jsonrpc\":\"2.0\",\"id\":%ld,\"method\":\"%s\",\"params\":{", id, method);
     if (raw == false) {
         for (int i = 2; i < n; i = i + 2) {
             bool comma = i + 1 < n ? true : false;
@@ -566,19 +793,19 @@ static int _mympd_api(lua_State *lua_vm, bool raw) {
     request->data = sdscat(request->data, "}}");
     
     if (strncmp(method, "MYMPD_API_", 10) == 0) {
-        tiny_queue_push(mympd_api_queue, request, tid);
+        tiny_queue_push(mympd_api_queue, request, id);
     }
     else if (strncmp(method, "MPDWORKER_API_", 14) == 0) {
-        tiny_queue_push(mpd_worker_queue, request, tid);
+        tiny_queue_push(mpd_worker_queue, request, id);
     }
     else {
-        tiny_queue_push(mpd_client_queue, request, tid);
+        tiny_queue_push(mpd_client_queue, request, id);
     }
 
     int i = 0;
     while (s_signal_received == 0 && i < 60) {
         i++;
-        t_work_result *response = tiny_queue_shift(mympd_script_queue, 1000000, tid);
+        t_work_result *response = tiny_queue_shift(mympd_script_queue, 1000000, id);
         if (response != NULL) {
             LOG_DEBUG("Got result: %s", response->data);
             
@@ -12,6 +12,8 @@
          ((5) == LUA_VERSION_MAJOR && \
           ((3) == LUA_VERSION_MINOR))
 
+void mympd_api_script_init(t_config *config);
+void mympd_api_script_cleanup(void);
 bool mympd_api_script_save(t_config *config, const char *script, int order, const char *content, const char *arguments, const char *oldscript);
 bool mympd_api_script_delete(t_config *config, const char *script);
 sds mympd_api_script_get(t_config *config, sds buffer, sds method, long request_id, const char *script);
@@ -17,22 +17,36 @@
 #include <inttypes.h>
 
 #include "../../dist/src/sds/sds.h"
+#include "../../dist/src/rax/rax.h"
 #include "../sds_extras.h"
 #include "../../dist/src/frozen/frozen.h"
 #include "../log.h"
 #include "../list.h"
 #include "config_defs.h"
 #include "../utility.h"
+#include "../state_store.h"
+#include "../mpd_client/mpd_client_last_played.h"
 #include "mympd_api_utility.h"
 #include "mympd_api_timer.h"
 #include "mympd_api_timer_handlers.h"
 #include "mympd_api_settings.h"
 
 //private definitions
-static sds state_file_rw_string(t_config *config, const char *name, const char *def_value, bool warn);
-static bool state_file_rw_bool(t_config *config, const char *name, const bool def_value, bool warn);
-static int state_file_rw_int(t_config *config, const char *name, const int def_value, bool warn);
-static bool state_file_write(t_config *config, const char *name, const char *value);
+//settings in the state store, each was a file in the state directory before
+static const char *state_store_keys[] = {"mpd_host", "mpd_port", "mpd_pass", "stickers", "taglist", "searchtaglist", "browsetaglist",
+    "smartpls", "smartpls_sort", "smartpls_prefix", "smartpls_interval", "generate_pls_tags", "max_elements_per_page",
+    "last_played_count", "love", "love_channel", "love_message", "notification_web", "notification_page", "media_session",
+    "auto_play", "jukebox_mode", "jukebox_playlist", "jukebox_queue_length", "jukebox_last_played", "jukebox_unique_tag",
+    "cols_queue_current", "cols_search", "cols_browse_database", "cols_browse_playlists_detail", "cols_browse_filesystem",
+    "cols_playback", "cols_queue_last_played", "cols_queue_jukebox", "localplayer", "stream_port", "stream_url", "bg_cover",
+    "bg_color", "bg_css_filter", "coverimage", "coverimage_name", "coverimage_size", "coverimage_size_small", "locale",
+    "music_directory", "bookmarks", "theme", "timer", "highlight_color", "booklet_name", "advanced", "lyrics", 0};
+
+static void remove_state_files(t_config *config, const char **state_files);
+static sds state_rw_string(t_state_store *store, const char *name, const char *def_value);
+static bool state_rw_bool(t_state_store *store, const char *name, const bool def_value);
+static int state_rw_int(t_state_store *store, const char *name, const int def_value);
+static bool state_write(t_mympd_state *mympd_state, const char *name, const char *value);
 static sds default_navbar_icons(t_config *config, sds buffer);
 static sds read_navbar_icons(t_config *config);
 
@@ -41,31 +55,18 @@ void mympd_api_settings_delete(t_config *config) {
     if (config->readonly == true) {
         return;
     }
-    const char* state_files[]={"auto_play", "bg_color", "bg_cover", "bg_css_filter", "browsetaglist", "cols_browse_database",
-        "cols_browse_filesystem", "cols_browse_playlists_detail", "cols_playback", "cols_queue_current", "cols_queue_last_played",
-        "cols_search", "cols_queue_jukebox", "coverimage", "coverimage_name", "coverimage_size", "jukebox_mode", "jukebox_playlist", "jukebox_queue_length",
-        "jukebox_unique_tag", "jukebox_last_played", "generate_pls_tags", "smartpls_sort", "smartpls_prefix", "smartpls_interval",
-        "last_played", "last_played_count", "locale", "localplayer", "love", "love_channel", "love_message",
-        "max_elements_per_page",  "mpd_host", "mpd_pass", "mpd_port", "notification_page", "notification_web", "searchtaglist",
-        "smartpls", "stickers", "stream_port", "stream_url", "taglist", "music_directory", "bookmarks", "bookmark_list", "coverimage_size_small", 
-        "theme", "timer", "highlight_color", "media_session", "booklet_name", "lyrics", "home_list", "navbar_icons", "advanced", 0};
-    const char** ptr = state_files;
-    while (*ptr != 0) {
-        sds filename = sdscatfmt(sdsempty(), "%s/state/%s", config->varlibdir, *ptr);
-        int rc = unlink(filename);
-        if (rc != 0 && rc != ENOENT) {
-            LOG_ERROR("Error removing file \"%s\": %s", filename, strerror(errno));
-        }
-        else if (rc != 0) {
-            //ignore error
-            LOG_DEBUG("Error removing file \"%s\": %s", filename, strerror(errno));
-        }
-        sdsfree(filename);
-        ++ptr;
-    }
+    state_store_remove(config->varlibdir);
+    remove_state_files(config, state_store_keys);
+    const char* state_files[]={"bookmark_list", "home_list", "navbar_icons", 0};
+    remove_state_files(config, state_files);
+    last_played_store_remove(config);
+}
+
+struct t_state_store *mympd_api_settings_store_open(t_config *config) {
+    return state_store_open(config->varlibdir, config->readonly, state_store_keys);
 }
 
-bool mympd_api_connection_save(t_config *config, t_mympd_state *mympd_state, struct json_token *key, struct json_token *val) {
+bool mympd_api_connection_save(t_mympd_state *mympd_state, struct json_token *key, struct json_token *val) {
     char *crap;
     sds settingname = sdsempty();
     sds settingvalue = sdscatlen(sdsempty(), val->ptr, val->len);
@@ -99,13 +100,14 @@ bool mympd_api_connection_save(t_config *config, t_mympd_state *mympd_state, str
         return true;
     }
 
-    bool rc = state_file_write(config, settingname, settingvalue);
+    //written by the commit at the end of the api call
+    state_store_set(mympd_state->state_store, settingname, settingvalue);
     sdsfree(settingname);
     sdsfree(settingvalue);
-    return rc;
+    return true;
 }
 
-bool mympd_api_cols_save(t_config *config, t_mympd_state *mympd_state, const char *table, const char *cols) {
+bool mympd_api_cols_save(t_mympd_state *mympd_state, const char *table, const char *cols) {
     sds tablename = sdsempty();
     if (strcmp(table, "colsQueueCurrent") == 0) {
         mympd_state->cols_queue_current = sdsreplace(mympd_state->cols_queue_current, cols);
@@ -144,7 +146,7 @@ bool mympd_api_cols_save(t_config *config, t_mympd_state *mympd_state, const cha
         return false;
     }
     
-    if (!state_file_write(config, tablename, cols)) {
+    if (!state_write(mympd_state, tablename, cols)) {
         sdsfree(tablename);
         return false;
     }
@@ -152,7 +154,9 @@ bool mympd_api_cols_save(t_config *config, t_mympd_state *mympd_state, const cha
     return true;
 }
 
-bool mympd_api_settings_set(t_config *config, t_mympd_state *mympd_state, struct json_token *key, struct json_token *val) {
+//changed is set to false if the setting is known and its value is unchanged
+bool mympd_api_settings_set(t_config *config, t_mympd_state *mympd_state, struct json_token *key, struct json_token *val, bool *changed) {
+    *changed = true;
     sds settingname = sdsempty();
     sds settingvalue = sdscatlen(sdsempty(), val->ptr, val->len);
     char *crap;
@@ -372,74 +376,80 @@ bool mympd_api_settings_set(t_config *config, t_mympd_state *mympd_state, struct
         sdsfree(settingvalue);
         return true;
     }
-    bool rc = state_file_write(config, settingname, settingvalue);
+    //written by the commit at the end of the api call
+    *changed = state_store_set(mympd_state->state_store, settingname, settingvalue);
     sdsfree(settingname);
     sdsfree(settingvalue);
-    return rc;
+    return true;
 }
 
 void mympd_api_settings_reset(t_config *config, t_mympd_state *mympd_state) {
+    state_store_free(mympd_state->state_store);
     mympd_api_settings_delete(config);
     free_mympd_state_sds(mympd_state);
     mympd_api_read_statefiles(config, mympd_state);
-    mympd_api_push_to_mpd_client(mympd_state);
+    mympd_api_push_to_mpd_client(config, mympd_state);
 }
 
 void mympd_api_read_statefiles(t_config *config, t_mympd_state *mympd_state) {
     LOG_INFO("Reading states");
-    mympd_state->mpd_host = state_file_rw_string(config, "mpd_host", config->mpd_host, false);
-    mympd_state->mpd_port = state_file_rw_int(config, "mpd_port", config->mpd_port, false);
-    mympd_state->mpd_pass = state_file_rw_string(config, "mpd_pass", config->mpd_pass, false);
-    mympd_state->stickers = state_file_rw_bool(config, "stickers", config->stickers, false);
-    mympd_state->taglist = state_file_rw_string(config, "taglist", config->taglist, false);
-    mympd_state->searchtaglist = state_file_rw_string(config, "searchtaglist", config->searchtaglist, false);
-    mympd_state->browsetaglist = state_file_rw_string(config, "browsetaglist", config->browsetaglist, false);
-    mympd_state->smartpls = state_file_rw_bool(config, "smartpls", config->smartpls, false);
-    mympd_state->smartpls_sort = state_file_rw_string(config, "smartpls_sort", config->smartpls_sort, false);
-    mympd_state->smartpls_prefix = state_file_rw_string(config, "smartpls_prefix", config->smartpls_prefix, false);
-    mympd_state->smartpls_interval = state_file_rw_int(config, "smartpls_interval", config->smartpls_interval, false);
-    mympd_state->generate_pls_tags = state_file_rw_string(config, "generate_pls_tags", config->generate_pls_tags, false);
-    mympd_state->max_elements_per_page = state_file_rw_int(config, "max_elements_per_page", config->max_elements_per_page, false);
-    mympd_state->last_played_count = state_file_rw_int(config, "last_played_count", config->last_played_count, false);
-    mympd_state->love = state_file_rw_bool(config, "love", config->love, false);
-    mympd_state->love_channel = state_file_rw_string(config, "love_channel", config->love_channel, false);
-    mympd_state->love_message = state_file_rw_string(config, "love_message", config->love_message, false);
-    mympd_state->notification_web = state_file_rw_bool(config, "notification_web", config->notification_web, false);
-    mympd_state->notification_page = state_file_rw_bool(config, "notification_page", config->notification_page, false);
-    mympd_state->media_session = state_file_rw_bool(config, "media_session", config->media_session, false);
-    mympd_state->auto_play = state_file_rw_bool(config, "auto_play", config->auto_play, false);
-    mympd_state->jukebox_mode = state_file_rw_int(config, "jukebox_mode", config->jukebox_mode, false);
-    mympd_state->jukebox_playlist = state_file_rw_string(config, "jukebox_playlist", config->jukebox_playlist, false);
-    mympd_state->jukebox_queue_length = state_file_rw_int(config, "jukebox_queue_length", config->jukebox_queue_length, false);
-    mympd_state->jukebox_last_played = state_file_rw_int(config, "jukebox_last_played", config->jukebox_last_played, false);
-    mympd_state->jukebox_unique_tag = state_file_rw_string(config, "jukebox_unique_tag", config->jukebox_unique_tag, false);
-    mympd_state->cols_queue_current = state_file_rw_string(config, "cols_queue_current", config->cols_queue_current, false);
-    mympd_state->cols_search = state_file_rw_string(config, "cols_search", config->cols_search, false);
-    mympd_state->cols_browse_database = state_file_rw_string(config, "cols_browse_database", config->cols_browse_database, false);
-    mympd_state->cols_browse_playlists_detail = state_file_rw_string(config, "cols_browse_playlists_detail", config->cols_browse_playlists_detail, false);
-    mympd_state->cols_browse_filesystem = state_file_rw_string(config, "cols_browse_filesystem", config->cols_browse_filesystem, false);
-    mympd_state->cols_playback = state_file_rw_string(config, "cols_playback", config->cols_playback, false);
-    mympd_state->cols_queue_last_played = state_file_rw_string(config, "cols_queue_last_played", config->cols_queue_last_played, false);
-    mympd_state->cols_queue_jukebox = state_file_rw_string(config, "cols_queue_jukebox", config->cols_queue_jukebox, false);
-    mympd_state->localplayer = state_file_rw_bool(config, "localplayer", config->localplayer, false);
-    mympd_state->stream_port = state_file_rw_int(config, "stream_port", config->stream_port, false);
-    mympd_state->stream_url = state_file_rw_string(config, "stream_url", config->stream_url, false);
-    mympd_state->bg_cover = state_file_rw_bool(config, "bg_cover", config->bg_cover, false);
-    mympd_state->bg_color = state_file_rw_string(config, "bg_color", config->bg_color, false);
-    mympd_state->bg_css_filter = state_file_rw_string(config, "bg_css_filter", config->bg_css_filter, false);
-    mympd_state->coverimage = state_file_rw_bool(config, "coverimage", config->coverimage, false);
-    mympd_state->coverimage_name = state_file_rw_string(config, "coverimage_name", config->coverimage_name, false);
-    mympd_state->coverimage_size = state_file_rw_int(config, "coverimage_size", config->coverimage_size, false);
-    mympd_state->coverimage_size_small = state_file_rw_int(config, "coverimage_size_small", config->coverimage_size_small, false);
-    mympd_state->locale = state_file_rw_string(config, "locale", config->locale, false);
-    mympd_state->music_directory = state_file_rw_string(config, "music_directory", config->music_directory, false);
-    mympd_state->bookmarks = state_file_rw_bool(config, "bookmarks", config->bookmarks, false);
-    mympd_state->theme = state_file_rw_string(config, "theme", config->theme, false);
-    mympd_state->timer = state_file_rw_bool(config, "timer", config->timer, false);
-    mympd_state->highlight_color = state_file_rw_string(config, "highlight_color", config->highlight_color, false);
-    mympd_state->booklet_name = state_file_rw_string(config, "booklet_name", config->booklet_name, false);
-    mympd_state->advanced = state_file_rw_string(config, "advanced", "{}", false);
-    mympd_state->lyrics = state_file_rw_bool(config, "lyrics", config->lyrics, false);
+    mympd_state->state_store = mympd_api_settings_store_open(config);
+    t_state_store *store = mympd_state->state_store;
+    mympd_state->mpd_host = state_rw_string(store, "mpd_host", config->mpd_host);
+    mympd_state->mpd_port = state_rw_int(store, "mpd_port", config->mpd_port);
+    mympd_state->mpd_pass = state_rw_string(store, "mpd_pass", config->mpd_pass);
+    mympd_state->stickers = state_rw_bool(store, "stickers", config->stickers);
+    mympd_state->taglist = state_rw_string(store, "taglist", config->taglist);
+    mympd_state->searchtaglist = state_rw_string(store, "searchtaglist", config->searchtaglist);
+    mympd_state->browsetaglist = state_rw_string(store, "browsetaglist", config->browsetaglist);
+    mympd_state->smartpls = state_rw_bool(store, "smartpls", config->smartpls);
+    mympd_state->smartpls_sort = state_rw_string(store, "smartpls_sort", config->smartpls_sort);
+    mympd_state->smartpls_prefix = state_rw_string(store, "smartpls_prefix", config->smartpls_prefix);
+    mympd_state->smartpls_interval = state_rw_int(store, "smartpls_interval", config->smartpls_interval);
+    mympd_state->generate_pls_tags = state_rw_string(store, "generate_pls_tags", config->generate_pls_tags);
+    mympd_state->max_elements_per_page = state_rw_int(store, "max_elements_per_page", config->max_elements_per_page);
+    mympd_state->last_played_count = state_rw_int(store, "last_played_count", config->last_played_count);
+    mympd_state->love = state_rw_bool(store, "love", config->love);
+    mympd_state->love_channel = state_rw_string(store, "love_channel", config->love_channel);
+    mympd_state->love_message = state_rw_string(store, "love_message", config->love_message);
+    mympd_state->notification_web = state_rw_bool(store, "notification_web", config->notification_web);
+    mympd_state->notification_page = state_rw_bool(store, "notification_page", config->notification_page);
+    mympd_state->media_session = state_rw_bool(store, "media_session", config->media_session);
+    mympd_state->auto_play = state_rw_bool(store, "auto_play", config->auto_play);
+    mympd_state->jukebox_mode = state_rw_int(store, "jukebox_mode", config->jukebox_mode);
+    mympd_state->jukebox_playlist = state_rw_string(store, "jukebox_playlist", config->jukebox_playlist);
+    mympd_state->jukebox_queue_length = state_rw_int(store, "jukebox_queue_length", config->jukebox_queue_length);
+    mympd_state->jukebox_last_played = state_rw_int(store, "jukebox_last_played", config->jukebox_last_played);
+    mympd_state->jukebox_unique_tag = state_rw_string(store, "jukebox_unique_tag", config->jukebox_unique_tag);
+    mympd_state->cols_queue_current = state_rw_string(store, "cols_queue_current", config->cols_queue_current);
+    mympd_state->cols_search = state_rw_string(store, "cols_search", config->cols_search);
+    mympd_state->cols_browse_database = state_rw_string(store, "cols_browse_database", config->cols_browse_database);
+    mympd_state->cols_browse_playlists_detail = state_rw_string(store, "cols_browse_playlists_detail", config->cols_browse_playlists_detail);
+    mympd_state->cols_browse_filesystem = state_rw_string(store, "cols_browse_filesystem", config->cols_browse_filesystem);
+    mympd_state->cols_playback = state_rw_string(store, "cols_playback", config->cols_playback);
+    mympd_state->cols_queue_last_played = state_rw_string(store, "cols_queue_last_played", config->cols_queue_last_played);
+    mympd_state->cols_queue_jukebox = state_rw_string(store, "cols_queue_jukebox", config->cols_queue_jukebox);
+    mympd_state->localplayer = state_rw_bool(store, "localplayer", config->localplayer);
+    mympd_state->stream_port = state_rw_int(store, "stream_port", config->stream_port);
+    mympd_state->stream_url = state_rw_string(store, "stream_url", config->stream_url);
+    mympd_state->bg_cover = state_rw_bool(store, "bg_cover", config->bg_cover);
+    mympd_state->bg_color = state_rw_string(store, "bg_color", config->bg_color);
+    mympd_state->bg_css_filter = state_rw_string(store, "bg_css_filter", config->bg_css_filter);
+    mympd_state->coverimage = state_rw_bool(store, "coverimage", config->coverimage);
+    mympd_state->coverimage_name = state_rw_string(store, "coverimage_name", config->coverimage_name);
+    mympd_state->coverimage_size = state_rw_int(store, "coverimage_size", config->coverimage_size);
+    mympd_state->coverimage_size_small = state_rw_int(store, "coverimage_size_small", config->coverimage_size_small);
+    mympd_state->locale = state_rw_string(store, "locale", config->locale);
+    mympd_state->music_directory = state_rw_string(store, "music_directory", config->music_directory);
+    mympd_state->bookmarks = state_rw_bool(store, "bookmarks", config->bookmarks);
+    mympd_state->theme = state_rw_string(store, "theme", config->theme);
+    mympd_state->timer = state_rw_bool(store, "timer", config->timer);
+    mympd_state->highlight_color = state_rw_string(store, "highlight_color", config->highlight_color);
+    mympd_state->booklet_name = state_rw_string(store, "booklet_name", config->booklet_name);
+    mympd_state->advanced = state_rw_string(store, "advanced", "{}");
+    mympd_state->lyrics = state_rw_bool(store, "lyrics", config->lyrics);
+    //persist the defaults of new settings
+    state_store_commit(store);
     if (config->readonly == true) {
         mympd_state->bookmarks = false;
         mympd_state->smartpls = false;
@@ -540,102 +550,56 @@ sds mympd_api_settings_put(t_config *config, t_mympd_state *mympd_state, sds buf
 }
 
 //privat functions
-static sds state_file_rw_string(t_config *config, const char *name, const char *def_value, bool warn) {
-    char *line = NULL;
-    size_t n = 0;
-    ssize_t read;
-    
-    sds result = sdsempty();
-    
-    if (!validate_string(name)) {
-        return result;
-    }
-    
-    sds cfg_file = sdscatfmt(sdsempty(), "%s/state/%s", config->varlibdir, name);
-    FILE *fp = fopen(cfg_file, "r");
-    if (fp == NULL) {
-        if (warn == true) {
-            LOG_WARN("Can not open file \"%s\": %s", cfg_file, strerror(errno));
-        }
-        else if (errno != ENOENT) {
-            LOG_ERROR("Can not open file \"%s\": %s", cfg_file, strerror(errno));
+static void remove_state_files(t_config *config, const char **state_files) {
+    const char** ptr = state_files;
+    while (*ptr != 0) {
+        sds filename = sdscatfmt(sdsempty(), "%s/state/%s", config->varlibdir, *ptr);
+        int rc = unlink(filename);
+        if (rc != 0 && errno != ENOENT) {
+            LOG_ERROR("Error removing file \"%s\": %s", filename, strerror(errno));
         }
-        state_file_write(config, name, def_value);
-        result = sdscat(result, def_value);
-        sdsfree(cfg_file);
-        return result;
-    }
-    sdsfree(cfg_file);
-    read = getline(&line, &n, fp);
-    if (read > 0) {
-        LOG_DEBUG("State %s: %s", name, line);
-    }
-    fclose(fp);
-    if (read > 0) {
-        result = sdscat(result, line);
-        sdstrim(result, " \n\r");
-        FREE_PTR(line);
-        return result;
+        sdsfree(filename);
+        ++ptr;
     }
-    
-    FREE_PTR(line);
-    result = sdscat(result, def_value);
-    return result;
 }
 
-static bool state_file_rw_bool(t_config *config, const char *name, const bool def_value, bool warn) {
+//returns the stored value, a missing setting is set to the default value
+static sds state_rw_string(t_state_store *store, const char *name, const char *def_value) {
+    sds value = state_store_get(store, name);
+    if (value == NULL) {
+        state_store_set(store, name, def_value);
+        return sdsnew(def_value);
+    }
+    LOG_DEBUG("State %s: %s", name, value);
+    return sdsdup(value);
+}
+
+static bool state_rw_bool(t_state_store *store, const char *name, const bool def_value) {
     bool value = def_value;
-    sds line = state_file_rw_string(config, name, def_value == true ? "true" : "false", warn);
+    sds line = state_rw_string(store, name, def_value == true ? "true" : "false");
     if (sdslen(line) > 0) {
         value = strtobool(line);
-        sdsfree(line);
     }
+    sdsfree(line);
     return value;
 }
 
-static int state_file_rw_int(t_config *config, const char *name, const int def_value, bool warn) {
+static int state_rw_int(t_state_store *store, const char *name, const int def_value) {
     char *crap = NULL;
     int value = def_value;
     sds def_value_str = sdsfromlonglong(def_value);
-    sds line = state_file_rw_string(config, name, def_value_str, warn);
+    sds line = state_rw_string(store, name, def_value_str);
     sdsfree(def_value_str);
     if (sdslen(line) > 0) {
         value = strtoimax(line, &crap, 10);
-        sdsfree(line);
     }
+    sdsfree(line);
     return value;
 }
 
-static bool state_file_write(t_config *config, const char *name, const char *value) {
-    if (config->readonly == true) {
-        return true;
-    }
-    if (!validate_string(name)) {
-        return false;
-    }
-    sds tmp_file = sdscatfmt(sdsempty(), "%s/state/%s.XXXXXX", config->varlibdir, name);
-    int fd = mkstemp(tmp_file);
-    if (fd < 0) {
-        LOG_ERROR("Can not open file \"%s\" for write: %s", tmp_file, strerror(errno));
-        sdsfree(tmp_file);
-        return false;
-    }
-    FILE *fp = fdopen(fd, "w");
-    int rc = fputs(value, fp);
-    if (rc == EOF) {
-        LOG_ERROR("Can not write to file \"%s\"", tmp_file);
-    }
-    fclose(fp);
-    sds cfg_file = sdscatfmt(sdsempty(), "%s/state/%s", config->varlibdir, name);
-    if (rename(tmp_file, cfg_file) == -1) {
-        LOG_ERROR("Renaming file from \"%s\" to \"%s\" failed: %s", tmp_file, cfg_file, strerror(errno));
-        sdsfree(tmp_file);
-        sdsfree(cfg_file);
-        return false;
-    }
-    sdsfree(tmp_file);
-    sdsfree(cfg_file);
-    return true;
+static bool state_write(t_mympd_state *mympd_state, const char *name, const char *value) {
+    state_store_set(mympd_state->state_store, name, value);
+    return state_store_commit(mympd_state->state_store);
 }
 
 static sds default_navbar_icons(t_config *config, sds buffer) {
@@ -15,8 +15,8 @@
 #include "../list.h"
 #include "../tiny_queue.h"
 #include "../api.h"
-#include "../global.h"
 #include "config_defs.h"
+#include "../global.h"
 #include "../utility.h"
 #include "../maintenance.h"
 #include "mympd_api_utility.h"
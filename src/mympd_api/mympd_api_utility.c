@@ -11,6 +11,7 @@
 #include <mpd/client.h>
 
 #include "../../dist/src/sds/sds.h"
+#include "../../dist/src/rax/rax.h"
 #include "../../dist/src/frozen/frozen.h"
 #include "../sds_extras.h"
 #include "../log.h"
@@ -20,10 +21,12 @@
 #include "../tiny_queue.h"
 #include "../global.h"
 #include "../utility.h"
+#include "../mpd_reader.h"
+#include "../state_store.h"
 #include "mympd_api_utility.h"
 #include "mympd_api_timer.h"
 
-void mympd_api_push_to_mpd_client(t_mympd_state *mympd_state) {
+void mympd_api_push_to_mpd_client(t_config *config, t_mympd_state *mympd_state) {
     t_work_request *request = create_request(-1, 0, MYMPD_API_SETTINGS_SET, "MYMPD_API_SETTINGS_SET", "");
     request->data = sdscat(request->data, "{\"jsonrpc\":\"2.0\",\"id\":0,\"method\":\"MYMPD_API_SETTINGS_SET\",\"params\":{");
     request->data = tojson_long(request->data, "jukeboxMode", mympd_state->jukebox_mode, true);
@@ -53,6 +56,7 @@ void mympd_api_push_to_mpd_client(t_mympd_state *mympd_state) {
     request->data = tojson_long(request->data, "lastPlayedCount", mympd_state->last_played_count, true);
     request->data = tojson_char(request->data, "musicDirectory", mympd_state->music_directory, false);
     request->data = sdscat(request->data, "}}");
+    mpd_reader_push_settings(config, request->data);
     tiny_queue_push(mpd_client_queue, request, 0);
 
     t_work_request *request2 = create_request(-1, 0, MYMPD_API_SETTINGS_SET, "MYMPD_API_SETTINGS_SET", "");
@@ -71,6 +75,7 @@ void mympd_api_push_to_mpd_client(t_mympd_state *mympd_state) {
 }
 
 void free_mympd_state(t_mympd_state *mympd_state) {
+    state_store_close(mympd_state->state_store);
     free_mympd_state_sds(mympd_state);
     truncate_timerlist(&mympd_state->timer_list);
     list_free(&mympd_state->home_list);
@@ -98,10 +98,11 @@ typedef struct t_mympd_state {
     struct list home_list;
     sds navbar_icons;
     sds advanced;
+    struct t_state_store *state_store;
 } t_mympd_state;
 
 void free_mympd_state(t_mympd_state *mympd_state);
 void free_mympd_state_sds(t_mympd_state *mympd_state);
-void mympd_api_push_to_mpd_client(t_mympd_state *mympd_state);
+void mympd_api_push_to_mpd_client(t_config *config, t_mympd_state *mympd_state);
 sds json_to_cols(sds cols, char *str, size_t len, bool *error);
 #endif
@@ -122,3 +122,22 @@ sds sdscrop(sds s) {
     sdsclear(s);
     return s;
 }
+
+//appends the 64 bit fnv-1a hash and the length of the data
+sds sdscathash(sds s, const char *p, size_t len) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)p[i];
+        hash *= 1099511628211ULL;
+    }
+    s = sdscatprintf(s, "%016llx-%zx", hash, len);
+    return s;
+}
+
+//appends a quoted strong http etag
+sds sdscatetag(sds s, const char *p, size_t len) {
+    s = sdscatlen(s, "\"", 1);
+    s = sdscathash(s, p, len);
+    s = sdscatlen(s, "\"", 1);
+    return s;
+}
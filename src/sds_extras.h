@@ -11,4 +11,6 @@ sds sdsurldecode(sds s, const char *p, size_t len, int is_form_url_encoded);
 sds sdscrop(sds s);
 sds sdsreplacelen(sds s, const char *value, size_t len);
 sds sdsreplace(sds s, const char *value);
+sds sdscathash(sds s, const char *p, size_t len);
+sds sdscatetag(sds s, const char *p, size_t len);
 #endif
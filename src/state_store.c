@@ -0,0 +1,400 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../dist/src/sds/sds.h"
+#include "../dist/src/rax/rax.h"
+#include "sds_extras.h"
+#include "log.h"
+#include "state_store.h"
+
+/*
+ The state store is one text file in the state directory:
+ - a header line followed by one "key<TAB>value" record per line
+ - newline, carriage return and backslash in values are escaped
+ - changes are appended as transactions, each transaction ends with an empty line
+ - the last record of a key wins, records of an incomplete transaction are discarded
+ - the file is rewritten (compacted) when the superseded records outnumber the keys
+*/
+
+//private definitions
+#define STATE_STORE_FILE "state_store"
+#define STATE_STORE_MAGIC "# myMPD state store 1\n"
+#define STATE_STORE_COMMIT "\n"
+
+static bool _state_store_load(t_state_store *store, bool *exists);
+static unsigned _state_store_import(t_state_store *store, const char *varlibdir, const char **legacy_keys);
+static void _state_store_remove_legacy(const char *varlibdir, const char **legacy_keys);
+static sds _state_store_record(sds buffer, const char *key, size_t key_len, const char *value);
+static sds _state_store_unescape(sds buffer, const char *p, size_t len);
+static bool _state_store_write_all(int fd, const char *buf, size_t len);
+static void _state_store_free_value(void *data);
+
+//public functions
+
+//loads the store with one read of the mapped file
+//legacy_keys are the per setting files of older versions, they are imported if the store does not exist
+t_state_store *state_store_open(const char *varlibdir, bool readonly, const char **legacy_keys) {
+    t_state_store *store = (t_state_store *)malloc(sizeof(t_state_store));
+    assert(store);
+    store->values = raxNew();
+    store->filename = sdscatfmt(sdsempty(), "%s/state/%s", varlibdir, STATE_STORE_FILE);
+    store->pending = sdsempty();
+    store->fd = -1;
+    store->journal = 0;
+    store->readonly = readonly;
+    store->compact = false;
+
+    unsigned imported = 0;
+    bool exists = true;
+    if (_state_store_load(store, &exists) == false) {
+        //never replace a store that can not be read with the defaults
+        LOG_ERROR("Can not read state store \"%s\", changes will not be saved", store->filename);
+        store->readonly = true;
+        return store;
+    }
+    if (exists == false) {
+        store->compact = true;
+        if (legacy_keys != NULL) {
+            imported = _state_store_import(store, varlibdir, legacy_keys);
+        }
+    }
+    if (store->compact == true || store->journal > raxSize(store->values)) {
+        if (state_store_compact(store) == true && imported > 0 && readonly == false) {
+            _state_store_remove_legacy(varlibdir, legacy_keys);
+        }
+    }
+    return store;
+}
+
+//writes outstanding changes and frees the store
+void state_store_close(t_state_store *store) {
+    if (store == NULL) {
+        return;
+    }
+    state_store_commit(store);
+    if (store->journal > 0) {
+        state_store_compact(store);
+    }
+    state_store_free(store);
+}
+
+//frees the store without writing outstanding changes
+void state_store_free(t_state_store *store) {
+    if (store == NULL) {
+        return;
+    }
+    if (store->fd > -1) {
+        close(store->fd);
+    }
+    raxFreeWithCallback(store->values, _state_store_free_value);
+    sdsfree(store->filename);
+    sdsfree(store->pending);
+    free(store);
+}
+
+//returns the stored value or NULL, the value is owned by the store
+sds state_store_get(t_state_store *store, const char *key) {
+    void *value = raxFind(store->values, (unsigned char *)key, strlen(key));
+    return value == raxNotFound ? NULL : (sds)value;
+}
+
+//changes are written by the next state_store_commit
+//returns false if the value is unchanged
+bool state_store_set(t_state_store *store, const char *key, const char *value) {
+    size_t key_len = strlen(key);
+    void *old = raxFind(store->values, (unsigned char *)key, key_len);
+    if (old != raxNotFound && strcmp((sds)old, value) == 0) {
+        return false;
+    }
+    old = NULL;
+    if (raxInsert(store->values, (unsigned char *)key, key_len, sdsnew(value), &old) == 0) {
+        sdsfree(old);
+        store->journal++;
+    }
+    store->pending = _state_store_record(store->pending, key, key_len, value);
+    return true;
+}
+
+//appends the pending changes as one transaction with one write and one fsync
+bool state_store_commit(t_state_store *store) {
+    if (sdslen(store->pending) == 0) {
+        return true;
+    }
+    if (store->readonly == true) {
+        sdsclear(store->pending);
+        return true;
+    }
+    if (store->compact == true || store->journal > raxSize(store->values)) {
+        //the rewritten file includes the pending changes
+        return state_store_compact(store);
+    }
+    if (store->fd == -1) {
+        store->fd = open(store->filename, O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (store->fd == -1) {
+            LOG_ERROR("Can not open file \"%s\" for write: %s", store->filename, strerror(errno));
+            return state_store_compact(store);
+        }
+    }
+    store->pending = sdscat(store->pending, STATE_STORE_COMMIT);
+    if (_state_store_write_all(store->fd, store->pending, sdslen(store->pending)) == false ||
+        fdatasync(store->fd) != 0)
+    {
+        LOG_ERROR("Can not write to file \"%s\": %s", store->filename, strerror(errno));
+        //rewrite the file to get rid of a partial transaction
+        store->compact = true;
+        return state_store_compact(store);
+    }
+    sdsclear(store->pending);
+    return true;
+}
+
+//replaces the file with a snapshot of the current values
+bool state_store_compact(t_state_store *store) {
+    if (store->readonly == true) {
+        sdsclear(store->pending);
+        return true;
+    }
+    sds tmp_file = sdscatfmt(sdsempty(), "%s.XXXXXX", store->filename);
+    int fd = mkstemp(tmp_file);
+    if (fd < 0) {
+        LOG_ERROR("Can not open file \"%s\" for write: %s", tmp_file, strerror(errno));
+        sdsfree(tmp_file);
+        return false;
+    }
+    sds buffer = sdsnew(STATE_STORE_MAGIC);
+    raxIterator iter;
+    raxStart(&iter, store->values);
+    raxSeek(&iter, "^", NULL, 0);
+    while (raxNext(&iter)) {
+        buffer = _state_store_record(buffer, (char *)iter.key, iter.key_len, (sds)iter.data);
+    }
+    raxStop(&iter);
+    buffer = sdscat(buffer, STATE_STORE_COMMIT);
+    bool rc = _state_store_write_all(fd, buffer, sdslen(buffer)) == true && fsync(fd) == 0;
+    if (rc == false) {
+        LOG_ERROR("Can not write to file \"%s\": %s", tmp_file, strerror(errno));
+    }
+    close(fd);
+    sdsfree(buffer);
+    if (rc == true && rename(tmp_file, store->filename) == -1) {
+        LOG_ERROR("Renaming file from \"%s\" to \"%s\" failed: %s", tmp_file, store->filename, strerror(errno));
+        rc = false;
+    }
+    if (rc == false) {
+        unlink(tmp_file);
+        sdsfree(tmp_file);
+        return false;
+    }
+    sdsfree(tmp_file);
+    //the append descriptor points to the replaced file
+    if (store->fd > -1) {
+        close(store->fd);
+        store->fd = -1;
+    }
+    LOG_DEBUG("Compacted state store \"%s\", %u records dropped", store->filename, store->journal);
+    store->journal = 0;
+    store->compact = false;
+    sdsclear(store->pending);
+    return true;
+}
+
+bool state_store_remove(const char *varlibdir) {
+    sds filename = sdscatfmt(sdsempty(), "%s/state/%s", varlibdir, STATE_STORE_FILE);
+    int rc = unlink(filename);
+    if (rc != 0 && errno != ENOENT) {
+        LOG_ERROR("Error removing file \"%s\": %s", filename, strerror(errno));
+        sdsfree(filename);
+        return false;
+    }
+    sdsfree(filename);
+    return true;
+}
+
+//private functions
+
+//sets exists to false if there is no store file
+//returns false if the store file exists but can not be read
+static bool _state_store_load(t_state_store *store, bool *exists) {
+    int fd = open(store->filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            LOG_ERROR("Can not open file \"%s\": %s", store->filename, strerror(errno));
+            return false;
+        }
+        *exists = false;
+        return true;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LOG_ERROR("Can not stat file \"%s\": %s", store->filename, strerror(errno));
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        store->compact = true;
+        return true;
+    }
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Can not map file \"%s\": %s", store->filename, strerror(errno));
+        return false;
+    }
+    size_t magic_len = strlen(STATE_STORE_MAGIC);
+    if (size < magic_len || memcmp(map, STATE_STORE_MAGIC, magic_len) != 0) {
+        LOG_ERROR("Invalid state store \"%s\", discarding it", store->filename);
+        store->compact = true;
+        munmap(map, size);
+        return true;
+    }
+    //find the end of the last complete transaction
+    const char *p = map + magic_len;
+    const char *end = map + size;
+    while (end > p && (end[-1] != '\n' || end[-2] != '\n')) {
+        end--;
+    }
+    if (end != map + size) {
+        LOG_WARN("Discarding incomplete transaction in state store \"%s\"", store->filename);
+        store->compact = true;
+    }
+    unsigned records = 0;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (eol == p) {
+            //end of transaction
+            p++;
+            continue;
+        }
+        const char *sep = memchr(p, '\t', (size_t)(eol - p));
+        if (sep != NULL && sep > p) {
+            sds value = _state_store_unescape(sdsempty(), sep + 1, (size_t)(eol - sep - 1));
+            void *old = NULL;
+            if (raxInsert(store->values, (unsigned char *)p, (size_t)(sep - p), value, &old) == 0) {
+                sdsfree(old);
+                store->journal++;
+            }
+            records++;
+        }
+        else {
+            LOG_WARN("Discarding invalid record in state store \"%s\"", store->filename);
+            store->compact = true;
+        }
+        p = eol + 1;
+    }
+    munmap(map, size);
+    LOG_DEBUG("Read %u records for %u keys from state store \"%s\"", records, (unsigned)raxSize(store->values), store->filename);
+    return true;
+}
+
+static unsigned _state_store_import(t_state_store *store, const char *varlibdir, const char **legacy_keys) {
+    unsigned imported = 0;
+    char *line = NULL;
+    size_t n = 0;
+    sds filename = sdsempty();
+    for (const char **key = legacy_keys; *key != NULL; key++) {
+        sdsclear(filename);
+        filename = sdscatfmt(filename, "%s/state/%s", varlibdir, *key);
+        FILE *fp = fopen(filename, "r");
+        if (fp == NULL) {
+            if (errno != ENOENT) {
+                LOG_ERROR("Can not open file \"%s\": %s", filename, strerror(errno));
+            }
+            continue;
+        }
+        ssize_t read = getline(&line, &n, fp);
+        fclose(fp);
+        if (read > 0) {
+            sds value = sdsnewlen(line, (size_t)read);
+            sdstrim(value, " \n\r");
+            state_store_set(store, *key, value);
+            sdsfree(value);
+            imported++;
+        }
+    }
+    free(line);
+    sdsfree(filename);
+    if (imported > 0) {
+        LOG_INFO("Imported %u state files into the state store", imported);
+    }
+    return imported;
+}
+
+static void _state_store_remove_legacy(const char *varlibdir, const char **legacy_keys) {
+    sds filename = sdsempty();
+    for (const char **key = legacy_keys; *key != NULL; key++) {
+        sdsclear(filename);
+        filename = sdscatfmt(filename, "%s/state/%s", varlibdir, *key);
+        if (unlink(filename) != 0 && errno != ENOENT) {
+            LOG_ERROR("Error removing file \"%s\": %s", filename, strerror(errno));
+        }
+    }
+    sdsfree(filename);
+}
+
+static sds _state_store_record(sds buffer, const char *key, size_t key_len, const char *value) {
+    buffer = sdscatlen(buffer, key, key_len);
+    buffer = sdscatlen(buffer, "\t", 1);
+    for (const char *p = value; *p != '\0'; p++) {
+        switch (*p) {
+            case '\n': buffer = sdscatlen(buffer, "\\n", 2); break;
+            case '\r': buffer = sdscatlen(buffer, "\\r", 2); break;
+            case '\\': buffer = sdscatlen(buffer, "\\\\", 2); break;
+            default: buffer = sdscatlen(buffer, p, 1);
+        }
+    }
+    return sdscatlen(buffer, "\n", 1);
+}
+
+static sds _state_store_unescape(sds buffer, const char *p, size_t len) {
+    const char *end = p + len;
+    while (p < end) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+            switch (*p) {
+                case 'n': buffer = sdscatlen(buffer, "\n", 1); break;
+                case 'r': buffer = sdscatlen(buffer, "\r", 1); break;
+                default: buffer = sdscatlen(buffer, p, 1);
+            }
+        }
+        else {
+            buffer = sdscatlen(buffer, p, 1);
+        }
+        p++;
+    }
+    return buffer;
+}
+
+static bool _state_store_write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+static void _state_store_free_value(void *data) {
+    sdsfree((sds)data);
+}
@@ -0,0 +1,28 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __STATE_STORE_H__
+#define __STATE_STORE_H__
+//all settings in one file: a compacted snapshot followed by an append-only journal of changes
+typedef struct t_state_store {
+    rax *values; //key -> sds value
+    sds filename;
+    sds pending; //journal records not written yet
+    int fd; //append descriptor, -1 if not opened
+    unsigned journal; //records in the file that were overwritten by later records
+    bool readonly;
+    bool compact; //file needs a rewrite, e.g. after a torn append
+} t_state_store;
+
+t_state_store *state_store_open(const char *varlibdir, bool readonly, const char **legacy_keys);
+void state_store_close(t_state_store *store);
+void state_store_free(t_state_store *store);
+sds state_store_get(t_state_store *store, const char *key);
+bool state_store_set(t_state_store *store, const char *key, const char *value);
+bool state_store_commit(t_state_store *store);
+bool state_store_compact(t_state_store *store);
+bool state_store_remove(const char *varlibdir);
+#endif
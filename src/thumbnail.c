@@ -0,0 +1,299 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "../dist/src/sds/sds.h"
+#include "sds_extras.h"
+#include "list.h"
+#include "config_defs.h"
+#include "log.h"
+#include "utility.h"
+#include "covercache.h"
+#include "thumbnail.h"
+
+//optional includes
+#ifdef ENABLE_LIBJPEG
+    #include <jpeglib.h>
+#endif
+
+//private definitions
+#define THUMBNAIL_QUALITY 80
+
+const unsigned thumbnail_sizes[] = {250, 500, 0};
+
+#ifdef ENABLE_LIBJPEG
+struct t_thumbnail_jpeg_error {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+};
+
+static void thumbnail_jpeg_error_exit(j_common_ptr cinfo);
+static void thumbnail_jpeg_output_message(j_common_ptr cinfo);
+static bool thumbnail_decode(sds image, unsigned size, unsigned char **pixels,
+                             unsigned *width, unsigned *height, unsigned *components);
+static unsigned char *thumbnail_scale(const unsigned char *pixels, unsigned width, unsigned height,
+                                      unsigned components, unsigned dst_width, unsigned dst_height);
+static bool thumbnail_encode(unsigned char *pixels, unsigned width, unsigned height,
+                             unsigned components, sds *thumb);
+#endif
+
+//public functions
+bool thumbnail_size_valid(unsigned size) {
+    #ifdef ENABLE_LIBJPEG
+    for (const unsigned *p = thumbnail_sizes; *p != 0; p++) {
+        if (*p == size) {
+            return true;
+        }
+    }
+    #else
+    (void) size;
+    #endif
+    return false;
+}
+
+//thumbnails are stored in the covercache as variants of the original key
+sds thumbnail_key(sds buffer, const char *key, unsigned size) {
+    return sdscatfmt(buffer, "%s?size=%u", key, size);
+}
+
+//downscales a jpeg image to the given size of the longest edge
+//returns false if the image is not a jpeg or is not larger than the requested size
+bool thumbnail_create(sds image, unsigned size, sds *thumb) {
+    #ifdef ENABLE_LIBJPEG
+    if (sdslen(image) < 3 || (unsigned char)image[0] != 0xFF || (unsigned char)image[1] != 0xD8) {
+        LOG_DEBUG("Thumbnails can only be created from jpeg images");
+        return false;
+    }
+    unsigned char *pixels = NULL;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned components = 0;
+    if (thumbnail_decode(image, size, &pixels, &width, &height, &components) == false) {
+        return false;
+    }
+    unsigned dst_width = size;
+    unsigned dst_height = size;
+    if (width > height) {
+        dst_height = height * size / width;
+    }
+    else {
+        dst_width = width * size / height;
+    }
+    if (dst_width == 0) {
+        dst_width = 1;
+    }
+    if (dst_height == 0) {
+        dst_height = 1;
+    }
+    unsigned char *scaled = pixels;
+    if (width > dst_width || height > dst_height) {
+        scaled = thumbnail_scale(pixels, width, height, components, dst_width, dst_height);
+        free(pixels);
+    }
+    bool rc = thumbnail_encode(scaled, dst_width, dst_height, components, thumb);
+    free(scaled);
+    LOG_DEBUG("Created thumbnail %ux%u from %ux%u", dst_width, dst_height, width, height);
+    return rc;
+    #else
+    (void) image;
+    (void) size;
+    (void) thumb;
+    return false;
+    #endif
+}
+
+bool thumbnail_create_from_file(const char *filename, unsigned size, sds *thumb) {
+    sds image = sdsempty();
+    bool rc = thumbnail_read_file(filename, &image) == true ? thumbnail_create(image, size, thumb) : false;
+    sdsfree(image);
+    return rc;
+}
+
+bool thumbnail_read_file(const char *filename, sds *image) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        LOG_ERROR("Can not open file \"%s\": %s", filename, strerror(errno));
+        return false;
+    }
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        *image = sdscatlen(*image, buffer, n);
+    }
+    fclose(fp);
+    return true;
+}
+
+//creates the thumbnail and stores it in the covercache under the thumbnail key,
+//if no thumbnail can be created the original image is stored under this key
+//to serve it as thumbnail and to not try it again, the covercache stores it only once
+bool thumbnail_store(t_config *config, const char *key, unsigned size, sds image) {
+    sds variant_key = thumbnail_key(sdsempty(), key, size);
+    sds thumb = sdsempty();
+    bool rc = thumbnail_create(image, size, &thumb);
+    if (rc == true) {
+        covercache_put(config, variant_key, "image/jpeg", thumb);
+    }
+    else if (sdslen(image) > 0) {
+        sds mime_type = get_mime_type_by_magic_stream(image);
+        covercache_put(config, variant_key, mime_type, image);
+        sdsfree(mime_type);
+    }
+    sdsfree(thumb);
+    sdsfree(variant_key);
+    return rc;
+}
+
+//private functions
+#ifdef ENABLE_LIBJPEG
+static void thumbnail_jpeg_error_exit(j_common_ptr cinfo) {
+    struct t_thumbnail_jpeg_error *err = (struct t_thumbnail_jpeg_error *)cinfo->err;
+    char buffer[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, buffer);
+    LOG_ERROR("libjpeg: %s", buffer);
+    longjmp(err->setjmp_buffer, 1);
+}
+
+static void thumbnail_jpeg_output_message(j_common_ptr cinfo) {
+    char buffer[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, buffer);
+    LOG_DEBUG("libjpeg: %s", buffer);
+}
+
+//decodes the image with the largest dct scaling factor that keeps it above the requested size
+static bool thumbnail_decode(sds image, unsigned size, unsigned char **pixels,
+                             unsigned *width, unsigned *height, unsigned *components)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct t_thumbnail_jpeg_error jerr;
+    unsigned char * volatile buffer = NULL;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = thumbnail_jpeg_error_exit;
+    jerr.pub.output_message = thumbnail_jpeg_output_message;
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(buffer);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)image, sdslen(image));
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.image_width <= size && cinfo.image_height <= size) {
+        LOG_DEBUG("Image is not larger than %u pixel", size);
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        LOG_DEBUG("Unsupported jpeg color space");
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    cinfo.out_color_space = cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    unsigned longest = cinfo.image_width > cinfo.image_height ? cinfo.image_width : cinfo.image_height;
+    unsigned denom = 1;
+    while (denom < 8 && longest / (denom * 2) >= size) {
+        denom *= 2;
+    }
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+    jpeg_start_decompress(&cinfo);
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    *components = (unsigned)cinfo.output_components;
+    size_t row_stride = (size_t)*width * *components;
+    buffer = malloc(row_stride * *height);
+    if (buffer == NULL) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = buffer + cinfo.output_scanline * row_stride;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    *pixels = buffer;
+    return true;
+}
+
+//box filter, every destination pixel is the average of its source area
+static unsigned char *thumbnail_scale(const unsigned char *pixels, unsigned width, unsigned height,
+                                      unsigned components, unsigned dst_width, unsigned dst_height)
+{
+    unsigned char *scaled = malloc((size_t)dst_width * dst_height * components);
+    assert(scaled);
+    unsigned long sum[3];
+    for (unsigned y = 0; y < dst_height; y++) {
+        unsigned sy0 = y * height / dst_height;
+        unsigned sy1 = (y + 1) * height / dst_height;
+        for (unsigned x = 0; x < dst_width; x++) {
+            unsigned sx0 = x * width / dst_width;
+            unsigned sx1 = (x + 1) * width / dst_width;
+            memset(sum, 0, sizeof(sum));
+            for (unsigned sy = sy0; sy < sy1; sy++) {
+                const unsigned char *p = pixels + ((size_t)sy * width + sx0) * components;
+                for (unsigned sx = sx0; sx < sx1; sx++) {
+                    for (unsigned c = 0; c < components; c++) {
+                        sum[c] += *p++;
+                    }
+                }
+            }
+            unsigned long count = (unsigned long)(sy1 - sy0) * (sx1 - sx0);
+            unsigned char *d = scaled + ((size_t)y * dst_width + x) * components;
+            for (unsigned c = 0; c < components; c++) {
+                d[c] = (unsigned char)(sum[c] / count);
+            }
+        }
+    }
+    return scaled;
+}
+
+static bool thumbnail_encode(unsigned char *pixels, unsigned width, unsigned height,
+                             unsigned components, sds *thumb)
+{
+    struct jpeg_compress_struct cinfo;
+    struct t_thumbnail_jpeg_error jerr;
+    unsigned char *outbuffer = NULL;
+    unsigned long outsize = 0;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = thumbnail_jpeg_error_exit;
+    jerr.pub.output_message = thumbnail_jpeg_output_message;
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        free(outbuffer);
+        return false;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = (int)components;
+    cinfo.in_color_space = components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, THUMBNAIL_QUALITY, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    size_t row_stride = (size_t)width * components;
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = pixels + cinfo.next_scanline * row_stride;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    *thumb = sdscatlen(*thumb, outbuffer, outsize);
+    jpeg_destroy_compress(&cinfo);
+    free(outbuffer);
+    return true;
+}
+#endif
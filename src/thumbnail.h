@@ -0,0 +1,19 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __THUMBNAIL_H__
+#define __THUMBNAIL_H__
+
+//fixed set of thumbnail sizes (longest edge in pixel)
+extern const unsigned thumbnail_sizes[];
+
+bool thumbnail_size_valid(unsigned size);
+sds thumbnail_key(sds buffer, const char *key, unsigned size);
+bool thumbnail_create(sds image, unsigned size, sds *thumb);
+bool thumbnail_create_from_file(const char *filename, unsigned size, sds *thumb);
+bool thumbnail_read_file(const char *filename, sds *image);
+bool thumbnail_store(t_config *config, const char *key, unsigned size, sds image);
+#endif
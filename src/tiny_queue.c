@@ -191,6 +191,31 @@ void *tiny_queue_shift(tiny_queue_t *queue, int timeout, long id) {
 }
 
 
+//passes queued entries to the handler until the queue is empty, the handler returns false
+//or the budget in ms has elapsed, at least one entry is handled, returns the number of handled entries
+unsigned tiny_queue_drain(tiny_queue_t *queue, long budget, tiny_queue_handler handler, void *user_data) {
+    struct timespec start;
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned handled = 0;
+    while (tiny_queue_length(queue, 0) > 0) {
+        void *data = tiny_queue_shift(queue, 50, 0);
+        if (data == NULL) {
+            break;
+        }
+        handled++;
+        if (handler(data, user_data) == false) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &current);
+        long elapsed = (current.tv_sec - start.tv_sec) * 1000 + (current.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= budget) {
+            break;
+        }
+    }
+    return handled;
+}
+
 void *tiny_queue_expire(tiny_queue_t *queue, time_t max_age) {
     int rc = pthread_mutex_lock(&queue->mutex);
     if (rc != 0) {
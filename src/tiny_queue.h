@@ -22,10 +22,14 @@ typedef struct tiny_queue_t {
     pthread_cond_t wakeup;
 } tiny_queue_t;
 
+//handler for tiny_queue_drain, takes ownership of data, returns false to stop draining
+typedef bool (*tiny_queue_handler)(void *data, void *user_data);
+
 tiny_queue_t *tiny_queue_create(void);
 void tiny_queue_free(tiny_queue_t *queue);
 int tiny_queue_push(struct tiny_queue_t *queue, void *data, long id);
 void *tiny_queue_shift(struct tiny_queue_t *queue, int timeout, long id);
 void *tiny_queue_expire(tiny_queue_t *queue, time_t max_age);
 unsigned tiny_queue_length(struct tiny_queue_t *queue, int timeout);
+unsigned tiny_queue_drain(struct tiny_queue_t *queue, long budget, tiny_queue_handler handler, void *user_data);
 #endif
@@ -470,37 +470,6 @@ bool is_streamuri(const char *uri) {
     return false;
 }
 
-bool write_covercache_file(t_config *config, const char *uri, const char *mime_type, sds binary) {
-    bool rc = false;
-    sds filename = sdsnew(uri);
-    uri_to_filename(filename);
-    sds tmp_file = sdscatfmt(sdsempty(), "%s/covercache/%s.XXXXXX", config->varlibdir, filename);
-    int fd = mkstemp(tmp_file);
-    if (fd < 0) {
-        LOG_ERROR("Can not open file \"%s\" for write: %s", tmp_file, strerror(errno));
-    }
-    else {
-        FILE *fp = fdopen(fd, "w");
-        fwrite(binary, 1, sdslen(binary), fp);
-        fclose(fp);
-        sds ext = get_ext_by_mime_type(mime_type);
-        sds cover_file = sdscatfmt(sdsempty(), "%s/covercache/%s.%s", config->varlibdir, filename, ext);
-        if (rename(tmp_file, cover_file) == -1) {
-            LOG_ERROR("Rename file from \"%s\" to \"%s\" failed: %s", tmp_file, cover_file, strerror(errno));
-            if (unlink(tmp_file) != 0) {
-                LOG_ERROR("Error removing file \"%s\": %s", tmp_file, strerror(errno));
-            }
-        }
-        LOG_DEBUG("Write covercache file \"%s\" for uri \"%s\"", cover_file, uri);
-        sdsfree(ext);
-        sdsfree(cover_file);
-        rc = true;
-    }
-    sdsfree(tmp_file);
-    sdsfree(filename);
-    return rc;
-}
-
 void my_usleep(time_t usec) {
     struct timespec ts = {
         .tv_sec = (usec / 1000) / 1000,
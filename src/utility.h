@@ -39,7 +39,6 @@ sds get_mime_type_by_ext(const char *filename);
 sds get_ext_by_mime_type(const char *mime_type);
 sds get_mime_type_by_magic(const char *filename);
 sds get_mime_type_by_magic_stream(sds stream);
-bool write_covercache_file(t_config *config, const char *uri, const char *mime_type, sds binary);
 bool strtobool(const char *value);
 int strip_extension(char *s);
 void strip_slash(sds s);
@@ -18,6 +18,7 @@
 #include "../dist/src/sds/sds.h"
 #include "../dist/src/mongoose/mongoose.h"
 #include "../dist/src/frozen/frozen.h"
+#include "../dist/src/rax/rax.h"
 
 #include "sds_extras.h"
 #include "api.h"
@@ -29,6 +30,7 @@
 #include "global.h"
 #include "web_server/web_server_utility.h"
 #include "web_server/web_server_albumart.h"
+#include "web_server/web_server_albumart_cache.h"
 #include "web_server/web_server_tagpics.h"
 #include "web_server.h"
 
@@ -41,7 +43,7 @@ static void ev_handler(struct mg_connection *nc, int ev, void *ev_data);
 #endif
 static void send_ws_notify(struct mg_mgr *mgr, t_work_result *response);
 static void send_api_response(struct mg_mgr *mgr, t_work_result *response);
-static bool handle_api(int conn_id, struct http_message *hm);
+static bool handle_api(t_config *config, int conn_id, struct http_message *hm);
 static bool handle_script_api(int conn_id, struct http_message *hm);
 
 //public functions
@@ -58,6 +60,7 @@ bool web_server_init(void *arg_mgr, t_config *config, t_mg_user_data *mg_user_da
     mg_user_data->conn_id = 1;
     mg_user_data->feat_library = false;
     mg_user_data->feat_mpd_albumart = false;
+    mg_user_data->albumart_cache = albumart_cache_new((size_t)config->albumart_cache_size * 1024 * 1024);
     
     //init monogoose mgr with mg_user_data
     mg_mgr_init(mgr, mg_user_data);
@@ -125,8 +128,10 @@ void *web_server_loop(void *arg_mgr) {
     sds last_notify = sdsempty();
     time_t last_time = 0;
     while (s_signal_received == 0) {
+        //handle all queued results before polling, albumart arrives in many chunks
         unsigned web_server_queue_length = tiny_queue_length(web_server_queue, 50);
-        if (web_server_queue_length > 0) {
+        while (web_server_queue_length > 0) {
+            web_server_queue_length--;
             t_work_result *response = tiny_queue_shift(web_server_queue, 50, 0);
             if (response != NULL) {
                 if (response->conn_id == -1) {
@@ -168,6 +173,23 @@ static bool parse_internal_message(t_work_result *response, t_mg_user_data *mg_u
     bool feat_mpd_albumart;
     bool rc = false;
     t_config *config = (t_config *) mg_user_data->config;
+
+    bool albumart_cache_clear_msg = false;
+    if (json_scanf(response->data, sdslen(response->data), "{albumartCacheClear: %B}", &albumart_cache_clear_msg) == 1) {
+        //database has changed
+        albumart_cache_clear(mg_user_data->albumart_cache);
+        free_result(response);
+        return true;
+    }
+
+    char *thumbnail_key = NULL;
+    if (json_scanf(response->data, sdslen(response->data), "{thumbnailCreated: %Q}", &thumbnail_key) == 1) {
+        //the next request serves the thumbnail from the covercache
+        albumart_cache_unmark_thumbnail(mg_user_data->albumart_cache, thumbnail_key);
+        FREE_PTR(thumbnail_key);
+        free_result(response);
+        return true;
+    }
     
     int je = json_scanf(response->data, sdslen(response->data), "{playlistDirectory: %Q, musicDirectory: %Q, coverimageName: %Q, featLibrary: %B, featMpdAlbumart: %B}", 
         &p_charbuf3, &p_charbuf1, &p_charbuf2, &feat_library, &feat_mpd_albumart);
@@ -178,6 +200,8 @@ static bool parse_internal_message(t_work_result *response, t_mg_user_data *mg_u
         mg_user_data->coverimage_names = split_coverimage_names(p_charbuf2, mg_user_data->coverimage_names, &mg_user_data->coverimage_names_len);
         mg_user_data->feat_library = feat_library;
         mg_user_data->feat_mpd_albumart = feat_mpd_albumart;
+        //cached lookups depend on the music directory and coverimage names
+        albumart_cache_clear(mg_user_data->albumart_cache);
         
         mg_user_data->rewrite_patterns = sdscrop(mg_user_data->rewrite_patterns);
         if (config->publish == true) {
@@ -247,7 +271,7 @@ static void send_api_response(struct mg_mgr *mgr, t_work_result *response) {
             if ((intptr_t)nc->user_data == response->conn_id) {
                 LOG_DEBUG("Sending response to conn_id %d: %s", (intptr_t)nc->user_data, response->data);
                 if (response->cmd_id == MPD_API_ALBUMART) {
-                    send_albumart(nc, response->data, response->binary);
+                    send_albumart(nc, (t_mg_user_data *) mgr->user_data, response->data, response->binary);
                 }
                 else {
                     mg_send_head(nc, 200, sdslen(response->data), "Content-Type: application/json");
@@ -365,7 +389,7 @@ static void ev_handler(struct mg_connection *nc, int ev, void *ev_data) {
             }
             else if (mg_vcmp(&hm->uri, "/api") == 0) {
                 //api request
-                bool rc = handle_api((intptr_t)nc->user_data, hm);
+                bool rc = handle_api(config, (intptr_t)nc->user_data, hm);
                 if (rc == false) {
                     LOG_ERROR("Invalid API request");
                     sds method = sdsempty();
@@ -508,7 +532,7 @@ static void ev_handler_redirect(struct mg_connection *nc, int ev, void *ev_data)
 }
 #endif
 
-static bool handle_api(int conn_id, struct http_message *hm) {
+static bool handle_api(t_config *config, int conn_id, struct http_message *hm) {
     if (hm->body.len > 2048) {
         LOG_ERROR("Request length of %d exceeds max request size, discarding request)", hm->body.len);
         return false;
@@ -551,6 +575,12 @@ static bool handle_api(int conn_id, struct http_message *hm) {
         tiny_queue_push(mpd_worker_queue, request, 0);
         
     }
+    else if (cmd_id == MPD_API_ALBUMART) {
+        tiny_queue_push(mpd_cover_queue, request, 0);
+    }
+    else if (config->mpd_readers > 0 && is_mpd_reader_api_method(cmd_id) == true) {
+        tiny_queue_push(mpd_reader_queue, request, 0);
+    }
     else {
         tiny_queue_push(mpd_client_queue, request, 0);
     }
@@ -9,10 +9,12 @@
 #include <signal.h>
 #include <string.h>
 #include <libgen.h>
+#include <inttypes.h>
 
 #include "../../dist/src/sds/sds.h"
 #include "../../dist/src/mongoose/mongoose.h"
 #include "../../dist/src/frozen/frozen.h"
+#include "../../dist/src/rax/rax.h"
 #include "../sds_extras.h"
 #include "../api.h"
 #include "../list.h"
@@ -21,43 +23,62 @@
 #include "../log.h"
 #include "../tiny_queue.h"
 #include "../global.h"
+#include "../thumbnail.h"
+#include "../covercache.h"
+#include "../cover_extractor.h"
 #include "web_server_utility.h"
+#include "web_server_albumart_cache.h"
 #include "web_server_albumart.h"
 
-//optional includes
-#ifdef ENABLE_LIBID3TAG
-    #include <id3tag.h>
-#endif
-
-#ifdef ENABLE_FLAC
-    #include <FLAC/metadata.h>
-#endif
-
 //privat definitions
-static bool handle_coverextract(struct mg_connection *nc, t_config *config, const char *uri, const char *media_file);
-static bool handle_coverextract_id3(t_config *config, const char *uri, const char *media_file, sds *binary);
-static bool handle_coverextract_flac(t_config *config, const char *uri, const char *media_file, sds *binary, bool is_ogg);
+static void serve_albumart_cache_entry(struct mg_connection *nc, struct http_message *hm, t_albumart_cache_entry *entry);
+static void serve_albumart_binary(struct mg_connection *nc, struct http_message *hm, const char *mime_type,
+                                  size_t size, sds binary, const char *etag);
+static unsigned get_thumbnail_size(struct http_message *hm, t_config *config);
+static bool serve_albumart_thumbnail(struct mg_connection *nc, struct http_message *hm, t_config *config,
+                                     t_albumart_cache *albumart_cache, const char *uri, const char *dir_key, unsigned size);
+static void queue_albumart_thumbnail(t_albumart_cache *albumart_cache, const char *key, unsigned size, const char *path, sds binary);
 
 //public functions
-void send_albumart(struct mg_connection *nc, sds data, sds binary) {
+void send_albumart(struct mg_connection *nc, t_mg_user_data *mg_user_data, sds data, sds binary) {
     char *p_charbuf1 = NULL;
+    char *p_charbuf2 = NULL;
+    unsigned offset = 0;
+    unsigned size = 0;
+    bool abort = false;
 
-    int je = json_scanf(data, sdslen(data), "{result: {mime_type:%Q}}", &p_charbuf1);
-    if (je == 1) {
-        LOG_DEBUG("Serving file from memory (%s - %u bytes)", p_charbuf1, sdslen(binary));
-        sds header = sdscatfmt(sdsempty(), "Content-Type: %s\r\n", p_charbuf1);
-        header = sdscat(header, EXTRA_HEADERS_CACHE);
-        mg_send_head(nc, 200, sdslen(binary), header);
+    //the mpd cover thread streams the image in chunks with offset and total size
+    json_scanf(data, sdslen(data), "{result: {mime_type: %Q, offset: %u, size: %u, abort: %B, uri: %Q}}",
+        &p_charbuf1, &offset, &size, &abort, &p_charbuf2);
+    if (abort == true) {
+        LOG_ERROR("Albumart transfer aborted");
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+    }
+    else if (offset > 0) {
         mg_send(nc, binary, sdslen(binary));
-        sdsfree(header);
+    }
+    else if (p_charbuf1 != NULL) {
+        if (size == 0) {
+            size = sdslen(binary);
+        }
+        if (p_charbuf2 != NULL && size == sdslen(binary)) {
+            //complete image in one response
+            albumart_cache_put_binary(mg_user_data->albumart_cache, p_charbuf2, p_charbuf1, binary);
+        }
+        serve_albumart_binary(nc, NULL, p_charbuf1, size, binary, NULL);
     }
     else {
+        if (p_charbuf2 != NULL) {
+            //mpd has no albumart for this uri
+            albumart_cache_put_notfound(mg_user_data->albumart_cache, p_charbuf2);
+        }
         //create dummy http message and serve not available image
         struct http_message hm;
         populate_dummy_hm(&hm);
         serve_na_image(nc, &hm);
     }
     FREE_PTR(p_charbuf1);
+    FREE_PTR(p_charbuf2);
 }
 
 //returns true if an image is served
@@ -108,24 +129,51 @@ bool handle_albumart(struct mg_connection *nc, struct http_message *hm, t_mg_use
     }
     //remove /albumart/
     sdsrange(uri_decoded, 10, -1);
+    t_albumart_cache *albumart_cache = mg_user_data->albumart_cache;
+    sds dir_key = albumart_cache_dir_key(sdsempty(), uri_decoded);
+    //check for an already created thumbnail
+    unsigned thumb_size = get_thumbnail_size(hm, config);
+    if (thumb_size > 0 && serve_albumart_thumbnail(nc, hm, config, albumart_cache, uri_decoded, dir_key, thumb_size) == true) {
+        sdsfree(dir_key);
+        sdsfree(uri_decoded);
+        return true;
+    }
+    //check the albumart cache for the song and its album directory
+    t_albumart_cache_entry *cached = albumart_cache_get(albumart_cache, uri_decoded);
+    if (cached == NULL) {
+        cached = albumart_cache_get(albumart_cache, dir_key);
+    }
+    if (cached != NULL && (cached->found == true || strcmp(cached->key, uri_decoded) == 0)) {
+        if (thumb_size > 0 && cached->found == true) {
+            queue_albumart_thumbnail(albumart_cache, cached->key, thumb_size,
+                (sdslen(cached->path) > 0 ? cached->path : NULL), (cached->blob != NULL ? cached->blob->binary : NULL));
+        }
+        serve_albumart_cache_entry(nc, hm, cached);
+        sdsfree(dir_key);
+        sdsfree(uri_decoded);
+        return true;
+    }
+    //a negative entry for the album directory skips the coverimage lookup
+    bool check_dir = cached == NULL ? true : false;
     //create absolute file
     sds mediafile = sdscatfmt(sdsempty(), "%s/%s", mg_user_data->music_directory, uri_decoded);
     LOG_DEBUG("Absolut media_file: %s", mediafile);
     //check covercache
     if (config->covercache == true) {
-        sds filename = sdsdup(uri_decoded);
-        uri_to_filename(filename);
-        sds covercachefile = sdscatfmt(sdsempty(), "%s/covercache/%s", config->varlibdir, filename);
-        sdsfree(filename);
-        covercachefile = find_image_file(covercachefile);
+        sds covercachefile = covercache_get(sdsempty(), config, uri_decoded);
         if (sdslen(covercachefile) > 0) {
             sds mime_type = get_mime_type_by_ext(covercachefile);
             LOG_DEBUG("Serving file %s (%s)", covercachefile, mime_type);
+            albumart_cache_put_file(albumart_cache, uri_decoded, covercachefile, mime_type);
+            if (thumb_size > 0) {
+                queue_albumart_thumbnail(albumart_cache, uri_decoded, thumb_size, covercachefile, NULL);
+            }
             mg_http_serve_file(nc, hm, covercachefile, mg_mk_str(mime_type), mg_mk_str(EXTRA_HEADERS_CACHE));
             sdsfree(uri_decoded);
             sdsfree(covercachefile);
             sdsfree(mediafile);
             sdsfree(mime_type);
+            sdsfree(dir_key);
             return true;
         }
 
@@ -139,7 +187,7 @@ bool handle_albumart(struct mg_connection *nc, struct http_message *hm, t_mg_use
         //try image in folder under music_directory
         sds path = sdsdup(uri_decoded);
         dirname(path);
-        for (int j = 0; j < mg_user_data->coverimage_names_len; j++) {
+        for (int j = 0; check_dir == true && j < mg_user_data->coverimage_names_len; j++) {
             sds coverfile = sdscatfmt(sdsempty(), "%s/%s/%s", mg_user_data->music_directory, path, mg_user_data->coverimage_names[j]);
             if (strchr(mg_user_data->coverimage_names[j], '.') == NULL) {
                 //basename, try extensions
@@ -149,159 +197,175 @@ bool handle_albumart(struct mg_connection *nc, struct http_message *hm, t_mg_use
                 LOG_DEBUG("Check for cover %s", coverfile);
                 sds mime_type = get_mime_type_by_ext(coverfile);
                 LOG_DEBUG("Serving file %s (%s)", coverfile, mime_type);
+                albumart_cache_put_file(albumart_cache, dir_key, coverfile, mime_type);
+                if (thumb_size > 0) {
+                    queue_albumart_thumbnail(albumart_cache, dir_key, thumb_size, coverfile, NULL);
+                }
                 mg_http_serve_file(nc, hm, coverfile, mg_mk_str(mime_type), mg_mk_str(EXTRA_HEADERS_CACHE));
                 sdsfree(uri_decoded);
                 sdsfree(coverfile);
                 sdsfree(mediafile);
                 sdsfree(mime_type);
                 sdsfree(path); 
+                sdsfree(dir_key);
                 return true;
             }
             sdsfree(coverfile);
         }
-        LOG_DEBUG("No cover file found in music directory");
+        if (check_dir == true) {
+            LOG_DEBUG("No cover file found in music directory");
+            albumart_cache_put_notfound(albumart_cache, dir_key);
+        }
         sdsfree(path);
-        //try to extract cover from media file
-        bool rc = handle_coverextract(nc, config, uri_decoded, mediafile);
-        if (rc == true) {
+        //extract the cover from the media file in the cover extractor threads
+        if (cover_extract_supported(mediafile) == true) {
+            LOG_DEBUG("Sending coverextract to cover_extractor_queue");
+            t_work_request *request = create_request(conn_id, 0, MPD_API_ALBUMART, "MPD_API_ALBUMART", "");
+            request->data = sdscat(request->data, "{\"jsonrpc\":\"2.0\",\"id\":0,\"method\":\"MPD_API_ALBUMART\",\"params\":{");
+            request->data = tojson_char(request->data, "uri", uri_decoded, true);
+            request->data = tojson_char(request->data, "mediafile", mediafile, true);
+            request->data = tojson_long(request->data, "size", thumb_size, false);
+            request->data = sdscat(request->data, "}}");
+
+            tiny_queue_push(cover_extractor_queue, request, 0);
             sdsfree(uri_decoded);
             sdsfree(mediafile);
-            return true;
+            sdsfree(dir_key);
+            return false;
         }
     }
     //ask mpd
     else if (mg_user_data->feat_library == false && mg_user_data->feat_mpd_albumart == true) {
-        LOG_DEBUG("Sending getalbumart to mpd_client_queue");
+        LOG_DEBUG("Sending getalbumart to mpd_cover_queue");
         t_work_request *request = create_request(conn_id, 0, MPD_API_ALBUMART, "MPD_API_ALBUMART", "");
         request->data = sdscat(request->data, "{\"jsonrpc\":\"2.0\",\"id\":0,\"method\":\"MPD_API_ALBUMART\",\"params\":{");
         request->data = tojson_char(request->data, "uri", uri_decoded, false);
         request->data = sdscat(request->data, "}}");
 
-        tiny_queue_push(mpd_client_queue, request, 0);
+        tiny_queue_push(mpd_cover_queue, request, 0);
         sdsfree(mediafile);
         sdsfree(uri_decoded);
+        sdsfree(dir_key);
         return false;
     }
 
     LOG_VERBOSE("No coverimage found for %s", mediafile);
+    albumart_cache_put_notfound(albumart_cache, uri_decoded);
     sdsfree(mediafile);
     sdsfree(uri_decoded);
+    sdsfree(dir_key);
     serve_na_image(nc, hm);
     return true;
 }
 
 //privat functions
-static bool handle_coverextract(struct mg_connection *nc, t_config *config, const char *uri, const char *media_file) {
-    bool rc = false;
-    sds mime_type_media_file = get_mime_type_by_ext(media_file);
-    LOG_DEBUG("Handle coverextract for uri \"%s\"", uri);
-    LOG_DEBUG("Mimetype of %s is %s", media_file, mime_type_media_file);
-    sds binary = sdsempty();
-    if (strcmp(mime_type_media_file, "audio/mpeg") == 0) {
-        rc = handle_coverextract_id3(config, uri, media_file, &binary);
+static void serve_albumart_cache_entry(struct mg_connection *nc, struct http_message *hm, t_albumart_cache_entry *entry) {
+    if (entry->found == false) {
+        LOG_DEBUG("Albumart cache: no coverimage for \"%s\"", entry->key);
+        serve_na_image(nc, hm);
+    }
+    else if (sdslen(entry->path) > 0) {
+        LOG_DEBUG("Albumart cache: serving file %s (%s)", entry->path, entry->mime_type);
+        mg_http_serve_file(nc, hm, entry->path, mg_mk_str(entry->mime_type), mg_mk_str(EXTRA_HEADERS_CACHE));
     }
-    else if (strcmp(mime_type_media_file, "audio/ogg") == 0) {
-        rc = handle_coverextract_flac(config, uri, media_file, &binary, true);
+    else {
+        serve_albumart_binary(nc, hm, entry->mime_type, sdslen(entry->blob->binary), entry->blob->binary, entry->blob->etag);
+    }
+}
+
+//size is the full image size, binary can be the first chunk only
+//hm is used for revalidation, the etag is calculated if it is NULL and the image is complete
+static void serve_albumart_binary(struct mg_connection *nc, struct http_message *hm, const char *mime_type,
+                                  size_t size, sds binary, const char *etag)
+{
+    sds etag_buf = NULL;
+    if (etag == NULL && size == sdslen(binary)) {
+        etag_buf = sdscatetag(sdsempty(), binary, sdslen(binary));
+        etag = etag_buf;
     }
-    else if (strcmp(mime_type_media_file, "audio/flac") == 0) {
-        rc = handle_coverextract_flac(config, uri, media_file, &binary, false);
+    if (hm != NULL && etag_matches(hm, etag) == true) {
+        send_not_modified(nc, etag, EXTRA_HEADERS_CACHE);
     }
-    sdsfree(mime_type_media_file);
-    if (rc == true) {
-        sds mime_type = get_mime_type_by_magic_stream(binary);
-        sds header = sdscatfmt(sdsempty(), "Content-Type: %s", mime_type);
+    else {
+        LOG_DEBUG("Serving file from memory (%s - %u bytes)", mime_type, size);
+        sds header = sdscatfmt(sdsempty(), "Content-Type: %s\r\n", mime_type);
+        if (etag != NULL && etag[0] != '\0') {
+            header = sdscatfmt(header, "ETag: %s\r\n", etag);
+        }
         header = sdscat(header, EXTRA_HEADERS_CACHE);
-        mg_send_head(nc, 200, sdslen(binary), header);
+        mg_send_head(nc, 200, size, header);
         mg_send(nc, binary, sdslen(binary));
         sdsfree(header);
-        sdsfree(mime_type);
     }
-    sdsfree(binary);
-    return rc;
+    if (etag_buf != NULL) {
+        sdsfree(etag_buf);
+    }
 }
 
-static bool handle_coverextract_id3(t_config *config, const char *uri, const char *media_file, sds *binary) {
-    bool rc = false;
-    #ifdef ENABLE_LIBID3TAG
-    LOG_DEBUG("Exctracting coverimage from %s", media_file);
-    struct id3_file *file_struct = id3_file_open(media_file, ID3_FILE_MODE_READONLY);
-    if (file_struct == NULL) {
-        LOG_ERROR("Can't parse id3_file: %s", media_file);
-        return false;
+//returns the requested and enabled thumbnail size or 0 for the original image
+static unsigned get_thumbnail_size(struct http_message *hm, t_config *config) {
+    if (config->thumbnails == false || config->covercache == false || hm->query_string.len == 0) {
+        return 0;
     }
-    struct id3_tag *tags = id3_file_tag(file_struct);
-    if (tags == NULL) {
-        LOG_ERROR("Can't read id3 tags from file: %s", media_file);
-        return false;
+    char size_str[10];
+    if (mg_get_http_var(&hm->query_string, "size", size_str, sizeof(size_str)) <= 0) {
+        return 0;
     }
-    struct id3_frame *frame = id3_tag_findframe(tags, "APIC", 0);
-    if (frame != NULL) {
-        id3_length_t length;
-        const id3_byte_t *pic = id3_field_getbinarydata(id3_frame_field(frame, 4), &length);
-        *binary = sdscatlen(*binary, pic, length);
-        if (config->covercache == true) {
-            write_covercache_file(config, uri, (char *)id3_field_getlatin1(id3_frame_field(frame, 1)), *binary);
+    unsigned size = strtoumax(size_str, NULL, 10);
+    return thumbnail_size_valid(size) == true ? size : 0;
+}
+
+//serves a thumbnail from the albumart cache or the covercache
+static bool serve_albumart_thumbnail(struct mg_connection *nc, struct http_message *hm, t_config *config,
+                                     t_albumart_cache *albumart_cache, const char *uri, const char *dir_key, unsigned size)
+{
+    const char *keys[] = {uri, dir_key, NULL};
+    for (const char **key = keys; *key != NULL; key++) {
+        sds variant_key = thumbnail_key(sdsempty(), *key, size);
+        t_albumart_cache_entry *cached = albumart_cache_get(albumart_cache, variant_key);
+        if (cached != NULL) {
+            serve_albumart_cache_entry(nc, hm, cached);
+            sdsfree(variant_key);
+            return true;
         }
-        LOG_DEBUG("Coverimage successfully extracted");
-        rc = true;        
-    }
-    else {
-        LOG_DEBUG("No embedded picture detected");
+        sds thumb_file = covercache_get(sdsempty(), config, variant_key);
+        if (sdslen(thumb_file) > 0) {
+            //the original image is stored as thumbnail if it can not be scaled
+            sds mime_type = get_mime_type_by_ext(thumb_file);
+            LOG_DEBUG("Serving thumbnail %s (%s)", thumb_file, mime_type);
+            albumart_cache_put_file(albumart_cache, variant_key, thumb_file, mime_type);
+            mg_http_serve_file(nc, hm, thumb_file, mg_mk_str(mime_type), mg_mk_str(EXTRA_HEADERS_CACHE));
+            sdsfree(mime_type);
+            sdsfree(thumb_file);
+            sdsfree(variant_key);
+            return true;
+        }
+        sdsfree(thumb_file);
+        sdsfree(variant_key);
     }
-    id3_file_close(file_struct);
-    #else
-    (void) config;
-    (void) uri;
-    (void) media_file;
-    (void) binary;
-    #endif
-    return rc;
+    return false;
 }
 
-static bool handle_coverextract_flac(t_config *config, const char *uri, const char *media_file, sds *binary, bool is_ogg) {
-    bool rc = false;
-    #ifdef ENABLE_FLAC
-    LOG_DEBUG("Exctracting coverimage from %s", media_file);
-    FLAC__StreamMetadata *metadata = NULL;
-
-    FLAC__Metadata_Chain *chain = FLAC__metadata_chain_new();
-    
-    if(! (is_ogg? FLAC__metadata_chain_read_ogg(chain, media_file) : FLAC__metadata_chain_read(chain, media_file)) ) {
-        LOG_DEBUG("%s: ERROR: reading metadata", media_file);
-        FLAC__metadata_chain_delete(chain);
-        return false;
+//thumbnails are created in the cover extractor threads, the original image is served until it exists
+static void queue_albumart_thumbnail(t_albumart_cache *albumart_cache, const char *key, unsigned size, const char *path, sds binary) {
+    if (path == NULL && binary == NULL) {
+        return;
     }
-
-    FLAC__Metadata_Iterator *iterator = FLAC__metadata_iterator_new();
-    FLAC__metadata_iterator_init(iterator, chain);
-    assert(iterator);
-    
-    do {
-        FLAC__StreamMetadata *block = FLAC__metadata_iterator_get_block(iterator);
-        if (block->type == FLAC__METADATA_TYPE_PICTURE) {
-            metadata = block;
-        }
-    } while (FLAC__metadata_iterator_next(iterator) && metadata == NULL);
-    
-    if (metadata == NULL) {
-        LOG_DEBUG("No embedded picture detected");
+    sds variant_key = thumbnail_key(sdsempty(), key, size);
+    if (albumart_cache_mark_thumbnail(albumart_cache, variant_key) == false) {
+        sdsfree(variant_key);
+        return;
     }
-    else {
-        *binary = sdscatlen(*binary, metadata->data.picture.data, metadata->data.picture.data_length);
-        if (config->covercache == true) {
-            write_covercache_file(config, uri, metadata->data.picture.mime_type, *binary);
-        }
-        LOG_DEBUG("Coverimage successfully extracted");
-        rc = true;
+    LOG_DEBUG("Sending thumbnail creation for \"%s\" to cover_extractor_queue", variant_key);
+    t_work_request *request = create_request(-1, 0, MPD_API_THUMBNAIL_CREATE, "MPD_API_THUMBNAIL_CREATE", "");
+    request->data = sdscat(request->data, "{\"jsonrpc\":\"2.0\",\"id\":0,\"method\":\"MPD_API_THUMBNAIL_CREATE\",\"params\":{");
+    request->data = tojson_char(request->data, "key", key, true);
+    request->data = tojson_long(request->data, "size", size, true);
+    request->data = tojson_char(request->data, "path", (path != NULL ? path : ""), false);
+    request->data = sdscat(request->data, "}}");
+    if (path == NULL) {
+        request->extra = sdsdup(binary);
     }
-    FLAC__metadata_iterator_delete(iterator);
-    FLAC__metadata_chain_delete(chain);
-    #else
-    (void) config;
-    (void) uri;
-    (void) media_file;
-    (void) binary;
-    (void) is_ogg;
-    #endif
-    return rc;
+    tiny_queue_push(cover_extractor_queue, request, 0);
+    sdsfree(variant_key);
 }
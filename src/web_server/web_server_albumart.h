@@ -6,6 +6,6 @@
 
 #ifndef __WEB_SERVER_ALBUMART_H__
 #define __WEB_SERVER_ALBUMART_H__
-void send_albumart(struct mg_connection *nc, sds data, sds binary);
+void send_albumart(struct mg_connection *nc, t_mg_user_data *mg_user_data, sds data, sds binary);
 bool handle_albumart(struct mg_connection *nc, struct http_message *hm, t_mg_user_data *mg_user_data, t_config *config, int conn_id);
 #endif
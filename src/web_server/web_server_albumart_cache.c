@@ -0,0 +1,247 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "../../dist/src/sds/sds.h"
+#include "../../dist/src/rax/rax.h"
+#include "../sds_extras.h"
+#include "../log.h"
+#include "web_server_albumart_cache.h"
+
+//private definitions
+static t_albumart_cache_entry *_albumart_cache_insert(t_albumart_cache *cache, const char *key, bool found,
+                                                      const char *path, const char *mime_type, sds binary);
+static void _albumart_cache_unlink(t_albumart_cache *cache, t_albumart_cache_entry *entry);
+static void _albumart_cache_link_head(t_albumart_cache *cache, t_albumart_cache_entry *entry);
+static void _albumart_cache_remove(t_albumart_cache *cache, t_albumart_cache_entry *entry);
+static sds _albumart_cache_read_file(const char *path, size_t max_size);
+static t_albumart_cache_blob *_albumart_cache_blob_get(t_albumart_cache *cache, sds binary);
+static void _albumart_cache_blob_release(t_albumart_cache *cache, t_albumart_cache_blob *blob);
+
+//public functions
+t_albumart_cache *albumart_cache_new(size_t max_size) {
+    t_albumart_cache *cache = (t_albumart_cache *)malloc(sizeof(t_albumart_cache));
+    assert(cache);
+    cache->entries = raxNew();
+    cache->blobs = raxNew();
+    cache->thumbnails_pending = raxNew();
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->size = 0;
+    cache->max_size = max_size;
+    return cache;
+}
+
+void albumart_cache_free(t_albumart_cache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    albumart_cache_clear(cache);
+    raxFree(cache->entries);
+    raxFree(cache->blobs);
+    raxFree(cache->thumbnails_pending);
+    free(cache);
+}
+
+void albumart_cache_clear(t_albumart_cache *cache) {
+    while (cache->head != NULL) {
+        _albumart_cache_remove(cache, cache->head);
+    }
+    LOG_DEBUG("Albumart cache cleared");
+}
+
+t_albumart_cache_entry *albumart_cache_get(t_albumart_cache *cache, const char *key) {
+    if (cache->max_size == 0) {
+        return NULL;
+    }
+    void *data = raxFind(cache->entries, (unsigned char *)key, strlen(key));
+    if (data == raxNotFound) {
+        return NULL;
+    }
+    t_albumart_cache_entry *entry = (t_albumart_cache_entry *)data;
+    if (cache->head != entry) {
+        _albumart_cache_unlink(cache, entry);
+        _albumart_cache_link_head(cache, entry);
+    }
+    return entry;
+}
+
+//marks the thumbnail as queued, returns false if it is already queued
+bool albumart_cache_mark_thumbnail(t_albumart_cache *cache, const char *key) {
+    return raxTryInsert(cache->thumbnails_pending, (unsigned char *)key, strlen(key), NULL, NULL) == 1 ? true : false;
+}
+
+void albumart_cache_unmark_thumbnail(t_albumart_cache *cache, const char *key) {
+    raxRemove(cache->thumbnails_pending, (unsigned char *)key, strlen(key), NULL);
+}
+
+//small images are read into memory, bigger ones are served from the file
+t_albumart_cache_entry *albumart_cache_put_file(t_albumart_cache *cache, const char *key, const char *path, const char *mime_type) {
+    if (cache->max_size == 0) {
+        return NULL;
+    }
+    sds binary = _albumart_cache_read_file(path, cache->max_size / 8);
+    t_albumart_cache_entry *entry = NULL;
+    if (binary != NULL) {
+        entry = _albumart_cache_insert(cache, key, true, "", mime_type, binary);
+        sdsfree(binary);
+    }
+    else {
+        entry = _albumart_cache_insert(cache, key, true, path, mime_type, NULL);
+    }
+    return entry;
+}
+
+t_albumart_cache_entry *albumart_cache_put_binary(t_albumart_cache *cache, const char *key, const char *mime_type, sds binary) {
+    if (cache->max_size == 0 || sdslen(binary) > cache->max_size / 8) {
+        return NULL;
+    }
+    return _albumart_cache_insert(cache, key, true, "", mime_type, binary);
+}
+
+void albumart_cache_put_notfound(t_albumart_cache *cache, const char *key) {
+    if (cache->max_size == 0) {
+        return;
+    }
+    _albumart_cache_insert(cache, key, false, "", "", NULL);
+}
+
+//the trailing slash separates album keys from song uris
+sds albumart_cache_dir_key(sds key, const char *uri) {
+    const char *dir_end = strrchr(uri, '/');
+    if (dir_end != NULL) {
+        key = sdscatlen(key, uri, (size_t)(dir_end - uri));
+    }
+    key = sdscatlen(key, "/", 1);
+    return key;
+}
+
+//private functions
+//binary is copied if no blob with the same content exists
+static t_albumart_cache_entry *_albumart_cache_insert(t_albumart_cache *cache, const char *key, bool found,
+                                                      const char *path, const char *mime_type, sds binary)
+{
+    void *old = raxFind(cache->entries, (unsigned char *)key, strlen(key));
+    if (old != raxNotFound) {
+        _albumart_cache_remove(cache, (t_albumart_cache_entry *)old);
+    }
+    t_albumart_cache_entry *entry = (t_albumart_cache_entry *)malloc(sizeof(t_albumart_cache_entry));
+    assert(entry);
+    entry->key = sdsnew(key);
+    entry->found = found;
+    entry->path = sdsnew(path);
+    entry->mime_type = sdsnew(mime_type);
+    entry->size = sizeof(t_albumart_cache_entry) + sdslen(entry->key) * 2 + sdslen(entry->path) +
+                  sdslen(entry->mime_type);
+    entry->blob = binary != NULL ? _albumart_cache_blob_get(cache, binary) : NULL;
+    raxInsert(cache->entries, (unsigned char *)entry->key, sdslen(entry->key), entry, NULL);
+    _albumart_cache_link_head(cache, entry);
+    cache->size += entry->size;
+    //evict least recently used entries
+    while (cache->size > cache->max_size && cache->tail != entry) {
+        _albumart_cache_remove(cache, cache->tail);
+    }
+    return entry;
+}
+
+static void _albumart_cache_unlink(t_albumart_cache *cache, t_albumart_cache_entry *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    }
+    else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    }
+    else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void _albumart_cache_link_head(t_albumart_cache *cache, t_albumart_cache_entry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    }
+    cache->head = entry;
+    if (cache->tail == NULL) {
+        cache->tail = entry;
+    }
+}
+
+static void _albumart_cache_remove(t_albumart_cache *cache, t_albumart_cache_entry *entry) {
+    _albumart_cache_unlink(cache, entry);
+    raxRemove(cache->entries, (unsigned char *)entry->key, sdslen(entry->key), NULL);
+    cache->size -= entry->size;
+    if (entry->blob != NULL) {
+        _albumart_cache_blob_release(cache, entry->blob);
+    }
+    sdsfree(entry->key);
+    sdsfree(entry->path);
+    sdsfree(entry->mime_type);
+    free(entry);
+}
+
+static sds _albumart_cache_read_file(const char *path, size_t max_size) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size <= 0 || (size_t)st.st_size > max_size) {
+        fclose(fp);
+        return NULL;
+    }
+    sds binary = sdsnewlen(NULL, (size_t)st.st_size);
+    size_t read = fread(binary, 1, (size_t)st.st_size, fp);
+    fclose(fp);
+    if (read != (size_t)st.st_size) {
+        sdsfree(binary);
+        return NULL;
+    }
+    return binary;
+}
+
+//blobs are accounted in the cache size until the last reference is released
+static t_albumart_cache_blob *_albumart_cache_blob_get(t_albumart_cache *cache, sds binary) {
+    sds etag = sdscatetag(sdsempty(), binary, sdslen(binary));
+    void *data = raxFind(cache->blobs, (unsigned char *)etag, sdslen(etag));
+    if (data != raxNotFound) {
+        t_albumart_cache_blob *blob = (t_albumart_cache_blob *)data;
+        blob->refcount++;
+        sdsfree(etag);
+        return blob;
+    }
+    t_albumart_cache_blob *blob = (t_albumart_cache_blob *)malloc(sizeof(t_albumart_cache_blob));
+    assert(blob);
+    blob->binary = sdsdup(binary);
+    blob->etag = etag;
+    blob->refcount = 1;
+    raxInsert(cache->blobs, (unsigned char *)blob->etag, sdslen(blob->etag), blob, NULL);
+    cache->size += sizeof(t_albumart_cache_blob) + sdslen(blob->binary) + sdslen(blob->etag) * 2;
+    return blob;
+}
+
+static void _albumart_cache_blob_release(t_albumart_cache *cache, t_albumart_cache_blob *blob) {
+    blob->refcount--;
+    if (blob->refcount == 0) {
+        cache->size -= sizeof(t_albumart_cache_blob) + sdslen(blob->binary) + sdslen(blob->etag) * 2;
+        raxRemove(cache->blobs, (unsigned char *)blob->etag, sdslen(blob->etag), NULL);
+        sdsfree(blob->binary);
+        sdsfree(blob->etag);
+        free(blob);
+    }
+}
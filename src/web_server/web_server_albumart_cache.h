@@ -0,0 +1,47 @@
+/*
+ SPDX-License-Identifier: GPL-2.0-or-later
+ myMPD (c) 2018-2021 Juergen Mang <mail@jcgames.de>
+ https://github.com/jcorporation/mympd
+*/
+
+#ifndef __WEB_SERVER_ALBUMART_CACHE_H__
+#define __WEB_SERVER_ALBUMART_CACHE_H__
+//image data shared by all entries with the same content, e.g. all tracks of an album
+typedef struct t_albumart_cache_blob {
+    sds binary;
+    sds etag; //content hash, also the key in the blobs rax
+    unsigned refcount;
+} t_albumart_cache_blob;
+
+typedef struct t_albumart_cache_entry {
+    sds key;
+    bool found; //false for negative entries
+    sds path; //image file, empty if binary is cached
+    sds mime_type;
+    t_albumart_cache_blob *blob; //NULL if binary is not cached
+    size_t size;
+    struct t_albumart_cache_entry *prev;
+    struct t_albumart_cache_entry *next;
+} t_albumart_cache_entry;
+
+typedef struct t_albumart_cache {
+    rax *entries;
+    rax *blobs;
+    rax *thumbnails_pending; //thumbnail keys queued for creation
+    t_albumart_cache_entry *head; //most recently used
+    t_albumart_cache_entry *tail; //least recently used
+    size_t size;
+    size_t max_size;
+} t_albumart_cache;
+
+t_albumart_cache *albumart_cache_new(size_t max_size);
+void albumart_cache_free(t_albumart_cache *cache);
+void albumart_cache_clear(t_albumart_cache *cache);
+t_albumart_cache_entry *albumart_cache_get(t_albumart_cache *cache, const char *key);
+t_albumart_cache_entry *albumart_cache_put_file(t_albumart_cache *cache, const char *key, const char *path, const char *mime_type);
+t_albumart_cache_entry *albumart_cache_put_binary(t_albumart_cache *cache, const char *key, const char *mime_type, sds binary);
+void albumart_cache_put_notfound(t_albumart_cache *cache, const char *key);
+bool albumart_cache_mark_thumbnail(t_albumart_cache *cache, const char *key);
+void albumart_cache_unmark_thumbnail(t_albumart_cache *cache, const char *key);
+sds albumart_cache_dir_key(sds key, const char *uri);
+#endif
@@ -17,6 +17,7 @@
 #ifndef DEBUG
 //embedded files for release build
 #include "web_server_embedded_files.c"
+#include "web_server_embedded_etags.h"
 #endif
 
 bool rm_mk_dir(sds dir_name, bool create) {
@@ -132,6 +133,31 @@ void serve_asset_image(struct mg_connection *nc, struct http_message *hm, const
     sdsfree(mime_type);
 }
 
+bool etag_matches(struct http_message *hm, const char *etag) {
+    struct mg_str *header = mg_get_http_header(hm, "If-None-Match");
+    if (header == NULL || etag == NULL || etag[0] == '\0') {
+        return false;
+    }
+    if (mg_vcmp(header, "*") == 0) {
+        return true;
+    }
+    //header can be a comma separated list of etags
+    return mg_strstr(*header, mg_mk_str(etag)) != NULL ? true : false;
+}
+
+void send_not_modified(struct mg_connection *nc, const char *etag, const char *extra_headers) {
+    LOG_DEBUG("Not modified: %s", etag);
+    mg_printf(nc, "HTTP/1.1 304 Not Modified\r\n"
+                  EXTRA_HEADERS"\r\n"
+                  "ETag: %s\r\n"
+                  "%s%s"
+                  "Content-Length: 0\r\n\r\n",
+                  etag,
+                  extra_headers,
+                  (extra_headers[0] != '\0' ? "\r\n" : "")
+             );
+}
+
 void serve_plaintext(struct mg_connection *nc, const char *text) {
     size_t len = strlen(text);
     mg_send_head(nc, 200, len, "Content-Type: text/plain");
@@ -147,25 +173,26 @@ struct embedded_file {
     bool cache;
     const unsigned char *data;
     const unsigned size;
+    const char *etag;
 };
 
 bool serve_embedded_files(struct mg_connection *nc, sds uri, struct http_message *hm) {
     const struct embedded_file embedded_files[] = {
-        {"/", 1, "text/html; charset=utf-8", true, false, index_html_data, index_html_size},
-        {"/css/combined.css", 17, "text/css; charset=utf-8", true, false, combined_css_data, combined_css_size},
-        {"/js/combined.js", 15, "application/javascript; charset=utf-8", true, false, combined_js_data, combined_js_size},
-        {"/sw.js", 6, "application/javascript; charset=utf-8", true, false, sw_js_data, sw_js_size},
-        {"/mympd.webmanifest", 18, "application/manifest+json", true, false, mympd_webmanifest_data, mympd_webmanifest_size},
-        {"/assets/coverimage-notavailable.svg", 35, "image/svg+xml", true, true, coverimage_notavailable_svg_data, coverimage_notavailable_svg_size},
-        {"/assets/MaterialIcons-Regular.woff2", 35, "font/woff2", false, true, MaterialIcons_Regular_woff2_data, MaterialIcons_Regular_woff2_size},
-        {"/assets/coverimage-stream.svg", 29, "image/svg+xml", true, true, coverimage_stream_svg_data, coverimage_stream_svg_size},
-        {"/assets/coverimage-loading.svg", 30, "image/svg+xml", true, true, coverimage_loading_svg_data, coverimage_loading_svg_size},
-        {"/assets/coverimage-booklet.svg", 30, "image/svg+xml", true, true, coverimage_booklet_svg_data, coverimage_booklet_svg_size},
-        {"/assets/coverimage-mympd.svg", 28, "image/svg+xml", true, true, coverimage_mympd_svg_data, coverimage_mympd_svg_size},
-        {"/assets/favicon.ico", 19, "image/vnd.microsoft.icon", false, true, favicon_ico_data, favicon_ico_size},
-        {"/assets/appicon-192.png", 23, "image/png", false, true, appicon_192_png_data, appicon_192_png_size},
-        {"/assets/appicon-512.png", 23, "image/png", false, true, appicon_512_png_data, appicon_512_png_size},
-        {NULL, 0, NULL, false, false, NULL, 0}
+        {"/", 1, "text/html; charset=utf-8", true, false, index_html_data, index_html_size, index_html_etag},
+        {"/css/combined.css", 17, "text/css; charset=utf-8", true, false, combined_css_data, combined_css_size, combined_css_etag},
+        {"/js/combined.js", 15, "application/javascript; charset=utf-8", true, false, combined_js_data, combined_js_size, combined_js_etag},
+        {"/sw.js", 6, "application/javascript; charset=utf-8", true, false, sw_js_data, sw_js_size, sw_js_etag},
+        {"/mympd.webmanifest", 18, "application/manifest+json", true, false, mympd_webmanifest_data, mympd_webmanifest_size, mympd_webmanifest_etag},
+        {"/assets/coverimage-notavailable.svg", 35, "image/svg+xml", true, true, coverimage_notavailable_svg_data, coverimage_notavailable_svg_size, coverimage_notavailable_svg_etag},
+        {"/assets/MaterialIcons-Regular.woff2", 35, "font/woff2", false, true, MaterialIcons_Regular_woff2_data, MaterialIcons_Regular_woff2_size, MaterialIcons_Regular_woff2_etag},
+        {"/assets/coverimage-stream.svg", 29, "image/svg+xml", true, true, coverimage_stream_svg_data, coverimage_stream_svg_size, coverimage_stream_svg_etag},
+        {"/assets/coverimage-loading.svg", 30, "image/svg+xml", true, true, coverimage_loading_svg_data, coverimage_loading_svg_size, coverimage_loading_svg_etag},
+        {"/assets/coverimage-booklet.svg", 30, "image/svg+xml", true, true, coverimage_booklet_svg_data, coverimage_booklet_svg_size, coverimage_booklet_svg_etag},
+        {"/assets/coverimage-mympd.svg", 28, "image/svg+xml", true, true, coverimage_mympd_svg_data, coverimage_mympd_svg_size, coverimage_mympd_svg_etag},
+        {"/assets/favicon.ico", 19, "image/vnd.microsoft.icon", false, true, favicon_ico_data, favicon_ico_size, favicon_ico_etag},
+        {"/assets/appicon-192.png", 23, "image/png", false, true, appicon_192_png_data, appicon_192_png_size, appicon_192_png_etag},
+        {"/assets/appicon-512.png", 23, "image/png", false, true, appicon_512_png_data, appicon_512_png_size, appicon_512_png_etag},
+        {NULL, 0, NULL, false, false, NULL, 0, NULL}
     };
     //decode uri
     sds uri_decoded = sdsurldecode(sdsempty(), uri, sdslen(uri), 0);
@@ -192,14 +219,21 @@ bool serve_embedded_files(struct mg_connection *nc, sds uri, struct http_message
                 return false;
             }
         }
+        //the browser revalidates with the etag
+        if (etag_matches(hm, p->etag) == true) {
+            send_not_modified(nc, p->etag, (p->cache == true ? EXTRA_HEADERS_CACHE : ""));
+            return true;
+        }
         //send header
         mg_printf(nc, "HTTP/1.1 200 OK\r\n"
                       EXTRA_HEADERS"\r\n"
                       "%s"
+                      "ETag: %s\r\n"
                       "Content-Length: %u\r\n"
                       "Content-Type: %s\r\n"
                       "%s\r\n",
                       (p->cache == true ? EXTRA_HEADERS_CACHE"\r\n" : ""),
+                      p->etag,
                       p->size,
                       p->mimetype,
                       (p->compressed == true ? "Content-Encoding: gzip\r\n" : "")
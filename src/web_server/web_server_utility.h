@@ -38,6 +38,7 @@ typedef struct t_mg_user_data {
     bool feat_library;
     bool feat_mpd_albumart;
     int conn_id;
+    struct t_albumart_cache *albumart_cache;
 } t_mg_user_data;
 
 #ifndef DEBUG
@@ -52,4 +53,6 @@ void serve_plaintext(struct mg_connection *nc, const char *text);
 void serve_stream_image(struct mg_connection *nc, struct http_message *hm);
 void serve_asset_image(struct mg_connection *nc, struct http_message *hm, const char *name);
 void populate_dummy_hm(struct http_message *hm);
+bool etag_matches(struct http_message *hm, const char *etag);
+void send_not_modified(struct mg_connection *nc, const char *etag, const char *extra_headers);
 #endif
@@ -13,14 +13,206 @@
 #include <assert.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "../dist/src/sds/sds.h"
 #include "../src/sds_extras.h"
 #include "../src/tiny_queue.h"
 #include "../src/list.h"
+#include "../src/random.h"
+#include "../dist/src/rax/rax.h"
+#include "../src/web_server/web_server_albumart_cache.h"
+#include "../src/state_store.h"
+#ifdef ENABLE_LUA
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+#include "../src/lua_vm.h"
+#endif
 
 _Thread_local sds thread_logname;
 
+static long elapsed_ms(struct timespec *start) {
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+    return (current.tv_sec - start->tv_sec) * 1000 + (current.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+//applies the moves to the original order and checks the result against the list order
+static bool check_reorder_moves(struct list *l, unsigned *moves, unsigned moves_len) {
+    unsigned *items = malloc(l->length * sizeof(unsigned));
+    assert(items);
+    for (unsigned i = 0; i < l->length; i++) {
+        items[i] = i;
+    }
+    for (unsigned m = 0; m < moves_len; m++) {
+        unsigned from = moves[m * 2];
+        unsigned to = moves[m * 2 + 1];
+        unsigned item = items[from];
+        if (from < to) {
+            memmove(items + from, items + from + 1, (to - from) * sizeof(unsigned));
+        }
+        else {
+            memmove(items + to + 1, items + to, (from - to) * sizeof(unsigned));
+        }
+        items[to] = item;
+    }
+    bool rc = true;
+    unsigned i = 0;
+    struct list_node *current = l->head;
+    while (current != NULL) {
+        if (items[i++] != (unsigned)current->value_i) {
+            rc = false;
+        }
+        current = current->next;
+    }
+    free(items);
+    return rc;
+}
+
+typedef struct t_burst_stats {
+    unsigned handled;
+    long latency_sum;
+    long latency_max;
+} t_burst_stats;
+
+//stub for mpd_client_api, the request data is the time it was queued
+static bool burst_handler(void *data, void *user_data) {
+    t_burst_stats *stats = (t_burst_stats *)user_data;
+    long latency = elapsed_ms((struct timespec *)data);
+    stats->handled++;
+    stats->latency_sum += latency;
+    if (latency > stats->latency_max) {
+        stats->latency_max = latency;
+    }
+    free(data);
+    //one mpd round trip per request
+    usleep(100);
+    return true;
+}
+
+//drains a burst of timestamped requests like the mpd_client loop, each loop cycle costs
+//the poll wait and the noidle/idle round trip, budget 0 handles one request per cycle
+static long bench_burst(tiny_queue_t *queue, unsigned burst, long budget) {
+    for (unsigned i = 0; i < burst; i++) {
+        struct timespec *queued = malloc(sizeof(struct timespec));
+        assert(queued);
+        clock_gettime(CLOCK_MONOTONIC, queued);
+        tiny_queue_push(queue, queued, 0);
+    }
+    t_burst_stats stats = { 0, 0, 0 };
+    long cycles = 0;
+    while (stats.handled < burst) {
+        usleep(5000);
+        cycles++;
+        tiny_queue_drain(queue, budget, burst_handler, &stats);
+    }
+    printf("Burst of %u requests, budget %ld ms: %ld cycles, average latency %ld ms, max latency %ld ms\n",
+        burst, budget, cycles, stats.latency_sum / burst, stats.latency_max);
+    return cycles;
+}
+
+#ifdef ENABLE_LUA
+static long elapsed_us(struct timespec *start) {
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+    return (current.tv_sec - start->tv_sec) * 1000000 + (current.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static void lua_test_setup(lua_State *lua_vm) {
+    luaL_openlibs(lua_vm);
+}
+
+static void write_script(const char *filename, const char *content) {
+    FILE *fp = fopen(filename, "w");
+    assert(fp);
+    fputs(content, fp);
+    fclose(fp);
+}
+
+//runs the script in a pooled state and returns its integer result, -1 on error
+static lua_Integer run_pooled_script(const char *filename) {
+    lua_State *lua_vm = lua_vm_acquire();
+    lua_Integer result = -1;
+    int rc = lua_vm_load_script(lua_vm, filename);
+    if (rc == 0) {
+        rc = lua_pcall(lua_vm, 0, 1, 0);
+        if (rc == 0) {
+            result = lua_tointeger(lua_vm, -1);
+        }
+    }
+    lua_vm_release(lua_vm, rc == 0);
+    return result;
+}
+
+//compares the start of a script in a new state with the start in a pooled state
+static bool bench_lua_start(const char *filename, unsigned runs) {
+    long start_new = 0;
+    long start_pooled = 0;
+    long release_pooled = 0;
+    struct timespec start;
+    bool rc = true;
+    for (unsigned i = 0; i < runs; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lua_State *lua_vm = luaL_newstate();
+        lua_test_setup(lua_vm);
+        int load_rc = luaL_loadfilex(lua_vm, filename, "t");
+        start_new += elapsed_us(&start);
+        if (load_rc != 0 || lua_pcall(lua_vm, 0, 1, 0) != 0) {
+            rc = false;
+        }
+        lua_close(lua_vm);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lua_vm = lua_vm_acquire();
+        load_rc = lua_vm_load_script(lua_vm, filename);
+        start_pooled += elapsed_us(&start);
+        if (load_rc != 0 || lua_pcall(lua_vm, 0, 1, 0) != 0) {
+            rc = false;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lua_vm_release(lua_vm, true);
+        release_pooled += elapsed_us(&start);
+    }
+    printf("Lua script start, %u runs: new state %ld us, pooled state %ld us (reset after the run %ld us)\n",
+        runs, start_new / runs, start_pooled / runs, release_pooled / runs);
+    return rc;
+}
+#endif
+
+//compares the playlist writes of the copy based and the in place reordering
+static bool bench_reorder(unsigned len, bool shuffle) {
+    struct list l;
+    list_init(&l);
+    for (unsigned i = 0; i < len; i++) {
+        //sorted playlist with ten songs appended
+        sds key = sdscatprintf(sdsempty(), "%08u", i < len - 10 ? i * 2 : (i - len + 10) * 2000 + 1);
+        list_push(&l, key, i, NULL, NULL);
+        sdsfree(key);
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (shuffle == true) {
+        list_shuffle(&l);
+    }
+    else {
+        list_sort_by_key(&l, true);
+    }
+    unsigned *moves = malloc(2 * len * sizeof(unsigned));
+    assert(moves);
+    unsigned moves_len = list_reorder_moves(&l, moves);
+    long ms = elapsed_ms(&start);
+    //each playlistadd appends one line, each playlistmove rewrites the whole file
+    printf("%s %u entries: %ld ms, copy %u commands / %u lines written, in place %u moves / %llu lines written\n",
+        (shuffle == true ? "Shuffle" : "Sort"), len, ms, len + 3, len, moves_len, (unsigned long long)moves_len * len);
+    bool rc = check_reorder_moves(&l, moves, moves_len);
+    free(moves);
+    list_free(&l);
+    return rc;
+}
+
 int main(void) {
 //tests tiny queue
     thread_logname = sdsempty();
@@ -63,6 +255,11 @@ int main(void) {
     test_data_out = tiny_queue_shift(test_queue, 50, 10);
     printf(strcmp(test_data_out, test_data_in2) == 0 ? "OK\n" : "ERROR\n");
 
+    //test4: a burst of requests is drained in one loop cycle
+    long cycles_single = bench_burst(test_queue, 20, 0);
+    long cycles_drain = bench_burst(test_queue, 20, 100);
+    printf(cycles_single == 20 && cycles_drain == 1 ? "OK\n" : "ERROR\n");
+
     tiny_queue_free(test_queue);
     sdsfree(thread_logname);
     sdsfree(test_data_in0);
@@ -137,4 +334,163 @@ int main(void) {
     printf("Tail is: %s\n", test_list->tail->key);
     list_free(test_list);
     free(test_list);
+
+//test playlist reordering
+    tinymt32_init(&tinymt, (unsigned int)time(NULL));
+    //test1: sorting a playlist with appended songs needs few moves
+    printf(bench_reorder(10000, false) == true && bench_reorder(50000, false) == true ? "OK\n" : "ERROR\n");
+    //test2: moves reproduce a shuffled playlist
+    printf(bench_reorder(10000, true) == true && bench_reorder(50000, true) == true ? "OK\n" : "ERROR\n");
+
+//test albumart cache
+    t_albumart_cache *albumart_cache = albumart_cache_new(8192);
+    sds image = sdsnewlen(NULL, 1000);
+    albumart_cache_put_binary(albumart_cache, "a/1.mp3", "image/jpeg", image);
+    albumart_cache_put_binary(albumart_cache, "b/1.mp3", "image/jpeg", image);
+    albumart_cache_put_notfound(albumart_cache, "c/");
+    //test1: lookup marks the entry as recently used
+    printf(albumart_cache_get(albumart_cache, "a/1.mp3") != NULL ? "OK\n" : "ERROR\n");
+    //test2: negative entry
+    t_albumart_cache_entry *entry = albumart_cache_get(albumart_cache, "c/");
+    printf(entry != NULL && entry->found == false ? "OK\n" : "ERROR\n");
+    //test3: least recently used entry is evicted
+    for (i = 0; i < 8; i++) {
+        sds key = sdscatfmt(sdsempty(), "d/%i.mp3", i);
+        sds other_image = sdsnewlen(NULL, 1000);
+        other_image[0] = (char)(i + 1);
+        albumart_cache_put_binary(albumart_cache, key, "image/jpeg", other_image);
+        albumart_cache_get(albumart_cache, "a/1.mp3");
+        sdsfree(other_image);
+        sdsfree(key);
+    }
+    printf(albumart_cache_get(albumart_cache, "b/1.mp3") == NULL && albumart_cache_get(albumart_cache, "a/1.mp3") != NULL &&
+        albumart_cache->size <= albumart_cache->max_size ? "OK\n" : "ERROR\n");
+    //test4: album directory key
+    sds dir_key = albumart_cache_dir_key(sdsempty(), "artist/album/track.flac");
+    printf(strcmp(dir_key, "artist/album/") == 0 ? "OK\n" : "ERROR\n");
+    sdsfree(dir_key);
+    albumart_cache_clear(albumart_cache);
+    printf(albumart_cache->size == 0 && albumart_cache_get(albumart_cache, "a/1.mp3") == NULL ? "OK\n" : "ERROR\n");
+    //test6: identical images share one blob
+    t_albumart_cache_entry *entry1 = albumart_cache_put_binary(albumart_cache, "e/1.mp3", "image/jpeg", image);
+    size_t size1 = albumart_cache->size;
+    t_albumart_cache_entry *entry2 = albumart_cache_put_binary(albumart_cache, "e/2.mp3", "image/jpeg", image);
+    printf(entry1->blob == entry2->blob && entry1->blob->refcount == 2 &&
+        albumart_cache->size - size1 < sdslen(image) ? "OK\n" : "ERROR\n");
+    albumart_cache_free(albumart_cache);
+    sdsfree(image);
+
+//test etag
+    sds etag1 = sdscatetag(sdsempty(), "image", 5);
+    sds etag2 = sdscatetag(sdsempty(), "image", 5);
+    sds etag3 = sdscatetag(sdsempty(), "imagf", 5);
+    //test1: same content, same etag
+    printf(strcmp(etag1, etag2) == 0 && etag1[0] == '"' ? "OK\n" : "ERROR\n");
+    //test2: changed content, changed etag
+    printf(strcmp(etag1, etag3) != 0 ? "OK\n" : "ERROR\n");
+    sdsfree(etag1);
+    sdsfree(etag2);
+    sdsfree(etag3);
+
+//test state store
+    char varlibdir[] = "/tmp/mympd_test_XXXXXX";
+    assert(mkdtemp(varlibdir));
+    sds state_dir = sdscatfmt(sdsempty(), "%s/state", varlibdir);
+    mkdir(state_dir, 0700);
+    sds legacy_file = sdscatfmt(sdsempty(), "%s/theme", state_dir);
+    FILE *fp = fopen(legacy_file, "w");
+    assert(fp);
+    fputs("theme-dark\n", fp);
+    fclose(fp);
+    const char *legacy_keys[] = {"theme", "locale", 0};
+    //test1: per setting files are imported and removed
+    t_state_store *store = state_store_open(varlibdir, false, legacy_keys);
+    sds value = state_store_get(store, "theme");
+    printf(value != NULL && strcmp(value, "theme-dark") == 0 && access(legacy_file, F_OK) != 0 ? "OK\n" : "ERROR\n");
+    //test2: appended changes survive a reopen, the last record wins
+    state_store_set(store, "locale", "de-DE");
+    state_store_commit(store);
+    state_store_set(store, "locale", "en-US");
+    state_store_set(store, "advanced", "{\"a\":\"line1\\nline2\"}\n");
+    state_store_commit(store);
+    state_store_free(store);
+    store = state_store_open(varlibdir, false, legacy_keys);
+    value = state_store_get(store, "locale");
+    sds value2 = state_store_get(store, "advanced");
+    printf(value != NULL && strcmp(value, "en-US") == 0 && value2 != NULL &&
+        strcmp(value2, "{\"a\":\"line1\\nline2\"}\n") == 0 && store->journal == 1 ? "OK\n" : "ERROR\n");
+    //test3: compaction drops the superseded records
+    for (i = 0; i < 10; i++) {
+        sds locale = sdsfromlonglong(i);
+        state_store_set(store, "locale", locale);
+        state_store_commit(store);
+        sdsfree(locale);
+    }
+    printf(store->journal <= 3 && strcmp(state_store_get(store, "locale"), "9") == 0 ? "OK\n" : "ERROR\n");
+    state_store_close(store);
+    //test4: an incomplete transaction is discarded
+    sds store_file = sdscatfmt(sdsempty(), "%s/state_store", state_dir);
+    fp = fopen(store_file, "a");
+    assert(fp);
+    fputs("locale\ttorn\ntheme\ttorn\n", fp);
+    fclose(fp);
+    store = state_store_open(varlibdir, false, legacy_keys);
+    printf(strcmp(state_store_get(store, "locale"), "9") == 0 && strcmp(state_store_get(store, "theme"), "theme-dark") == 0 &&
+        state_store_set(store, "theme", "theme-dark") == false ? "OK\n" : "ERROR\n");
+    state_store_free(store);
+    //test5: a store that can not be mapped is not replaced
+    state_store_remove(varlibdir);
+    mkdir(store_file, 0700);
+    store = state_store_open(varlibdir, false, legacy_keys);
+    state_store_set(store, "locale", "de-DE");
+    struct stat st;
+    printf(store->readonly == true && state_store_get(store, "theme") == NULL && state_store_commit(store) == true &&
+        stat(store_file, &st) == 0 && S_ISDIR(st.st_mode) ? "OK\n" : "ERROR\n");
+    state_store_close(store);
+    rmdir(store_file);
+    sdsfree(store_file);
+    state_store_remove(varlibdir);
+    rmdir(state_dir);
+    rmdir(varlibdir);
+    sdsfree(state_dir);
+    sdsfree(legacy_file);
+
+#ifdef ENABLE_LUA
+//test lua state pool
+    char scriptdir[] = "/tmp/mympd_test_XXXXXX";
+    assert(mkdtemp(scriptdir));
+    sds mutate_script = sdscatfmt(sdsempty(), "%s/mutate.lua", scriptdir);
+    sds check_script = sdscatfmt(sdsempty(), "%s/check.lua", scriptdir);
+    sds version_script = sdscatfmt(sdsempty(), "%s/version.lua", scriptdir);
+    write_script(mutate_script, "string.upper = function() return 'changed' end\n"
+        "string.extra = 1\n"
+        "getmetatable('').__index = { len = function() return -1 end }\n"
+        "setmetatable(_G, { __index = function() return 1 end })\n"
+        "leaked = 1\n"
+        "print = nil\n"
+        "return 1\n");
+    write_script(check_script, "if leaked == nil and string.extra == nil and string.upper('a') == 'A' and\n"
+        "  ('ab'):len() == 2 and print ~= nil and getmetatable(_G) == nil then return 1 end\n"
+        "return 0\n");
+    lua_vm_pool_init(lua_test_setup);
+    //test1: changes of a script to the globals and the string library do not leak into the next run
+    printf(run_pooled_script(mutate_script) == 1 && run_pooled_script(check_script) == 1 &&
+        run_pooled_script(check_script) == 1 ? "OK\n" : "ERROR\n");
+    //test2: a rewritten script is compiled again
+    write_script(version_script, "return 1\n");
+    lua_Integer version1 = run_pooled_script(version_script);
+    lua_Integer version1_cached = run_pooled_script(version_script);
+    write_script(version_script, "return 22\n");
+    printf(version1 == 1 && version1_cached == 1 && run_pooled_script(version_script) == 22 ? "OK\n" : "ERROR\n");
+    //test3: start of a script in a pooled state
+    printf(bench_lua_start(check_script, 1000) == true ? "OK\n" : "ERROR\n");
+    lua_vm_pool_free();
+    unlink(mutate_script);
+    unlink(check_script);
+    unlink(version_script);
+    rmdir(scriptdir);
+    sdsfree(mutate_script);
+    sdsfree(check_script);
+    sdsfree(version_script);
+#endif
 }